@@ -43,6 +43,8 @@ LSP_MusicInit:
 			cmpi.w	#(1<<8)|(30),(a0)+			; this play routine supports v1.30 as minimal version of LPConvert.exe
 			blt		.dataError
 			movea.l	a0,a4					; relocation flag ad
+			btst	#3,1(a4)				; -huffman cmd codes: only LSPDecoder can play them
+			bne		.dataError
 			addq.w	#2,a0					; skip relocation flag
 			move.w	(a0)+,m_currentBpm(a3)	; default BPM
 			move.w	(a0)+,m_escCodeRewind(a3)
@@ -58,10 +60,13 @@ LSP_MusicInit:
 			move.l	(a0)+,d4		; lossless mask
 			lea		4(a1,d2.l),a2
 			addq.w	#4,a1
-			lea		.dpcmTable(pc),a5
 .dpcmLoop:	move.w	(a0)+,d2		; word count-1
 			beq.s	.reloc			; end
-			tst.b	(a4)			; already depacked/relocated?
+			lea		.dpcmTable(pc),a5
+			btst	#4,1(a4)		; per sample step tables?
+			beq.s	.table0
+			adda.w	(a0)+,a5		; step table offset
+.table0:	tst.b	(a4)			; already depacked/relocated?
 			bne.s	.dpcmLoop
 			add.l	d4,d4			; ADPCM packed or not
 			bcs.s	.copy
@@ -134,6 +139,9 @@ LSP_MusicInit:
 .dataError:	illegal
 .dpcmTable:
 			dc.b	0,1,2,4,8,16,32,64,-128,-64,-32,-16,-8,-4,-2,-1
+			dc.b	0,1,2,4,7,12,20,32,-48,-32,-20,-12,-7,-4,-2,-1
+			dc.b	0,1,2,3,4,6,8,11,-14,-11,-8,-6,-4,-3,-2,-1
+			dc.b	0,1,4,9,16,25,48,96,-128,-96,-48,-25,-16,-9,-4,-1
 
 ;------------------------------------------------------------------
 ;
@@ -16,8 +16,20 @@
 ;	LSP_MusicInitMicro		Initialize a LSP driver + relocate score&bank music data
 ;	LSP_MusicPlayTickMicro	Play a LSP music (call it per frame)
 ;
+;	Set LSP_MICRO_TRANSFORMS to 1 to play "-optstreams" scores using delta or byte planes streams ( "LSPt" signature )
+;
 ;*****************************************************************
 
+	IFND	LSP_MICRO_TRANSFORMS
+LSP_MICRO_TRANSFORMS	=	0
+	ENDC
+
+	IFNE	LSP_MICRO_TRANSFORMS
+LSP_MICRO_SLOTS		=	16+4+4+4		; streams, previous volumes, previous periods, period planes distances
+	ELSE
+LSP_MICRO_SLOTS		=	16
+	ENDC
+
 ;------------------------------------------------------------------
 ;
 ;	LSP_MusicInitMicro
@@ -31,11 +43,23 @@
 LSP_dataError:	illegal
 
 LSP_MusicInitMicro:
+		IFNE	LSP_MICRO_TRANSFORMS
+			moveq	#0,d2					; stream decode flags
+			cmpi.l	#'LSPt',(a0)			; LSP "micro" mode with transformed streams
+			bne.s	.plain
+			addq.w	#6,a0					; skip version ( 'LSPt' scores only exist since -optstreams )
+			move.w	(a0)+,d2
+			beq.s	LSP_dataError			; 'LSPt' always has a transform
+			cmpi.w	#7,d2					; delta volume, delta period & period planes flags only
+			bhi.s	LSP_dataError
+			bra.s	.header
+.plain:
+		ENDC
 			cmpi.l	#'LSPm',(a0)+	; LSP "micro" mode signature
 			bne.s	LSP_dataError
 			cmpi.w	#$0118,(a0)+			; this play routine supports v1.24 as minimal version of LPConvert.exe
 			blt.s	LSP_dataError
-			lea		LSPMicroVars(pc),a3
+.header:	lea		LSPMicroVars(pc),a3
 			clr.w	m_lastDmacon(a3)
 			move.l	a2,m_dmaconPatch(a3)
 			pea		(a0)
@@ -57,6 +81,21 @@ LSP_MusicInitMicro:
 			move.l	d1,m_loopStreams-m_streams(a2)		; set loopStreams at 0 by default
 			move.l	d1,(a2)+				
 		endr
+		IFNE	LSP_MICRO_TRANSFORMS
+			move.w	d2,m_decodeFlags(a3)
+			moveq	#8-1,d0
+.clrDelta:	clr.l	m_loopStreams-m_streams(a2)		; previous volumes & periods start at 0
+			clr.l	(a2)+
+			dbf		d0,.clrDelta
+			moveq	#4-1,d0
+.planes:	moveq	#0,d1
+			tst.w	d2
+			beq.s	.noPlane
+			move.l	(a0)+,d1				; "LSPt": period planes distances come first in stream data
+.noPlane:	move.l	d1,m_loopStreams-m_streams(a2)
+			move.l	d1,(a2)+
+			dbf		d0,.planes
+		ENDC
 			bset.b	#1,$bfe001				; disabling this fucking Low pass filter!!
 			move.l	(a7)+,a0				; point on default BPM value (to please LightSpeedPlayer_cia.asm)
 			rts
@@ -73,6 +112,9 @@ LSP_MusicInitMicro:
 ;------------------------------------------------------------------
 LSP_MusicPlayTickMicro:
 			lea		LSPMicroVars(pc),a2
+		IFNE	LSP_MICRO_TRANSFORMS
+			move.w	m_decodeFlags(a2),d5
+		ENDC
 			move.w	m_lastDmacon(a2),d0
 			beq.s	.skip
 			lea		m_resetv(a2),a3
@@ -98,12 +140,38 @@ LSP_MusicPlayTickMicro:
 			add.b	d0,d0
 			bcc.s	.noVol
 			move.l	4*4*1-4(a1),a0
+		IFNE	LSP_MICRO_TRANSFORMS
+			move.b	(a0)+,d1
+			btst	#0,d5			; delta volume
+			beq.s	.absVol
+			add.b	4*4*4-4+3(a1),d1
+			move.b	d1,4*4*4-4+3(a1)
+.absVol:	move.b	d1,$9(a6)		; volume
+		ELSE
 			move.b	(a0)+,$9(a6)	; volume
+		ENDC
 			move.l	a0,4*4*1-4(a1)
 .noVol:		add.b	d0,d0
 			bcc.s	.noPer
 			move.l	4*4*2-4(a1),a0
+		IFNE	LSP_MICRO_TRANSFORMS
+			btst	#2,d5			; period planes
+			beq.s	.perWord
+			move.b	(a0),d1
+			lsl.w	#8,d1
+			move.l	4*4*6-4(a1),d2
+			move.b	0(a0,d2.l),d1
+			addq.l	#1,a0
+			bra.s	.perDelta
+.perWord:	move.w	(a0)+,d1
+.perDelta:	btst	#1,d5			; delta period
+			beq.s	.absPer
+			add.w	4*4*5-4+2(a1),d1
+			move.w	d1,4*4*5-4+2(a1)
+.absPer:	move.w	d1,$6(a6)		; period
+		ELSE
 			move.w	(a0)+,$6(a6)		; period
+		ENDC
 			move.l	a0,4*4*2-4(a1)
 .noPer:		add.b	d0,d0
 			bcc.s	.noInstr
@@ -148,7 +216,7 @@ LSP_MusicPlayTickMicro:
 			exg		a0,a1
 .skipRestore:
 			; do not stress about this rept, your exe packer will enjoy it
-			rept	16
+			rept	LSP_MICRO_SLOTS
 			move.l	(a0)+,(a1)+
 			endr
 .noLoopCmd:
@@ -156,11 +224,14 @@ LSP_MusicPlayTickMicro:
 
 	rsreset
 
-m_streams:			rs.l	16
-m_loopStreams:		rs.l	16
+m_streams:			rs.l	LSP_MICRO_SLOTS
+m_loopStreams:		rs.l	LSP_MICRO_SLOTS
 m_dmaconPatch:		rs.l	1	;  8 m_lfmDmaConPatch
 m_lspInstruments:	rs.l	1	; 16 LSP instruments table addr
 m_lastDmacon:		rs.w	1
+	IFNE	LSP_MICRO_TRANSFORMS
+m_decodeFlags:		rs.w	1
+	ENDC
 m_resetv:			rs.b	4*6
 sizeof_LSPVars:		rs.w	0
 
@@ -0,0 +1,80 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+#include <stdlib.h>
+#include <assert.h>
+#include "BankLayout.h"
+
+// Knuth-Morris-Pratt failure table: length of the longest proper border of pattern[0..i]
+static int*	BuildFailureTable(const s8* pattern, int patternLen)
+{
+	int* fail = (int*)malloc(patternLen * sizeof(int));
+	fail[0] = 0;
+	int k = 0;
+	for (int i = 1; i < patternLen; i++)
+	{
+		while ((k > 0) && (pattern[i] != pattern[k]))
+			k = fail[k - 1];
+		if (pattern[i] == pattern[k])
+			k++;
+		fail[i] = k;
+	}
+	return fail;
+}
+
+int		FindEvenOccurrence(const s8* text, int textLen, const s8* pattern, int patternLen)
+{
+	assert(patternLen > 0);
+	if (patternLen > textLen)
+		return -1;
+
+	int* fail = BuildFailureTable(pattern, patternLen);
+	int ret = -1;
+	int j = 0;
+	for (int i = 0; i < textLen; i++)
+	{
+		while ((j > 0) && (text[i] != pattern[j]))
+			j = fail[j - 1];
+		if (text[i] == pattern[j])
+			j++;
+		if (j == patternLen)
+		{
+			const int start = i + 1 - patternLen;
+			if (0 == (start & 1))
+			{
+				ret = start;
+				break;
+			}
+			j = fail[j - 1];
+		}
+	}
+	free(fail);
+	return ret;
+}
+
+int		EvenOverlap(const s8* a, int aLen, const s8* b, int bLen)
+{
+	assert((aLen > 0) && (bLen > 0));
+	int* fail = BuildFailureTable(b, bLen);
+	int j = 0;
+	for (int i = 0; i < aLen; i++)
+	{
+		while ((j > 0) && (a[i] != b[j]))
+			j = fail[j - 1];
+		if (a[i] == b[j])
+			j++;
+		if (j == bLen)
+			j = fail[j - 1];
+	}
+	// j is now the longest head of b ending a, keep shorter borders until b starts at an even offset
+	while ((j > 0) && ((aLen - j) & 1))
+		j = fail[j - 1];
+	free(fail);
+	return j;
+}
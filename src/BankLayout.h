@@ -0,0 +1,21 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Sound bank samples sharing the same chip RAM bytes ( -sharesamples command line option )
+// Paula DMA fetches words, so any shared sample start must stay at an even distance from the start of the sample it shares.
+
+#pragma once
+#include "LSPTypes.h"
+
+// first even offset of "pattern" inside "text", -1 if not found
+int		FindEvenOccurrence(const s8* text, int textLen, const s8* pattern, int patternLen);
+
+// longest byte count ending "a" that also starts "b", with b starting at an even offset from a ( 0 if none )
+// a full containment of b in a is not reported, use FindEvenOccurrence first
+int		EvenOverlap(const s8* a, int aLen, const s8* b, int bLen);
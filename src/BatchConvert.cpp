@@ -0,0 +1,165 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Convert a complete directory of .mod files, or all modules listed in a manifest file, on all CPU cores
+// ( -batch command line option )
+
+#include <stdio.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <filesystem>
+#include "LSPEncoder.h"
+#include "BatchConvert.h"
+#include "ThreadPool.h"
+#include "ConversionCache.h"
+#include "Log.h"
+
+struct BatchJob
+{
+	std::string	modFilename;
+	std::string	log;
+	bool		success;
+	ConvertSummary	summary;
+};
+
+static bool	IsModFilename(const std::filesystem::path& path)
+{
+	std::string name = path.filename().string();
+	std::transform(name.begin(), name.end(), name.begin(), [](char c) { return char(tolower(c)); });
+	if ((name.size() > 4) && (0 == name.compare(name.size() - 4, 4, ".mod")))
+		return true;
+	return (0 == name.compare(0, 4, "mod."));		// amiga style "mod.songname"
+}
+
+static bool	GatherModules(const char* source, std::vector<BatchJob>& jobs)
+{
+	std::error_code err;
+	const std::filesystem::path sourcePath(source);
+	std::vector<std::string> names;
+
+	if (std::filesystem::is_directory(sourcePath, err))
+	{
+		for (const auto& entry : std::filesystem::directory_iterator(sourcePath, err))
+		{
+			if (entry.is_regular_file(err) && IsModFilename(entry.path()))
+				names.push_back(entry.path().string());
+		}
+		// directory order is file system dependent, sort to get the same batch everywhere
+		std::sort(names.begin(), names.end());
+	}
+	else
+	{
+		FILE* h = fopen(source, "r");
+		if (NULL == h)
+		{
+			printf("ERROR: Unable to open batch source \"%s\"\n", source);
+			return false;
+		}
+		// manifest: one MOD file per line, relative to the manifest directory. '#' starts a comment line
+		const std::filesystem::path baseDir = sourcePath.parent_path();
+		char line[_MAX_PATH];
+		while (fgets(line, sizeof(line), h))
+		{
+			std::string name(line);
+			const size_t first = name.find_first_not_of(" \t\r\n");
+			if ((std::string::npos == first) || ('#' == name[first]))
+				continue;
+			const size_t last = name.find_last_not_of(" \t\r\n");
+			const std::filesystem::path modPath(name.substr(first, last - first + 1));
+			names.push_back(modPath.is_absolute() ? modPath.string() : (baseDir / modPath).string());
+		}
+		fclose(h);
+	}
+
+	jobs.resize(names.size());
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		jobs[i].modFilename = names[i];
+		jobs[i].success = false;
+	}
+
+	if (jobs.empty())
+		printf("ERROR: No MOD file found in \"%s\"\n", source);
+
+	return !jobs.empty();
+}
+
+static void	ConvertJob(const ConvertParams& batchParams, BatchJob& job)
+{
+	LSPLogCaptureBegin(&job.log);
+
+	ConvertParams params = batchParams;
+	params.m_batchSource = NULL;
+	params.m_threadCount = 1;		// modules are already converted in parallel
+	params.m_modFilename = job.modFilename.c_str();
+	params.SetDefaultFilenames();
+
+	job.success = ConvertModule(params, &job.summary);
+
+	LSPLogCaptureEnd();
+}
+
+int		BatchProcess(const ConvertParams& params)
+{
+	std::vector<BatchJob> jobs;
+	if (!GatherModules(params.m_batchSource, jobs))
+		return -1;
+
+	printf("Batch converting %d module(s) from \"%s\"\n\n", int(jobs.size()), params.m_batchSource);
+
+	// each module log is captured, and printed in batch order as soon as all previous modules are done
+	// ( so the console output doesn't depend on the thread count )
+	std::mutex printLock;
+	std::vector<bool> done(jobs.size(), false);
+	size_t nextToPrint = 0;
+
+	ParallelFor(int(jobs.size()), params.m_threadCount, [&](int i)
+	{
+		ConvertJob(params, jobs[i]);
+
+		std::lock_guard<std::mutex> guard(printLock);
+		done[i] = true;
+		while ((nextToPrint < jobs.size()) && (done[nextToPrint]))
+		{
+			BatchJob& job = jobs[nextToPrint];
+			printf("----- [%d/%d] %s -----\n", int(nextToPrint + 1), int(jobs.size()), job.modFilename.c_str());
+			fwrite(job.log.data(), 1, job.log.size(), stdout);
+			printf("\n");
+			job.log.clear();
+			job.log.shrink_to_fit();
+			nextToPrint++;
+		}
+		fflush(stdout);
+	});
+
+	int failCount = 0;
+	printf("Batch summary:\n");
+	printf("     #  Result   Frames  Duration      Bank     Score  Module\n");
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		const BatchJob& job = jobs[i];
+		if (job.success)
+		{
+			const ConvertSummary& info = job.summary;
+			printf("  %4d  OK     %8d     %02d:%02d  %8d  %8d  %s\n", int(i + 1), info.frameCount,
+				info.durationSec / 60, info.durationSec % 60, info.bankSize, info.scoreSize, job.modFilename.c_str());
+		}
+		else
+		{
+			printf("  %4d  FAILED %8s  %8s  %8s  %8s  %s\n", int(i + 1), "-", "-", "-", "-", job.modFilename.c_str());
+			failCount++;
+		}
+	}
+	printf("%d module(s) converted, %d failed\n", int(jobs.size()) - failCount, failCount);
+
+	return (0 == failCount) ? 0 : -1;
+}
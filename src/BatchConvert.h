@@ -0,0 +1,17 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Convert a complete directory of .mod files, or all modules listed in a manifest file, on all CPU cores
+// ( -batch command line option )
+
+#pragma once
+
+struct ConvertParams;
+
+int		BatchProcess(const ConvertParams& params);
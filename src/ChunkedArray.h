@@ -0,0 +1,77 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Growable array allocated by fixed size chunks ( per frame conversion data )
+// Memory follows the real used size, elements never move, and new elements are zeroed (like calloc).
+// Note: all members zeroed is a valid empty array (LSPEncoder is memset at construction)
+
+#pragma once
+#include <stdlib.h>
+#include <assert.h>
+
+template <typename T, int kChunkShift = 12>
+class ChunkedArray
+{
+public:
+	ChunkedArray() : m_chunks(NULL), m_chunkCount(0), m_chunkCapacity(0), m_size(0) {}
+	~ChunkedArray() { Clear(); }
+	ChunkedArray(const ChunkedArray&) = delete;
+	ChunkedArray&	operator=(const ChunkedArray&) = delete;
+
+	void	Clear()
+	{
+		for (int i = 0; i < m_chunkCount; i++)
+			free(m_chunks[i]);
+		free(m_chunks);
+		m_chunks = NULL;
+		m_chunkCount = 0;
+		m_chunkCapacity = 0;
+		m_size = 0;
+	}
+
+	// access any index, the array grows if needed
+	T&		operator[](int index)
+	{
+		assert(index >= 0);
+		if (index >= m_size)
+			Grow(index + 1);
+		return m_chunks[index >> kChunkShift][index & kChunkMask];
+	}
+
+	const T&	operator[](int index) const
+	{
+		assert((index >= 0) && (index < m_size));
+		return m_chunks[index >> kChunkShift][index & kChunkMask];
+	}
+
+	int		GetSize() const { return m_size; }
+	size_t	GetAllocatedBytes() const { return size_t(m_chunkCount) * kChunkSize * sizeof(T); }
+
+private:
+	static const int	kChunkSize = 1 << kChunkShift;
+	static const int	kChunkMask = kChunkSize - 1;
+
+	void	Grow(int size)
+	{
+		const int chunkCount = (size + kChunkMask) >> kChunkShift;
+		if (chunkCount > m_chunkCapacity)
+		{
+			m_chunkCapacity = (chunkCount > m_chunkCapacity * 2) ? chunkCount : m_chunkCapacity * 2;
+			m_chunks = (T**)realloc(m_chunks, m_chunkCapacity * sizeof(T*));
+		}
+		while (m_chunkCount < chunkCount)
+			m_chunks[m_chunkCount++] = (T*)calloc(kChunkSize, sizeof(T));
+		m_size = size;
+	}
+
+	T**		m_chunks;
+	int		m_chunkCount;
+	int		m_chunkCapacity;
+	int		m_size;
+};
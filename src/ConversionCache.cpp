@@ -0,0 +1,272 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// On disk conversion cache ( -cache command line option )
+
+#define	_CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <functional>
+#include <filesystem>
+#include "LSPEncoder.h"
+#include "LSPDecoder.h"
+#include "ConversionCache.h"
+#include "crc32.h"
+#include "Log.h"
+
+static const uint32_t	kCacheFormatVersion = 2;		// change it each time the cache entry layout changes
+
+static const char* const	kInfoName = "info.txt";
+static const char* const	kBankName = "bank.lsbank";
+static const char* const	kScoreName = "score.lsmusic";
+static const char* const	kPlayerName = "insane.asm";
+static const char* const	kPlayerObjectName = "insane.o";
+static const char* const	kPlayerBinaryName = "insane.bin";
+static const char* const	kWavName = "preview.wav";
+static const int			kMaxEntryFiles = 6;
+
+// FNV-1a 64bits names the entry, an independent crc32 of the same input is checked on restore
+static void	HashUpdate(CacheKey& key, const void* data, size_t size)
+{
+	const u8* p = (const u8*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		key.hash ^= p[i];
+		key.hash *= 0x100000001b3ull;
+	}
+	key.crc = CrcUpdate(key.crc, p, int(size));
+}
+
+template <typename T> static void	HashValue(CacheKey& key, const T& v)
+{
+	HashUpdate(key, &v, sizeof(T));
+}
+
+static void	HashString(CacheKey& key, const char* s)
+{
+	HashUpdate(key, s, strlen(s) + 1);
+}
+
+CacheKey	ConversionCache::ComputeKey(const ConvertParams& params, const u8* modData, int modSize)
+{
+	CacheKey key;
+	key.hash = 0xcbf29ce484222325ull;
+	key.crc = ~0u;
+	key.modSize = modSize;
+	HashValue(key, kCacheFormatVersion);
+	HashValue(key, int(LSP_MAJOR_VERSION));
+	HashValue(key, int(LSP_MINOR_VERSION));
+	HashValue(key, modSize);
+	HashUpdate(key, modData, modSize);
+
+	// every option changing any output byte should be there
+	HashValue(key, params.m_generateInsane);
+	HashValue(key, params.m_insaneObject);
+	HashValue(key, params.m_insaneBinary);
+	HashValue(key, params.m_insaneBudget);
+	HashValue(key, params.m_keepModSoundBankLayout);
+	HashValue(key, params.m_nosettempo);
+	HashValue(key, params.m_amigaEmulation);
+	HashValue(key, params.m_loopPreview);
+	HashValue(key, params.m_lspMicro);
+	HashValue(key, params.m_fixed50hz);
+	HashValue(key, params.m_seqGetPosSupport);
+	HashValue(key, params.m_seqSetPosSupport);
+	HashValue(key, params.m_shrink);
+	HashValue(key, params.m_adpcm);
+	HashValue(key, params.m_mono);
+	HashValue(key, params.m_losslessMask);
+	HashValue(key, params.m_autoLosslessDb);
+	HashValue(key, params.m_optCodes);
+	HashValue(key, params.m_huffman);
+	HashValue(key, params.m_optStreams);
+	HashValue(key, params.m_shareSamples);
+	HashValue(key, params.m_optBank);
+	if (params.m_generateInsane)
+		HashString(key, params.m_sScoreFilename);		// insane source code mentions the .lsmusic name
+	return key;
+}
+
+ConversionCache::ConversionCache(const char* directory) : m_directory(directory)
+{
+}
+
+std::string	ConversionCache::EntryPath(const CacheKey& key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)key.hash);
+	return (std::filesystem::path(m_directory) / name).string();
+}
+
+// list of (cache entry file, output file) for these params
+static int	GetEntryFiles(const ConvertParams& params, const char* entryFiles[kMaxEntryFiles], const char* outputFiles[kMaxEntryFiles])
+{
+	int count = 0;
+	entryFiles[count] = kBankName;		outputFiles[count++] = params.m_sBankFilename;
+	entryFiles[count] = kScoreName;		outputFiles[count++] = params.m_sScoreFilename;
+	if (params.m_generateInsane)
+	{
+		entryFiles[count] = kPlayerName;
+		outputFiles[count++] = params.m_sPlayerFilename;
+	}
+	if (params.m_insaneObject)
+	{
+		entryFiles[count] = kPlayerObjectName;
+		outputFiles[count++] = params.m_sPlayerObjectFilename;
+	}
+	if (params.m_insaneBinary)
+	{
+		entryFiles[count] = kPlayerBinaryName;
+		outputFiles[count++] = params.m_sPlayerBinaryFilename;
+	}
+	if (params.m_amigaEmulation)
+	{
+		entryFiles[count] = kWavName;
+		outputFiles[count++] = params.m_sAmigaWavFilename;
+	}
+	return count;
+}
+
+bool	ConversionCache::Restore(const ConvertParams& params, const CacheKey& key, ConvertSummary* summary) const
+{
+	const std::filesystem::path entry(EntryPath(key));
+
+	// info file is written last, so an entry without info is incomplete
+	FILE* h = fopen((entry / kInfoName).string().c_str(), "r");
+	if (NULL == h)
+		return false;
+	ConvertSummary info;
+	unsigned int crc = 0;
+	int modSize = 0;
+	const int n = fscanf(h, "mod %d\ncrc %x\nframes %d\nduration %d\nbank %d\nscore %d\n", &modSize, &crc, &info.frameCount, &info.durationSec, &info.bankSize, &info.scoreSize);
+	fclose(h);
+	if (6 != n)
+		return false;
+
+	// entry name is only a 64bits hash, make sure the entry really is this conversion
+	if ((modSize != key.modSize) || (crc != key.crc))
+	{
+		LSPPrintf("Warning: Cache entry %016llx does not match \"%s\", ignored\n", (unsigned long long)key.hash, params.m_modFilename);
+		return false;
+	}
+
+	const char* entryFiles[kMaxEntryFiles];
+	const char* outputFiles[kMaxEntryFiles];
+	const int count = GetEntryFiles(params, entryFiles, outputFiles);
+	for (int i = 0; i < count; i++)
+	{
+		std::error_code err;
+		if (!std::filesystem::copy_file(entry / entryFiles[i], outputFiles[i], std::filesystem::copy_options::overwrite_existing, err))
+		{
+			LSPPrintf("Warning: Unable to restore \"%s\" from cache\n", outputFiles[i]);
+			return false;
+		}
+		LSPPrintf("Restored \"%s\" from cache\n", outputFiles[i]);
+	}
+	*summary = info;
+	return true;
+}
+
+bool	ConversionCache::Store(const ConvertParams& params, const CacheKey& key, const ConvertSummary& summary) const
+{
+	const std::filesystem::path entry(EntryPath(key));
+	std::error_code err;
+	if (std::filesystem::exists(entry, err))
+		return true;
+
+	// build the entry in a private temp directory, then rename it ( several LSPConvert could store the same entry )
+	char tmpName[64];
+	snprintf(tmpName, sizeof(tmpName), ".tmp%016llx_%zx", (unsigned long long)key.hash, std::hash<std::thread::id>()(std::this_thread::get_id()));
+	const std::filesystem::path tmp = std::filesystem::path(m_directory) / tmpName;
+	std::filesystem::create_directories(tmp, err);
+	if (err)
+	{
+		LSPPrintf("Warning: Unable to create cache directory \"%s\"\n", tmp.string().c_str());
+		return false;
+	}
+
+	bool ret = true;
+	const char* entryFiles[kMaxEntryFiles];
+	const char* outputFiles[kMaxEntryFiles];
+	const int count = GetEntryFiles(params, entryFiles, outputFiles);
+	for (int i = 0; (i < count) && ret; i++)
+		ret = std::filesystem::copy_file(outputFiles[i], tmp / entryFiles[i], std::filesystem::copy_options::overwrite_existing, err);
+
+	if (ret)
+	{
+		FILE* h = fopen((tmp / kInfoName).string().c_str(), "w");
+		ret = (NULL != h);
+		if (h)
+		{
+			fprintf(h, "mod %d\ncrc %08x\nframes %d\nduration %d\nbank %d\nscore %d\n", key.modSize, key.crc, summary.frameCount, summary.durationSec, summary.bankSize, summary.scoreSize);
+			fclose(h);
+		}
+	}
+
+	if (ret)
+	{
+		std::filesystem::rename(tmp, entry, err);
+		if (err && (!std::filesystem::exists(entry)))
+			ret = false;
+	}
+
+	std::filesystem::remove_all(tmp, err);
+	if (!ret)
+		LSPPrintf("Warning: Unable to store conversion into cache \"%s\"\n", m_directory.c_str());
+	return ret;
+}
+
+bool	ConvertModule(const ConvertParams& params, ConvertSummary* summary)
+{
+	memset(summary, 0, sizeof(ConvertSummary));
+
+	CacheKey key = {};
+	bool useCache = false;
+	if (params.m_cacheDir)
+	{
+		BinaryParser modFile;
+		if (modFile.LoadFromFile(params.m_modFilename))
+		{
+			key = ConversionCache::ComputeKey(params, (const u8*)modFile.GetBuffer(), modFile.GetLen());
+			useCache = true;
+		}
+	}
+
+	// these options only print or save a report, the conversion has to run ( result is still stored )
+	const bool reportOnly = params.m_packEstimate || params.m_cycles || params.m_timings;
+	if (useCache && reportOnly)
+		LSPPrintf("Cache lookup skipped for \"%s\": -pack, -cycles and -timings reports need a conversion\n", params.m_modFilename);
+
+	const ConversionCache cache(useCache ? params.m_cacheDir : "");
+	if ((useCache) && (!reportOnly))
+	{
+		if (cache.Restore(params, key, summary))
+		{
+			LSPPrintf("Cache hit for \"%s\" (key %016llx), no conversion needed\n", params.m_modFilename, (unsigned long long)key.hash);
+			if (params.m_optCodes || params.m_shareSamples || params.m_optBank || params.m_huffman || params.m_optStreams || (params.m_insaneBudget > 0) || (params.m_autoLosslessDb > 0.f))
+				LSPPrintf("Note: conversion reports of the options are not printed on a cache hit\n");
+			return true;
+		}
+	}
+
+	LSPEncoder* encoder = new LSPEncoder;
+	encoder->SetConvertParams(params);
+	const bool ret = encoder->LoadModule() && encoder->ExportToLSP();
+	summary->frameCount = encoder->GetFrameCount();
+	summary->durationSec = encoder->GetDurationSec();
+	summary->bankSize = encoder->GetSoundBankSize();
+	summary->scoreSize = encoder->GetScoreSize();
+	delete encoder;
+
+	if (ret && useCache)
+		cache.Store(params, key, *summary);
+
+	return ret;
+}
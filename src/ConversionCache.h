@@ -0,0 +1,54 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// On disk conversion cache ( -cache command line option )
+// Each entry is a directory named by a 64bits hash of the MOD content, the converter version and
+// every option changing the output files. A cache hit restores the files without any simulation.
+// info.txt also stores the MOD size and a crc32 of the same input, checked before restoring.
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include "LSPTypes.h"
+
+struct ConvertParams;
+
+struct ConvertSummary
+{
+	int		frameCount;
+	int		durationSec;
+	int		bankSize;
+	int		scoreSize;
+};
+
+struct CacheKey
+{
+	uint64_t	hash;		// FNV-1a, entry directory name
+	uint32_t	crc;		// crc32 of the same input, stored in info.txt
+	int			modSize;
+};
+
+// convert one module using params, going through the cache if params.m_cacheDir is set
+bool	ConvertModule(const ConvertParams& params, ConvertSummary* summary);
+
+class ConversionCache
+{
+public:
+	ConversionCache(const char* directory);
+
+	static	CacheKey	ComputeKey(const ConvertParams& params, const u8* modData, int modSize);
+
+	bool	Restore(const ConvertParams& params, const CacheKey& key, ConvertSummary* summary) const;
+	bool	Store(const ConvertParams& params, const CacheKey& key, const ConvertSummary& summary) const;
+
+private:
+	std::string		EntryPath(const CacheKey& key) const;
+
+	std::string		m_directory;
+};
@@ -0,0 +1,1103 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Static 68000 cycle cost model of the LSP replay routines ( -cycles command line option )
+
+#define	_CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <algorithm>
+#include "CycleModel.h"
+#include "Log.h"
+
+static const int	kIrqException = 44;			// interrupt autovector processing
+
+//---------------------------------------------------------------------------------------
+// 68000 instruction timing
+//---------------------------------------------------------------------------------------
+enum EaMode
+{
+	kEaDn,
+	kEaAn,
+	kEaInd,			// (An)
+	kEaPostInc,		// (An)+
+	kEaPreDec,		// -(An)
+	kEaDisp,		// d16(An)
+	kEaIndex,		// d8(An,Xn)
+	kEaAbsW,
+	kEaAbsL,
+	kEaPcDisp,		// d16(PC)
+	kEaPcIndex,		// d8(PC,Xn)
+	kEaImm,
+	kEaModeCount
+};
+
+struct Operand
+{
+	EaMode	mode;
+	long	value;			// immediate value ( if known )
+	int		regCount;		// movem register list
+};
+
+// effective address calculation time, byte/word and long
+static const int	kEaTime[kEaModeCount][2] =
+{
+	{ 0,0 }, { 0,0 }, { 4,8 }, { 4,8 }, { 6,10 }, { 8,12 }, { 10,14 }, { 8,12 }, { 12,16 }, { 8,12 }, { 10,14 }, { 4,8 }
+};
+
+// MOVE destination time, byte/word and long
+static const int	kMoveDstTime[kEaModeCount][2] =
+{
+	{ 0,0 }, { 0,0 }, { 4,8 }, { 4,8 }, { 4,8 }, { 8,12 }, { 10,14 }, { 8,12 }, { 12,16 }, { -1,-1 }, { -1,-1 }, { -1,-1 }
+};
+
+//									Dn  An (An) (An)+ -(An) d16 d8  abs.w abs.l d16pc d8pc imm
+static const int	kLeaTime[kEaModeCount] = { -1, -1, 4, -1, -1, 8, 12, 8, 12, 8, 12, -1 };
+static const int	kPeaTime[kEaModeCount] = { -1, -1, 12, -1, -1, 16, 20, 16, 20, 16, 20, -1 };
+static const int	kJmpTime[kEaModeCount] = { -1, -1, 8, -1, -1, 10, 14, 10, 12, 10, 14, -1 };
+static const int	kJsrTime[kEaModeCount] = { -1, -1, 16, -1, -1, 18, 22, 18, 20, 18, 22, -1 };
+
+static int	RegisterId(const char* s, int len)
+{
+	if ((2 == len) && (('s' == tolower(s[0])) && ('p' == tolower(s[1]))))
+		return 15;
+	if ((2 == len) && (s[1] >= '0') && (s[1] <= '7'))
+	{
+		if ('d' == tolower(s[0]))
+			return s[1] - '0';
+		if ('a' == tolower(s[0]))
+			return 8 + s[1] - '0';
+	}
+	return -1;
+}
+
+static long	ParseValue(const char* s)
+{
+	if ('$' == *s)
+		return strtol(s + 1, NULL, 16);
+	return strtol(s, NULL, 0);
+}
+
+// movem register list ( "d0-a6", "d0/d2-d4/a0" )
+static int	RegisterListCount(const std::string& s)
+{
+	int count = 0;
+	size_t start = 0;
+	while (start < s.size())
+	{
+		size_t end = s.find('/', start);
+		if (std::string::npos == end)
+			end = s.size();
+		const std::string item = s.substr(start, end - start);
+		const size_t dash = item.find('-');
+		if (std::string::npos == dash)
+		{
+			if (RegisterId(item.c_str(), int(item.size())) < 0)
+				return -1;
+			count++;
+		}
+		else
+		{
+			const int r0 = RegisterId(item.c_str(), int(dash));
+			const int r1 = RegisterId(item.c_str() + dash + 1, int(item.size() - dash - 1));
+			if ((r0 < 0) || (r1 < r0))
+				return -1;
+			count += r1 - r0 + 1;
+		}
+		start = end + 1;
+	}
+	return count;
+}
+
+static Operand	ParseOperand(const std::string& s)
+{
+	Operand op = { kEaAbsL, 0, 0 };
+	const int reg = RegisterId(s.c_str(), int(s.size()));
+	if (reg >= 0)
+	{
+		op.mode = (reg < 8) ? kEaDn : kEaAn;
+		op.regCount = 1;
+		return op;
+	}
+	if ('#' == s[0])
+	{
+		op.mode = kEaImm;
+		op.value = ParseValue(s.c_str() + 1);
+		return op;
+	}
+	if ((s.size() > 2) && ('-' == s[0]) && ('(' == s[1]))
+	{
+		op.mode = kEaPreDec;
+		return op;
+	}
+	if ((s.size() > 2) && (')' == s[s.size() - 2]) && ('+' == s[s.size() - 1]))
+	{
+		op.mode = kEaPostInc;
+		return op;
+	}
+	if (')' == s[s.size() - 1])
+	{
+		// base register is in the last parenthesis
+		const size_t open = s.rfind('(');
+		const std::string inside = s.substr(open + 1, s.size() - open - 2);
+		const size_t comma = inside.find(',');
+		const std::string base = inside.substr(0, comma);
+		const bool pc = (2 == base.size()) && ('p' == tolower(base[0])) && ('c' == tolower(base[1]));
+		if (std::string::npos != comma)
+			op.mode = pc ? kEaPcIndex : kEaIndex;
+		else if (pc)
+			op.mode = kEaPcDisp;
+		else
+			op.mode = (0 == open) ? kEaInd : kEaDisp;
+		return op;
+	}
+	if ((s.find('-') != std::string::npos) || (s.find('/') != std::string::npos))
+	{
+		const int count = RegisterListCount(s);
+		if (count > 0)
+		{
+			op.mode = kEaDn;		// register list
+			op.regCount = count;
+			return op;
+		}
+	}
+	const size_t len = s.size();
+	if ((len > 2) && ('.' == s[len - 2]) && ('w' == tolower(s[len - 1])))
+		op.mode = kEaAbsW;
+	return op;
+}
+
+static bool	IsMemory(EaMode mode)
+{
+	return (mode != kEaDn) && (mode != kEaAn) && (mode != kEaImm);
+}
+
+static int	BitCount(unsigned long v)
+{
+	int n = 0;
+	for (; v; v &= v - 1)
+		n++;
+	return n;
+}
+
+static bool	IsConditionalBranch(const std::string& base)
+{
+	if (('b' == base[0]) && (3 == base.size()))
+	{
+		static const char* const cc[] = { "eq","ne","cc","cs","pl","mi","ge","lt","gt","le","hi","ls","vc","vs","hs","lo" };
+		for (const char* c : cc)
+			if (0 == strcmp(base.c_str() + 1, c))
+				return true;
+	}
+	return false;
+}
+
+// split "label: mnemonic op1,op2 ; comment" in lower case mnemonic & operands. Returns false if no instruction
+static bool	SplitInstruction(const char* line, std::string& mnemonic, std::vector<std::string>& ops)
+{
+	// skip label ( "label:" ) & comment
+	const char* p = line;
+	const char* colon = p;
+	while ((*colon) && (' ' != *colon) && ('\t' != *colon) && (':' != *colon) && (';' != *colon))
+		colon++;
+	if (':' == *colon)
+		p = colon + 1;
+	while ((' ' == *p) || ('\t' == *p))
+		p++;
+	mnemonic.clear();
+	ops.clear();
+	while ((*p) && (' ' != *p) && ('\t' != *p) && (';' != *p))
+		mnemonic += char(tolower(*p++));
+	if (mnemonic.empty())
+		return false;
+
+	// operands, split on top level commas
+	std::string cur;
+	int depth = 0;
+	while ((' ' == *p) || ('\t' == *p))
+		p++;
+	for (; (*p) && (';' != *p) && (' ' != *p) && ('\t' != *p); p++)
+	{
+		if ('(' == *p)
+			depth++;
+		else if (')' == *p)
+			depth--;
+		if ((',' == *p) && (0 == depth))
+		{
+			ops.push_back(cur);
+			cur.clear();
+		}
+		else
+			cur += *p;
+	}
+	if (!cur.empty())
+		ops.push_back(cur);
+	return true;
+}
+
+int		M68kInstructionCycles(const char* line)
+{
+	std::string mnemonic;
+	std::vector<std::string> ops;
+	if (!SplitInstruction(line, mnemonic, ops))
+		return -1;
+
+	char size = 'w';
+	std::string base = mnemonic;
+	const size_t dot = mnemonic.find('.');
+	if (std::string::npos != dot)
+	{
+		size = mnemonic[dot + 1];
+		base = mnemonic.substr(0, dot);
+	}
+	const int l = ('l' == size) ? 1 : 0;
+
+	Operand src = { kEaDn, 0, 0 };
+	Operand dst = { kEaDn, 0, 0 };
+	if (ops.size() >= 1)
+		src = ParseOperand(ops[0]);
+	if (ops.size() >= 2)
+		dst = ParseOperand(ops[1]);
+	const int srcEa = kEaTime[src.mode][l];
+	const int dstEa = kEaTime[dst.mode][l];
+
+	// no operand
+	if ("rts" == base) return 16;
+	if ("rte" == base) return 20;
+	if ("nop" == base) return 4;
+	if ("illegal" == base) return 34;
+	if ((ops.empty()) || (ops.size() > 2))
+		return -1;
+
+	// one operand
+	if ("bra" == base) return kBranchTaken;
+	if ("bsr" == base) return 18;
+	if ("jmp" == base) return kJmpTime[src.mode];
+	if ("jsr" == base) return kJsrTime[src.mode];
+	if ("pea" == base) return kPeaTime[src.mode];
+	if (("swap" == base) || ("ext" == base)) return 4;
+	if (IsConditionalBranch(base))
+		return ('s' == size) || ('b' == size) ? kBranchShortNotTaken : kBranchWordNotTaken;
+	if (('d' == base[0]) && ('b' == base[1]))
+		return kDbfLoop;
+	if ("tst" == base) return 4 + srcEa;
+	if ("clr" == base) return (kEaDn == src.mode) ? (l ? 6 : 4) : (l ? 12 : 8) + srcEa;
+	if (('s' == base[0]) && (2 == base.size() || 3 == base.size()) && (1 == ops.size()))		// st, sf, seq...
+		return (kEaDn == src.mode) ? 6 : 8 + kEaTime[src.mode][0];
+	if (1 == ops.size())
+		return -1;
+
+	// two operands
+	if (("move" == base) || ("movea" == base))
+	{
+		const int d = (kEaAn == dst.mode) ? 0 : kMoveDstTime[dst.mode][l];
+		return (d < 0) ? -1 : 4 + srcEa + d;
+	}
+	if ("moveq" == base) return 4;
+	if ("movem" == base)
+	{
+		const bool toMem = (src.regCount > 0) && IsMemory(dst.mode);
+		const Operand& list = toMem ? src : dst;
+		const EaMode mem = toMem ? dst.mode : src.mode;
+		const int perReg = l ? 8 : 4;
+		const int extra = ((kEaDisp == mem) || (kEaAbsW == mem) || (kEaPcDisp == mem)) ? 4 : (((kEaIndex == mem) || (kEaAbsL == mem) || (kEaPcIndex == mem)) ? 6 : 0);
+		return (toMem ? 8 : 12) + extra + perReg * list.regCount;
+	}
+	if ("lea" == base) return kLeaTime[src.mode];
+	if ("exg" == base) return 6;
+
+	if (("addq" == base) || ("subq" == base))
+	{
+		if (kEaDn == dst.mode) return l ? 8 : 4;
+		if (kEaAn == dst.mode) return 8;
+		return (l ? 12 : 8) + dstEa;
+	}
+
+	const bool isCmp = (0 == base.compare(0, 3, "cmp"));
+	static const char* const arith[] = { "add","sub","and","or","cmp","eor" };
+	std::string op = base;
+	for (const char* a : arith)
+	{
+		const size_t n = strlen(a);
+		if ((0 == base.compare(0, n, a)) && ((base.size() == n) || ((base.size() == n + 1) && (('a' == base[n]) || ('i' == base[n])))))
+			op = a;
+	}
+	if ((op != base) || ("add" == base) || ("sub" == base) || ("and" == base) || ("or" == base) || ("cmp" == base) || ("eor" == base))
+	{
+		if (kEaAn == dst.mode)
+		{
+			if (isCmp) return 6 + srcEa;
+			if (!l) return 8 + srcEa;
+			return ((kEaDn == src.mode) || (kEaAn == src.mode) || (kEaImm == src.mode)) ? 8 : 6 + srcEa;
+		}
+		if (kEaImm == src.mode)
+		{
+			if (kEaDn == dst.mode) return isCmp ? (l ? 14 : 8) : (l ? 16 : 8);
+			return isCmp ? ((l ? 12 : 8) + dstEa) : ((l ? 20 : 12) + dstEa);
+		}
+		if (kEaDn == dst.mode)
+		{
+			if (!l) return 4 + srcEa;
+			if (isCmp) return 6 + srcEa;
+			return ((kEaDn == src.mode) || (kEaAn == src.mode)) ? 8 : 6 + srcEa;
+		}
+		return (l ? 12 : 8) + dstEa;
+	}
+
+	if (("btst" == base) || ("bset" == base) || ("bclr" == base) || ("bchg" == base))
+	{
+		const bool test = ("btst" == base);
+		if (kEaImm == src.mode)
+			return (kEaDn == dst.mode) ? (test ? 10 : 12) : ((test ? 8 : 12) + kEaTime[dst.mode][0]);
+		return (kEaDn == dst.mode) ? (test ? 6 : 8) : ((test ? 4 : 8) + kEaTime[dst.mode][0]);
+	}
+
+	static const char* const shifts[] = { "lsl","lsr","asl","asr","rol","ror","roxl","roxr" };
+	for (const char* s : shifts)
+	{
+		if (base == s)
+		{
+			const int n = (kEaImm == src.mode) ? int(src.value) : 8;		// register count: unknown, 8 bits assumed
+			return (l ? 8 : 6) + 2 * n;
+		}
+	}
+
+	if (("mulu" == base) || ("muls" == base))
+		return 38 + srcEa + 2 * ((kEaImm == src.mode) ? BitCount((unsigned long)src.value & 0xffff) : 16);
+	if ("divu" == base) return 140 + srcEa;
+	if ("divs" == base) return 158 + srcEa;
+
+	return -1;
+}
+
+//---------------------------------------------------------------------------------------
+// Player tick models. Each path is written with the .asm instruction text
+//---------------------------------------------------------------------------------------
+PlayerCostModel::PlayerCostModel() :
+	m_insaneExtCount(0),
+	m_microDecodeFlags(0),
+	m_usedInstructions(NULL),
+	m_standardCmdExec(1 << 16, -1),
+	m_microTick(1 << 18, -1)
+{
+}
+
+// cached instruction time ( instruction text is a string literal, so the pointer is the key )
+int		PlayerCostModel::C(const char* instruction) const
+{
+	if (m_usedInstructions)
+		m_usedInstructions->insert(instruction);
+	auto it = m_instructionCache.find(instruction);
+	if (it != m_instructionCache.end())
+		return it->second;
+	const int cycles = M68kInstructionCycles(instruction);
+	assert(cycles >= 0);
+	m_instructionCache[instruction] = cycles;
+	return cycles;
+}
+
+const char*	PlayerCostModel::GetVariantName(PlayerVariant variant)
+{
+	static const char* const names[kPlayerVariantCount] =
+	{
+		"standard (LightSpeedPlayer.asm)",
+		"standard + CIA irq (LightSpeedPlayer_cia.asm)",
+		"insane (generated player)",
+		"micro (LightSpeedPlayer_Micro.asm)",
+		"micro + CIA irq (LightSpeedPlayer_cia.asm)",
+	};
+	return names[variant];
+}
+
+// LightSpeedPlayer.asm: read a cmd code, including extended codes ( 0 bytes prefix )
+// keep in sync with LightSpeedPlayer.asm ( checked by CheckPlayerSources )
+int		PlayerCostModel::StandardCode(int code) const
+{
+	int c = C("moveq\t#0,d0") + C("move.b\t(a0)+,d0");
+	const int ext = code / 255;
+	if (0 == ext)
+		return c + kBranchWordNotTaken + C("add.w\td0,d0") + C("move.w\t0(a2,d0.w),d0");
+
+	c += kBranchTaken;		// beq .cextended
+	c += ext * (C("addi.w\t#$100,d0") + C("move.b\t(a0)+,d0"));
+	c += (ext - 1) * kBranchTaken + kBranchShortNotTaken;
+	return c + C("add.w\td0,d0") + C("move.w\t0(a2,d0.w),d0");
+}
+
+// -huffman cmd read. There is no 68k player for prefix codes yet, so this is the table driven decoder it would use:
+// d6 bit buffer ( MSB aligned ), d7 buffered bits, a0 bit stream, a2 256 longs table on the next 8 bits ( bits.w, cmd.w ),
+// a3 canonical table for longer codes ( mask.w, first.w, count.w, rank.w per length from 9 bits ), a4 cmd values
+int		PlayerCostModel::PrefixCodeReadCycles(int bits, int& bufferedBits) const
+{
+	assert((bits >= 1) && (bits <= 16));
+	int c = C("cmpi.b\t#16,d7");
+	if (bufferedBits < 16)
+	{
+		c += kBranchShortNotTaken + C("moveq\t#0,d1") + C("move.w\t(a0)+,d1") + C("moveq\t#16,d2") + C("sub.b\td7,d2");
+		c += 8 + 2 * (16 - bufferedBits);				// lsl.l d2,d1
+		c += C("or.l\td1,d6") + C("addi.b\t#16,d7");
+		bufferedBits += 16;
+	}
+	else
+		c += kBranchTaken;
+	c += C("move.l\td6,d0") + C("rol.l\t#8,d0") + C("andi.w\t#$ff,d0") + C("add.w\td0,d0") + C("add.w\td0,d0");
+	c += C("move.l\t0(a2,d0.w),d0");
+	if (bits <= 8)
+	{
+		c += kBranchShortNotTaken;						// bmi.s .long
+		c += C("swap\td0") + 8 + 2 * bits + C("sub.b\td0,d7") + C("swap\td0");		// lsl.l d0,d6
+	}
+	else
+	{
+		c += kBranchTaken + C("moveq\t#9,d1") + C("lea\tm_prefixLengths(a1),a3");
+		for (int len = 9; len <= bits; len++)
+		{
+			c += C("move.l\td6,d0") + 8 + 2 * len;		// rol.l d1,d0
+			c += C("and.w\t(a3)+,d0") + C("sub.w\t(a3)+,d0") + C("cmp.w\t(a3)+,d0");
+			if (len < bits)
+				c += kBranchShortNotTaken + C("addq.w\t#2,a3") + C("addq.w\t#1,d1") + kBranchTaken;
+			else
+				c += kBranchTaken;
+		}
+		c += C("add.w\t(a3),d0") + C("add.w\td0,d0") + C("move.w\t0(a4,d0.w),d0");
+		c += 8 + 2 * bits + C("sub.b\td1,d7") + C("bra.s\t.cmd");		// lsl.l d1,d6
+	}
+	bufferedBits -= bits;
+	return c;
+}
+
+// LightSpeedPlayer.asm .cmdExec: volumes, periods & instruments of the frame
+// keep in sync with LightSpeedPlayer.asm ( checked by CheckPlayerSources )
+int		PlayerCostModel::StandardCmdExec(u16 wordCmd) const
+{
+	int& cached = m_standardCmdExec[wordCmd];
+	if (cached >= 0)
+		return cached;
+
+	static const char* const volumeMoves[4] = { "move.b\t(a0)+,$a9-$a0(a6)", "move.b\t(a0)+,$b9-$a0(a6)", "move.b\t(a0)+,$c9-$a0(a6)", "move.b\t(a0)+,$d9-$a0(a6)" };
+	static const char* const periodMoves[4] = { "move.w\t(a0)+,$a6-$a0(a6)", "move.w\t(a0)+,$b6-$a0(a6)", "move.w\t(a0)+,$c6-$a0(a6)", "move.w\t(a0)+,$d6-$a0(a6)" };
+	int c = 0;
+	for (int v = 3; v >= 0; v--)
+	{
+		c += C("add.b\td0,d0");
+		c += (wordCmd & (1 << (4 + v))) ? kBranchShortNotTaken + C(volumeMoves[v]) : kBranchTaken;
+	}
+	c += C("move.l\ta0,(a1)+") + C("move.l\t(a1),a0") + C("tst.b\td0");
+	if (wordCmd & 0xf)
+	{
+		c += kBranchShortNotTaken;
+		for (int v = 3; v >= 0; v--)
+		{
+			c += C("add.b\td0,d0");
+			c += (wordCmd & (1 << v)) ? kBranchShortNotTaken + C(periodMoves[v]) : kBranchTaken;
+		}
+	}
+	else
+		c += kBranchTaken;
+
+	c += C("tst.w\td0");
+	if (wordCmd >> 8)
+	{
+		c += kBranchShortNotTaken;
+		c += C("moveq\t#0,d1") + C("move.l\tm_lspInstruments-4(a1),a2") + C("lea\t.resetv+12(pc),a4") + C("lea\t3*16(a6),a5") + C("moveq\t#4-1,d2");
+		for (int v = 3; v >= 0; v--)
+		{
+			const int voiceCode = (wordCmd >> (8 + v * 2)) & 3;
+			c += C("add.w\td0,d0");
+			if (voiceCode & 2)
+			{
+				c += kBranchTaken + C("add.w\t(a0)+,a2") + C("add.w\td0,d0");
+				c += (voiceCode & 1) ? kBranchShortNotTaken + C("bset\td2,d1") + C("move.w\td1,$96-$a0(a6)") : kBranchTaken;
+				c += C("move.l\t(a2)+,(a5)") + C("move.w\t(a2)+,4(a5)") + C("move.l\ta2,(a4)");
+			}
+			else
+			{
+				c += kBranchShortNotTaken + C("add.w\td0,d0");
+				if (voiceCode & 1)
+					c += kBranchShortNotTaken + C("move.l\t(a4),a3") + C("move.l\t(a3)+,(a5)") + C("move.w\t(a3)+,4(a5)") + C("bra.s\t.skip");
+				else
+					c += kBranchTaken;
+			}
+			c += C("subq.w\t#4,a4") + C("lea\t-16(a5),a5") + ((v > 0) ? kDbfLoop : kDbfExpired);
+		}
+		c += C("move.l\tm_dmaconPatch-4(a1),a3") + C("move.b\td1,(a3)");
+	}
+	else
+		c += kBranchTaken;
+
+	c += C("move.l\ta0,(a1)") + C("rts");
+	cached = c;
+	return c;
+}
+
+// LightSpeedPlayer.asm LSP_MusicPlayTick
+// keep in sync with LightSpeedPlayer.asm ( checked by CheckPlayerSources )
+int		PlayerCostModel::StandardTick(const PlayerFrame& frame) const
+{
+	int c = C("bsr\tLSP_MusicPlayTick");
+	c += C("lea\tLSP_State(pc),a1") + C("move.l\t(a1),a0") + C("move.l\tm_codeTableAddr(a1),a2");
+
+	// ESC codes are always extended codes ( >= 255 )
+	const int cmpRewind = C("cmp.w\tm_escCodeRewind(a1),d0");
+	const int cmpBpm = C("cmp.w\tm_escCodeSetBpm(a1),d0");
+	const int cmpGetPos = C("cmp.w\tm_escCodeGetPos(a1),d0");
+	for (int i = 0; i < frame.escCount; i++)
+	{
+		c += StandardCode(frame.escCodes[i]);
+		switch (frame.escKinds[i])
+		{
+		case kEscRewind:
+			c += cmpRewind + kBranchTaken;
+			c += C("move.l\tm_byteStreamLoop(a1),a0") + C("move.l\tm_wordStreamLoop(a1),m_wordStream(a1)") + C("bra\t.process");
+			break;
+		case kEscSetBpm:
+			c += cmpRewind + kBranchShortNotTaken + cmpBpm + kBranchTaken;
+			c += C("move.b\t(a0)+,(m_currentBpm+1)(a1)") + C("bra\t.process");
+			break;
+		case kEscGetPos:
+			c += cmpRewind + kBranchShortNotTaken + cmpBpm + kBranchShortNotTaken + cmpGetPos + kBranchWordNotTaken;
+			c += C("move.b\t(a0)+,(m_currentSeq+1)(a1)") + C("bra\t.process");
+			break;
+		}
+	}
+
+	c += StandardCode(frame.cmdCode);
+	if (frame.cmdCode >= 255)
+	{
+		c += cmpRewind + kBranchShortNotTaken + cmpBpm + kBranchShortNotTaken + cmpGetPos + kBranchTaken;
+		c += StandardCmdExec(frame.wordCmd);
+	}
+	else if (0 == frame.wordCmd)
+	{
+		c += kBranchTaken + C("move.l\ta0,(a1)") + C("rts");
+	}
+	else
+	{
+		c += kBranchWordNotTaken + StandardCmdExec(frame.wordCmd);
+	}
+	return c;
+}
+
+// generated insane player: code dispatch through the jump table
+int		PlayerCostModel::InsaneDispatch(int code) const
+{
+	const int ext = code / 255;
+	int c = C("moveq\t#0,d0") + C("move.b\t(a0)+,d0");
+	if (m_insaneExtCount > 0)
+		c += (ext > 0) ? kBranchTaken : C("beq.s\t.extended1");
+	if (ext >= 1)
+	{
+		c += C("move.w\t#$0100,d0") + C("move.b\t(a0)+,d0");
+		if (m_insaneExtCount > 1)
+			c += (ext > 1) ? kBranchTaken : C("beq.s\t.extended2");
+	}
+	if (ext >= 2)
+		c += C("move.w\t#$0200,d0") + C("move.b\t(a0)+,d0");
+	return c + C("add.w\td0,d0") + C("move.w\t.LSP_JmpTable(pc,d0.w),d0") + C("jmp\t.LSP_JmpTable(pc,d0.w)");
+}
+
+int		PlayerCostModel::InsaneTick(const PlayerFrame& frame) const
+{
+	int c = C("bsr\tLSP_MusicPlayTickInsane");
+	c += C("lea\tLSP_StateInsane+8(pc),a1") + C("move.l\t(a1),a0");
+	for (int i = 0; i < frame.escCount; i++)
+	{
+		c += InsaneDispatch(frame.escCodes[i]);
+		if (kEscRewind == frame.escKinds[i])
+			c += C("move.l\t0-8(a1),16-8(a1)") + C("move.l\t24-8(a1),a0") + C("bra.s\t.process");
+		else
+			c += C("move.b\t(a0)+,-1(a1)") + C("bra.s\t.process");
+	}
+	c += InsaneDispatch(frame.cmdCode);
+	if ((frame.cmdCode >= 0) && (frame.cmdCode < int(m_insaneRoutines.size())))
+		c += m_insaneRoutines[frame.cmdCode];
+	return c;
+}
+
+// LightSpeedPlayer_Micro.asm LSP_MusicPlayTickMicro, both LSP_MICRO_TRANSFORMS versions
+// keep in sync with LightSpeedPlayer_Micro.asm ( checked by CheckPlayerSources )
+int		PlayerCostModel::MicroTick(const PlayerFrame& frame) const
+{
+	const int key = (frame.wordCmd & 0xfff) | ((frame.microPrevDmacon & 15) << 12) | ((frame.microLoopCmd & 3) << 16);
+	int& cached = m_microTick[key];
+	if (cached >= 0)
+		return cached;
+
+	const int flags = m_microDecodeFlags;
+	int c = C("bsr\tLSP_MusicPlayTickMicro");
+	c += C("lea\tLSPMicroVars(pc),a2");
+	if (flags)
+		c += C("move.w\tm_decodeFlags(a2),d5");
+	c += C("move.w\tm_lastDmacon(a2),d0");
+	if (frame.microPrevDmacon)
+	{
+		c += kBranchShortNotTaken + C("lea\tm_resetv(a2),a3") + C("lea\t16*4(a6),a4") + C("moveq\t#4-1,d1");
+		for (int v = 3; v >= 0; v--)
+		{
+			c += C("lea\t-16(a4),a4") + C("btst\td1,d0");
+			c += (frame.microPrevDmacon & (1 << v)) ? kBranchShortNotTaken + C("move.l\t(a3)+,(a4)") + C("move.w\t(a3)+,4(a4)") : kBranchTaken;
+			c += (v > 0) ? kDbfLoop : kDbfExpired;
+		}
+	}
+	else
+		c += kBranchTaken;
+
+	c += C("lea\tm_streams(a2),a1") + C("moveq\t#4-1,d7") + C("moveq\t#0,d6") + C("lea\tm_resetv(a2),a3") + C("lea\t16*4(a6),a6");
+	for (int v = 0; v < 4; v++)
+	{
+		c += C("lea\t-16(a6),a6") + C("move.l\t(a1),a0") + C("move.b\t(a0)+,d0") + C("move.l\ta0,(a1)+");
+		c += C("add.b\td0,d0");
+		if (frame.wordCmd & (1 << (v + 8)))
+		{
+			c += kBranchShortNotTaken + C("move.l\t4*4*1-4(a1),a0") + C("move.l\ta0,4*4*1-4(a1)");
+			if (flags)
+			{
+				c += C("move.b\t(a0)+,d1") + C("btst\t#0,d5") + C("move.b\td1,$9(a6)");
+				c += (flags & kMicroDeltaVolume) ? kBranchShortNotTaken + C("add.b\t4*4*4-4+3(a1),d1") + C("move.b\td1,4*4*4-4+3(a1)") : kBranchTaken;
+			}
+			else
+				c += C("move.b\t(a0)+,$9(a6)");
+		}
+		else
+			c += kBranchTaken;
+		c += C("add.b\td0,d0");
+		if (frame.wordCmd & (1 << (v + 4)))
+		{
+			c += kBranchShortNotTaken + C("move.l\t4*4*2-4(a1),a0") + C("move.l\ta0,4*4*2-4(a1)");
+			if (flags)
+			{
+				c += C("btst\t#2,d5");
+				if (flags & kMicroPeriodPlanes)
+				{
+					c += kBranchShortNotTaken + C("move.b\t(a0),d1") + C("lsl.w\t#8,d1") + C("move.l\t4*4*6-4(a1),d2");
+					c += C("move.b\t0(a0,d2.l),d1") + C("addq.l\t#1,a0") + C("bra.s\t.perDelta");
+				}
+				else
+					c += kBranchTaken + C("move.w\t(a0)+,d1");
+				c += C("btst\t#1,d5") + C("move.w\td1,$6(a6)");
+				c += (flags & kMicroDeltaPeriod) ? kBranchShortNotTaken + C("add.w\t4*4*5-4+2(a1),d1") + C("move.w\td1,4*4*5-4+2(a1)") : kBranchTaken;
+			}
+			else
+				c += C("move.w\t(a0)+,$6(a6)");
+		}
+		else
+			c += kBranchTaken;
+		c += C("add.b\td0,d0");
+		if (frame.wordCmd & (1 << v))
+		{
+			c += kBranchShortNotTaken + C("move.l\t4*4*3-4(a1),a0") + C("moveq\t#0,d1") + C("move.b\t(a0)+,d1") + C("move.l\ta0,4*4*3-4(a1)");
+			c += C("mulu.w\t#12,d1") + C("move.l\tm_lspInstruments(a2),a0") + C("add.w\td1,a0") + C("bset\td7,d6");
+			c += C("move.l\t(a0)+,(a6)") + C("move.w\t(a0)+,4(a6)") + C("move.l\t(a0)+,(a3)+") + C("move.w\t(a0)+,(a3)+");
+		}
+		else
+			c += kBranchTaken;
+		c += (v < 3) ? kDbfLoop : kDbfExpired;
+	}
+
+	c += C("move.w\td6,$dff096") + C("move.w\td6,m_lastDmacon(a2)") + C("move.l\tm_dmaconPatch(a2),a0") + C("move.b\td6,(a0)");
+	c += C("add.b\td0,d0");
+	if (frame.microLoopCmd)
+	{
+		c += kBranchShortNotTaken + C("lea\tm_streams(a2),a0") + C("lea\tm_loopStreams(a2),a1") + C("add.b\td0,d0");
+		c += (3 == frame.microLoopCmd) ? kBranchShortNotTaken + C("exg\ta0,a1") : kBranchTaken;
+		c += 16 * C("move.l\t(a0)+,(a1)+");
+	}
+	else
+		c += kBranchTaken;
+	c += C("rts");
+
+	cached = c;
+	return c;
+}
+
+// LightSpeedPlayer_cia.asm: main interrupt ( player tick ) and DMACON interrupt
+// keep in sync with LightSpeedPlayer_cia.asm ( checked by CheckPlayerSources )
+int		PlayerCostModel::CiaIrq(bool bpmChange) const
+{
+	int c = kIrqException + C("btst.b\t#0,$bfdd00") + kBranchShortNotTaken + C("movem.l\td0-a6,-(a7)") + C("lea\t$dff0a0,a6");
+	c += C("move.l\t.pMusicBPM(pc),a0") + C("move.w\t(a0),d0") + C("cmp.w\t.curBpm(pc),d0");
+	if (bpmChange)
+	{
+		c += kBranchShortNotTaken + C("lea\t.curBpm(pc),a2") + C("move.w\td0,(a2)") + C("move.l\t.ciaClock(pc),d1");
+		c += C("divu.w\td0,d1") + C("move.b\td1,$bfd400") + C("lsr.w\t#8,d1") + C("move.b\td1,$bfd500");
+	}
+	else
+		c += kBranchTaken;
+	c += C("lea\t.LSP_DmaconIrq(pc),a0") + C("move.l\t.irqVector(pc),a1") + C("move.l\ta0,(a1)") + C("move.b\t#$19,$bfdf00");
+	c += C("movem.l\t(a7)+,d0-a6") + C("move.w\t#$2000,$dff09c") + C("nop") + C("rte");
+
+	c += kIrqException + C("btst.b\t#1,$bfdd00") + kBranchShortNotTaken + C("move.w\t.LSPDmaCon(pc),$dff096");
+	c += C("pea\t(a0)") + C("move.l\t.irqVector(pc),a0") + C("pea\t.LSP_MainIrq(pc)") + C("move.l\t(a7)+,(a0)") + C("move.l\t(a7)+,a0");
+	c += C("move.w\t#$2000,$dff09c") + C("nop") + C("rte");
+	return c;
+}
+
+int		PlayerCostModel::FrameCycles(PlayerVariant variant, const PlayerFrame& frame) const
+{
+	switch (variant)
+	{
+	case kPlayerStandard:		return StandardTick(frame);
+	case kPlayerStandardCia:	return CiaIrq(frame.bpmChange) + StandardTick(frame);
+	case kPlayerInsane:			return InsaneTick(frame);
+	case kPlayerMicro:			return MicroTick(frame);
+	case kPlayerMicroCia:		return CiaIrq(false) + MicroTick(frame);
+	default:					assert(false); return 0;
+	}
+}
+
+//---------------------------------------------------------------------------------------
+// Generated insane player routines
+//---------------------------------------------------------------------------------------
+void	PlayerCostModel::SetInsaneSource(const char* source, int size, int codesCount)
+{
+	m_insaneLines.clear();
+	m_insaneLabels.clear();
+	int start = 0;
+	for (int i = 0; i <= size; i++)
+	{
+		if ((i == size) || ('\n' == source[i]))
+		{
+			std::string line(source + start, i - start);
+			if ((!line.empty()) && ('\r' == line.back()))
+				line.pop_back();
+			if ((!line.empty()) && (' ' != line[0]) && ('\t' != line[0]) && (';' != line[0]))
+			{
+				const size_t end = line.find_first_of(": \t");
+				m_insaneLabels[line.substr(0, end)] = int(m_insaneLines.size());
+			}
+			m_insaneLines.push_back(line);
+			start = i + 1;
+		}
+	}
+	m_insaneExtCount = codesCount / 255;
+	m_insaneRoutines.assign(codesCount, 0);
+}
+
+// routine time from its label to rts, following unconditional branches
+int		PlayerCostModel::RoutineCycles(const std::string& label) const
+{
+	auto it = m_insaneLabels.find(label);
+	if (it == m_insaneLabels.end())
+		return 0;
+
+	int cycles = 0;
+	int line = it->second;
+	for (int guard = 0; (guard < 100000) && (line < int(m_insaneLines.size())); guard++)
+	{
+		const std::string& text = m_insaneLines[line++];
+		const int c = M68kInstructionCycles(text.c_str());
+		if (c < 0)
+			continue;		// label only, data or directive
+		cycles += c;
+
+		// instruction & operand, to follow "bra label" or stop at "rts"
+		size_t p = 0;
+		if ((!text.empty()) && (' ' != text[0]) && ('\t' != text[0]))
+			p = text.find_first_of(" \t");
+		p = text.find_first_not_of(" \t", p);
+		const size_t e = text.find_first_of(" \t", p);
+		const std::string mnemonic = text.substr(p, e - p);
+		if (("rts" == mnemonic) || ("rte" == mnemonic))
+			break;
+		if ((0 == mnemonic.compare(0, 3, "bra")) || ("jmp" == mnemonic))
+		{
+			const size_t o = text.find_first_not_of(" \t", e);
+			const size_t oe = text.find_first_of(" \t;", o);
+			const std::string target = text.substr(o, oe - o);
+			auto t = m_insaneLabels.find(target);
+			if (t == m_insaneLabels.end())
+				break;
+			line = t->second;
+		}
+	}
+	return cycles;
+}
+
+void	PlayerCostModel::SetInsaneRoutine(int cmdCode, const char* label)
+{
+	assert((cmdCode >= 0) && (cmdCode < int(m_insaneRoutines.size())));
+	m_insaneRoutines[cmdCode] = RoutineCycles(label);
+}
+
+void	PlayerCostModel::SetInsaneRoutineCycles(int cmdCode, int cycles)
+{
+	assert((cmdCode >= 0) && (cmdCode < int(m_insaneRoutines.size())));
+	m_insaneRoutines[cmdCode] = cycles;
+}
+
+//---------------------------------------------------------------------------------------
+// Player sources sync check
+//---------------------------------------------------------------------------------------
+// "mnemonic op1,op2" without label, comment & spaces
+static bool	InstructionKey(const char* line, std::string& key, std::string& mnemonic)
+{
+	std::vector<std::string> ops;
+	if (!SplitInstruction(line, mnemonic, ops))
+		return false;
+	key = mnemonic;
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		key += (0 == i) ? " " : ",";
+		for (char c : ops[i])
+			key += char(tolower(c));
+	}
+	return true;
+}
+
+// directives & instructions whose time is not given by their text: branches use the kBranch constants,
+// and the bsr to a player tick is counted by the caller model
+static bool	IsModeledByText(const std::string& mnemonic)
+{
+	const size_t dot = mnemonic.find('.');
+	const std::string base = mnemonic.substr(0, dot);
+	if (IsConditionalBranch(base) || ("bra" == base) || ("bsr" == base) || ("dbf" == base) || ("dbra" == base))
+		return false;
+	static const char* const directives[] = { "if", "ifne", "ifeq", "ifd", "ifnd", "else", "endc", "endif", "rept", "endr", "rsreset", "even", "cnop", "dc", "ds" };
+	for (const char* d : directives)
+	{
+		if (base == d)
+			return false;
+	}
+	return true;
+}
+
+// instruction keys of a routine, from its label to the next global label ( or "rsreset" ). Numeric IF blocks are
+// evaluated, the other ones ( LSP_MICRO_TRANSFORMS ) are both kept because the model covers both versions
+static bool	ReadRoutine(const std::string& source, const char* label, std::set<std::string>& keys)
+{
+	std::vector<int> conditions;		// 0 skipped, 1 assembled, 2 both
+	bool inside = false;
+	size_t start = 0;
+	while (start < source.size())
+	{
+		size_t end = source.find('\n', start);
+		if (std::string::npos == end)
+			end = source.size();
+		std::string line = source.substr(start, end - start);
+		start = end + 1;
+		if ((!line.empty()) && ('\r' == line.back()))
+			line.pop_back();
+
+		if ((!line.empty()) && (' ' != line[0]) && ('\t' != line[0]) && (';' != line[0]) && ('*' != line[0]))
+		{
+			const std::string name = line.substr(0, line.find_first_of(": \t"));
+			if (name == label)
+				inside = true;
+			else if ((inside) && ('.' != name[0]))
+				break;
+		}
+
+		std::string key;
+		std::string mnemonic;
+		if ((!inside) || (!InstructionKey(line.c_str(), key, mnemonic)))
+			continue;
+		if ("rsreset" == mnemonic)
+			break;
+		if (("if" == mnemonic) || ("ifne" == mnemonic) || ("ifeq" == mnemonic) || ("ifd" == mnemonic) || ("ifnd" == mnemonic))
+		{
+			const std::string value = key.substr(mnemonic.size() + 1);
+			int state = 2;
+			if ((!value.empty()) && (isdigit((unsigned char)value[0])) && ('d' != mnemonic[2]))
+				state = ((0 != strtol(value.c_str(), NULL, 0)) != ("ifeq" == mnemonic)) ? 1 : 0;
+			conditions.push_back(state);
+		}
+		else if (("else" == mnemonic) && (!conditions.empty()))
+		{
+			if (2 != conditions.back())
+				conditions.back() ^= 1;
+		}
+		else if ((("endc" == mnemonic) || ("endif" == mnemonic)) && (!conditions.empty()))
+			conditions.pop_back();
+		else if ((IsModeledByText(mnemonic)) && (conditions.end() == std::find(conditions.begin(), conditions.end(), 0)))
+			keys.insert(key);
+	}
+	return inside;
+}
+
+// every instruction of the modeled paths should be in the routine, and every instruction of the routine modeled
+static int	CompareRoutine(const char* fileName, const std::set<std::string>& routine, const std::set<const char*>& used)
+{
+	std::set<std::string> modeled;
+	for (const char* instruction : used)
+	{
+		std::string key;
+		std::string mnemonic;
+		if ((InstructionKey(instruction, key, mnemonic)) && (IsModeledByText(mnemonic)))
+			modeled.insert(key);
+	}
+	int errors = 0;
+	for (const std::string& key : modeled)
+	{
+		if (0 == routine.count(key))
+		{
+			LSPPrintf("ERROR: -cycles model uses \"%s\", not found in %s\n", key.c_str(), fileName);
+			errors++;
+		}
+	}
+	for (const std::string& key : routine)
+	{
+		if (0 == modeled.count(key))
+		{
+			LSPPrintf("ERROR: %s \"%s\" is not in the -cycles model\n", fileName, key.c_str());
+			errors++;
+		}
+	}
+	return errors;
+}
+
+static bool	LoadTextFile(const std::string& fileName, std::string& text)
+{
+	FILE* h = fopen(fileName.c_str(), "rb");
+	if (NULL == h)
+		return false;
+	char buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), h)) > 0)
+		text.append(buffer, n);
+	fclose(h);
+	return true;
+}
+
+int		PlayerCostModel::CheckPlayerSources(const char* directory)
+{
+	static const struct
+	{
+		const char*	fileName;
+		const char*	label;
+	} kRoutines[] =
+	{
+		{ "LightSpeedPlayer.asm", "LSP_MusicPlayTick" },
+		{ "LightSpeedPlayer_Micro.asm", "LSP_MusicPlayTickMicro" },
+		{ "LightSpeedPlayer_cia.asm", ".LSP_MainIrq" },
+	};
+
+	int errors = 0;
+	for (int r = 0; r < 3; r++)
+	{
+		std::string source;
+		std::set<std::string> routine;
+		const std::string fileName = std::string(directory) + "/" + kRoutines[r].fileName;
+		if ((!LoadTextFile(fileName, source)) || (!ReadRoutine(source, kRoutines[r].label, routine)))
+		{
+			LSPPrintf("ERROR: Unable to read %s routine from \"%s\"\n", kRoutines[r].label, fileName.c_str());
+			return -1;
+		}
+
+		// run every path of the model ( micro: plain player, then transforms player with each decode flags )
+		std::set<const char*> used;
+		const int passCount = (1 == r) ? 8 : 2;
+		for (int pass = 0; pass < passCount; pass++)
+		{
+			PlayerCostModel model;
+			model.m_usedInstructions = &used;
+			PlayerFrame frame = {};
+			switch (r)
+			{
+			case 0:
+				for (int w = 0; w < 0x10000; w++)
+				{
+					frame.wordCmd = u16(w);
+					frame.cmdCode = (0 == w) ? 0 : 1 + pass * 600;
+					model.StandardTick(frame);
+				}
+				frame.escCount = 3;
+				frame.escKinds[0] = kEscRewind;		frame.escCodes[0] = 255;
+				frame.escKinds[1] = kEscSetBpm;		frame.escCodes[1] = 256;
+				frame.escKinds[2] = kEscGetPos;		frame.escCodes[2] = 257;
+				model.StandardTick(frame);
+				break;
+			case 1:
+				model.SetMicroDecodeFlags(pass);
+				for (int w = 0; w < 0x1000; w++)
+				{
+					for (int k = 0; k < 6; k++)
+					{
+						frame.wordCmd = u16(w);
+						frame.microPrevDmacon = (k & 1) ? 15 : 0;
+						frame.microLoopCmd = (k >> 1) ? 1 + (k >> 1) : 0;
+						model.MicroTick(frame);
+					}
+				}
+				break;
+			default:
+				model.CiaIrq(0 != pass);
+				break;
+			}
+		}
+		errors += CompareRoutine(kRoutines[r].fileName, routine, used);
+	}
+	return errors;
+}
+
+//---------------------------------------------------------------------------------------
+// Report
+//---------------------------------------------------------------------------------------
+static double	ToScanlines(double cycles)
+{
+	return cycles / double(kCyclesPerScanline);
+}
+
+void	PrintPlayerCostReport(PlayerVariant variant, const std::vector<int>& frameCycles, const FrameDescFunc& describe)
+{
+	const int frameCount = int(frameCycles.size());
+	if (0 == frameCount)
+		return;
+
+	double sum = 0.0;
+	int peak = 0;
+	for (int c : frameCycles)
+	{
+		sum += double(c);
+		peak = std::max(peak, c);
+	}
+	const double average = sum / double(frameCount);
+
+	LSPPrintf("Player CPU time, %s:\n", PlayerCostModel::GetVariantName(variant));
+	LSPPrintf("  Average.......: %d cycles (%.2f scanline)\n", int(average + 0.5), ToScanlines(average));
+	LSPPrintf("  Peak..........: %d cycles (%.2f scanline)\n", peak, ToScanlines(peak));
+
+	// histogram, half scanline steps
+	const int kStep = kCyclesPerScanline / 2;
+	const int bucketCount = peak / kStep + 1;
+	std::vector<int> buckets(bucketCount, 0);
+	for (int c : frameCycles)
+		buckets[c / kStep]++;
+	int maxBucket = 0;
+	for (int n : buckets)
+		maxBucket = std::max(maxBucket, n);
+	LSPPrintf("  Histogram (scanlines):\n");
+	for (int b = 0; b < bucketCount; b++)
+	{
+		char bar[41];
+		const int len = (buckets[b] * 40 + maxBucket - 1) / maxBucket;
+		memset(bar, '#', len);
+		bar[len] = 0;
+		LSPPrintf("    %4.1f-%4.1f : %6d (%5.1f%%) %s\n", b * 0.5, (b + 1) * 0.5, buckets[b], (buckets[b] * 100.0) / frameCount, bar);
+	}
+
+	// worst frames, first ones when equal
+	std::vector<int> order(frameCount);
+	for (int i = 0; i < frameCount; i++)
+		order[i] = i;
+	const int worstCount = std::min(5, frameCount);
+	std::partial_sort(order.begin(), order.begin() + worstCount, order.end(), [&](int a, int b)
+	{
+		return (frameCycles[a] != frameCycles[b]) ? (frameCycles[a] > frameCycles[b]) : (a < b);
+	});
+	LSPPrintf("  Worst frames:\n");
+	for (int i = 0; i < worstCount; i++)
+	{
+		char desc[128];
+		describe(order[i], desc, sizeof(desc));
+		LSPPrintf("    frame %6d %s : %d cycles (%.2f scanline)\n", order[i], desc, frameCycles[order[i]], ToScanlines(frameCycles[order[i]]));
+	}
+}
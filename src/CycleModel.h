@@ -0,0 +1,120 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Static 68000 cycle cost model of the LSP replay routines ( -cycles command line option )
+// Plain MC68000 timings without any wait state: chip RAM DMA contention & CIA E-clock sync are not modeled.
+// Player paths are written with their .asm instruction text, and the generated insane routines are parsed.
+
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <functional>
+#include "LSPTypes.h"
+
+static	const	int		kCyclesPerScanline = 454;		// PAL 7.09MHz 68000, 64us per line
+
+static	const	int		kBranchTaken = 10;			// Bcc.s & Bcc.w
+static	const	int		kBranchShortNotTaken = 8;
+static	const	int		kBranchWordNotTaken = 12;
+static	const	int		kDbfLoop = 10;
+static	const	int		kDbfExpired = 14;
+
+// cycles of one 68000 instruction ( ex: "move.w (a0)+,$a6-$a0(a6)" ), "label:" & comment are skipped
+// Conditional branches & dbf return the "not taken" time. Returns -1 if not supported
+int		M68kInstructionCycles(const char* line);
+
+// instruction sizes come from the assembler: M68kAssembler::InstructionBytes
+
+enum PlayerVariant
+{
+	kPlayerStandard,			// LightSpeedPlayer.asm
+	kPlayerStandardCia,			// LightSpeedPlayer.asm called from LightSpeedPlayer_cia.asm interrupts
+	kPlayerInsane,				// generated -insane player
+	kPlayerMicro,				// LightSpeedPlayer_Micro.asm
+	kPlayerMicroCia,			// LightSpeedPlayer_Micro.asm called from LightSpeedPlayer_cia.asm interrupts
+	kPlayerVariantCount
+};
+
+enum EscKind
+{
+	kEscRewind,
+	kEscGetPos,
+	kEscSetBpm,
+};
+
+// what a player tick reads from the music data for one frame
+struct PlayerFrame
+{
+	u16		wordCmd;
+	int		cmdCode;					// index in the cmd code table
+	int		escCount;					// ESC codes processed before the frame cmd
+	EscKind	escKinds[3];
+	int		escCodes[3];
+	bool	bpmChange;					// music BPM variable changed ( CIA timer update )
+	int		microPrevDmacon;			// micro: voices started by the previous tick ( reset by this tick )
+	int		microLoopCmd;				// micro: 0 none, 2 backup loop point, 3 restore loop point
+};
+
+class PlayerCostModel
+{
+public:
+	PlayerCostModel();
+
+	// generated insane player: routine of each cmd code is found by its label ( ".r_xxx" )
+	void	SetInsaneSource(const char* source, int size, int codesCount);
+	void	SetInsaneRoutine(int cmdCode, const char* label);
+	// -insane-budget: cmd codes going through the generic decoder, whose time depends on the cmd word
+	void	SetInsaneRoutineCycles(int cmdCode, int cycles);
+
+	// micro player assembled with LSP_MICRO_TRANSFORMS=1 to play "-optstreams" 'LSPt' scores ( 0: plain player )
+	void	SetMicroDecodeFlags(int flags) { m_microDecodeFlags = flags; }
+
+	int		FrameCycles(PlayerVariant variant, const PlayerFrame& frame) const;
+
+	// cmd code read only: byte codes ( LightSpeedPlayer.asm ) or -huffman prefix codes
+	int		ByteCodeReadCycles(int code) const { return StandardCode(code); }
+	int		PrefixCodeReadCycles(int bits, int& bufferedBits) const;
+	static	const	int	kPrefixDecodeTablesSize = 256 * 4 + 8 * 8;
+
+	static const char*	GetVariantName(PlayerVariant variant);
+
+	// checks the modeled paths against the player routines of LightSpeedPlayer.asm, LightSpeedPlayer_Micro.asm and
+	// LightSpeedPlayer_cia.asm found in directory. Prints & returns the mismatch count ( -1 if a file is missing )
+	static	int		CheckPlayerSources(const char* directory);
+
+private:
+	int		C(const char* instruction) const;
+	int		StandardCode(int code) const;
+	int		StandardTick(const PlayerFrame& frame) const;
+	int		StandardCmdExec(u16 wordCmd) const;
+	int		InsaneTick(const PlayerFrame& frame) const;
+	int		InsaneDispatch(int code) const;
+	int		MicroTick(const PlayerFrame& frame) const;
+	int		CiaIrq(bool bpmChange) const;
+	int		RoutineCycles(const std::string& label) const;
+
+	std::vector<std::string>	m_insaneLines;
+	std::unordered_map<std::string, int>	m_insaneLabels;		// label -> line index
+	std::vector<int>			m_insaneRoutines;		// cycles per cmd code
+	int							m_insaneExtCount;		// extended jump table levels ( codes count / 255 )
+	int							m_microDecodeFlags;
+	std::set<const char*>*		m_usedInstructions;		// CheckPlayerSources: instruction texts of the run paths
+
+	// most frames share the same cmd, so paths are cached
+	mutable std::unordered_map<const char*, int>	m_instructionCache;
+	mutable std::vector<int>	m_standardCmdExec;		// per word cmd, -1 if not computed yet
+	mutable std::vector<int>	m_microTick;			// per word cmd, previous dmacon & loop cmd
+};
+
+// describe a frame in the worst frames list ( song position, pattern & row )
+typedef std::function<void(int frame, char* desc, int descSize)>	FrameDescFunc;
+
+void	PrintPlayerCostReport(PlayerVariant variant, const std::vector<int>& frameCycles, const FrameDescFunc& describe);
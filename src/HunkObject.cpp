@@ -0,0 +1,94 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Insane player as Amiga hunk object or raw binary ( -insaneobj & -insanebin command line options )
+
+#include <string.h>
+#include <string>
+#include "HunkObject.h"
+#include "M68kAssembler.h"
+#include "external/Shrinkler/doshunks.h"
+
+static const char* const	kUnitName = "LSP_Insane";
+
+static const char* const	sJumpTable =
+	"\t\tbra.w\tLSP_MusicInitInsane\n"
+	"\t\tbra.w\tLSP_MusicPlayTickInsane\n"
+	"\t\tbra.w\tLSP_MusicGetPos\n";
+
+// hunk names are longword counted & zero padded
+static void	AddHunkName(MemoryStream& out, const char* name, u32 type)
+{
+	const int len = int(strlen(name));
+	const int longs = (len + 3) / 4;
+	out.Add32((type << 24) | u32(longs));
+	out.AddBuffer(name, len);
+	for (int i = len; i < longs * 4; i++)
+		out.Add8(0);
+}
+
+bool	BuildInsaneHunkObject(const MemoryStream& source, MemoryStream& out)
+{
+	M68kAssembler assembler;
+	if (!assembler.Assemble((const char*)source.GetRawBuffer(), source.GetSize()))
+		return false;
+
+	const std::vector<u8>& code = assembler.GetCode();
+	const int codeLongs = (int(code.size()) + 3) / 4;
+
+	out.Add32(HUNK_UNIT);
+	AddHunkName(out, kUnitName, 0);
+
+	out.Add32(HUNK_CODE);
+	out.Add32(codeLongs);
+	out.AddBuffer(code.data(), int(code.size()));
+	for (int i = int(code.size()); i < codeLongs * 4; i++)
+		out.Add8(0);
+
+	const std::vector<int>& relocs = assembler.GetRelocs();
+	if (!relocs.empty())
+	{
+		out.Add32(HUNK_RELOC32);
+		out.Add32(u32(relocs.size()));
+		out.Add32(0);						// relocated against the code hunk itself
+		for (int offset : relocs)
+			out.Add32(offset);
+		out.Add32(0);
+	}
+
+	out.Add32(HUNK_EXT);
+	for (const AsmSymbol& symbol : assembler.GetGlobalSymbols())
+	{
+		AddHunkName(out, symbol.name.c_str(), EXT_DEF);
+		out.Add32(symbol.offset);
+	}
+	out.Add32(0);
+
+	out.Add32(HUNK_END);
+	return true;
+}
+
+bool	BuildInsaneRawBinary(const MemoryStream& source, MemoryStream& out)
+{
+	std::string text(sJumpTable);
+	text.append((const char*)source.GetRawBuffer(), source.GetSize());
+
+	M68kAssembler assembler;
+	if (!assembler.Assemble(text.c_str(), int(text.size())))
+		return false;
+
+	const std::vector<u8>& code = assembler.GetCode();
+	out.AddBuffer(code.data(), int(code.size()));
+	if (code.size() & 1)
+		out.Add8(0);
+	for (int offset : assembler.GetRelocs())
+		out.Add32(offset);
+	out.Add32(0);
+	return true;
+}
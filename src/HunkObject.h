@@ -0,0 +1,20 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Insane player as Amiga hunk object or raw binary ( -insaneobj & -insanebin command line options )
+
+#pragma once
+#include "MemoryStream.h"
+
+// linkable object: one code hunk ( any memory ), all global labels of the source exported
+bool	BuildInsaneHunkObject(const MemoryStream& source, MemoryStream& out);
+
+// raw binary: bra.w jump table ( +0 LSP_MusicInitInsane, +4 LSP_MusicPlayTickInsane, +8 LSP_MusicGetPos ), code,
+// then the 32bits code offsets to relocate ( add the binary address ), 0 terminated
+bool	BuildInsaneRawBinary(const MemoryStream& source, MemoryStream& out);
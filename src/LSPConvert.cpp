@@ -10,9 +10,12 @@
 #include <stdlib.h>
 #include "LSPEncoder.h"
 #include "LSPDecoder.h"
+#include "BatchConvert.h"
+#include "ConversionCache.h"
 #include "external/micromod/micromod.h"
-
-LSPEncoder gLSPEncoder;
+#ifdef MACOS_LINUX
+#include "WindowsCompat.h"
+#endif
 
 bool	ConvertParams::ParseArgs(int argc, char* argv[])
 {
@@ -29,6 +32,14 @@ bool	ConvertParams::ParseArgs(int argc, char* argv[])
 			{
 				m_generateInsane = true;
 			}
+			else if (0 == strcmp(argv[argId], "-insaneobj"))
+			{
+				m_insaneObject = true;
+			}
+			else if (0 == strcmp(argv[argId], "-insanebin"))
+			{
+				m_insaneBinary = true;
+			}
 			else if (0 == strcmp(argv[argId], "-setpos"))
 			{
 				m_seqSetPosSupport = true;
@@ -41,6 +52,14 @@ bool	ConvertParams::ParseArgs(int argc, char* argv[])
 			{
 				m_shrink = true;
 			}
+			else if (0 == strcmp(argv[argId], "-sharesamples"))
+			{
+				m_shareSamples = true;
+			}
+			else if (0 == strcmp(argv[argId], "-optbank"))
+			{
+				m_optBank = true;
+			}
 			else if (0 == strcmp(argv[argId], "-nosampleoptim"))
 			{
 				m_keepModSoundBankLayout = true;
@@ -72,6 +91,26 @@ bool	ConvertParams::ParseArgs(int argc, char* argv[])
 			{
 				m_packEstimate = true;
 			}
+			else if (0 == strcmp(argv[argId], "-timings"))
+			{
+				m_timings = true;
+			}
+			else if (0 == strcmp(argv[argId], "-cycles"))
+			{
+				m_cycles = true;
+			}
+			else if (0 == strcmp(argv[argId], "-optcodes"))
+			{
+				m_optCodes = true;
+			}
+			else if (0 == strcmp(argv[argId], "-huffman"))
+			{
+				m_huffman = true;
+			}
+			else if (0 == strcmp(argv[argId], "-optstreams"))
+			{
+				m_optStreams = true;
+			}
 			else if (0 == strcmp(argv[argId], "-micro"))
 			{
 				m_lspMicro = true;
@@ -109,6 +148,46 @@ bool	ConvertParams::ParseArgs(int argc, char* argv[])
 				strncpy_s(m_sAmigaWavFilename, argv[argId + 1], _MAX_PATH);
 				argId++;
 			}
+			else if ((0 == strcmp(argv[argId], "-batch")) && (argId < argc-1))
+			{
+				m_batchSource = argv[argId + 1];
+				argId++;
+			}
+			else if ((0 == strcmp(argv[argId], "-threads")) && (argId < argc-1))
+			{
+				m_threadCount = atoi(argv[argId + 1]);
+				if (m_threadCount < 1)
+				{
+					printf("ERROR: Invalid -threads count (%s)\n", argv[argId + 1]);
+					return false;
+				}
+				argId++;
+			}
+			else if ((0 == strcmp(argv[argId], "-cache")) && (argId < argc-1))
+			{
+				m_cacheDir = argv[argId + 1];
+				argId++;
+			}
+			else if ((0 == strcmp(argv[argId], "-autolossless")) && (argId < argc-1))
+			{
+				m_autoLosslessDb = float(atof(argv[argId + 1]));
+				if (m_autoLosslessDb <= 0.f)
+				{
+					printf("ERROR: Invalid -autolossless SNR threshold (%s dB)\n", argv[argId + 1]);
+					return false;
+				}
+				argId++;
+			}
+			else if ((0 == strcmp(argv[argId], "-insane-budget")) && (argId < argc-1))
+			{
+				m_insaneBudget = atoi(argv[argId + 1]);
+				if (m_insaneBudget <= 0)
+				{
+					printf("ERROR: Invalid -insane-budget code size (%s bytes)\n", argv[argId + 1]);
+					return false;
+				}
+				argId++;
+			}
 			else if ((0 == strcmp(argv[argId], "-lossless")) && (argId < argc-1))
 			{
 				const int instrument = atoi(argv[argId + 1]);
@@ -141,19 +220,22 @@ bool	ConvertParams::ParseArgs(int argc, char* argv[])
 		argId++;
 	}
 
-	if (1 == nameCount)
+	if (m_batchSource)
 	{
-		if ( 0 == m_sBankFilename[0] )
-			SetNameWithExtension(m_modFilename, m_sBankFilename, ".lsbank", NULL);
-		if ( 0 == m_sScoreFilename[0] )
-			SetNameWithExtension(m_modFilename, m_sScoreFilename, ".lsmusic", m_lspMicro ? "_micro" : nullptr);
-		if ( 0 == m_sPlayerFilename[0] )
-			SetNameWithExtension(m_modFilename, m_sPlayerFilename, ".asm", "_insane");
-		if ( 0 == m_sAmigaWavFilename[0] )
-			SetNameWithExtension(m_modFilename, m_sAmigaWavFilename, ".wav", "_amiga");
-		#if D_MICROMOD_DEBUG
-		SetNameWithExtension(m_modFilename, m_sWavFilename, ".wav", NULL);
-		#endif
+		if (nameCount > 0)
+		{
+			printf("ERROR: -batch mode does not take a MOD file name (\"%s\")\n", m_modFilename);
+		}
+		else if (m_sBankFilename[0] || m_sScoreFilename[0] || m_sPlayerFilename[0] || m_sAmigaWavFilename[0])
+		{
+			printf("ERROR: -lsbank, -lsmusic, -insanefile and -wav options can't be used in -batch mode\n");
+		}
+		else
+			ret = true;
+	}
+	else if (1 == nameCount)
+	{
+		SetDefaultFilenames();
 		ret = true;
 	}
 
@@ -165,6 +247,16 @@ bool	ConvertParams::ParseArgs(int argc, char* argv[])
 			printf("ERROR: Insane player doesn't support -micro\n");
 			ret = false;
 		}
+		if ((m_insaneObject || m_insaneBinary) && !m_generateInsane)
+		{
+			printf("ERROR: -insaneobj and -insanebin need -insane option\n");
+			ret = false;
+		}
+		if ((m_insaneBudget > 0) && !m_generateInsane)
+		{
+			printf("ERROR: -insane-budget needs -insane option\n");
+			ret = false;
+		}
 		if (m_seqSetPosSupport || m_seqGetPosSupport)
 		{
 			if (m_lspMicro)
@@ -184,17 +276,47 @@ bool	ConvertParams::ParseArgs(int argc, char* argv[])
 			ret = false;
 		}
 
+		if (m_shareSamples && (m_keepModSoundBankLayout || m_adpcm))
+		{
+			printf("ERROR: -sharesamples is not compatible with -nosampleoptim or -adpcm options\n");
+			ret = false;
+		}
+
+		if (m_optBank && m_keepModSoundBankLayout)
+		{
+			printf("ERROR: -optbank is not compatible with -nosampleoptim option\n");
+			ret = false;
+		}
+
 		if (m_keepModSoundBankLayout && m_adpcm)
 		{
 			printf("ERROR: -adpcm is not compatible with -nosampleoptim option\n");
 			ret = false;
 		}
 
+		if ((m_autoLosslessDb > 0.f) && !m_adpcm)
+		{
+			printf("ERROR: -autolossless needs -adpcm option\n");
+			ret = false;
+		}
+
 		if (m_adpcm && m_lspMicro)
 		{
 			printf("ERROR: -adpcm is not compatible with -micro mode\n");
 			ret = false;
 		}
+
+		if (m_huffman && (m_lspMicro || m_generateInsane || m_seqSetPosSupport))
+		{
+			printf("ERROR: -huffman is not compatible with -micro, -insane or -setpos options\n");
+			ret = false;
+		}
+
+		if (m_optStreams && !m_lspMicro)
+		{
+			printf("ERROR: -optstreams needs -micro mode\n");
+			ret = false;
+		}
 	}
 
 	if ( !ret )
@@ -203,29 +325,65 @@ bool	ConvertParams::ParseArgs(int argc, char* argv[])
 	return ret;
 }
 
+void	ConvertParams::SetDefaultFilenames()
+{
+	if ( 0 == m_sBankFilename[0] )
+		SetNameWithExtension(m_modFilename, m_sBankFilename, ".lsbank", NULL);
+	if ( 0 == m_sScoreFilename[0] )
+		SetNameWithExtension(m_modFilename, m_sScoreFilename, ".lsmusic", m_lspMicro ? "_micro" : nullptr);
+	if ( 0 == m_sPlayerFilename[0] )
+		SetNameWithExtension(m_modFilename, m_sPlayerFilename, ".asm", "_insane");
+	if ( 0 == m_sPlayerObjectFilename[0] )
+		SetNameWithExtension(m_sPlayerFilename, m_sPlayerObjectFilename, ".o", NULL);
+	if ( 0 == m_sPlayerBinaryFilename[0] )
+		SetNameWithExtension(m_sPlayerFilename, m_sPlayerBinaryFilename, ".bin", NULL);
+	if ( 0 == m_sAmigaWavFilename[0] )
+		SetNameWithExtension(m_modFilename, m_sAmigaWavFilename, ".wav", "_amiga");
+	if ( 0 == m_sTimingsFilename[0] )
+		SetNameWithExtension(m_modFilename, m_sTimingsFilename, ".json", "_timings");
+	#if D_MICROMOD_DEBUG
+	SetNameWithExtension(m_modFilename, m_sWavFilename, ".wav", NULL);
+	#endif
+}
+
 void	Help()
 {
 	printf(	"Usage:\n");
 	printf("\tLSPConvert <mod file> [-options]\n"
+		"\tLSPConvert -batch <directory|manifest file> [-threads <n>] [-options]\n"
 		"\noptions:\n"
 		"\t-micro : Produce larger but highly compressible .lsmusic file (need micro replayer)\n"
 		"\t-adpcm : Produce highly compressible (greater than x2) .lsbank file (using ADPCM encoding)\n"
 		"\t-lossless <x> : In case of -adpcm mode, do not ADPCM pack specific MOD instrument number x\n"
+		"\t-autolossless <dB> : In case of -adpcm mode, do not ADPCM pack instruments with a lower SNR (per instrument report)\n"
 	 	"\t-insane : Generate insane mode fast replayer source code\n"
+		"\t-insaneobj : Also assemble the insane replayer into an Amiga hunk object (.o, no assembler needed)\n"
+		"\t-insanebin : Also assemble the insane replayer into a relocatable raw binary (.bin)\n"
+		"\t-insane-budget <bytes> : Limit insane routines code size, rare cmds use a generic decoder\n"
 		"\t-getpos : Enable LSP_MusicGetPos function use\n"
 		"\t-setpos : Enable LSP_MusicSetPos function use\n"
 		"\t-shrink: shrink any non used sample data if possible\n"
+		"\t-sharesamples : store identical or overlapping samples data only once in the sound bank\n"
+		"\t-optbank : order samples in the sound bank to pack better (same .lsbank size unpacked)\n"
 		"\t-nosampleoptim : preserve original .MOD soundbank layout (nice for AmigaKlang)\n"
 		"\t-amigapreview : generate a wav from LSP data (output simulated LSP Amiga player)\n"
 		"\t-mono : generate MONO wav with -amigapreview option\n"
 		"\t-looppreview : generate longer wav preview if you want to test MOD looping\n"
-		"\t-pack : display Amiga Schrinkler packing estimation size (.lsmusic file only)\n"
+		"\t-pack : display Amiga Schrinkler packing estimation size (.lsmusic file only, each stream too with -v)\n"
+		"\t-optcodes : reorder cmd codes to pack better (same .lsmusic size unpacked)\n"
+		"\t-huffman : store cmd codes as prefix codes (smaller .lsmusic, slower decode, no 68k player yet)\n"
+		"\t-optstreams : search the best packing streams order & transforms in -micro mode\n"
+		"\t-timings : save per conversion phase timings & memory usage in a JSON file\n"
+		"\t-cycles : estimate the 68000 player CPU time of each frame (average, peak, histogram & worst frames)\n"
 		"\t-fixed50hz : Makes 50hz player compatible even with other BPM than 125! (no CIA required)\n"
 		"\t-nosettempo : remove $Fxx>$20 SetTempo support (for very old .mods compatiblity)\n"
 		"\t-lsbank <filename> : Set a specific name for .lsbank file\n"
 		"\t-lsmusic <filename> : Set a specific name for .lsmusic file\n"
 		"\t-wav <filename> : Set a specific name for -amigapreview WAV file\n"
 		"\t-insanefile <filename> : Set a specific name for -insane mode generated source code\n"
+		"\t-batch <dir|file> : Convert all .mod of a directory, or all files listed in a manifest (one per line)\n"
+		"\t-threads <n> : Number of threads (-batch modules, or parallel steps of one conversion: ADPCM, -pack -v, -optstreams, -optbank...) (default: all cores)\n"
+		"\t-cache <dir> : Reuse previous conversion results stored in <dir> (skip unchanged modules)\n"
 		"\t-v : verbose\n"
 	   );
 }
@@ -233,13 +391,19 @@ void	Help()
 int	Process(int argc, char* argv[])
 {
 	int ret = -1;
-	
-	if (gLSPEncoder.ParseArgs(argc, argv))
+	ConvertParams params;
+
+	if (params.ParseArgs(argc, argv))
 	{
-		if (gLSPEncoder.LoadModule())
+		if (params.m_batchSource)
+		{
+			ret = BatchProcess(params);
+		}
+		else
 		{
-			gLSPEncoder.ExportToLSP();
-			ret = 0;
+			ConvertSummary summary;
+			if (ConvertModule(params, &summary))
+				ret = 0;
 		}
 	}
 	else
@@ -20,6 +20,7 @@
 #include "WavWriter.h"
 #include "Paula.h"
 #include "adpcm.h"
+#include "Log.h"
 
 
 BinaryParser::BinaryParser()
@@ -123,10 +124,24 @@ void	BinaryParser::seek(int pos)
 
 LSPDecoder::LSPDecoder()
 {
+	m_halfInstruments = NULL;
+	m_codes = NULL;
+	m_huffman = false;
+	m_renderedFrameCount = 0;
+	m_renderedSampleCount = 0;
+}
+
+LSPDecoder::~LSPDecoder()
+{
+	free(m_halfInstruments);
+	free(m_codes);
 }
 
 u16	LSPDecoder::ReadNextCmd(BinaryParser& parser)
 {
+	if (m_huffman)
+		return ReadNextPrefixCmd(parser);
+
 	int idx = 0;
 	for (;;)
 	{
@@ -140,6 +155,51 @@ u16	LSPDecoder::ReadNextCmd(BinaryParser& parser)
 	return m_codes[idx];
 }
 
+u16	LSPDecoder::ReadNextPrefixCmd(BinaryParser& bitStream)
+{
+	while (m_bitCount <= 16)
+	{
+		const u32 w = (bitStream.GetPos() + 2 <= bitStream.GetLen()) ? bitStream.ru16() : 0;
+		m_bitBuffer |= w << (16 - m_bitCount);
+		m_bitCount += 16;
+	}
+
+	const int top = m_bitBuffer >> 24;
+	int len = m_lutBits[top];
+	int rank = m_lutRank[top];
+	if (0 == len)
+	{
+		// code longer than 8 bits
+		for (len = 9; ; len++)
+		{
+			assert(len <= 16);
+			const u32 code = m_bitBuffer >> (32 - len);
+			if (code - m_firstCode[len] < u32(m_lengthCount[len]))
+			{
+				rank = m_firstRank[len] + int(code - m_firstCode[len]);
+				break;
+			}
+		}
+	}
+	m_bitBuffer <<= len;
+	m_bitCount -= len;
+	assert(rank < m_codesCount);
+	return m_codes[rank];
+}
+
+void	LSPDecoder::SeekBitStream(BinaryParser& bitStream, int bitPos)
+{
+	bitStream.seek((bitPos >> 4) * 2);
+	m_bitBuffer = 0;
+	m_bitCount = 0;
+	const int skip = bitPos & 15;
+	if (skip)
+	{
+		m_bitBuffer = u32(bitStream.ru16()) << (16 + skip);
+		m_bitCount = 16 - skip;
+	}
+}
+
 static const int	BpmToSampleCount(int bpm)
 {
 	return (HOST_REPLAY_RATE * 5) / (bpm * 2);
@@ -158,386 +218,499 @@ static void StereoToMono(int16_t* buffer, int len)
 
 bool	LSPDecoder::LoadAndRender(const char* sMusicName, const char* sBankName, const char* sOutputWavFile, bool verbose, bool loopPreview, bool mono)
 {
+	BinaryParser musicFile;
+	BinaryParser bankFile;
 
+	LSPPrintf("Reading back LSP files:\n"
+		"  Score: \"%s\"\n"
+		"  Bank.: \"%s\"\n",
+		sMusicName, sBankName);
+
+	if (!musicFile.LoadFromFile(sMusicName))
+	{
+		LSPPrintf("ERROR: Unable to load \"%s\"\n", sMusicName);
+		return false;
+	}
+	if (!bankFile.LoadFromFile(sBankName))
+	{
+		LSPPrintf("ERROR: Unable to load \"%s\"\n", sBankName);
+		return false;
+	}
+	return Render(musicFile, bankFile, sOutputWavFile, verbose, loopPreview, mono);
+}
+
+bool	LSPDecoder::RenderFromMemory(const void* music, int musicSize, const void* bank, int bankSize, const char* sOutputWavFile, bool verbose, bool loopPreview, bool mono)
+{
+	// private copies: ADPCM bank is depacked in place
 	BinaryParser musicFile;
 	BinaryParser bankFile;
+	musicFile.LoadFromMemory(music, musicSize);
+	bankFile.LoadFromMemory(bank, bankSize);
+	return Render(musicFile, bankFile, sOutputWavFile, verbose, loopPreview, mono);
+}
 
+bool	LSPDecoder::Render(BinaryParser& musicFile, BinaryParser& bankFile, const char* sOutputWavFile, bool verbose, bool loopPreview, bool mono)
+{
+	// no WAV file if sOutputWavFile is NULL ( benchmark )
 	WavWriter paulaOutput;
-	printf("Generating WAV file \"%s\"...\n", sOutputWavFile);
-	paulaOutput.Open(sOutputWavFile, HOST_REPLAY_RATE, mono ? 1 : 2);
+	if (sOutputWavFile)
+	{
+		LSPPrintf("Generating WAV file \"%s\"...\n", sOutputWavFile);
+		paulaOutput.Open(sOutputWavFile, HOST_REPLAY_RATE, mono ? 1 : 2);
+	}
 
 	Paula paulaChip(HOST_REPLAY_RATE);
 
-	printf("Reading back LSP files:\n"
-		"  Score: \"%s\"\n"
-		"  Bank.: \"%s\"\n",
-		sMusicName, sBankName);
-
 	bool ret = false;
-	if (musicFile.LoadFromFile(sMusicName))
+	paulaChip.UploadChipMemoryBank(bankFile.GetBuffer(), bankFile.GetLen(), 0);		// upload at ad 0
+
+	u32 sign = musicFile.ru32();
+
+	if ((sign != 'LSP1') && (sign != 'LSPm') && (sign != 'LSPt'))
+	{
+		LSPPrintf("ERROR: not a valid LSP music file\n");
+		return false;
+	}
+
+	const bool microMode = (sign == 'LSPm') || (sign == 'LSPt');
+
+	u32 bnkMagic = bankFile.ru32();
+	u32 magic = bnkMagic;
+	if ( !microMode )
+		magic = musicFile.ru32();
+
+	if (magic == bnkMagic)
 	{
-		u32 lsMusicMaxSize = musicFile.GetLen();
-		if (bankFile.LoadFromFile(sBankName))
+
+		u16 version = musicFile.ru16();		// major/minor version
+		LSPPrintf("Version: $%04x\n", version);
+
+		u16 flags = 0;
+		u16 bpm = 125;
+		int microFlags = 0;
+		if (sign == 'LSPt')
+		{
+			microFlags = musicFile.ru16();		// -optstreams decode flags
+			LSPPrintf("Micro decode flags: $%x\n", microFlags);
+		}
+		if (!microMode)
 		{
+			flags = musicFile.ru16();		// skip relocating flag
+			bpm = musicFile.ru16();
+			m_escCodeRewind = musicFile.ru16();
+			m_escCodeSetBpm = musicFile.ru16();
+			m_escCodeGetPos = musicFile.ru16();
+		}
+		else
+			bpm = musicFile.ru16();
 
-			paulaChip.UploadChipMemoryBank(bankFile.GetBuffer(), bankFile.GetLen(), 0);		// upload at ad 0
+		LSPPrintf("Main BPM: %d\n", bpm);
+
+		int frameSampleCount = BpmToSampleCount(bpm);
+		m_frameCount = 0;
 
-			u32 sign = musicFile.ru32();
+		if (!microMode)
+			m_frameCount = musicFile.ru32();
 
-			if ((sign != 'LSP1') && (sign != 'LSPm'))
+		// depack ADPCM
+		if (flags & (1 << 2))
+		{
+			int8_t* pw = (int8_t*)bankFile.GetWriteBuffer();
+			pw += 4;		// skip lsbank signature
+			uint32_t inplaceOffset = musicFile.ru32();
+			const uint8_t* pr = (const uint8_t*)pw + inplaceOffset;
+			uint32_t losslessMask = musicFile.ru32();
+			for (;;)
 			{
-				printf("ERROR: not a valid LSP music file\n");
-				return false;
+				int len = musicFile.ru16();
+				if (0 == len)
+					break;
+				len += 1;		// stored len, in ADPCM bytes, -1 to please DBF instruction
+				int table = 0;
+				if (flags & (1 << 4))
+					table = musicFile.ru16() / 16;		// step table offset
+				if (losslessMask&(1 << 31))
+				{
+					memmove(pw, pr, len * 2);
+					pr += len * 2;
+				}
+				else
+				{
+					dpcmDecode(pr, len, pw, dpcmGetTable(table));
+					pr += len;
+				}
+				pw += len * 2;
+				losslessMask <<= 1;
 			}
+			paulaChip.UploadChipMemoryBank(bankFile.GetBuffer(), bankFile.GetLen(), 0);		// upload at ad 0
+		}
 
-			const bool microMode = (sign == 'LSPm');
-
-			u32 bnkMagic = bankFile.ru32();
-			u32 magic = bnkMagic;
-			if ( !microMode )
-				magic = musicFile.ru32();
-
-			if (magic == bnkMagic)
+		m_instrumentCount = musicFile.ru16();
+		LSPPrintf("LSP Instruments: %d\n", m_instrumentCount);
+		m_halfInstruments = (LSPHalfInstrument*)malloc((m_instrumentCount * 2) * sizeof(LSPHalfInstrument));	// *2 because half instrument (just pos/len) ( +1 because last half could be read by player)
+		for (int i = 0; i < m_instrumentCount; i++)
+		{
+			m_halfInstruments[i*2].pos = musicFile.ru32();
+			m_halfInstruments[i*2].len = musicFile.ru16();
+			m_halfInstruments[i*2+1].pos = musicFile.ru32();
+			m_halfInstruments[i*2+1].len = musicFile.ru16();
+			if (verbose)
 			{
+				LSPPrintf("LSP instrument #%3d : %08x|%04x|%08x|%04x\n", i, m_halfInstruments[i*2].pos,
+					m_halfInstruments[i*2].len,
+					m_halfInstruments[i*2+1].pos,
+					m_halfInstruments[i*2+1].len);
+			}
+		}
 
-				u16 version = musicFile.ru16();		// major/minor version
-				printf("Version: $%04x\n", version);
+		int streamsOffsets[16] = {};
+		int streamsLoopOffsets[16];
+		int periodPlanes[4] = {};
+		u16 deltaValues[8] = {};				// previous volumes & periods ( -optstreams delta streams )
+		u16 deltaLoopValues[8] = {};
 
-				u16 flags = 0;
-				u16 bpm = 125;
-				if (!microMode)
+		if (microMode)
+		{
+			m_codesCount = -1;
+			for (int i = 0; i < 16; i++)
+			{
+				streamsOffsets[i] = musicFile.ru32();
+				streamsLoopOffsets[i] = 0;		// by default loop at very beginning ( stream view relative )
+			}
+			if (microFlags)
+			{
+				// offsets are from here, period planes distances are the first stream data
+				const int tablePos = musicFile.GetPos();
+				for (int v = 0; v < 4; v++)
+					periodPlanes[v] = musicFile.ru32();
+				musicFile.seek(tablePos);
+			}
+		}
+		else if (flags & (1 << 3))
+		{
+			// -huffman: prefix codes count per length, then cmd values in canonical order
+			m_huffman = true;
+			m_codesCount = musicFile.ru16();
+			LSPPrintf("LSP prefix codes: %d\n", m_codesCount);
+			u32 code = 0;
+			int rank = 0;
+			m_firstCode[0] = 0;
+			m_firstRank[0] = 0;
+			m_lengthCount[0] = 0;
+			memset(m_lutBits, 0, sizeof(m_lutBits));
+			memset(m_lutRank, 0, sizeof(m_lutRank));
+			for (int len = 1; len <= 16; len++)
+			{
+				m_lengthCount[len] = musicFile.ru16();
+				m_firstCode[len] = code;
+				m_firstRank[len] = rank;
+				for (int i = 0; (i < m_lengthCount[len]) && (len <= 8); i++)
 				{
-					flags = musicFile.ru16();		// skip relocating flag
-					bpm = musicFile.ru16();
-					m_escCodeRewind = musicFile.ru16();
-					m_escCodeSetBpm = musicFile.ru16();
-					m_escCodeGetPos = musicFile.ru16();
+					const int first = (code + i) << (8 - len);
+					for (int j = 0; j < (1 << (8 - len)); j++)
+					{
+						m_lutBits[first + j] = u8(len);
+						m_lutRank[first + j] = u16(rank + i);
+					}
 				}
-				else
-					bpm = musicFile.ru16();
+				code = (code + m_lengthCount[len]) << 1;
+				rank += m_lengthCount[len];
+			}
+			assert(rank == m_codesCount);
+			m_codes = (u16*)malloc(m_codesCount * sizeof(u16));
+			for (int i = 0; i < m_codesCount; i++)
+				m_codes[i] = musicFile.ru16();
+
+			int seqTimingCount = musicFile.ru16();
+			musicFile.skip(seqTimingCount * 8);
+
+			m_wordStreamSize = musicFile.ru32();
+			m_byteStreamLoop = musicFile.ru32();
+			m_wordStreamLoop = musicFile.ru32();
+		}
+		else
+		{
+			m_codesCount = musicFile.ru16();
+			LSPPrintf("LSP codes......: %d\n", m_codesCount);
+			m_codes = (u16*)malloc(m_codesCount * sizeof(u16));
+			for (int i = 0; i < m_codesCount; i++)
+				m_codes[i] = musicFile.ru16();
+
+			int seqTimingCount = musicFile.ru16();
+			musicFile.skip(seqTimingCount * 8);
+
+			m_wordStreamSize = musicFile.ru32();
+			m_byteStreamLoop = musicFile.ru32();
+			m_wordStreamLoop = musicFile.ru32();
+		}
+
+		BinaryParser streams[16];
+		int streamCount = 2;
+		const u8* p = (const u8*)musicFile.GetReadPtr();
+		if (microMode)
+		{
+			streamCount = 16;
+			for (int s = 0; s < 16; s++)
+				streams[s].SetMemoryView(p + streamsOffsets[s], musicFile.GetLen() - streamsOffsets[s]);	// we don't have the stream size so use dummy higher value
+		}
+		else if (m_huffman)
+		{
+			const int byteStreamSize = musicFile.ru32();
+			m_bitStreamLoop = musicFile.ru32();
+			p = (const u8*)musicFile.GetReadPtr();
+			streams[0].LoadFromMemory(p, m_wordStreamSize);
+			streams[1].LoadFromMemory(p + m_wordStreamSize, byteStreamSize);
+			const int bitStreamSize = musicFile.GetLen() - (musicFile.GetPos() + m_wordStreamSize + byteStreamSize);
+			streams[2].LoadFromMemory(p + m_wordStreamSize + byteStreamSize, bitStreamSize);
+			SeekBitStream(streams[2], 0);
+		}
+		else
+		{
+			streams[0].LoadFromMemory(p, m_wordStreamSize);
+			const int byteStreamSize = musicFile.GetLen() - (musicFile.GetPos() + m_wordStreamSize);
+			streams[1].LoadFromMemory(p + m_wordStreamSize, byteStreamSize);
+		}
+
+		u32 nextAd[4] = {};
+		u16 nextLen[4] = {};
+
+		LSPPrintf("Simulating LSP Amiga player & Paula in \"%s\"\n", sOutputWavFile ? sOutputWavFile : "memory");
+		if ( microMode )
+			LSPPrintf("(LSP micro mode)\n");
 
-				printf("Main BPM: %d\n", bpm);
+		AudioBuffer tmpBuffer(2);
 
-				int frameSampleCount = BpmToSampleCount(bpm);
-				m_frameCount = 0;
+		u32 totalSampleCount = 0;
+		int frame = 0;
+		u16 prevDmaCon = 0;
 
-				if (!microMode)
-					m_frameCount = musicFile.ru32();
+		LSPHalfInstrument reset[4] = {};
 
-				// depack ADPCM
-				if (flags & (1 << 2))
+		int loopCount = loopPreview ? 2 : 1;
+		while ( loopCount > 0)
+		{
+			if (microMode)
+			{
+				u16 dmaCon = 0;
+				for (int v = 0; v < 4; v++)
 				{
-					int8_t* pw = (int8_t*)bankFile.GetWriteBuffer();
-					pw += 4;		// skip lsbank signature
-					uint32_t inplaceOffset = musicFile.ru32();
-					const uint8_t* pr = (const uint8_t*)pw + inplaceOffset;
-					uint32_t losslessMask = musicFile.ru32();
-					for (;;)
+					if (prevDmaCon&(1 << v))
+					{
+						paulaChip.SetSampleAd(v, reset[v].pos);
+						paulaChip.SetLen(v, reset[v].len);
+					}
+
+					u8 vCmd = streams[v+0].ru8();
+
+					if (vCmd&(1 << 7))	// volume
 					{
-						int len = musicFile.ru16();
-						if (0 == len)
-							break;
-						len += 1;		// stored len, in ADPCM bytes, -1 to please DBF instruction
-						if (losslessMask&(1 << 31))
+						u8 vol = streams[v + 4].ru8();
+						if (microFlags & kMicroDeltaVolume)
 						{
-							memmove(pw, pr, len * 2);
-							pr += len * 2;
+							vol += u8(deltaValues[v]);
+							deltaValues[v] = vol;
+						}
+						assert(vol <= 64);
+						paulaChip.SetVolume(v, vol);
+					}
+					if (vCmd&(1 << 6))	// period
+					{
+						u16 per;
+						if (microFlags & kMicroPeriodPlanes)
+						{
+							const u8* r = (const u8*)streams[v + 8].GetReadPtr();
+							per = (r[0] << 8) | r[periodPlanes[v]];
+							streams[v + 8].skip(1);
 						}
 						else
 						{
-							dpcmDecode(pr, len, pw);
-							pr += len;
+							assert(0 == (((const u8*)streams[v + 8].GetReadPtr() - (const u8*)musicFile.GetBuffer()) & 1));
+							per = streams[v+8].ru8();
+							per = (per<<8) | streams[v+8].ru8();
+						}
+						if (microFlags & kMicroDeltaPeriod)
+						{
+							per += deltaValues[4 + v];
+							deltaValues[4 + v] = per;
 						}
-						pw += len * 2;
-						losslessMask <<= 1;
+						paulaChip.SetPeriod(v, per);
+					}
+					if (vCmd&(1 << 5))	// instrument
+					{
+						int instrId = streams[v + 12].ru8();
+						assert(instrId < m_instrumentCount);
+						dmaCon |= 1 << v;
+						const LSPHalfInstrument* instr = m_halfInstruments + instrId * 2;
+						paulaChip.SetSampleAd(v, instr[0].pos);
+						paulaChip.SetLen(v, instr[0].len);
+						reset[v] = instr[1];
 					}
-					paulaChip.UploadChipMemoryBank(bankFile.GetBuffer(), bankFile.GetLen(), 0);		// upload at ad 0
-				}
 
-				m_instrumentCount = musicFile.ru16();
-				printf("LSP Instruments: %d\n", m_instrumentCount);
-				m_halfInstruments = (LSPHalfInstrument*)malloc((m_instrumentCount * 2) * sizeof(LSPHalfInstrument));	// *2 because half instrument (just pos/len) ( +1 because last half could be read by player)
-				for (int i = 0; i < m_instrumentCount; i++)
-				{
-					m_halfInstruments[i*2].pos = musicFile.ru32();
-					m_halfInstruments[i*2].len = musicFile.ru16();
-					m_halfInstruments[i*2+1].pos = musicFile.ru32();
-					m_halfInstruments[i*2+1].len = musicFile.ru16();
-					if (verbose)
+					// handle loop
+					const int loopCmd = (vCmd >> 3) & 3;
+					if ( 2 == loopCmd )
 					{
-						printf("LSP instrument #%3d : %08x|%04x|%08x|%04x\n", i, m_halfInstruments[i*2].pos,
-							m_halfInstruments[i*2].len,
-							m_halfInstruments[i*2+1].pos,
-							m_halfInstruments[i*2+1].len);
+						// backup loop points from current stream position
+						for (int s = 0; s < 16; s++)
+							streamsLoopOffsets[s] = streams[s].GetPos();
+						memcpy(deltaLoopValues, deltaValues, sizeof(deltaValues));
 					}
-				}
+					else if ( 3 == loopCmd )
+					{
+						// loop point, just restore the stream loop positions
+						for (int s = 0; s < 16; s++)
+							streams[s].seek(streamsLoopOffsets[s]);
+						memcpy(deltaValues, deltaLoopValues, sizeof(deltaValues));
 
-				int streamsOffsets[16] = {};
-				int streamsLoopOffsets[16];
+						loopCount--;
+					}
 
-				if (microMode)
+				}
+				paulaChip.WriteDmaCon(dmaCon);
+				paulaChip.WriteDmaCon(dmaCon | 0x8000);
+				prevDmaCon = dmaCon;
+			}
+			else
+			{
+				// normal mode
+				const int cmdStreamId = m_huffman ? 2 : 1;
+				u16 cmd = ReadNextCmd(streams[cmdStreamId]);
+				if (m_escCodeRewind == cmd)
 				{
-					m_codesCount = -1;
-					for (int i = 0; i < 16; i++)
+					streams[0].seek(m_wordStreamLoop);
+					streams[1].seek(m_byteStreamLoop);
+					if (m_huffman)
+						SeekBitStream(streams[2], m_bitStreamLoop);
+					cmd = ReadNextCmd(streams[cmdStreamId]);
+
+					loopCount--;
+					if ( 0 == loopCount )
 					{
-						streamsOffsets[i] = musicFile.ru32();
-						streamsLoopOffsets[i] = streamsOffsets[i];	// by default loop at very beginning
+						// in normal mode, end of stream appears in a "new" frame, so we should exit without generating the audio for this frame
+						// (note: this is not the case for "micro" mode)
+						break;
 					}
 				}
-				else
+
+				if (m_escCodeSetBpm == cmd)
 				{
-					m_codesCount = musicFile.ru16();
-					printf("LSP codes......: %d\n", m_codesCount);
-					m_codes = (u16*)malloc(m_codesCount * sizeof(u16));
-					for (int i = 0; i < m_codesCount; i++)
-						m_codes[i] = musicFile.ru16();
-
-					int seqTimingCount = musicFile.ru16();
-					musicFile.skip(seqTimingCount * 8);
-
-					m_wordStreamSize = musicFile.ru32();
-					m_byteStreamLoop = musicFile.ru32();
-					m_wordStreamLoop = musicFile.ru32();
+					bpm = streams[1].ru8();
+					frameSampleCount = BpmToSampleCount(bpm);
+					//							LSPPrintf("setBPM(%d)\n", bpm);
 				}
-
-				BinaryParser streams[16];
-				int streamCount = 2;
-				const u8* p = (const u8*)musicFile.GetReadPtr();
-				if (microMode)
+				else if (m_escCodeGetPos == cmd)
 				{
-					streamCount = 16;
-					for (int s = 0; s < 16; s++)
-						streams[s].SetMemoryView(p + streamsOffsets[s], musicFile.GetLen() - streamsOffsets[s]);	// we don't have the stream size so use dummy higher value
+					// skip getpos byte
+					streams[1].ru8();
 				}
 				else
 				{
-					streams[0].LoadFromMemory(p, m_wordStreamSize);
-					const int byteStreamSize = musicFile.GetLen() - (musicFile.GetPos() + m_wordStreamSize);
-					streams[1].LoadFromMemory(p + m_wordStreamSize, byteStreamSize);
-				}
-
-				u32 nextAd[4] = {};
-				u16 nextLen[4] = {};
-
-				printf("Simulating LSP Amiga player & Paula in \"%s\"\n", sOutputWavFile);
-				if ( microMode )
-					printf("(LSP micro mode)\n");
 
-				AudioBuffer tmpBuffer(2);
+					//					LSPPrintf("Frame %d: cmd:$%04x ",frame,cmd);
 
-				u32 totalSampleCount = 0;
-				int frame = 0;
-				u16 prevDmaCon = 0;
+										// 12..15	set replen
+										// 8..11	volume
+										// 4..7		periods
+										// 0..3		dmacon
 
-				LSPHalfInstrument reset[4] = {};
+										// setreplen
 
-				int loopCount = loopPreview ? 2 : 1;
-				while ( loopCount > 0)
-				{
-					if (microMode)
+					// volumes
+					for (int b = 7; b >= 4; b--)
 					{
-						u16 dmaCon = 0;
-						for (int v = 0; v < 4; v++)
+						if (cmd & (1 << b))
 						{
-							if (prevDmaCon&(1 << v))
-							{
-								paulaChip.SetSampleAd(v, reset[v].pos);
-								paulaChip.SetLen(v, reset[v].len);
-							}
-
-							u8 vCmd = streams[v+0].ru8();
-
-							if (vCmd&(1 << 7))	// volume
-							{
-								u8 vol = streams[v + 4].ru8();
-								assert(vol <= 64);
-								paulaChip.SetVolume(v, vol);
-							}
-							if (vCmd&(1 << 6))	// period
-							{
-								assert(0 == (streams[v + 8].GetPos() & 1));
-								u16 per = streams[v+8].ru8();
-								per = (per<<8) | streams[v+8].ru8();
-								paulaChip.SetPeriod(v, per);
-							}
-							if (vCmd&(1 << 5))	// instrument
-							{
-								int instrId = streams[v + 12].ru8();
-								assert(instrId < m_instrumentCount);
-								dmaCon |= 1 << v;
-								const LSPHalfInstrument* instr = m_halfInstruments + instrId * 2;
-								paulaChip.SetSampleAd(v, instr[0].pos);
-								paulaChip.SetLen(v, instr[0].len);
-								reset[v] = instr[1];
-							}
-
-							// handle loop
-							const int loopCmd = (vCmd >> 3) & 3;
-							if ( 2 == loopCmd )
-							{
-								// backup loop points from current stream position
-								for (int s = 0; s < 16; s++)
-									streamsLoopOffsets[s] = streams[s].GetPos();
-							}
-							else if ( 3 == loopCmd )
-							{
-								// loop point, just restore the stream loop positions
-								for (int s = 0; s < 16; s++)
-									streams[s].seek(streamsLoopOffsets[s]);
-
-								loopCount--;
-							}
-
+							u8 vol = streams[1].ru8();
+							paulaChip.SetVolume(b - 4, vol);
 						}
-						paulaChip.WriteDmaCon(dmaCon);
-						paulaChip.WriteDmaCon(dmaCon | 0x8000);
-						prevDmaCon = dmaCon;
 					}
-					else
-					{
-						// normal mode
-						u16 cmd = ReadNextCmd(streams[1]);
-						if (m_escCodeRewind == cmd)
-						{
-							streams[0].seek(m_wordStreamLoop);
-							streams[1].seek(m_byteStreamLoop);
-							cmd = ReadNextCmd(streams[1]);
 
-							loopCount--;
-							if ( 0 == loopCount )
-							{
-								// in normal mode, end of stream appears in a "new" frame, so we should exit without generating the audio for this frame
-								// (note: this is not the case for "micro" mode)
-								break;
-							}
-						}
-
-						if (m_escCodeSetBpm == cmd)
-						{
-							bpm = streams[1].ru8();
-							frameSampleCount = BpmToSampleCount(bpm);
-							//							printf("setBPM(%d)\n", bpm);
-						}
-						else if (m_escCodeGetPos == cmd)
+					// periods
+					for (int b = 3; b >= 0; b--)
+					{
+						if (cmd & (1 << b))
 						{
-							// skip getpos byte
-							streams[1].ru8();
+							u16 per = streams[0].ru16();
+							paulaChip.SetPeriod(b - 0, per);
+							//							LSPPrintf("%04x|", per);
 						}
-						else
-						{
-
-							//					printf("Frame %d: cmd:$%04x ",frame,cmd);
-
-												// 12..15	set replen
-												// 8..11	volume
-												// 4..7		periods
-												// 0..3		dmacon
+					}
 
-												// setreplen
+					// voices
+					int ioffset = -12;
+					int dmaCon = 0;
+					for (int v = 3; v >= 0; v--)
+					{
+						int voiceCode = (cmd >> (8 + v * 2)) & 3;
 
-							// volumes
-							for (int b = 7; b >= 4; b--)
+						if (voiceCode > 0)
+						{
+							if (1 == voiceCode)
 							{
-								if (cmd & (1 << b))
-								{
-									u8 vol = streams[1].ru8();
-									paulaChip.SetVolume(b - 4, vol);
-								}
+								assert(nextAd[v]);
+								assert(nextLen[v]);
+								paulaChip.SetSampleAd(v, nextAd[v]);
+								paulaChip.SetLen(v, nextLen[v]);
 							}
-
-							// periods
-							for (int b = 3; b >= 0; b--)
+							else
 							{
-								if (cmd & (1 << b))
+								ioffset += streams[0].rs16();
+								if (3 == voiceCode)
 								{
-									u16 per = streams[0].ru16();
-									paulaChip.SetPeriod(b - 0, per);
-									//							printf("%04x|", per);
+									dmaCon |= 1 << v;
+									paulaChip.WriteDmaCon(dmaCon);	// switch off DMA
+									assert(0 == (ioffset % 12));
 								}
-							}
-
-							// voices
-							int ioffset = -12;
-							int dmaCon = 0;
-							for (int v = 3; v >= 0; v--)
-							{
-								int voiceCode = (cmd >> (8 + v * 2)) & 3;
-
-								if (voiceCode > 0)
+								else
 								{
-									if (1 == voiceCode)
-									{
-										assert(nextAd[v]);
-										assert(nextLen[v]);
-										paulaChip.SetSampleAd(v, nextAd[v]);
-										paulaChip.SetLen(v, nextLen[v]);
-									}
-									else
-									{
-										ioffset += streams[0].rs16();
-										if (3 == voiceCode)
-										{
-											dmaCon |= 1 << v;
-											paulaChip.WriteDmaCon(dmaCon);	// switch off DMA
-											assert(0 == (ioffset % 12));
-										}
-										else
-										{
-											assert(2 == voiceCode);
-											assert(0 == (ioffset % 6));
-										}
-										int halfInstrId = ioffset / 6;
-										assert(halfInstrId < m_instrumentCount * 2);
-										paulaChip.SetSampleAd(v, m_halfInstruments[halfInstrId].pos);
-										paulaChip.SetLen(v, m_halfInstruments[halfInstrId].len);
-										if (voiceCode & 1)
-										{
-											nextAd[v] = m_halfInstruments[halfInstrId + 1].pos;
-											nextLen[v] = m_halfInstruments[halfInstrId + 1].len;
-											assert(dmaCon & (1 << v));
-										}
-										else
-										{
-											nextAd[v] = 0;
-											nextLen[v] = 0;
-										}
-
-										ioffset += 6;			// the player use move.l (a2)+ and move.w (a2)+
-									}
+									assert(2 == voiceCode);
+									assert(0 == (ioffset % 6));
+								}
+								int halfInstrId = ioffset / 6;
+								assert(halfInstrId < m_instrumentCount * 2);
+								paulaChip.SetSampleAd(v, m_halfInstruments[halfInstrId].pos);
+								paulaChip.SetLen(v, m_halfInstruments[halfInstrId].len);
+								if (voiceCode & 1)
+								{
+									nextAd[v] = m_halfInstruments[halfInstrId + 1].pos;
+									nextLen[v] = m_halfInstruments[halfInstrId + 1].len;
+									assert(dmaCon & (1 << v));
+								}
+								else
+								{
+									nextAd[v] = 0;
+									nextLen[v] = 0;
 								}
-							}
 
-							paulaChip.WriteDmaCon(dmaCon | 0x8000);
+								ioffset += 6;			// the player use move.l (a2)+ and move.w (a2)+
+							}
 						}
 					}
-					// now we can render a complete paula frame
-					s16* buffer = tmpBuffer.GetAudioBuffer(frameSampleCount);
-					paulaChip.AudioStreamRender(buffer, frameSampleCount);
-					if ( mono )
-						StereoToMono(buffer, frameSampleCount);
-					paulaOutput.AddAudioData(buffer, frameSampleCount);
-					frame++;
-
-					totalSampleCount += frameSampleCount;
-				}
 
-				printf("End of streams. ( %d frames )\n", frame);
-				static const int seconds = totalSampleCount / HOST_REPLAY_RATE;
-				printf("Music duration: %dm%02ds\n", seconds / 60, seconds % 60);
-			}
-			else
-			{
-				printf("ERROR: lsmusic & lsbank magic value does NOT match!\n");
+					paulaChip.WriteDmaCon(dmaCon | 0x8000);
+				}
 			}
+			// now we can render a complete paula frame
+			s16* buffer = tmpBuffer.GetAudioBuffer(frameSampleCount);
+			paulaChip.AudioStreamRender(buffer, frameSampleCount);
+			if ( mono )
+				StereoToMono(buffer, frameSampleCount);
+			paulaOutput.AddAudioData(buffer, frameSampleCount);
+			frame++;
+
+			totalSampleCount += frameSampleCount;
 		}
-		else
-		{
-			printf("ERROR: Unable to load \"%s\"\n", sBankName);
-		}
+
+		LSPPrintf("End of streams. ( %d frames )\n", frame);
+		m_renderedFrameCount = frame;
+		m_renderedSampleCount = totalSampleCount;
+		const int seconds = totalSampleCount / HOST_REPLAY_RATE;
+		LSPPrintf("Music duration: %dm%02ds\n", seconds / 60, seconds % 60);
+		ret = true;
 	}
 	else
 	{
-		printf("ERROR: Unable to load \"%s\"\n", sMusicName);
+		LSPPrintf("ERROR: lsmusic & lsbank magic value does NOT match!\n");
 	}
 	return ret;
 }
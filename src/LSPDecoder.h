@@ -53,13 +53,20 @@ class LSPDecoder
 {
 public:
 	LSPDecoder();
+	~LSPDecoder();
 
 	bool	LoadAndRender(const char* sMusicName, const char* sBankName, const char* sOutputWavFile, bool verbose, bool loopPreview, bool mono);
+	bool	RenderFromMemory(const void* music, int musicSize, const void* bank, int bankSize, const char* sOutputWavFile, bool verbose, bool loopPreview, bool mono);
+	int		GetRenderedFrameCount() const { return m_renderedFrameCount; }
+	u32		GetRenderedSampleCount() const { return m_renderedSampleCount; }
 
 
 private:
 
+	bool	Render(BinaryParser& musicFile, BinaryParser& bankFile, const char* sOutputWavFile, bool verbose, bool loopPreview, bool mono);
 	u16		ReadNextCmd(BinaryParser& parser);
+	u16		ReadNextPrefixCmd(BinaryParser& bitStream);
+	void	SeekBitStream(BinaryParser& bitStream, int bitPos);
 
 	struct LSPHalfInstrument
 	{
@@ -71,6 +78,8 @@ private:
 	int		m_instrumentCount;
 	int		m_codesCount;
 	u32		m_frameCount;
+	int		m_renderedFrameCount;
+	u32		m_renderedSampleCount;
 	u16		m_escCodeRewind;
 	u16		m_escCodeSetBpm;
 	u16		m_escCodeGetPos;
@@ -80,5 +89,15 @@ private:
 	int		m_byteStreamLoop;
 	int		m_wordStreamLoop;
 
+	// -huffman score: cmd codes are canonical prefix codes in a MSB first bit stream
+	bool	m_huffman;
+	int		m_bitStreamLoop;
+	u32		m_bitBuffer;				// next bits, MSB aligned
+	int		m_bitCount;
+	u8		m_lutBits[256];				// decode table on the next 8 bits, 0 for longer codes
+	u16		m_lutRank[256];
+	u32		m_firstCode[17];			// canonical decoding of longer codes, per length
+	int		m_firstRank[17];
+	int		m_lengthCount[17];
 
 };
\ No newline at end of file
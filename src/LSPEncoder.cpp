@@ -11,28 +11,42 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <math.h>
 #include <assert.h>
 #include "MemoryStream.h"
 #include "LSPEncoder.h"
 #include "LSPDecoder.h"
 #include "crc32.h"
 #include "external/micromod/micromod.h"
+#include "PatternMemo.h"
+#include "CycleModel.h"
+#include "PackModel.h"
+#include "BankLayout.h"
+#include "HunkObject.h"
+#include "M68kAssembler.h"
+#include "ThreadPool.h"
 #include "WavWriter.h"
 #include "adpcm.h"
+#include "Log.h"
 #ifdef MACOS_LINUX
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <filesystem>
 #include "WindowsCompat.h"
 #endif
 
 static const	int kWordStreamId = 0;
 static const	int kByteStreamId = 1;
+static const	int kBitStreamId = 2;			// -huffman: cmd prefix codes
 static const	int kMicroCmdStreamId = 0;
 
 static const	int	kResampleShrinkMarginPercent = 5;
+static const	int	kModHeaderSize = 1084;		// title, 31 instruments, sequence and "M.K." signature
 
-extern long tick_len;
 int	ShrinklerCompressEstimate(u8* data, int size);
+int	ShrinklerCompressEstimate(u8* data, int size, int preset);
+int	ShrinklerEstimatePreset();
 
 
 void	ConvertParams::SetNameWithExtension(const char* src, char* dst, const char* sExt, const char* sNamePostfix)
@@ -71,27 +85,18 @@ LSPEncoder::~LSPEncoder()
 	Reset();
 }
 
-static	void	w16(FILE* h, u16 v)
-{
-	fputc(v >> 8, h);
-	fputc(v&255, h);
-}
-
-static	void	w32(FILE* h, u32 v)
-{
-	w16(h, v >> 16);
-	w16(h, v & 0xffff);
-}
-
 void	LSPEncoder::Reset()
 {
-	for (int i = 0; i < MOD_CHANNEL_COUNT; i++)
+	for (int i = 0; i < 31; i++)
 	{
-		free(m_ChannelRowData[i]);
-		m_ChannelRowData[i] = NULL;
+		free(m_lspSamples[i].sampleData);
+		m_lspSamples[i].sampleData = NULL;
+		free(m_lspSamples[i].dpcmData);
+		m_lspSamples[i].dpcmData = NULL;
 	}
-	free(m_RowData);
-	m_RowData = NULL;
+	free(m_ModBuffer);
+	m_ModBuffer = NULL;
+	m_RowData.Clear();
 	m_cmdEncoder.Setup(1<<16, LSP_CMDWORD_MAX);
 	m_lspIntrumentEncoder.Setup(31 << 8, LSP_INSTRUMENT_MAX);
 	m_periodEncoder.Setup(1 << 12, 256);
@@ -103,9 +108,11 @@ void	LSPEncoder::Reset()
 	m_minTickRate = 50;
 	m_modInstrumentUsedMask = 0;
 	m_frameCount = 0;
+	m_replayedFrameCount = 0;
 	m_uniqueId = 0;
 	m_originalModSoundBank = NULL;
 	m_originalModSoundBankSize = 0;
+	m_timings.Reset();
 }
 
 void	LSPEncoder::AddLSPInstrument(int id, int modInstrument, int sampleOffsetInBytes)
@@ -119,7 +126,7 @@ void	LSPEncoder::AddLSPInstrument(int id, int modInstrument, int sampleOffsetInB
 	LSPInstrument& dst = m_lspIntruments[id];
 	if (sampleOffsetInBytes >= lspSample.len)
 	{
-		printf("Warning: bad Sample Offset data for instrument #%d (offset=%d, len=%d) Force to %d\n", modInstrument, sampleOffsetInBytes, lspSample.len, lspSample.repStart);
+		LSPPrintf("Warning: bad Sample Offset data for instrument #%d (offset=%d, len=%d) Force to %d\n", modInstrument, sampleOffsetInBytes, lspSample.len, lspSample.repStart);
 		sampleOffsetInBytes = lspSample.repStart;
 	}
 
@@ -158,21 +165,30 @@ bool	LSPEncoder::LoadModule()
 
 	const char* filename = m_convertParams.m_modFilename;
 
-	printf("Loading %s...\n", filename);
+	LSPPrintf("Loading %s...\n", filename);
+
+	BinaryParser modFile;
+	if (!modFile.LoadFromFile(filename))
+	{
+		Reset();
+		LSPPrintf("ERROR: Unable to load file \"%s\"\n", filename);
+		return false;
+	}
+	return LoadModuleFromMemory(modFile.GetBuffer(), modFile.GetLen());
+}
+
+bool	LSPEncoder::LoadModuleFromMemory(const void* modData, int modSize)
+{
 	Reset();
 
 	WavWriter micromodOutput;
 
 	bool ret = false;
-	FILE* h = fopen(filename, "rb");
-	if (h)
+	if (modSize >= kModHeaderSize)
 	{
-		fseek(h, 0, SEEK_END);
-		m_ModFileSize = ftell(h);
-		fseek(h, 0, SEEK_SET);
+		m_ModFileSize = modSize;
 		m_ModBuffer = (u8*)malloc(m_ModFileSize);
-		fread(m_ModBuffer, 1, m_ModFileSize, h);
-		fclose(h);
+		memcpy(m_ModBuffer, modData, m_ModFileSize);
 
 		int numchan = calculate_num_channels((signed char*)m_ModBuffer);
 		if (4 == numchan)
@@ -193,27 +209,25 @@ bool	LSPEncoder::LoadModule()
 
 			if (m_MODScoreSize > 0)
 			{
-				// as micromod_initialise calls "sequence_tick" (?!!), we should alloc up-front
-				m_frameMax = 60 * 30 * 100;	// consider 30 minutes MOD at 100Hz tick
+				// frame data storage grows with the song ( note: micromod_initialise already calls "sequence_tick" )
 				for (int i = 0; i < MOD_CHANNEL_COUNT; i++)
 				{
-					m_ChannelRowData[i] = (ChannelRowData*)calloc(m_frameMax, sizeof(ChannelRowData));
 					m_previousVolumes[i] = -1;
 					m_previousPeriods[i] = -1;
 					m_previousInstrument[i] = -1;
 				}
-				m_RowData = (LspFrameData*)calloc(m_frameMax, sizeof(LspFrameData));
 				memset(m_seqPosFrame, 0xff, sizeof(m_seqPosFrame));
 				m_frameLoop = 0;
 				m_seqHighest = -1;
 
-				if (0 == micromod_initialise((signed char*)m_ModBuffer, HOST_REPLAY_RATE))
+				Micromod micromod(this);
+				if (0 == micromod.initialise((signed char*)m_ModBuffer, HOST_REPLAY_RATE))
 				{
 					#if D_MICROMOD_DEBUG
 					if (m_convertParams.m_renderWav)
 					{
 						micromodOutput.Open(m_convertParams.m_sWavFilename, HOST_REPLAY_RATE, 2);
-						printf("Rendering into %s...\n", m_convertParams.m_sWavFilename);
+						LSPPrintf("Rendering into %s...\n", m_convertParams.m_sWavFilename);
 					}
 					#endif
 					m_totalSampleCount = 0;
@@ -221,39 +235,56 @@ bool	LSPEncoder::LoadModule()
 					m_seqPosFrame[0] = 0;
 					ret = true;
 
+					#if D_MICROMOD_DEBUG
 					AudioBuffer tmpBuffer(2);
+					#endif
 
 					int previousDmacon = 0;
 					int previousInstrument[4] = {};
 
 					//---------------------------------------------------------------------------------------
-					// play the complete .mod and store all data per frame in LspFrameData & ChannelRowData
+					// play the complete .mod and store all data per frame in LspFrameData
 					//---------------------------------------------------------------------------------------
-					while (0 == sequence_tick())
+					// patterns entered again with the same state are copied ( not in verbose mode, to keep the full log )
+					bool memoize = !m_convertParams.m_verbose;
+					#if D_MICROMOD_DEBUG
+					if (m_convertParams.m_renderWav)
+						memoize = false;
+					#endif
+					PatternMemo memo(*this, micromod);
+
+					m_timings.Begin(kPhaseSimulation);
+					for (;;)
 					{
-						// run the mixer to get the exact amount of each instrument used
-						s16* buffer = tmpBuffer.GetAudioBuffer(tick_len);
-						simulateMixing(buffer, tick_len);
+						if ((memoize) && (memo.Update()))
+							continue;
+						if (0 != micromod.sequence_tick())
+							break;
+						m_RowData[m_frameCount].row = u8(micromod.get_row());
+
+						// track the exact amount of each instrument used ( no need to really mix )
+						const long tick_len = micromod.get_tick_len();
 						#if D_MICROMOD_DEBUG
 						if (m_convertParams.m_renderWav)
-							micromodOutput.AddAudioData(buffer, tick_len);
-						#endif
-						if (m_frameCount >= m_frameMax)
 						{
-							printf("Fatal ERROR: Music end detection issue (song is more than %d ticks)\n", m_frameMax);
-							return false;
+							s16* buffer = tmpBuffer.GetAudioBuffer(tick_len);
+							micromod.simulateMixing(buffer, tick_len);
+							micromodOutput.AddAudioData(buffer, tick_len);
 						}
+						else
+						#endif
+							micromod.simulateSampleFetch(tick_len);
 						m_frameCount++;
 						m_totalSampleCount += tick_len;
 					}
+					m_timings.End(kPhaseSimulation, m_frameCount);
+
+					m_timings.Begin(kPhaseReadback);
 
 					// If any loop point, force the vol & per to be set
 					assert(m_frameLoop >= 0);
-					for (int v=0;v<4;v++)
-					{
-						m_ChannelRowData[v][m_frameLoop].volSet = true;
-						m_ChannelRowData[v][m_frameLoop].perSet = true;
-					}
+					m_RowData[m_frameLoop].volSetMask = 0xf;
+					m_RowData[m_frameLoop].perSetMask = 0xf;
 
 					//---------------------------------------------------------------------------------------
 					// And now read back the data to produce LSP delta stream & proper wordCmd, including
@@ -270,34 +301,32 @@ bool	LSPEncoder::LoadModule()
 
 						for (int v = 3; v >= 0; v--)
 						{
-							const ChannelRowData& data = m_ChannelRowData[v][frame];
+							const ChannelRowData& data = out.voices[v];
 
 							if (data.instrument > 0)
 							{
-								const int sampleOffsetCode = data.sampleOffsetInBytes >> 8;
-								assert(unsigned(sampleOffsetCode) < 256);
-								int intrValue = ((data.instrument - 1) << 8) | sampleOffsetCode;
+								int intrValue = ((data.instrument - 1) << 8) | data.sampleOffsetCode;
 
 								if (!m_lspIntrumentEncoder.IsValueRegistered(intrValue))
 								{	// create a LSP entry
 									int code = m_lspIntrumentEncoder.RegisterValue(intrValue);
 									if (MicroMode() && (code >= 256))
 									{
-										printf("Fatal ERROR: LSP only supports 256 Instruments max in Micro mode (too many $9xx commands)\n");
+										LSPPrintf("Fatal ERROR: LSP only supports 256 Instruments max in Micro mode (too many $9xx commands)\n");
 										return false;
 									}
 									if (code < LSP_INSTRUMENT_MAX)
 									{
-										AddLSPInstrument(code, data.instrument, data.sampleOffsetInBytes);
+										AddLSPInstrument(code, data.instrument, data.sampleOffsetCode << 8);
 									}
 									else
 									{
-										printf("Fatal ERROR: More than %d LSP Instruments (too many $9xx commands)\n", LSP_INSTRUMENT_MAX);
+										LSPPrintf("Fatal ERROR: More than %d LSP Instruments (too many $9xx commands)\n", LSP_INSTRUMENT_MAX);
 										return false;
 									}
 								}
 
-								if (data.dmaRestart)
+								if (out.dmaRestartMask & (1 << v))
 								{
 									frameInstMask |= (1 << v);
 									frameDmaCon |= (1 << v);
@@ -312,10 +341,10 @@ bool	LSPEncoder::LoadModule()
 								}
 							}
 
-							if (data.volSet)
+							if (out.volSetMask & (1 << v))
 								frameVolMask |= (1 << v);
 
-							if (data.perSet)
+							if (out.perSetMask & (1 << v))
 							{
 								framePerMask |= (1 << v);
 								m_periodEncoder.RegisterValue(data.period);
@@ -341,7 +370,7 @@ bool	LSPEncoder::LoadModule()
 						int cmd = m_cmdEncoder.RegisterValue(out.wordCmd);
 						if ((cmd < 0) || (cmd >= LSP_CMDWORD_MAX))
 						{
-							printf("Fatal error: Too many LSP cmd words (%d)\n", cmd);
+							LSPPrintf("Fatal error: Too many LSP cmd words (%d)\n", cmd);
 							return false;
 						}
 
@@ -372,6 +401,15 @@ bool	LSPEncoder::LoadModule()
 
 //					m_periodEncoder.SortValues();
 
+					m_timings.End(kPhaseReadback, m_frameCount);
+
+					if ((m_convertParams.m_optCodes) && (!MicroMode()))
+					{
+						m_timings.Begin(kPhaseCmdCodes);
+						OptimizeCmdCodes();
+						m_timings.End(kPhaseCmdCodes, m_frameCount);
+					}
+
 					m_modDurationSec = (m_totalSampleCount+ HOST_REPLAY_RATE-1) / HOST_REPLAY_RATE;
 
 					#if D_MICROMOD_DEBUG
@@ -386,16 +424,16 @@ bool	LSPEncoder::LoadModule()
 						{
 							if (m_convertParams.m_verbose)
 							{
-								printf("Instrument #%2d: %d bytes, max replay rate = %dHz\n", i, info.len, info.maxReplayRate);
+								LSPPrintf("Instrument #%2d: %d bytes, max replay rate = %dHz\n", i, info.len, info.maxReplayRate);
 								if (info.repStart + info.repLen > info.len)
 								{
-									printf("  Warning: sample goes over RepStart+RepLen (%d > %d)\n", info.len, info.repStart + info.repLen);
+									LSPPrintf("  Warning: sample goes over RepStart+RepLen (%d > %d)\n", info.len, info.repStart + info.repLen);
 								}
 								if (info.resampleMaxLen > 0)
 								{
 									int cmpLen = (info.resampleMaxLen * (100 + kResampleShrinkMarginPercent)) / 100;
 									if (info.len > cmpLen)
-										printf("  Warning: Only use %d sample bytes (len=%d)\n", info.resampleMaxLen, info.len);
+										LSPPrintf("  Warning: Only use %d sample bytes (len=%d)\n", info.resampleMaxLen, info.len);
 								}
 							}
 						}
@@ -406,7 +444,7 @@ bool	LSPEncoder::LoadModule()
 								if (m_convertParams.m_verbose)
 								{
 									if ( 0 == info.resampleMaxLen )
-										printf("Warning: Instrument #%d is never used! (len=%d)\n", i, info.len);
+										LSPPrintf("Warning: Instrument #%d is never used! (len=%d)\n", i, info.len);
 //									assert(0 == info.resampleMaxLen);
 								}
 							}
@@ -418,23 +456,23 @@ bool	LSPEncoder::LoadModule()
 			}
 			else
 			{
-				printf("ERROR: This is not a valid Amiga MOD file\n");
+				LSPPrintf("ERROR: This is not a valid Amiga MOD file\n");
 			}
 		}
 		else
 		{
-			printf("ERROR: This file is %d channel(s) (AMIGA LSP only supports 4 channels)\n", numchan);
+			LSPPrintf("ERROR: This file is %d channel(s) (AMIGA LSP only supports 4 channels)\n", numchan);
 		}
 	}
 	else
 	{
-		printf("ERROR: Unable to load file \"%s\"\n", filename);
+		LSPPrintf("ERROR: This is not a valid Amiga MOD file\n");
 	}
 
 	const int codesCount = m_cmdEncoder.GetCodesCount();
 	if (codesCount > LSP_CMDWORD_MAX)			// 765 max because "extended" and "rewind" code
 	{
-		printf("ERROR: Too many Cmd combine (%d)\n", codesCount);
+		LSPPrintf("ERROR: Too many Cmd combine (%d)\n", codesCount);
 		ret = false;
 	}
 
@@ -442,12 +480,12 @@ bool	LSPEncoder::LoadModule()
 	{
 		if ( m_sampleWithoutANote )
 		{
-			printf("ERROR: \"-micro\" mode does NOT support \"sample without a note\" technic.\n");
+			LSPPrintf("ERROR: \"-micro\" mode does NOT support \"sample without a note\" technic.\n");
 			ret = false;
 		}
 		if ((m_setBpmCount > 1) && (!Fixed50Hz()))
 		{
-			printf("ERROR: \"-micro\" mode does NOT support BPM change within the song (try -fixed50hz maybe)\n");
+			LSPPrintf("ERROR: \"-micro\" mode does NOT support BPM change within the song (try -fixed50hz maybe)\n");
 			ret = false;
 		}
 	}
@@ -465,8 +503,9 @@ void	LSPEncoder::SetPeriod(int channel, int period)
 	{
 		assert(unsigned(channel) < unsigned(MOD_CHANNEL_COUNT));
 		assert((period >= AMIGA_PER_MIN) && (period < (1 << AMIGA_PERIOD_BITS)));
-		m_ChannelRowData[channel][m_frameCount].period = period;
-		m_ChannelRowData[channel][m_frameCount].perSet = (period != m_previousPeriods[channel]);
+		LspFrameData& frame = m_RowData[m_frameCount];
+		frame.voices[channel].period = period;
+		LspFrameData::SetVoiceBit(frame.perSetMask, channel, period != m_previousPeriods[channel]);
 		m_previousPeriods[channel] = period;
 	}
 }
@@ -477,8 +516,9 @@ void	LSPEncoder::SetVolume(int channel, int volume)
 	{
 		assert(unsigned(channel) < unsigned(MOD_CHANNEL_COUNT));
 		assert(unsigned(volume) <= unsigned(64));
-		m_ChannelRowData[channel][m_frameCount].volume = volume;
-		m_ChannelRowData[channel][m_frameCount].volSet = (volume != m_previousVolumes[channel]);
+		LspFrameData& frame = m_RowData[m_frameCount];
+		frame.voices[channel].volume = volume;
+		LspFrameData::SetVoiceBit(frame.volSetMask, channel, volume != m_previousVolumes[channel]);
 		m_previousVolumes[channel] = volume;
 	}
 }
@@ -490,7 +530,7 @@ void	LSPEncoder::SetSeqLoop(int seqPos)
 	m_frameLoop = m_seqPosFrame[seqPos];
 
 	if ( m_convertParams.m_verbose )
-		printf("Loop, seq=%d (frame=%d)\n", seqPos, m_frameLoop);
+		LSPPrintf("Loop, seq=%d (frame=%d)\n", seqPos, m_frameLoop);
 }
 
 void	LSPEncoder::SetSeqPos(int seqPos)
@@ -505,7 +545,7 @@ void	LSPEncoder::SetSeqPos(int seqPos)
 
 		const int frame = m_frameCount;
 		if ( m_convertParams.m_verbose )
-			printf("%02d:%02d | Seq #%2d: frame %d\n", secPos/60, secPos%60, seqPos, frame);
+			LSPPrintf("%02d:%02d | Seq #%2d: frame %d\n", secPos/60, secPos%60, seqPos, frame);
 		m_seqPosFrame[seqPos] = frame;
 	}
 }
@@ -533,15 +573,17 @@ void	LSPEncoder::NoteOn(int channel, int instrument, int sampleOffsetInBytes, bo
 			if (sampleOffsetInBytes > 0)
 				m_sampleOffsetUsed = true;
 
-			m_ChannelRowData[channel][m_frameCount].instrument = instrument;
-			m_ChannelRowData[channel][m_frameCount].sampleOffsetInBytes = sampleOffsetInBytes;
-			m_ChannelRowData[channel][m_frameCount].dmaRestart = DMAConReset;
+			assert((0 == (sampleOffsetInBytes & 255)) && (unsigned(sampleOffsetInBytes >> 8) < 256));
+			LspFrameData& frame = m_RowData[m_frameCount];
+			frame.voices[channel].instrument = instrument;
+			frame.voices[channel].sampleOffsetCode = sampleOffsetInBytes >> 8;
+			LspFrameData::SetVoiceBit(frame.dmaRestartMask, channel, DMAConReset);
 			m_modInstrumentUsedMask |= 1 << (instrument - 1);
 		}
 		else
 		{
 			if (m_convertParams.m_verbose)
-				printf("Warning: Playing an EMPTY sample instrument (#%d)\n", instrument);
+				LSPPrintf("Warning: Playing an EMPTY sample instrument (#%d)\n", instrument);
 		}
 	}
 }
@@ -558,13 +600,13 @@ void	LSPEncoder::SetModInstrumentInfo(int instr, s8* modSampleBank, int start, i
 	if (m_convertParams.m_verbose)
 	{
 		const unsigned char* us = (const unsigned char*)(modSampleBank + start);
-		printf("MOD Instr #%2d: start=$%06x len=$%05x, repstart=$%05x replen=%05x | ", instr, start, len, repStart, repLen);
+		LSPPrintf("MOD Instr #%2d: start=$%06x len=$%05x, repstart=$%05x replen=%05x | ", instr, start, len, repStart, repLen);
 		const int dlen = (len > 8) ? 8 : len;
 		for (int i = 0; i < dlen; i++)
-			printf("%02x ", us[i]);
+			LSPPrintf("%02x ", us[i]);
 		if (len > 8)
-			printf("...");
-		printf("\n");
+			LSPPrintf("...");
+		LSPPrintf("\n");
 	}
 	assert((instr > 0) && (instr <= 31));
 	assert(repStart + repLen <= len);
@@ -590,12 +632,12 @@ void	LSPEncoder::SetModInstrumentInfo(int instr, s8* modSampleBank, int start, i
 		if (byte0 || byte1)
 		{
 			if (m_convertParams.m_verbose)
-				printf("Warning: MOD Instrument #%d is non looping and wave two first bytes are not $00 ($%02x $%02x)\n", instr, byte0, byte1);
+				LSPPrintf("Warning: MOD Instrument #%d is non looping and wave two first bytes are not $00 ($%02x $%02x)\n", instr, byte0, byte1);
 
 			if (!m_convertParams.m_keepModSoundBankLayout)
 			{
 				if (m_convertParams.m_verbose)
-					printf("  Fixing by clearing two first bytes...\n");
+					LSPPrintf("  Fixing by clearing two first bytes...\n");
 
 				info.sampleData[repStart] = 0;
 				info.sampleData[repStart + 1] = 0;
@@ -647,9 +689,9 @@ void	LSPEncoder::SetBPM(int bpm)
 		if (m_convertParams.m_verbose)
 		{
 			if ( Fixed50Hz() )
-				printf("Fixed 50hz mode! (emulating BPM change to %d (%dHz))\n", bpm, tickRate);
+				LSPPrintf("Fixed 50hz mode! (emulating BPM change to %d (%dHz))\n", bpm, tickRate);
 			else
-				printf("Set BPM to %d (%dHz)\n", bpm, tickRate);
+				LSPPrintf("Set BPM to %d (%dHz)\n", bpm, tickRate);
 		}
 		m_setBpmCount++;
 		m_bpm = bpm;
@@ -668,29 +710,29 @@ void	LSPEncoder::SetBPM(int bpm)
 
 void	LSPEncoder::DisplayInfos()
 {
-	printf("MOD File........: %3d KiB\n", (m_ModFileSize + 1023) >> 10);
-	printf("  MOD Samples...: %d bytes\n", m_originalModSoundBankSize);
-	printf("  MOD Score.....: %d bytes\n", m_MODScoreSize);
+	LSPPrintf("MOD File........: %3d KiB\n", (m_ModFileSize + 1023) >> 10);
+	LSPPrintf("  MOD Samples...: %d bytes\n", m_originalModSoundBankSize);
+	LSPPrintf("  MOD Score.....: %d bytes\n", m_MODScoreSize);
 
 	if (m_setBpmCount > 1)
-		printf("  BPM changed %d times during MOD!\n", m_setBpmCount);
+		LSPPrintf("  BPM changed %d times during MOD!\n", m_setBpmCount);
 	else
-		printf("  Main BPM......: %d (%dHz)\n", m_bpm, (m_bpm * 2) / 5);
+		LSPPrintf("  Main BPM......: %d (%dHz)\n", m_bpm, (m_bpm * 2) / 5);
 
 	if ((m_setBpmCount > 1) || (m_bpm != 125))
 	{
 		if (Fixed50Hz())
-			printf("  WARNING: Non conventional BPM with -fixed50hz option, CIA player *NOT* needed!\n");
+			LSPPrintf("  WARNING: Non conventional BPM with -fixed50hz option, CIA player *NOT* needed!\n");
 		else
-			printf("  WARNING: Non conventional BPM, use CIA player!\n");
+			LSPPrintf("  WARNING: Non conventional BPM, use CIA player!\n");
 	}
 	if (m_setFilterCount > 0)
-		printf("  WARNING: Bypass SetFilter command E0 (not supported)\n");
+		LSPPrintf("  WARNING: Bypass SetFilter command E0 (not supported)\n");
 
 	if (m_convertParams.m_verbose)
 	{
-		printf("  Sample offset: %s\n", m_sampleOffsetUsed ? "Yes" : "No");
-		printf("  Sequence count: #%d\n", m_seqHighest+1);
+		LSPPrintf("  Sample offset: %s\n", m_sampleOffsetUsed ? "Yes" : "No");
+		LSPPrintf("  Sequence count: #%d\n", m_seqHighest+1);
 	}
 }
 
@@ -711,6 +753,12 @@ static	void	StoreIntoCmdStream(MemoryStream& stream, int value)
 	stream.Add8(l+1);
 }
 
+// micro stream ids 0..3 are periods, read with move.w: they start at an even offset ( except byte planes )
+static int	MicroStreamPadding(int streamId, int offset, int decodeFlags)
+{
+	return ((streamId < 4) && (0 == (decodeFlags & kMicroPeriodPlanes)) && (offset & 1)) ? 1 : 0;
+}
+
 static int	ComputeCodesTableSize(int codesCount)
 {
 	const int seg255 = (codesCount + 254) / 255;	// # of segments of 255 entries
@@ -724,10 +772,11 @@ int LSPEncoder::ComputeAdpcmInfoSize() const
 	{
 		addSize += 4;		// depackInPlace offset
 		addSize += 4;		// lossless bitmask
+		const bool stepTables = UsesDpcmStepTables();
 		for (int i = 0; i < 31; i++)
 		{
 			if (m_modInstrumentUsedMask & (1 << i))
-				addSize += 2;
+				addSize += stepTables ? 2 + 2 : 2;		// nibble count ( & step table offset )
 		}
 		addSize += 2;		// end "0" marker
 	}
@@ -783,12 +832,13 @@ void	LSPEncoder::ComputeAndFixSampleOffsets()
 	{
 		assert(m_minTickRate > 0);
 		int bankOffset = 4;					// 4 to store first magic bank 32bits number
+		m_bankSampleCount = 0;
 		for (int i = 0; i < 31; i++)
 		{
 			if (m_modInstrumentUsedMask & (1 << i))
 			{
 				LspSample& info = m_lspSamples[i];
-				info.soundBankOffset = bankOffset;
+				m_bankOrder[m_bankSampleCount++] = i;
 
 				if (m_convertParams.m_shrink)
 				{
@@ -796,7 +846,7 @@ void	LSPEncoder::ComputeAndFixSampleOffsets()
 					if (info.repStart + info.repLen > info.len)
 					{
 						int len2 = info.repStart + info.repLen;
-						printf("Instrument #%02d: Len overrun RepLen. Shrinking from %d to %d bytes\n", i+1, info.len, len2);
+						LSPPrintf("Instrument #%02d: Len overrun RepLen. Shrinking from %d to %d bytes\n", i+1, info.len, len2);
 						info.len = len2;
 					}
 
@@ -807,7 +857,7 @@ void	LSPEncoder::ComputeAndFixSampleOffsets()
 						if (info.len > cmpLen)
 						{
 							int len2 = (cmpLen + 1)&(-2);		// always even size
-							printf("Instrument #%02d: Sample not fully replayed. Shrinking from %d to %d bytes\n", i+1, info.len, len2);
+							LSPPrintf("Instrument #%02d: Sample not fully replayed. Shrinking from %d to %d bytes\n", i+1, info.len, len2);
 							info.len = len2;
 							if (info.repStart + info.repLen > len2)
 							{
@@ -831,21 +881,429 @@ void	LSPEncoder::ComputeAndFixSampleOffsets()
 					int oldLen = info.len;
 					info.ExtendSample(sampleToAdd);
 					if (m_convertParams.m_verbose)
-						printf("NOTE: extending micro-sample #%d from %d to %d bytes\n", i + 1, oldLen, info.len);
+						LSPPrintf("NOTE: extending micro-sample #%d from %d to %d bytes\n", i + 1, oldLen, info.len);
 				}
-
-				bankOffset += info.len;
 			}
 		}
+
+		if (m_convertParams.m_adpcm)
+			EncodeDpcmSamples();
+
+		if (m_convertParams.m_optBank)
+			OptimizeBankOrder();
+
+		for (int i = 0; i < m_bankSampleCount; i++)
+		{
+			LspSample& info = m_lspSamples[m_bankOrder[i]];
+			info.soundBankOffset = bankOffset;
+			bankOffset += info.len;
+		}
+		if (m_convertParams.m_shareSamples)
+		{
+			const int sharedSize = ShareSampleBankBytes();
+			LSPPrintf("Samples sharing: %d bytes of chip RAM saved ( bank %d -> %d bytes )\n", bankOffset - sharedSize, bankOffset, sharedSize);
+			bankOffset = sharedSize;
+		}
 		m_lspSoundBankSize = bankOffset;
 	}
 	else
 	{
-		printf("Warning: -nosampleoptim option used. No micro-sample fix will be applied\n");
+		LSPPrintf("Warning: -nosampleoptim option used. No micro-sample fix will be applied\n");
 		m_lspSoundBankSize = m_originalModSoundBankSize;
 	}
 }
 
+// -sharesamples: a sample found inside another one points into its data, then remaining samples are chained
+// when the head of one matches the tail of another ( greedy, largest overlap first ). Returns the new bank size
+int	LSPEncoder::ShareSampleBankBytes()
+{
+	int ids[31];
+	int count = 0;
+	for (int i = 0; i < 31; i++)
+	{
+		if ((m_modInstrumentUsedMask & (1 << i)) && (m_lspSamples[i].len > 0))
+			ids[count++] = i;
+	}
+
+	// longest first, so a sample could only be contained in an already kept one
+	for (int i = 1; i < count; i++)
+	{
+		const int id = ids[i];
+		int j = i;
+		for (; (j > 0) && (m_lspSamples[ids[j - 1]].len < m_lspSamples[id].len); j--)
+			ids[j] = ids[j - 1];
+		ids[j] = id;
+	}
+
+	int parent[31];				// sample containing this one, -1 if stored
+	int parentPos[31];
+	int roots[31];
+	int rootCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const LspSample& info = m_lspSamples[ids[i]];
+		parent[ids[i]] = -1;
+		for (int r = 0; r < rootCount; r++)
+		{
+			const LspSample& root = m_lspSamples[roots[r]];
+			const int pos = FindEvenOccurrence(root.sampleData, root.len, info.sampleData, info.len);
+			if (pos >= 0)
+			{
+				parent[ids[i]] = roots[r];
+				parentPos[ids[i]] = pos;
+				if (m_convertParams.m_verbose)
+					LSPPrintf("Instrument #%02d: %d bytes sample found in instrument #%02d at +%d\n", ids[i] + 1, info.len, roots[r] + 1, pos);
+				break;
+			}
+		}
+		if (parent[ids[i]] < 0)
+			roots[rootCount++] = ids[i];
+	}
+
+	int overlap[31][31] = {};
+	for (int a = 0; a < rootCount; a++)
+	{
+		for (int b = 0; b < rootCount; b++)
+		{
+			if (a != b)
+			{
+				const LspSample& sa = m_lspSamples[roots[a]];
+				const LspSample& sb = m_lspSamples[roots[b]];
+				overlap[a][b] = EvenOverlap(sa.sampleData, sa.len, sb.sampleData, sb.len);
+			}
+		}
+	}
+
+	int next[31];
+	int prev[31];
+	int chainHead[31];
+	for (int r = 0; r < rootCount; r++)
+	{
+		next[r] = -1;
+		prev[r] = -1;
+		chainHead[r] = r;
+	}
+	for (;;)
+	{
+		int best = 0;
+		int bestA = -1;
+		int bestB = -1;
+		for (int a = 0; a < rootCount; a++)
+		{
+			if (next[a] >= 0)
+				continue;
+			for (int b = 0; b < rootCount; b++)
+			{
+				if ((prev[b] < 0) && (chainHead[a] != b) && (overlap[a][b] > best))
+				{
+					best = overlap[a][b];
+					bestA = a;
+					bestB = b;
+				}
+			}
+		}
+		if (0 == best)
+			break;
+		next[bestA] = bestB;
+		prev[bestB] = bestA;
+		for (int r = bestB; r >= 0; r = next[r])
+			chainHead[r] = chainHead[bestA];
+		if (m_convertParams.m_verbose)
+			LSPPrintf("Instrument #%02d: starts with the last %d bytes of instrument #%02d\n", roots[bestB] + 1, best, roots[bestA] + 1);
+	}
+
+	// chains are stored in bank order of their first sample
+	int bankOffset = 4;
+	for (int i = 0; i < m_bankSampleCount; i++)
+	{
+		for (int r = 0; r < rootCount; r++)
+		{
+			if ((roots[r] == m_bankOrder[i]) && (prev[r] < 0))
+			{
+				int offset = bankOffset;
+				for (int c = r; c >= 0; c = next[c])
+				{
+					LspSample& info = m_lspSamples[roots[c]];
+					info.soundBankOffset = offset;
+					bankOffset = offset + info.len;
+					if (next[c] >= 0)
+						offset = bankOffset - overlap[c][next[c]];
+				}
+			}
+		}
+	}
+	for (int i = 0; i < count; i++)
+	{
+		if (parent[ids[i]] >= 0)
+			m_lspSamples[ids[i]].soundBankOffset = m_lspSamples[parent[ids[i]]].soundBankOffset + parentPos[ids[i]];
+	}
+	return bankOffset;
+}
+
+// -adpcm: each sample is encoded with all the step tables ( in parallel ), the one with the lowest squared error is kept
+// -autolossless: samples whose SNR ( or segmental SNR, so noise in quiet parts counts ) is below the threshold stay lossless
+void	LSPEncoder::EncodeDpcmSamples()
+{
+	const ConvertParams& params = m_convertParams;
+	m_timings.Begin(kPhaseAdpcm);
+
+	struct Candidate
+	{
+		int		sample;
+		int		table;
+		u8*		data;
+		int64_t	error;
+		float	segSnr;
+	};
+	std::vector<Candidate> candidates;
+	for (int s = 0; s < m_bankSampleCount; s++)
+	{
+		const int i = m_bankOrder[s];
+		free(m_lspSamples[i].dpcmData);
+		m_lspSamples[i].dpcmData = NULL;
+		m_lspSamples[i].dpcmTable = 0;
+		if (0 == (params.m_losslessMask & (1 << i)))
+		{
+			for (int t = 0; t < kDpcmTableCount; t++)
+				candidates.push_back({ i, t, NULL, 0, 0.f });
+		}
+	}
+
+	ParallelFor(int(candidates.size()), params.m_threadCount, [&](int c)
+	{
+		Candidate& candidate = candidates[c];
+		const LspSample& info = m_lspSamples[candidate.sample];
+		const int8_t* table = dpcmGetTable(candidate.table);
+		candidate.data = (u8*)malloc(info.len / 2);
+		dpcmEncode(info.sampleData, info.len, candidate.data, table);
+		std::vector<int8_t> decoded(info.len);
+		dpcmDecode(candidate.data, info.len / 2, decoded.data(), table);
+		// segmental SNR: mean of 256 samples blocks SNR, clamped to -10..60 dB, silent blocks skipped
+		static const int kSegmentLen = 256;
+		double segSum = 0.0;
+		int segCount = 0;
+		for (int seg = 0; seg < info.len; seg += kSegmentLen)
+		{
+			int64_t signal = 0;
+			int64_t error = 0;
+			for (int i = seg; i < std::min(seg + kSegmentLen, info.len); i++)
+			{
+				const int64_t err = decoded[i] - info.sampleData[i];
+				error += err * err;
+				signal += info.sampleData[i] * info.sampleData[i];
+			}
+			candidate.error += error;
+			if (signal > 0)
+			{
+				segSum += std::min(60.0, std::max(-10.0, 10.0 * log10(double(signal) / double(error + 1))));
+				segCount++;
+			}
+		}
+		candidate.segSnr = segCount ? float(segSum / segCount) : 60.f;
+	});
+
+	const bool autoLossless = (params.m_autoLosslessDb > 0.f);
+	if (autoLossless)
+		LSPPrintf("ADPCM auto lossless ( %.1f dB threshold ):\n", params.m_autoLosslessDb);
+
+	size_t bytes = 0;
+	int adpcmSaving = 0;
+	int losslessCost = 0;
+	size_t c = 0;
+	for (int s = 0; s < m_bankSampleCount; s++)
+	{
+		const int id = m_bankOrder[s];
+		LspSample& info = m_lspSamples[id];
+		if ((c >= candidates.size()) || (candidates[c].sample != id))
+		{
+			if (autoLossless)
+				LSPPrintf("  Instrument #%02d: lossless ( -lossless option ), %d bytes\n", id + 1, info.len);
+			continue;
+		}
+
+		// first one wins on equal error, so the default table is kept when nothing is better
+		int best = 0;
+		for (int t = 1; t < kDpcmTableCount; t++)
+		{
+			if (candidates[c + t].error < candidates[c + best].error)
+				best = t;
+		}
+		info.dpcmData = candidates[c + best].data;
+		info.dpcmTable = best;
+		candidates[c + best].data = NULL;
+		for (int t = 0; t < kDpcmTableCount; t++)
+			free(candidates[c + t].data);
+		bytes += info.len;
+
+		int64_t signal = 0;
+		for (int i = 0; i < info.len; i++)
+			signal += info.sampleData[i] * info.sampleData[i];
+		const float snr = float(10.0 * log10(double(signal + 1) / double(candidates[c + best].error + 1)));
+		const float segSnr = candidates[c + best].segSnr;
+		if (params.m_verbose)
+		{
+			LSPPrintf("Instrument #%02d: ADPCM step table %d ( SNR %.1f dB, default table %.1f dB )\n", id + 1, best,
+				snr, 10.0 * log10(double(signal + 1) / double(candidates[c].error + 1)));
+		}
+		if (autoLossless)
+		{
+			const bool lossless = (std::min(snr, segSnr) < params.m_autoLosslessDb);
+			LSPPrintf("  Instrument #%02d: SNR %5.1f dB, segmental SNR %5.1f dB, ADPCM saves %6d bytes%s\n", id + 1, snr, segSnr, info.len / 2,
+				lossless ? " -> lossless" : "");
+			if (lossless)
+			{
+				m_convertParams.m_losslessMask |= 1 << id;
+				free(info.dpcmData);
+				info.dpcmData = NULL;
+				info.dpcmTable = 0;
+				losslessCost += info.len / 2;
+			}
+			else
+				adpcmSaving += info.len / 2;
+		}
+		c += kDpcmTableCount;
+	}
+	if (autoLossless)
+		LSPPrintf("  ADPCM saves %d bytes, auto lossless samples cost %d bytes\n", adpcmSaving, losslessCost);
+	m_timings.End(kPhaseAdpcm, m_frameCount, bytes);
+}
+
+// -optbank: similar samples close to each other pack better. A fast LZ + literal model scores each samples pair
+// ( cost of a sample right after another one ), then pairs are chained greedily, best gain first. The new order is
+// only kept if the Shrinkler estimate of the whole bank confirms it
+void	LSPEncoder::OptimizeBankOrder()
+{
+	static const int kSearchPreset = 1;
+	static const int kContextBytes = 16 * 1024;		// previous sample tail used to score a pair
+	const ConvertParams& params = m_convertParams;
+	const int count = m_bankSampleCount;
+	if (count < 2)
+		return;
+
+	// bytes stored in the .lsbank for each sample ( ADPCM samples are encoded independently, so order doesn't change them )
+	std::vector<std::vector<u8>> data(count);
+	for (int i = 0; i < count; i++)
+	{
+		const LspSample& info = m_lspSamples[m_bankOrder[i]];
+		if (info.dpcmData)
+			data[i].assign(info.dpcmData, info.dpcmData + info.len / 2);
+		else
+			data[i].assign((const u8*)info.sampleData, (const u8*)info.sampleData + info.len);
+	}
+
+	// literal cost of sample b, alone ( a < 0 ) or right after sample a
+	auto literalCost = [&](int a, int b) -> int64_t
+	{
+		std::vector<u8> buffer;
+		if (a >= 0)
+		{
+			const int context = std::min(kContextBytes, int(data[a].size()));
+			buffer.insert(buffer.end(), data[a].end() - context, data[a].end());
+		}
+		const int start = int(buffer.size());
+		buffer.insert(buffer.end(), data[b].begin(), data[b].end());
+		std::vector<u8> inMatch(buffer.size());
+		LiteralCostModel::MarkMatches(buffer.data(), int(buffer.size()), inMatch.data());
+		LiteralCostModel model;
+		int64_t startCost = 0;
+		for (int i = 0; i < int(buffer.size()); i++)
+		{
+			if (i == start)
+				startCost = model.GetCost();
+			if (!inMatch[i])
+				model.Add(buffer[i], i);
+		}
+		return model.GetCost() - startCost;
+	};
+
+	std::vector<int64_t> alone(count);
+	ParallelFor(count, params.m_threadCount, [&](int b)
+	{
+		alone[b] = literalCost(-1, b);
+	});
+	std::vector<int64_t> gain(count * count, 0);
+	ParallelFor(count * count, params.m_threadCount, [&](int job)
+	{
+		const int a = job / count;
+		const int b = job % count;
+		if (a != b)
+			gain[job] = alone[b] - literalCost(a, b);
+	});
+
+	int next[31];
+	int prev[31];
+	int chainHead[31];
+	for (int i = 0; i < count; i++)
+	{
+		next[i] = -1;
+		prev[i] = -1;
+		chainHead[i] = i;
+	}
+	for (;;)
+	{
+		int64_t best = 0;
+		int bestA = -1;
+		int bestB = -1;
+		for (int a = 0; a < count; a++)
+		{
+			if (next[a] >= 0)
+				continue;
+			for (int b = 0; b < count; b++)
+			{
+				if ((prev[b] < 0) && (chainHead[a] != b) && (gain[a * count + b] > best))
+				{
+					best = gain[a * count + b];
+					bestA = a;
+					bestB = b;
+				}
+			}
+		}
+		if (bestA < 0)
+			break;
+		next[bestA] = bestB;
+		prev[bestB] = bestA;
+		for (int i = bestB; i >= 0; i = next[i])
+			chainHead[i] = chainHead[bestA];
+	}
+
+	// candidate 0 is the current order, candidate 1 the chains in current order of their first sample
+	std::vector<int> orders[2];
+	for (int i = 0; i < count; i++)
+		orders[0].push_back(i);
+	for (int i = 0; i < count; i++)
+	{
+		if (prev[i] < 0)
+		{
+			for (int c = i; c >= 0; c = next[c])
+				orders[1].push_back(c);
+		}
+	}
+	assert(int(orders[1].size()) == count);
+
+	int packedSize[2];
+	ParallelFor(2, params.m_threadCount, [&](int c)
+	{
+		std::vector<u8> bank;
+		for (int i : orders[c])
+			bank.insert(bank.end(), data[i].begin(), data[i].end());
+		packedSize[c] = ShrinklerCompressEstimate(bank.data(), int(bank.size()), kSearchPreset);
+	});
+
+	const bool reorder = (packedSize[1] < packedSize[0]);
+	LSPPrintf("Samples order: packed bank estimate %d -> %d bytes (Shrinkler -%d)\n", packedSize[0], reorder ? packedSize[1] : packedSize[0], kSearchPreset);
+	if (reorder)
+	{
+		int order[31];
+		for (int i = 0; i < count; i++)
+			order[i] = m_bankOrder[orders[1][i]];
+		memcpy(m_bankOrder, order, count * sizeof(int));
+		LSPPrintf("  Order........:");
+		for (int i = 0; i < count; i++)
+			LSPPrintf(" #%02d", m_bankOrder[i] + 1);
+		LSPPrintf("\n");
+	}
+}
+
 int	LSPEncoder::FrameToSeq(int frame) const
 {
 	for (int i = 0; i <= m_seqFinalCount; i++)
@@ -880,7 +1338,7 @@ int	LSPEncoder::FrameToSeq(int frame) const
 // 13 str: 28870 -> 4272
 // 16 str: 67465 -> 4068
 
-bool	LSPEncoder::ExportToLSP()
+bool	LSPEncoder::BuildLSP(LSPConvertOutput* output)
 {
 	bool ret = true;
 
@@ -907,11 +1365,34 @@ bool	LSPEncoder::ExportToLSP()
 
 	m_byteStreamLoopPos = -1;
 	m_wordStreamLoopPos = -1;
+	m_bitStreamLoopPos = -1;
+
+	m_microDecodeFlags = 0;
+	for (int i = 0; i < kMicroModeStreamCount; i++)
+		m_microStreamOrder[i] = i;
 
 	int streamCount = 2;
 
+	// -huffman: cmd codes are collected, then stored as prefix codes in their own bit stream
+	const bool huffman = params.m_huffman && !MicroMode();
+	std::vector<int> cmdCodes;
+	int loopCmdIndex = 0;
+	int cmdCodesByteSize = 0;
+	int bytePadding = 0;
+	auto storeCmd = [&](int cmd)
+	{
+		if (huffman)
+			cmdCodes.push_back(cmd);
+		else
+			StoreIntoCmdStream(streams[kByteStreamId], cmd);
+		cmdSize += ComputeCmdSize(cmd);
+		cmdCodesByteSize += ComputeCmdSize(cmd);
+	};
+
 	m_seqFinalCount = (params.m_seqSetPosSupport || params.m_seqGetPosSupport) ? (m_seqHighest + 1) : 0;
 
+	m_timings.Begin(kPhaseStreams);
+
 	if (MicroMode())
 	{
 		streamCount = kMicroModeStreamCount;
@@ -919,8 +1400,9 @@ bool	LSPEncoder::ExportToLSP()
 		{
 			for (int frame = 0; frame < m_frameCount; frame++)
 			{
-				u16 wordCmd = m_RowData[frame].wordCmd;
-				const ChannelRowData& data = m_ChannelRowData[voice][frame];
+				const LspFrameData& frameData = m_RowData[frame];
+				u16 wordCmd = frameData.wordCmd;
+				const ChannelRowData& data = frameData.voices[voice];
 
 				const int kPerStreamId = 0 + voice;	// period first to be 16bits aligned
 				const int kCmdStreamId = 4 + voice;
@@ -957,14 +1439,14 @@ bool	LSPEncoder::ExportToLSP()
 				// volume
 				if (wordCmd & (1 << (voice + 8)))
 				{
-					assert(m_ChannelRowData[voice][frame].volume <= 64);
-					streams[kVolStreamId].Add8(m_ChannelRowData[voice][frame].volume);
+					assert(data.volume <= 64);
+					streams[kVolStreamId].Add8(data.volume);
 				}
 
 				// period
 				if (wordCmd & (1 << (voice + 4)))
 				{
-					const u16 per = u16(m_ChannelRowData[voice][frame].period);
+					const u16 per = u16(data.period);
 					streams[kPerStreamId].Add8(per>>8);
 					streams[kPerStreamId].Add8(per&255);
 				}
@@ -972,14 +1454,10 @@ bool	LSPEncoder::ExportToLSP()
 				// instrument
 				if (wordCmd & (1 << (voice + 0)))
 				{
-					assert(0 == (data.sampleOffsetInBytes & 255));
-					const int sampleOffsetCode = data.sampleOffsetInBytes >> 8;
-					assert(sampleOffsetCode < 256);
-					assert(data.instrument <= 31);
-					int intrValue = ((data.instrument - 1) << 8) | sampleOffsetCode;
+					int intrValue = ((data.instrument - 1) << 8) | data.sampleOffsetCode;
 					int instrId = m_lspIntrumentEncoder.GetCodeFromValue(intrValue);
 					assert((instrId >= 0) && (instrId <= 255));
-					assert(data.dmaRestart);			// do not support intrument without note
+					assert(frameData.dmaRestartMask & (1 << voice));			// do not support intrument without note
 					streams[kInstStreamId].Add8(instrId);
 				}
 			}
@@ -994,6 +1472,7 @@ bool	LSPEncoder::ExportToLSP()
 			{
 				m_byteStreamLoopPos = streams[kByteStreamId].GetSize();
 				m_wordStreamLoopPos = streams[kWordStreamId].GetSize();
+				loopCmdIndex = int(cmdCodes.size());
 			}
 
 			if ((params.m_seqSetPosSupport) || (params.m_seqGetPosSupport))
@@ -1008,40 +1487,38 @@ bool	LSPEncoder::ExportToLSP()
 					{
 						int cmd = m_cmdEncoder.GetCodeFromValue(m_EscValueGetPos);
 						assert(cmd >= 0);
-						StoreIntoCmdStream(streams[kByteStreamId], cmd);
+						storeCmd(cmd);
 						streams[kByteStreamId].Add8(u8(seq));
-						cmdSize += ComputeCmdSize(cmd);
 						cmdSize += 1;		// seq pos byte
 					}
 				}
 			}
 
-			const u16 wordCmd = m_RowData[frame].wordCmd;
+			const LspFrameData& frameData = m_RowData[frame];
+			const u16 wordCmd = frameData.wordCmd;
 
 			// maybe there is a BPM change
-			if ((m_RowData[frame].bpm) && (m_setBpmCount > 1))
+			if ((frameData.bpm) && (m_setBpmCount > 1))
 			{
 				int cmd = m_cmdEncoder.GetCodeFromValue(m_EscValueSetBpm);
 				assert(cmd >= 0);
-				StoreIntoCmdStream(streams[kByteStreamId], cmd);
-				assert(m_RowData[frame].bpm < 256);
-				streams[kByteStreamId].Add8(u8(m_RowData[frame].bpm));
+				storeCmd(cmd);
+				assert(frameData.bpm < 256);
+				streams[kByteStreamId].Add8(u8(frameData.bpm));
 
-				cmdSize += ComputeCmdSize(cmd);
 				cmdSize += 1;		// bpm byte
 			}
 
 			int cmd = m_cmdEncoder.GetCodeFromValue(wordCmd);
 			assert(cmd >= 0);
-			StoreIntoCmdStream(streams[kByteStreamId], cmd);
-			cmdSize += ComputeCmdSize(cmd);
+			storeCmd(cmd);
 
 			for (int voice = MOD_CHANNEL_COUNT - 1; voice >= 0; voice--)
 			{
 				// volume
 				if (wordCmd & (1 << (voice + 4)))
 				{
-					streams[kByteStreamId].Add8(m_ChannelRowData[voice][frame].volume);
+					streams[kByteStreamId].Add8(frameData.voices[voice].volume);
 					volSize += 1;
 				}
 			}
@@ -1051,7 +1528,7 @@ bool	LSPEncoder::ExportToLSP()
 				// period
 				if (wordCmd & (1 << (voice + 0)))
 				{
-					streams[kWordStreamId].Add16(m_ChannelRowData[voice][frame].period);
+					streams[kWordStreamId].Add16(frameData.voices[voice].period);
 					perSize += 2;
 				}
 			}
@@ -1068,19 +1545,15 @@ bool	LSPEncoder::ExportToLSP()
 
 				if (codeVoice & 2)
 				{
-					const ChannelRowData& data = m_ChannelRowData[voice][frame];
-
-					assert(0 == (data.sampleOffsetInBytes & 255));
-					const int sampleOffsetCode = data.sampleOffsetInBytes >> 8;
-					assert(sampleOffsetCode < 256);
+					const ChannelRowData& data = frameData.voices[voice];
 
-					int intrValue = ((data.instrument - 1) << 8) | sampleOffsetCode;
+					int intrValue = ((data.instrument - 1) << 8) | data.sampleOffsetCode;
 
 					int instrId = m_lspIntrumentEncoder.GetCodeFromValue(intrValue);
 					assert(instrId >= 0);
 
 					int offset = instrId * 12 - currentOffset;
-					if (!data.dmaRestart)
+					if (0 == (frameData.dmaRestartMask & (1 << voice)))
 					{
 						// tricky: if sample set without a note, we point on the "repeat" part of the sample
 						offset += 6;
@@ -1095,12 +1568,60 @@ bool	LSPEncoder::ExportToLSP()
 			}
 		}
 		int rewindCode = m_cmdEncoder.GetCodeFromValue(m_EscValueRewind);
-		StoreIntoCmdStream(streams[kByteStreamId], rewindCode);
-		cmdSize += ComputeCmdSize(rewindCode);
+		storeCmd(rewindCode);
+
+		if (huffman)
+		{
+			// ESC codes are registered once, prefix code lengths need their real usage
+			const int escValues[3] = { m_EscValueRewind, m_EscValueSetBpm, m_EscValueGetPos };
+			for (int e = 0; e < 3; e++)
+			{
+				const int code = m_cmdEncoder.GetCodeFromValue(escValues[e]);
+				if (code >= 0)
+					m_cmdEncoder.SetValueCount(escValues[e], std::max(1, int(std::count(cmdCodes.begin(), cmdCodes.end(), code))));
+			}
+			m_cmdEncoder.HuffmanPack(params.m_verbose ? "Cmd prefix codes" : NULL);
+
+			// byte stream is followed by the bit stream, made of MSB first 16bits words
+			bytePadding = streams[kByteStreamId].GetSize() & 1;
+			if (bytePadding)
+				streams[kByteStreamId].Add8(0);
+			u32 bitBuffer = 0;
+			int bitCount = 0;
+			int bitPos = 0;
+			for (int i = 0; i < int(cmdCodes.size()); i++)
+			{
+				if (i == loopCmdIndex)
+					m_bitStreamLoopPos = bitPos;
+				const int bits = m_cmdEncoder.GetHuffmanBits(cmdCodes[i]);
+				assert((bits >= 1) && (bits <= kHuffmanMaxBits));
+				bitBuffer = (bitBuffer << bits) | m_cmdEncoder.GetHuffmanCode(cmdCodes[i]);
+				bitCount += bits;
+				bitPos += bits;
+				while (bitCount >= 16)
+				{
+					bitCount -= 16;
+					streams[kBitStreamId].Add16(u16(bitBuffer >> bitCount));
+				}
+			}
+			if (bitCount > 0)
+				streams[kBitStreamId].Add16(u16(bitBuffer << (16 - bitCount)));
+			streams[kBitStreamId].Add16(0);		// the player refill could read one word ahead
+			streamCount = 3;
+		}
 	}
+	m_timings.End(kPhaseStreams, m_frameCount);
 
+	if ((params.m_optStreams) && (MicroMode()))
+	{
+		m_timings.Begin(kPhaseStreamLayout);
+		OptimizeMicroLayout(streams);
+		m_timings.End(kPhaseStreamLayout, m_frameCount);
+	}
 
+	m_timings.Begin(kPhaseSampleOffsets);
 	ComputeAndFixSampleOffsets();
+	m_timings.End(kPhaseSampleOffsets, m_frameCount);
 
 	if (params.m_generateInsane)
 	{
@@ -1111,340 +1632,862 @@ bool	LSPEncoder::ExportToLSP()
 
 		const int lspScoreSize = ComputeLSPMusicSize(streamsSize);
 
-		FILE* hc;
-		if (fopen_s(&hc, params.m_sPlayerFilename, "w"))
-			return false;
-		printf("Writing LSP insane player source code (%s)\n", params.m_sPlayerFilename);
+		if (ExportCodeHeader(output->playerSource, lspScoreSize, streams[kWordStreamId].GetSize()))
+			ExportReplayCode(output->playerSource);
 
-		if (ExportCodeHeader(hc, lspScoreSize, streams[kWordStreamId].GetSize()))
-			ExportReplayCode(hc);
-		fclose(hc);
+		// no assembler needed on the user side
+		if ((params.m_insaneObject) && (!BuildInsaneHunkObject(output->playerSource, output->playerObject)))
+			return false;
+		if ((params.m_insaneBinary) && (!BuildInsaneRawBinary(output->playerSource, output->playerBinary)))
+			return false;
 	}
 
-	ExportBank(params.m_sBankFilename);
-	ExportScore(params, streams, streamCount, MicroMode());
+	if ((!ExportBank(output->bank)) || (!ExportScore(params, streams, streamCount, MicroMode(), output->score)))
+		return false;
+
+	if (huffman)
+	{
+		const int prefixTableSize = 2 + kHuffmanMaxBits * 2 + m_cmdEncoder.GetHuffmanSymbolCount() * 2;
+		const int codesTableSize = 2 + ComputeCodesTableSize(m_cmdEncoder.GetCodesCount()) * 2;
+		m_byteCodesScoreSize = m_lspScoreSize - prefixTableSize - 8 - streams[kBitStreamId].GetSize() - bytePadding + codesTableSize + cmdCodesByteSize;
+	}
 
 //	assert(lspScoreSize == m_lspScoreSize);
 
-	printf("LSP File........: %3d KiB\n", (m_lspScoreSize + m_lspSoundBankSize + 1023) >> 10);
-	printf("  LSP Samples...: %d bytes\n", m_lspSoundBankSize);
-	printf("  LSP Score.....: %d bytes\n", m_lspScoreSize);
-	printf("  Duration......: %02d:%02d\n", m_modDurationSec / 60, m_modDurationSec % 60);
-	printf("  LSP Frames....: %d\n", m_frameCount);
+	LSPPrintf("LSP File........: %3d KiB\n", (m_lspScoreSize + m_lspSoundBankSize + 1023) >> 10);
+	LSPPrintf("  LSP Samples...: %d bytes\n", m_lspSoundBankSize);
+	LSPPrintf("  LSP Score.....: %d bytes\n", m_lspScoreSize);
+	LSPPrintf("  Duration......: %02d:%02d\n", m_modDurationSec / 60, m_modDurationSec % 60);
+	LSPPrintf("  LSP Frames....: %d\n", m_frameCount);
 	if (params.m_seqSetPosSupport)
-		printf("  SetPos enabled (%d bytes)\n", m_seqFinalCount * 8);
+		LSPPrintf("  SetPos enabled (%d bytes)\n", m_seqFinalCount * 8);
 	if (params.m_seqGetPosSupport)
-		printf("  GetPos enabled (%d bytes)\n", m_seqFinalCount * 3);	// 2 bytes ESC code + 1 byte seqpos
+		LSPPrintf("  GetPos enabled (%d bytes)\n", m_seqFinalCount * 3);	// 2 bytes ESC code + 1 byte seqpos
 
 	if (m_convertParams.m_verbose)
 	{
-		printf("  Periods count.: %d\n", m_periodEncoder.GetCodesCount());
-		printf("  LSP Instruments: %d\n", m_lspIntrumentEncoder.GetCodesCount());
-		printf("  Cmd count......: %d\n", m_cmdEncoder.GetCodesCount());
-		printf("  Stream details:\n");
+		LSPPrintf("  Periods count.: %d\n", m_periodEncoder.GetCodesCount());
+		LSPPrintf("  LSP Instruments: %d\n", m_lspIntrumentEncoder.GetCodesCount());
+		LSPPrintf("  Cmd count......: %d\n", m_cmdEncoder.GetCodesCount());
+		LSPPrintf("  Stream details:\n");
 		for (int s = 0; s < streamCount; s++)
+			LSPPrintf("    Stream #%02d: %d bytes\n", s, streams[s].GetSize());		// packed sizes are reported with -pack
+	}
+
+	if (m_convertParams.m_lspMicro)
+		LSPPrintf("NOTE: -micro option enabled, please use LightSpeedPlayer_Micro.asm replayer!\n");
+
+	return ret;
+}
+
+bool	LSPEncoder::ConvertFromMemory(const void* modData, int modSize, LSPConvertOutput* output)
+{
+	return LoadModuleFromMemory(modData, modSize) && BuildLSP(output);
+}
+
+static bool	WriteOutputFile(const char* sFilename, const MemoryStream& stream, bool textMode = false)
+{
+	if (!stream.SaveToFile(sFilename, textMode))
+	{
+		LSPPrintf("ERROR: Unable to write file \"%s\"\n", sFilename);
+		return false;
+	}
+	return true;
+}
+
+bool	LSPEncoder::ExportToLSP()
+{
+	const ConvertParams& params = m_convertParams;
+
+	LSPConvertOutput output;
+	if (!BuildLSP(&output))
+		return false;
+
+	if (params.m_generateInsane)
+	{
+		LSPPrintf("Writing LSP insane player source code (%s)\n", params.m_sPlayerFilename);
+		if (!WriteOutputFile(params.m_sPlayerFilename, output.playerSource, true))
+			return false;
+		if (params.m_insaneObject)
 		{
-/*			if (m_convertParams.m_packEstimate)
-			{
-				int packedSize = ShrinklerCompressEstimate((u8*)streams[s].GetRawBuffer(), streams[s].GetSize());
-				const float prc = (float(packedSize) * 100.f) / float(streams[s].GetSize());
-				printf("    Stream #%02d: %d bytes -> %d bytes ( %.02f%% )\n", s, streams[s].GetSize(), packedSize, prc);
-			}
-			else
-*/			{
-				printf("    Stream #%02d: %d bytes\n", s, streams[s].GetSize());
-			}
+			LSPPrintf("Writing LSP insane player hunk object (%s)\n", params.m_sPlayerObjectFilename);
+			if (!WriteOutputFile(params.m_sPlayerObjectFilename, output.playerObject))
+				return false;
+		}
+		if (params.m_insaneBinary)
+		{
+			LSPPrintf("Writing LSP insane player raw binary (%s)\n", params.m_sPlayerBinaryFilename);
+			if (!WriteOutputFile(params.m_sPlayerBinaryFilename, output.playerBinary))
+				return false;
 		}
 	}
 
-	if (m_convertParams.m_lspMicro)
-		printf("NOTE: -micro option enabled, please use LightSpeedPlayer_Micro.asm replayer!\n");
+	LSPPrintf("Writing LSBANK file \"%s\"...\n", params.m_sBankFilename);
+	if (!WriteOutputFile(params.m_sBankFilename, output.bank))
+		return false;
 
-	if (m_convertParams.m_amigaEmulation)
+	LSPPrintf("Writing LSMUSIC file \"%s\"...\n", params.m_sScoreFilename);
+	if (!WriteOutputFile(params.m_sScoreFilename, output.score))
+		return false;
+
+	// preview & packing estimate use the in-memory files, no need to read them back
+	if (params.m_amigaEmulation)
 	{
 		LSPDecoder decoder;
-		decoder.LoadAndRender(m_convertParams.m_sScoreFilename, m_convertParams.m_sBankFilename, m_convertParams.m_sAmigaWavFilename, m_convertParams.m_verbose, m_convertParams.m_loopPreview, m_convertParams.m_mono);
+		m_timings.Begin(kPhasePreview);
+		decoder.RenderFromMemory(output.score.GetRawBuffer(), output.score.GetSize(), output.bank.GetRawBuffer(), output.bank.GetSize(),
+			params.m_sAmigaWavFilename, params.m_verbose, params.m_loopPreview, params.m_mono);
+		m_timings.End(kPhasePreview, decoder.GetRenderedFrameCount());
 	}
 
-	if (m_convertParams.m_packEstimate)
+	if (params.m_packEstimate)
 	{
-		BinaryParser fs;
-		if (fs.LoadFromFile(m_convertParams.m_sScoreFilename))
+		const int size = output.score.GetSize();
+		LSPPrintf("Packing estimation for \"%s\"\n", params.m_sScoreFilename);
+		LSPPrintf("Estimating Amiga Shrinkler packing size... (preset -%d)\n", ShrinklerEstimatePreset());
+
+		// whole file first ( longest job ), then each stream in -v mode, all packed in parallel
+		const int streamJobCount = params.m_verbose ? m_streamCount : 0;
+		int packedSizes[1 + kMicroModeStreamCount];
+		m_timings.Begin(kPhasePackEstimate);
+		ParallelFor(1 + streamJobCount, params.m_threadCount, [&](int job)
+		{
+			u8* data = (u8*)output.score.GetRawBuffer();
+			if (0 == job)
+				packedSizes[job] = ShrinklerCompressEstimate(data, size);
+			else
+				packedSizes[job] = ShrinklerCompressEstimate(data + m_streamScoreOffset[job - 1], m_streamSize[job - 1]);
+		});
+		m_timings.End(kPhasePackEstimate, m_frameCount, size);
+		LSPPrintf("Packing from %d to %d bytes\n", size, packedSizes[0]);
+		for (int s = 0; s < streamJobCount; s++)
 		{
-			int size = fs.GetLen();
-			u8* data = (u8*)fs.GetBuffer();
-			printf("Packing estimation for \"%s\"\n", m_convertParams.m_sScoreFilename);
-			int packedSize = ShrinklerCompressEstimate(data, size);
-			printf("Packing from %d to %d bytes\n", size, packedSize);
+			const float prc = m_streamSize[s] ? (float(packedSizes[1 + s]) * 100.f) / float(m_streamSize[s]) : 0.f;
+			LSPPrintf("    Stream #%02d: %d bytes -> %d bytes ( %.02f%% )\n", s, m_streamSize[s], packedSizes[1 + s], prc);
 		}
 	}
 
-	return ret;
-}
+	if (params.m_huffman)
+		ReportPrefixCodesTradeOff();
 
-uint32_t LSPEncoder::GetBankDepackInPlaceOffset(uint32_t* total) const
-{
-	assert(!m_convertParams.m_keepModSoundBankLayout);
-	uint32_t packedSize = 0;
-	uint32_t totalSize = 0;
-	for (int i = 0; i < 31; i++)
+	if (params.m_cycles)
+		ReportPlayerCost(output);
+
+	if (params.m_timings)
 	{
-		if (m_modInstrumentUsedMask & (1 << i))
+		LSPPrintf("Writing timings file \"%s\"...\n", params.m_sTimingsFilename);
+		if (!m_timings.WriteJson(params.m_sTimingsFilename, params.m_modFilename, m_frameCount))
 		{
-			totalSize += m_lspSamples[i].len;
-			if ( m_convertParams.m_losslessMask & (1<<i))
-				packedSize += m_lspSamples[i].len;
-			else
-				packedSize += m_lspSamples[i].len>>1;
+			LSPPrintf("ERROR: Unable to write file \"%s\"\n", params.m_sTimingsFilename);
+			return false;
 		}
 	}
-	*total = totalSize;
-	return totalSize - packedSize;
+
+	return true;
 }
 
-bool	LSPEncoder::ExportBank(const char* sfilename)
+// -optcodes: search a cmd code order that packs better, using a fast model of Shrinkler literals.
+// Codes stay in their size class ( 1 byte, 2 bytes... ) so the unpacked size & the player speed don't change
+void	LSPEncoder::OptimizeCmdCodes()
 {
-	bool ret = false;
-	FILE* h;
+	const ConvertParams& params = m_convertParams;
+	static const int kCmdToken = 256;		// tokens >= 256 are cmd values, others are plain bytes
+	static const int kMaxEvaluations = 4000;
+	static const int kWorkBudget = 8 << 20;		// modeled bytes, bounds the search time of long songs
 
-	if (0 == fopen_s(&h, sfilename, "wb"))
+	// byte stream content, in BuildLSP order
+	std::vector<int> tokens;
+	for (int frame = 0; frame < m_frameCount; frame++)
 	{
-		printf("Writing LSBANK file \"%s\"...\n", sfilename);
-		w32(h, m_uniqueId);
-		if (m_convertParams.m_keepModSoundBankLayout)
+		const LspFrameData& frameData = m_RowData[frame];
+		if ((params.m_seqGetPosSupport) && (FrameToSeq(frame) >= 0))
 		{
-			assert(m_lspSoundBankSize == m_originalModSoundBankSize);
-			fwrite(m_originalModSoundBank, 1, m_lspSoundBankSize, h);
+			tokens.push_back(kCmdToken + m_EscValueGetPos);
+			tokens.push_back(FrameToSeq(frame));
 		}
-		else
+		if ((frameData.bpm) && (m_setBpmCount > 1))
+		{
+			tokens.push_back(kCmdToken + m_EscValueSetBpm);
+			tokens.push_back(frameData.bpm);
+		}
+		tokens.push_back(kCmdToken + frameData.wordCmd);
+		for (int voice = MOD_CHANNEL_COUNT - 1; voice >= 0; voice--)
+		{
+			if (frameData.wordCmd & (1 << (voice + 4)))
+				tokens.push_back(frameData.voices[voice].volume);
+		}
+	}
+	tokens.push_back(kCmdToken + m_EscValueRewind);
+
+	// LZ matches don't depend on the code order ( same size class ), so only literals are modeled
+	std::vector<u8> bytes;
+	std::vector<int> byteTokens;
+	for (int t : tokens)
+	{
+		if (t >= kCmdToken)
 		{
-			if (m_convertParams.m_adpcm)
+			const int code = m_cmdEncoder.GetCodeFromValue(t - kCmdToken);
+			for (int i = 0; i < code / 255; i++)
 			{
-				uint32_t bankSize = 0;
-				uint32_t inplaceOffset = GetBankDepackInPlaceOffset(&bankSize);
-				assert(0 == (bankSize&1));
-				uint8_t* buffer = (uint8_t *)malloc(bankSize);
-				memset(buffer, 0, bankSize);
-				uint8_t* pw = buffer + inplaceOffset;
-				for (int i = 0; i < 31; i++)
-				{
-					if (m_modInstrumentUsedMask & (1 << i))
-					{
-						const LspSample& info = m_lspSamples[i];
-						assert(0 == (info.len&1));
-						if (m_convertParams.m_losslessMask & (1 << i))
-						{
-							printf("Info: Do not ADPCM compress .MOD instrument #%d\n", i + 1);
-							memcpy(pw, info.sampleData, info.len);
-							pw += info.len;
-						}
-						else
-						{
-							dpcmEncode(info.sampleData, info.len, pw);
-							pw += info.len / 2;
-						}
-					}
-				}
-				fwrite(buffer, 1, bankSize, h);
-				free(buffer);
+				bytes.push_back(0);
+				byteTokens.push_back(0);
 			}
-			else
+			bytes.push_back(u8(code % 255 + 1));
+		}
+		else
+			bytes.push_back(u8(t));
+		byteTokens.push_back(t);
+	}
+	std::vector<u8> inMatch(bytes.size());
+	LiteralCostModel::MarkMatches(bytes.data(), int(bytes.size()), inMatch.data());
+	std::vector<int> literalTokens;
+	std::vector<int> literalPos;
+	for (int i = 0; i < int(bytes.size()); i++)
+	{
+		if (!inMatch[i])
+		{
+			literalTokens.push_back(byteTokens[i]);
+			literalPos.push_back(i);
+		}
+	}
+
+	// codes table + byte stream literals
+	const int codesCount = m_cmdEncoder.GetCodesCount();
+	std::vector<int> codeOfValue(1 << 16, 0);
+	LiteralCostModel model;
+	auto cost = [&](const int* codeToValue) -> int64_t
+	{
+		model.Reset();
+		int pos = 0;
+		for (int code = 0; code < codesCount; code++)
+		{
+			const int value = codeToValue[code];
+			codeOfValue[value] = code;
+			if (0 == (code % 255))
 			{
-				for (int i = 0; i < 31; i++)
-				{
-					if (m_modInstrumentUsedMask & (1 << i))
-					{
-						const LspSample& info = m_lspSamples[i];
-						fwrite(info.sampleData, 1, info.len, h);
-					}
-				}
+				model.Add(0, pos++);
+				model.Add(0, pos++);
 			}
+			model.Add(u8(value >> 8), pos++);
+			model.Add(u8(value), pos++);
+		}
+		for (size_t i = 0; i < literalTokens.size(); i++)
+		{
+			const int t = literalTokens[i];
+			model.Add((t >= kCmdToken) ? u8(codeOfValue[t - kCmdToken] % 255 + 1) : u8(t), literalPos[i]);
 		}
-		fclose(h);
-		ret = true;
+		return model.GetCost();
+	};
+
+	auto currentCost = [&]()
+	{
+		std::vector<int> codeToValue(codesCount);
+		for (int code = 0; code < codesCount; code++)
+			codeToValue[code] = m_cmdEncoder.GetValueFromCode(code);
+		return cost(codeToValue.data());
+	};
+
+	// first use of each value, for the "first use" start order
+	std::vector<int> firstUse(1 << 16, int(tokens.size()));
+	for (int i = int(tokens.size()) - 1; i >= 0; i--)
+	{
+		if (tokens[i] >= kCmdToken)
+			firstUse[tokens[i] - kCmdToken] = i;
 	}
-	return ret;
+
+	const int evaluationBytes = int(literalTokens.size()) + codesCount * 2;
+	const int maxEvaluations = std::max(500, std::min(kMaxEvaluations, kWorkBudget / evaluationBytes));
+
+	const int64_t frequencyCost = currentCost();
+	for (int first = 0; first < codesCount; first += 255)
+	{
+		// start from the best of frequency, value & first use orders, then swap codes
+		const int count = (codesCount - first < 255) ? codesCount - first : 255;
+		std::vector<int> frequencyOrder(count);
+		for (int i = 0; i < count; i++)
+			frequencyOrder[i] = m_cmdEncoder.GetValueFromCode(first + i);
+		std::vector<int> valueOrder = frequencyOrder;
+		std::sort(valueOrder.begin(), valueOrder.end());
+		std::vector<int> firstUseOrder = frequencyOrder;
+		std::stable_sort(firstUseOrder.begin(), firstUseOrder.end(), [&](int a, int b) { return firstUse[a] < firstUse[b]; });
+
+		const std::vector<int>* startOrders[3] = { &frequencyOrder, &valueOrder, &firstUseOrder };
+		int64_t bestCost = -1;
+		const std::vector<int>* bestOrder = NULL;
+		for (const std::vector<int>* order : startOrders)
+		{
+			m_cmdEncoder.SetCodeOrder(first, count, order->data());
+			const int64_t c = currentCost();
+			if ((bestCost < 0) || (c < bestCost))
+			{
+				bestCost = c;
+				bestOrder = order;
+			}
+		}
+		m_cmdEncoder.SetCodeOrder(first, count, bestOrder->data());
+		m_cmdEncoder.OptimizeCodeOrder(first, count, cost, maxEvaluations);
+	}
+	const int64_t optimizedCost = currentCost();
+
+	const int shift = LiteralCostModel::kCostBitShift + 3;
+	const int before = int(frequencyCost >> shift);
+	const int after = int(optimizedCost >> shift);
+	LSPPrintf("Cmd codes order: packed literals estimate %d -> %d bytes (%d bytes saved)\n", before, after, before - after);
 }
 
-bool	LSPEncoder::ExportScore(const ConvertParams& params, MemoryStream* streams, int streamCount, bool microMode)
+// -optstreams: micro streams order & transforms, each candidate layout is packed ( fast Shrinkler preset, in parallel )
+void	LSPEncoder::OptimizeMicroLayout(MemoryStream* streams)
 {
-	bool ret = false;
-	FILE* h;
-	if (0 == fopen_s(&h, params.m_sScoreFilename, "wb"))
+	const ConvertParams& params = m_convertParams;
+	static const int kSearchPreset = 1;
+	static const int kFlagsCount = 8;			// all kMicroDeltaVolume, kMicroDeltaPeriod & kMicroPeriodPlanes combinations
+	static const char kKindNames[4] = { 'P', 'C', 'V', 'I' };		// stream id / 4: period, cmd, volume, instrument
+
+	// transformed copies of volume ( id 8..11 ) & period ( id 0..3 ) streams
+	MemoryStream deltaVolumes[4];
+	MemoryStream periods[3][4];				// delta, planes, delta + planes
+	for (int v = 0; v < 4; v++)
+	{
+		deltaVolumes[v].Add(streams[8 + v]);
+		deltaVolumes[v].DeltaProcess();
+		for (int t = 0; t < 3; t++)
+		{
+			periods[t][v].Add(streams[v]);
+			if (0 == (t & 1))
+				periods[t][v].DeltaProcess16();
+			if (t >= 1)
+				periods[t][v].BytePlaneSplit16();
+		}
+	}
+	auto stream = [&](int id, int flags) -> const MemoryStream&
+	{
+		if ((id >= 8) && (id < 12) && (flags & kMicroDeltaVolume))
+			return deltaVolumes[id - 8];
+		const int t = (flags & (kMicroDeltaPeriod | kMicroPeriodPlanes)) >> 1;
+		if ((id < 4) && (t > 0))
+			return periods[t - 1][id];
+		return streams[id];
+	};
+
+	struct Candidate
+	{
+		int		flags;
+		int		order[kMicroModeStreamCount];
+		int		packedSize;
+	};
+	auto evaluate = [&](std::vector<Candidate>& candidates)
 	{
-		printf("Writing LSMUSIC file \"%s\"...\n", params.m_sScoreFilename);
+		ParallelFor(int(candidates.size()), params.m_threadCount, [&](int c)
+		{
+			Candidate& candidate = candidates[c];
+			std::vector<u8> data;
+			for (int i = 0; i < kMicroModeStreamCount; i++)
+			{
+				const int id = candidate.order[i];
+				if (MicroStreamPadding(id, int(data.size()), candidate.flags))
+					data.push_back(0);
+				const MemoryStream& s = stream(id, candidate.flags);
+				data.insert(data.end(), s.GetRawBuffer(), s.GetRawBuffer() + s.GetSize());
+			}
+			candidate.packedSize = ShrinklerCompressEstimate(data.data(), int(data.size()), kSearchPreset);
+		});
+		// first one wins on equal size, so the plain layout is kept if nothing is better
+		int best = 0;
+		for (int c = 1; c < int(candidates.size()); c++)
+		{
+			if (candidates[c].packedSize < candidates[best].packedSize)
+				best = c;
+		}
+		return candidates[best];
+	};
 
-		if ( microMode)
-			w32(h, 'LSPm');
-		else
-			w32(h, 'LSP1');
-		if (!microMode)		// no uniqueid in micro mode
-			w32(h, m_uniqueId);
-		fputc(LSP_MAJOR_VERSION, h);
-		fputc(LSP_MINOR_VERSION, h);
-		assert(m_bpm > 0);
-
-		if (!microMode)
-		{
-			int code = 0;
-			code |= int(m_convertParams.m_seqGetPosSupport & 1)<<0;
-			code |= int(m_convertParams.m_seqSetPosSupport & 1)<<1;
-			if ( params.m_adpcm )
-				code |= 1 << 2;
-
-			w16(h, code);				// relocation byte & seq timing flags
-			w16(h, m_bpm);
-			w16(h, m_EscValueRewind);
-			w16(h, m_EscValueSetBpm);
-			w16(h, m_EscValueGetPos);
-			w32(h, m_frameCount);
+	// transforms, with the default order
+	std::vector<Candidate> candidates(kFlagsCount);
+	for (int f = 0; f < kFlagsCount; f++)
+	{
+		candidates[f].flags = f;
+		for (int i = 0; i < kMicroModeStreamCount; i++)
+			candidates[f].order[i] = i;
+	}
+	const Candidate defaultLayout = evaluate(candidates);
+	const int plainSize = candidates[0].packedSize;
+
+	// stream orders with the best transforms: each kind order, streams grouped by kind or by voice
+	candidates.clear();
+	int kinds[4] = { 0, 1, 2, 3 };
+	do
+	{
+		for (int byVoice = 0; byVoice < 2; byVoice++)
+		{
+			Candidate candidate;
+			candidate.flags = defaultLayout.flags;
+			for (int i = 0; i < kMicroModeStreamCount; i++)
+				candidate.order[i] = byVoice ? (kinds[i & 3] * 4 + (i >> 2)) : (kinds[i >> 2] * 4 + (i & 3));
+			candidates.push_back(candidate);
+		}
+	}
+	while (std::next_permutation(kinds, kinds + 4));
+	const Candidate best = evaluate(candidates);
+
+	// apply the transforms
+	for (int v = 0; v < 4; v++)
+	{
+		if (best.flags & kMicroDeltaVolume)
+			streams[8 + v].DeltaProcess();
+		if (best.flags & kMicroDeltaPeriod)
+			streams[v].DeltaProcess16();
+		if (best.flags & kMicroPeriodPlanes)
+			streams[v].BytePlaneSplit16();
+	}
+	m_microDecodeFlags = best.flags;
+	for (int i = 0; i < kMicroModeStreamCount; i++)
+		m_microStreamOrder[i] = best.order[i];
+
+	char sOrder[kMicroModeStreamCount * 3 + 1];
+	for (int i = 0; i < kMicroModeStreamCount; i++)
+		snprintf(sOrder + i * 3, 4, "%c%d ", kKindNames[best.order[i] >> 2], best.order[i] & 3);
+	LSPPrintf("Micro streams layout: packed streams estimate %d -> %d bytes (Shrinkler -%d)\n", plainSize, best.packedSize, kSearchPreset);
+	LSPPrintf("  Order........: %s(P period, C cmd, V volume, I instrument)\n", sOrder);
+	LSPPrintf("  Decode flags.: $%x%s%s%s\n", best.flags,
+		(best.flags & kMicroDeltaVolume) ? " delta-volume" : "",
+		(best.flags & kMicroDeltaPeriod) ? " delta-period" : "",
+		(best.flags & kMicroPeriodPlanes) ? " period-planes" : "");
+	if (best.flags)
+		LSPPrintf("NOTE: transformed streams, assemble LightSpeedPlayer_Micro.asm with LSP_MICRO_TRANSFORMS=1\n");
+}
+
+// what each player tick reads, same order as BuildLSP streams
+void	LSPEncoder::BuildPlayerFrames(std::vector<PlayerFrame>& frames) const
+{
+	const ConvertParams& params = m_convertParams;
+	frames.resize(m_frameCount);
+	for (int frame = 0; frame < m_frameCount; frame++)
+	{
+		const LspFrameData& frameData = m_RowData[frame];
+		PlayerFrame& f = frames[frame];
+		memset(&f, 0, sizeof(f));
+		f.wordCmd = frameData.wordCmd;
+		f.bpmChange = (frameData.bpm) && (m_setBpmCount > 1);
+		if (MicroMode())
+		{
+			f.microPrevDmacon = (frame > 0) ? (m_RowData[frame - 1].wordCmd & 0xf) : 0;
+			if ((m_frameLoop > 0) && (frame == m_frameLoop - 1))
+				f.microLoopCmd = 2;
+			if (frame == m_frameCount - 1)
+				f.microLoopCmd = 3;
 		}
 		else
-			w16(h, m_bpm);
+		{
+			f.cmdCode = m_cmdEncoder.GetCodeFromValue(f.wordCmd);
+			if (frame == m_frameLoop)		// music is looping ( ESC rewind read by the tick after the last frame )
+			{
+				f.escKinds[f.escCount] = kEscRewind;
+				f.escCodes[f.escCount++] = m_cmdEncoder.GetCodeFromValue(m_EscValueRewind);
+			}
+			if ((params.m_seqGetPosSupport) && (FrameToSeq(frame) >= 0))
+			{
+				f.escKinds[f.escCount] = kEscGetPos;
+				f.escCodes[f.escCount++] = m_cmdEncoder.GetCodeFromValue(m_EscValueGetPos);
+			}
+			if (f.bpmChange)
+			{
+				f.escKinds[f.escCount] = kEscSetBpm;
+				f.escCodes[f.escCount++] = m_cmdEncoder.GetCodeFromValue(m_EscValueSetBpm);
+			}
+		}
+	}
+}
+
+// -cycles: static estimate of the 68000 player time of each frame
+void	LSPEncoder::ReportPlayerCost(const LSPConvertOutput& output)
+{
+	const ConvertParams& params = m_convertParams;
+	PlayerCostModel model;
+	if (MicroMode())
+		model.SetMicroDecodeFlags(m_microDecodeFlags);
+
+	const bool insane = params.m_generateInsane && (output.playerSource.GetSize() > 0);
+	if (insane)
+	{
+		const int codesCount = m_cmdEncoder.GetCodesCount();
+		model.SetInsaneSource((const char*)output.playerSource.GetRawBuffer(), output.playerSource.GetSize(), codesCount);
+		for (int i = 0; i < codesCount; i++)
+		{
+			if (m_cmdEncoder.IsDummyCodeEntry(i))
+				continue;
+			const int word = m_cmdEncoder.GetValueFromCode(i);
+			if ((m_EscValueRewind == word) || (m_EscValueSetBpm == word) || (m_EscValueGetPos == word))
+				continue;
+			if (m_insaneGenericCycles[i] > 0)
+			{
+				model.SetInsaneRoutineCycles(i, m_insaneGenericCycles[i]);
+				continue;
+			}
+			char sLabel[128] = ".r_";
+			GenLabel(word, sLabel + 3);
+			model.SetInsaneRoutine(i, sLabel);
+		}
+	}
+
+	std::vector<PlayerFrame> frames;
+	BuildPlayerFrames(frames);
+
+	auto describe = [this](int frame, char* desc, int descSize)
+	{
+		int pos = 0;
+		for (int i = 0; i <= m_seqHighest; i++)
+		{
+			if ((m_seqPosFrame[i] >= 0) && (m_seqPosFrame[i] <= frame) && (m_seqPosFrame[i] >= m_seqPosFrame[pos]))
+				pos = i;
+		}
+		snprintf(desc, descSize, "(pos %3d, pattern %3d, row %2d)", pos, m_ModBuffer[952 + pos] & 0x7f, m_RowData[frame].row);
+	};
+
+	static const PlayerVariant normalVariants[] = { kPlayerStandard, kPlayerStandardCia, kPlayerInsane };
+	static const PlayerVariant microVariants[] = { kPlayerMicro, kPlayerMicroCia };
+	const PlayerVariant* variants = MicroMode() ? microVariants : normalVariants;
+	const int variantCount = MicroMode() ? 2 : (insane ? 3 : 2);
+
+	LSPPrintf("Player CPU time estimate (68000 7.09MHz, %d cycles per scanline, no DMA wait state)\n", kCyclesPerScanline);
+	std::vector<int> cycles(m_frameCount);
+	for (int v = 0; v < variantCount; v++)
+	{
+		for (int frame = 0; frame < m_frameCount; frame++)
+			cycles[frame] = model.FrameCycles(variants[v], frames[frame]);
+		PrintPlayerCostReport(variants[v], cycles, describe);
+	}
+}
+
+// -huffman: byte codes & prefix codes score, side by side
+void	LSPEncoder::ReportPrefixCodesTradeOff()
+{
+	PlayerCostModel model;
+	std::vector<PlayerFrame> frames;
+	BuildPlayerFrames(frames);
+
+	int64_t byteSum = 0;
+	int64_t prefixSum = 0;
+	int bytePeak = 0;
+	int prefixPeak = 0;
+	int bufferedBits = 0;
+	for (const PlayerFrame& f : frames)
+	{
+		int byteCycles = 0;
+		int prefixCycles = 0;
+		for (int i = 0; i <= f.escCount; i++)
+		{
+			const int code = (i < f.escCount) ? f.escCodes[i] : f.cmdCode;
+			byteCycles += model.ByteCodeReadCycles(code);
+			prefixCycles += model.PrefixCodeReadCycles(m_cmdEncoder.GetHuffmanBits(code), bufferedBits);
+		}
+		byteSum += byteCycles;
+		prefixSum += prefixCycles;
+		bytePeak = std::max(bytePeak, byteCycles);
+		prefixPeak = std::max(prefixPeak, prefixCycles);
+	}
+	const int frameCount = std::max(1, m_frameCount);
+
+	LSPPrintf("Cmd codes trade-off........: byte codes | prefix codes (-huffman)\n");
+	LSPPrintf("  Score size...............: %6d bytes | %6d bytes (+%d bytes player decode tables)\n", m_byteCodesScoreSize, m_lspScoreSize, PlayerCostModel::kPrefixDecodeTablesSize);
+	LSPPrintf("  Cmd read, average........: %6d cycles | %6d cycles\n", int((byteSum + frameCount / 2) / frameCount), int((prefixSum + frameCount / 2) / frameCount));
+	LSPPrintf("  Cmd read, peak...........: %6d cycles | %6d cycles\n", bytePeak, prefixPeak);
+}
+
+// true if any sample needs a step table other than the default one ( score flag bit 4 )
+bool LSPEncoder::UsesDpcmStepTables() const
+{
+	for (int s = 0; s < m_bankSampleCount; s++)
+	{
+		if (m_lspSamples[m_bankOrder[s]].dpcmTable != 0)
+			return true;
+	}
+	return false;
+}
+
+uint32_t LSPEncoder::GetBankDepackInPlaceOffset(uint32_t* total) const
+{
+	assert(!m_convertParams.m_keepModSoundBankLayout);
+	uint32_t packedSize = 0;
+	uint32_t totalSize = 0;
+	for (int i = 0; i < 31; i++)
+	{
+		if (m_modInstrumentUsedMask & (1 << i))
+		{
+			totalSize += m_lspSamples[i].len;
+			if ( m_convertParams.m_losslessMask & (1<<i))
+				packedSize += m_lspSamples[i].len;
+			else
+				packedSize += m_lspSamples[i].len>>1;
+		}
+	}
+	*total = totalSize;
+	return totalSize - packedSize;
+}
 
-		// ADPCM info
-		if (params.m_adpcm)
+bool	LSPEncoder::ExportBank(MemoryStream& h)
+{
+	h.Add32(m_uniqueId);
+	if (m_convertParams.m_keepModSoundBankLayout)
+	{
+		assert(m_lspSoundBankSize == m_originalModSoundBankSize);
+		h.AddBuffer(m_originalModSoundBank, m_lspSoundBankSize);
+	}
+	else
+	{
+		if (m_convertParams.m_adpcm)
 		{
 			uint32_t bankSize = 0;
 			uint32_t inplaceOffset = GetBankDepackInPlaceOffset(&bankSize);
-			w32(h, inplaceOffset);		// offset for ADPCM nibbles
-			uint32_t losslessMask = 0;
-			int bit = 31;
-			for (int i = 0; i < 31; i++)
+			assert(0 == (bankSize&1));
+			uint8_t* buffer = (uint8_t *)malloc(bankSize);
+			memset(buffer, 0, bankSize);
+			uint8_t* pw = buffer + inplaceOffset;
+			for (int s = 0; s < m_bankSampleCount; s++)
 			{
-				if (m_modInstrumentUsedMask & (1 << i))
+				const int i = m_bankOrder[s];
+				const LspSample& info = m_lspSamples[i];
+				assert(0 == (info.len&1));
+				if (m_convertParams.m_losslessMask & (1 << i))
 				{
-					if (m_convertParams.m_losslessMask & (1 << i))
-						losslessMask |= (1u << bit);
-					bit--;
+					LSPPrintf("Info: Do not ADPCM compress .MOD instrument #%d\n", i + 1);
+					memcpy(pw, info.sampleData, info.len);
+					pw += info.len;
+				}
+				else
+				{
+					memcpy(pw, info.dpcmData, info.len / 2);
+					pw += info.len / 2;
 				}
 			}
-			w32(h, losslessMask);
-
+			h.AddBuffer(buffer, bankSize);
+			free(buffer);
+		}
+		else
+		{
+			// samples could share bytes ( -sharesamples ), so each one is written at its bank offset
+			const int bankSize = m_lspSoundBankSize - 4;
+			s8* bank = (s8*)malloc(bankSize);
+			memset(bank, 0, bankSize);
 			for (int i = 0; i < 31; i++)
 			{
 				if (m_modInstrumentUsedMask & (1 << i))
-					w16(h, (m_lspSamples[i].len / 2)-1);	// nibble count, -1 for DBF
+				{
+					const LspSample& info = m_lspSamples[i];
+					assert(info.soundBankOffset - 4 + info.len <= bankSize);
+					memcpy(bank + info.soundBankOffset - 4, info.sampleData, info.len);
+				}
 			}
-			w16(h, 0);		// end marker
+			h.AddBuffer(bank, bankSize);
+			free(bank);
 		}
+	}
+	return true;
+}
 
-		const int instrumentCount = m_lspIntrumentEncoder.GetCodesCount();
-		w16(h, u16(instrumentCount));
+bool	LSPEncoder::ExportScore(const ConvertParams& params, MemoryStream* streams, int streamCount, bool microMode, MemoryStream& h)
+{
+	if ( microMode)
+		h.Add32(m_microDecodeFlags ? 'LSPt' : 'LSPm');		// 'LSPt': -optstreams transformed streams
+	else
+		h.Add32('LSP1');
+	if (!microMode)		// no uniqueid in micro mode
+		h.Add32(m_uniqueId);
+	h.Add8(LSP_MAJOR_VERSION);
+	h.Add8(LSP_MINOR_VERSION);
+	if ((microMode) && (m_microDecodeFlags))
+		h.Add16(u16(m_microDecodeFlags));
+	assert(m_bpm > 0);
+
+	if (!microMode)
+	{
+		int code = 0;
+		code |= int(m_convertParams.m_seqGetPosSupport & 1)<<0;
+		code |= int(m_convertParams.m_seqSetPosSupport & 1)<<1;
+		if ( params.m_adpcm )
+		{
+			code |= 1 << 2;
+			if (UsesDpcmStepTables())
+				code |= 1 << 4;		// per sample step tables ( otherwise same layout as older versions )
+		}
+		if ( params.m_huffman )
+			code |= 1 << 3;
+
+		h.Add16(code);				// relocation byte & seq timing flags
+		h.Add16(m_bpm);
+		h.Add16(m_EscValueRewind);
+		h.Add16(m_EscValueSetBpm);
+		h.Add16(m_EscValueGetPos);
+		h.Add32(m_frameCount);
+	}
+	else
+		h.Add16(m_bpm);
 
-		// store instruments ( 12 bytes padded )
-		for (int i = 0; i < instrumentCount; i++)
+	// ADPCM info
+	if (params.m_adpcm)
+	{
+		uint32_t bankSize = 0;
+		uint32_t inplaceOffset = GetBankDepackInPlaceOffset(&bankSize);
+		h.Add32(inplaceOffset);		// offset for ADPCM nibbles
+		uint32_t losslessMask = 0;
+		for (int s = 0; s < m_bankSampleCount; s++)
 		{
-			const int sampleId = m_lspIntruments[i].lspSampleId;
-			assert((sampleId >= 1) && (sampleId <= 31));
-			const LspSample& info = m_lspSamples[sampleId-1];
-			int lspLen = info.len - m_lspIntruments[i].sampleOffset;
-			assert(lspLen >= 2);
-			assert(lspLen <= 0xffff*2);
+			if (m_convertParams.m_losslessMask & (1 << m_bankOrder[s]))
+				losslessMask |= (1u << (31 - s));
+		}
+		h.Add32(losslessMask);
 
-			w32(h, info.soundBankOffset + m_lspIntruments[i].sampleOffset);
-			w16(h, lspLen / 2);				// word count
-			w32(h, info.soundBankOffset + info.repStart);
-			w16(h, info.repLen / 2);
+		const bool stepTables = UsesDpcmStepTables();
+		for (int s = 0; s < m_bankSampleCount; s++)
+		{
+			const LspSample& info = m_lspSamples[m_bankOrder[s]];
+			h.Add16((info.len / 2)-1);		// nibble count, -1 for DBF
+			if (stepTables)
+				h.Add16(info.dpcmTable * 16);	// step table offset
 		}
+		h.Add16(0);		// end marker
+	}
+
+	const int instrumentCount = m_lspIntrumentEncoder.GetCodesCount();
+	h.Add16(u16(instrumentCount));
+
+	// store instruments ( 12 bytes padded )
+	for (int i = 0; i < instrumentCount; i++)
+	{
+		const int sampleId = m_lspIntruments[i].lspSampleId;
+		assert((sampleId >= 1) && (sampleId <= 31));
+		const LspSample& info = m_lspSamples[sampleId-1];
+		int lspLen = info.len - m_lspIntruments[i].sampleOffset;
+		assert(lspLen >= 2);
+		assert(lspLen <= 0xffff*2);
+
+		h.Add32(info.soundBankOffset + m_lspIntruments[i].sampleOffset);
+		h.Add16(lspLen / 2);				// word count
+		h.Add32(info.soundBankOffset + info.repStart);
+		h.Add16(info.repLen / 2);
+	}
 
-		if (!microMode)
+	if (!microMode)
+	{
+		if (params.m_huffman)
+		{
+			// prefix codes count per length, then cmd values in canonical order
+			const int symbolCount = m_cmdEncoder.GetHuffmanSymbolCount();
+			h.Add16(u16(symbolCount));
+			for (int len = 1; len <= kHuffmanMaxBits; len++)
+				h.Add16(u16(m_cmdEncoder.GetHuffmanLengthCount(len)));
+			for (int i = 0; i < symbolCount; i++)
+				h.Add16(u16(m_cmdEncoder.GetValueFromCode(m_cmdEncoder.GetCodeFromHuffmanRank(i))));
+		}
+		else
 		{
 			int tableSize = ComputeCodesTableSize(m_cmdEncoder.GetCodesCount());
-			w16(h, tableSize);
+			h.Add16(tableSize);
 
 			for (int i = 0; i < m_cmdEncoder.GetCodesCount(); i++)
 			{
 				if (0 == (i % 255))
-					w16(h, 0);			// 0 is reserved
+					h.Add16(0);			// 0 is reserved
 
 				u16 shortCmd = m_cmdEncoder.GetValueFromCode(i);
-				w16(h, shortCmd);
+				h.Add16(shortCmd);
 			}
+		}
 
-			// save seq info
-			if (params.m_seqSetPosSupport)
-			{
-				w16(h, m_seqFinalCount); // seq count
-				const int wordStreamSize = streams[kWordStreamId].GetSize();
-				for (int i = 0; i < m_seqFinalCount; i++)
-				{
-					w32(h, u32(m_seqPosWordStream[i]));
-					w32(h, u32(m_seqPosByteStream[i])+wordStreamSize);
-				}
-			}
-			else
+		// save seq info
+		if (params.m_seqSetPosSupport)
+		{
+			h.Add16(m_seqFinalCount); // seq count
+			const int wordStreamSize = streams[kWordStreamId].GetSize();
+			for (int i = 0; i < m_seqFinalCount; i++)
 			{
-				w16(h, 0);
+				h.Add32(u32(m_seqPosWordStream[i]));
+				h.Add32(u32(m_seqPosByteStream[i])+wordStreamSize);
 			}
-
-			assert(streams[kWordStreamId].GetSize() / 2 < 65536);
-			assert(0 == (streams[kWordStreamId].GetSize() & 1));
-			w32(h, u32(streams[kWordStreamId].GetSize()));
-			w32(h, u32(m_byteStreamLoopPos));
-			w32(h, u32(m_wordStreamLoopPos));
 		}
 		else
 		{
+			h.Add16(0);
+		}
 
-			/*
-					0 per	0
-					1 per	1
-					2 per	2
-					3 per	3
-					0 cmd	4
-					1 cmd	5
-					2 cmd	6
-					3 cmd	7
-					0 vol	8
-					1 vol	9
-					2 vol	10
-					3 vol	11
-					0 inst	12
-					1 inst	13
-					2 inst	14
-					3 inst	15
-			*/
-			assert(kMicroModeStreamCount == streamCount);
-			int offsets[kMicroModeStreamCount];
-			int offset = 0;
-			for (int i = 0; i < streamCount; i++)
-			{
-				offsets[i] = offset;
-				offset += streams[i].GetSize();
-			}
-
-			// note: streams are ordered so "period" streams come first in the file ( to be even aligned, because of move.w reading )
-			static const int ordering[kMicroModeStreamCount] =
-			{
-				4,5,6,7,			// period streams come first in the file
-				8,9,10,11,
-				0,1,2,3,
-				12,13,14,15
-			};
-			for (int i = 0; i < streamCount; i++)
-				w32(h, offsets[ordering[i]]);
+		assert(streams[kWordStreamId].GetSize() / 2 < 65536);
+		assert(0 == (streams[kWordStreamId].GetSize() & 1));
+		h.Add32(u32(streams[kWordStreamId].GetSize()));
+		h.Add32(u32(m_byteStreamLoopPos));
+		h.Add32(u32(m_wordStreamLoopPos));
+		if (params.m_huffman)
+		{
+			assert(0 == (streams[kByteStreamId].GetSize() & 1));
+			h.Add32(u32(streams[kByteStreamId].GetSize()));
+			h.Add32(u32(m_bitStreamLoopPos));
 		}
+	}
+	else
+	{
 
-		int baseOffset = ftell(h);
-		for (int s = 0; s < streamCount; s++)
+		/*
+				0 per	0
+				1 per	1
+				2 per	2
+				3 per	3
+				0 cmd	4
+				1 cmd	5
+				2 cmd	6
+				3 cmd	7
+				0 vol	8
+				1 vol	9
+				2 vol	10
+				3 vol	11
+				0 inst	12
+				1 inst	13
+				2 inst	14
+				3 inst	15
+		*/
+		assert(kMicroModeStreamCount == streamCount);
+		int offsets[kMicroModeStreamCount];
+		int offset = m_microDecodeFlags ? 4 * 4 : 0;		// 'LSPt': period planes offsets come first
+		for (int i = 0; i < streamCount; i++)
 		{
-			if (m_convertParams.m_verbose)
-			{
-				printf("Offset $%06x : stream #%d\n", baseOffset, s);
-				baseOffset += streams[s].GetSize();
-			}
-			streams[s].FileWrite(h);
+			const int s = m_microStreamOrder[i];
+			offset += MicroStreamPadding(s, offset, m_microDecodeFlags);
+			offsets[s] = offset;
+			offset += streams[s].GetSize();
 		}
 
-		const int scoreSize = ftell(h);
+		// note: streams are ordered so "period" streams come first in the file ( to be even aligned, because of move.w reading )
+		static const int ordering[kMicroModeStreamCount] =
+		{
+			4,5,6,7,			// period streams come first in the file
+			8,9,10,11,
+			0,1,2,3,
+			12,13,14,15
+		};
+		for (int i = 0; i < streamCount; i++)
+			h.Add32(offsets[ordering[i]]);
 
-		m_lspScoreSize = scoreSize;
-		fclose(h);
-		ret = true;
+		if (m_microDecodeFlags)
+		{
+			// distance between high & low bytes of each period stream ( player order )
+			for (int i = 8; i < 12; i++)
+				h.Add32((m_microDecodeFlags & kMicroPeriodPlanes) ? u32(streams[ordering[i]].GetSize() / 2) : 0);
+		}
 	}
 
-	return ret;
+	for (int i = 0; i < streamCount; i++)
+	{
+		const int s = microMode ? m_microStreamOrder[i] : i;
+		if ((microMode) && (MicroStreamPadding(s, h.GetSize(), m_microDecodeFlags)))
+			h.Add8(0);
+		if (m_convertParams.m_verbose)
+			LSPPrintf("Offset $%06x : stream #%d\n", h.GetSize(), s);
+		m_streamScoreOffset[s] = h.GetSize();
+		m_streamSize[s] = streams[s].GetSize();
+		h.Add(streams[s]);
+	}
+	m_streamCount = streamCount;
+
+	m_lspScoreSize = h.GetSize();
+
+	return true;
 }
 
 void	LSPEncoder::GenLabel(int word, char* out)
@@ -1496,15 +2539,269 @@ struct FetchInfo
 	int		offset;
 };
 
-bool	LSPEncoder::ExportReplayCode(FILE* h)
+// false for a label or comment only line
+static bool	HasInstruction(const std::string& line)
 {
+	size_t p = 0;
+	if ((!line.empty()) && (' ' != line[0]) && ('\t' != line[0]))
+	{
+		p = line.find(':');
+		p = (std::string::npos == p) ? line.find_first_of(" \t") : p + 1;
+		if (std::string::npos == p)
+			return false;
+	}
+	p = line.find_first_not_of(" \t", p);
+	return (std::string::npos != p) && (';' != line[p]);
+}
 
-	const int codes_count = m_cmdEncoder.GetCodesCount();
+// generated instructions must all be modeled, or a variant would look cheaper than it is
+static int	LinesCycles(const std::vector<std::string>& lines)
+{
+	int cycles = 0;
+	for (const std::string& line : lines)
+	{
+		if (!HasInstruction(line))
+			continue;
+		const int c = M68kInstructionCycles(line.c_str());
+		assert(c >= 0);
+		cycles += c;
+	}
+	return cycles;
+}
 
+static int	LinesBytes(const std::vector<std::string>& lines)
+{
+	int bytes = 0;
+	for (const std::string& line : lines)
+	{
+		if (!HasInstruction(line))
+			continue;
+		const int b = M68kAssembler::InstructionBytes(line.c_str());
+		assert(b >= 0);
+		bytes += b;
+	}
+	return bytes;
+}
 
-	fprintf_s(h, "; %d specific callback\n", codes_count - 1);
+// reset & instrument fetches of a routine. a4 points .resetv+leaOffset ( no a4 if leaOffset < 0 )
+void	LSPEncoder::GenFetchCode(const FetchInfo* fetchInfo, int fetchCount, int instrCount, int leaOffset, std::vector<std::string>& lines)
+{
+	char line[128];
+	lines.clear();
+	int currentOffset = leaOffset;
+	if (leaOffset > 0)
+	{
+		snprintf(line, sizeof(line), "\t\tlea\t\t.resetv+%d(pc),a4", leaOffset);
+		lines.push_back(line);
+	}
+	else if (0 == leaOffset)
+		lines.push_back("\t\tlea\t\t.resetv(pc),a4");
+
+	if (instrCount > 0)
+		lines.push_back("\t\tmovea.l\ta1,a2");
+
+	for (int i = 0; i < fetchCount; i++)
+	{
+		const FetchInfo& finfo = fetchInfo[i];
+		const int delta = finfo.offset - currentOffset;
+		if (kResetLen == finfo.voiceCode)
+		{
+			if (leaOffset < 0)
+				snprintf(line, sizeof(line), "\t\tmove.l\t.resetv+%d(pc),a3", finfo.offset);
+			else if (0 == delta)
+			{
+				snprintf(line, sizeof(line), "\t\tmove.l\t(a4)+,a3");
+				currentOffset += 4;
+			}
+			else
+				snprintf(line, sizeof(line), "\t\tmove.l\t%d(a4),a3", delta);
+			lines.push_back(line);
+			if (finfo.voice)
+				snprintf(line, sizeof(line), "\t\tmove.l\t(a3)+,$%x0(a6)", finfo.voice);
+			else
+				snprintf(line, sizeof(line), "\t\tmove.l\t(a3)+,(a6)");
+			lines.push_back(line);
+			snprintf(line, sizeof(line), "\t\tmove.w\t(a3)+,$%x4(a6)", finfo.voice);
+			lines.push_back(line);
+		}
+		else
+		{
+			assert(finfo.voiceCode != kNone);
+			lines.push_back("\t\tadd.w\t(a0)+,a2");
+			if (finfo.voice)
+				snprintf(line, sizeof(line), "\t\tmove.l\t(a2)+,$%x0(a6)", finfo.voice);
+			else
+				snprintf(line, sizeof(line), "\t\tmove.l\t(a2)+,(a6)");
+			lines.push_back(line);
+			snprintf(line, sizeof(line), "\t\tmove.w\t(a2)+,$%x4(a6)", finfo.voice);
+			lines.push_back(line);
+			if (finfo.voiceCode == kPlayInstrument)
+			{
+				assert(leaOffset >= 0);
+				if (0 == delta)
+				{
+					snprintf(line, sizeof(line), "\t\tmove.l\ta2,(a4)+");
+					currentOffset += 4;
+				}
+				else
+					snprintf(line, sizeof(line), "\t\tmove.l\ta2,%d(a4)", delta);
+				lines.push_back(line);
+			}
+		}
+	}
+}
+
+// one cmd word routine, as instruction lines ( rts included )
+struct InsaneRoutine
+{
+	std::string					label;
+	std::vector<std::string>	lines;
+	int							cmdCode;
+	int							host;		// routine containing this one as its tail, -1 if emitted
+	int							entry;		// first line of this routine in the host one
+};
+
+// -insane-budget: rare cmd words jump to a generic decoder with d0 = dmacon << 16 | cmd word.
+// Same reads & writes as a specific routine, driven by bit tests ( only d0/a0/a1/a2/a3/a4 used ).
+// word < 0 gives the whole decoder, else only the instructions executed for this cmd word.
+// Returns the taken conditional branches count of this path
+static int	GenGenericDecoder(int word, std::vector<std::string>& lines)
+{
+	const bool all = (word < 0);
+	int taken = 0;
+	char line[128];
+	lines.clear();
+	auto add = [&](bool executed) { if (all || executed) lines.push_back(line); };
+	auto branch = [&](bool isTaken) { lines.push_back(line); taken += ((!all) && (isTaken)) ? 1 : 0; };
+	auto label = [&]() { if (all) lines.push_back(line); };
+
+	for (int v = 3; v >= 0; v--)
+	{
+		const bool volume = (!all) && (word & (1 << (4 + v)));
+		snprintf(line, sizeof(line), "\t\tbtst\t#%d,d0", 4 + v);					add(true);
+		snprintf(line, sizeof(line), "\t\tbeq.s\t.gvol%d", v);					branch(!volume);
+		snprintf(line, sizeof(line), "\t\tmove.b\t(a0)+,$%02x(a6)", v * 16 + 9);	add(volume);
+		snprintf(line, sizeof(line), ".gvol%d:", v);							label();
+	}
+
+	int dmaCon = 0;
+	for (int v = 0; v < 4; v++)
+		dmaCon |= ((!all) && (3 == ((word >> (8 + v * 2)) & 3))) ? (1 << v) : 0;
+	snprintf(line, sizeof(line), "\t\tmove.l\ta0,(a1)+");						add(true);
+	snprintf(line, sizeof(line), "\t\tmove.l\t(a1)+,a0");						add(true);
+	snprintf(line, sizeof(line), "\t\tswap\td0");								add(true);
+	snprintf(line, sizeof(line), "\t\ttst.b\td0");								add(true);
+	snprintf(line, sizeof(line), "\t\tbeq.s\t.gnodma");						branch(0 == dmaCon);
+	snprintf(line, sizeof(line), "\t\tmove.w\td0,$96-$a0(a6)");				add(dmaCon != 0);
+	snprintf(line, sizeof(line), "\t\tmove.b\td0,(a0)");						add(dmaCon != 0);
+	snprintf(line, sizeof(line), ".gnodma:");								label();
+	snprintf(line, sizeof(line), "\t\tswap\td0");								add(true);
+	snprintf(line, sizeof(line), "\t\tmove.l\t(a1),a0");						add(true);
+
+	for (int v = 3; v >= 0; v--)
+	{
+		const bool period = (!all) && (word & (1 << v));
+		snprintf(line, sizeof(line), "\t\tbtst\t#%d,d0", v);						add(true);
+		snprintf(line, sizeof(line), "\t\tbeq.s\t.gper%d", v);					branch(!period);
+		snprintf(line, sizeof(line), "\t\tmove.w\t(a0)+,$%02x(a6)", v * 16 + 6);	add(period);
+		snprintf(line, sizeof(line), ".gper%d:", v);							label();
+	}
+
+	snprintf(line, sizeof(line), "\t\tmovea.l\ta1,a2");						add(true);
+	snprintf(line, sizeof(line), "\t\tlea\t\t.resetv(pc),a4");					add(true);
+	for (int v = 3; v >= 0; v--)
+	{
+		// voice code bits: high one for an instrument fetch, low one for reset or loop pointer backup
+		const int voiceCode = all ? 0 : ((word >> (8 + v * 2)) & 3);
+		const bool instr = (voiceCode >= 2);
+		const bool low = (voiceCode & 1) != 0;
+		const int offset = (3 - v) * 4;
+		char reg[16];
+		char resetv[16];
+		if (v)
+			snprintf(reg, sizeof(reg), "$%x0(a6)", v);
+		else
+			snprintf(reg, sizeof(reg), "(a6)");
+		if (offset)
+			snprintf(resetv, sizeof(resetv), "%d(a4)", offset);
+		else
+			snprintf(resetv, sizeof(resetv), "(a4)");
+
+		snprintf(line, sizeof(line), "\t\tbtst\t#%d,d0", 9 + v * 2);				add(true);
+		snprintf(line, sizeof(line), "\t\tbne.s\t.ginst%d", v);					branch(instr);
+		snprintf(line, sizeof(line), "\t\tbtst\t#%d,d0", 8 + v * 2);				add(!instr);
+		snprintf(line, sizeof(line), "\t\tbeq.s\t.gnext%d", v);					if (all || !instr) branch(!low);
+		snprintf(line, sizeof(line), "\t\tmove.l\t%s,a3", resetv);				add(!instr && low);
+		snprintf(line, sizeof(line), "\t\tmove.l\t(a3)+,%s", reg);				add(!instr && low);
+		snprintf(line, sizeof(line), "\t\tmove.w\t(a3)+,$%x4(a6)", v);			add(!instr && low);
+		snprintf(line, sizeof(line), "\t\tbra.s\t.gnext%d", v);					add(!instr && low);
+		snprintf(line, sizeof(line), ".ginst%d:", v);							label();
+		snprintf(line, sizeof(line), "\t\tadd.w\t(a0)+,a2");						add(instr);
+		snprintf(line, sizeof(line), "\t\tmove.l\t(a2)+,%s", reg);				add(instr);
+		snprintf(line, sizeof(line), "\t\tmove.w\t(a2)+,$%x4(a6)", v);			add(instr);
+		snprintf(line, sizeof(line), "\t\tbtst\t#%d,d0", 8 + v * 2);				add(instr);
+		snprintf(line, sizeof(line), "\t\tbeq.s\t.gnext%d", v);					if (all || instr) branch(!low);
+		snprintf(line, sizeof(line), "\t\tmove.l\ta2,%s", resetv);				add(instr && low);
+		snprintf(line, sizeof(line), ".gnext%d:", v);							label();
+	}
+	snprintf(line, sizeof(line), "\t\tmove.l\ta0,(a1)");						add(true);
+	snprintf(line, sizeof(line), "\t\trts");									add(true);
+	return taken;
+}
+
+// -insane: a routine that is the exact tail of a longer one is only an entry label inside it.
+// Same instructions executed, so replay cycles don't change. Longest routines are hosts, shorter ones look for one.
+// Returns the code bytes saved
+static int	ShareRoutineTails(std::vector<InsaneRoutine>& routines)
+{
+	std::vector<int> order(routines.size());
+	for (int i = 0; i < int(order.size()); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&routines](int a, int b) { return routines[a].lines.size() > routines[b].lines.size(); });
+
+	std::vector<int> hosts;
+	int savedBytes = 0;
+	for (int r : order)
+	{
+		InsaneRoutine& routine = routines[r];
+		routine.host = -1;
+		routine.entry = 0;
+		const size_t len = routine.lines.size();
+		for (int h : hosts)
+		{
+			const std::vector<std::string>& hostLines = routines[h].lines;
+			if (std::equal(routine.lines.rbegin(), routine.lines.rend(), hostLines.rbegin()))
+			{
+				routine.host = h;
+				routine.entry = int(hostLines.size() - len);
+				break;
+			}
+		}
+		if (routine.host < 0)
+			hosts.push_back(r);
+		else
+			savedBytes += LinesBytes(routine.lines);
+	}
+	return savedBytes;
+}
+
+bool	LSPEncoder::ExportReplayCode(MemoryStream& h)
+{
+
+	const int codes_count = m_cmdEncoder.GetCodesCount();
 
 	FetchInfo fetchInfo[4];
+	MemoryStream code;
+	std::vector<InsaneRoutine> routines;
+	std::vector<std::string> fetchLines;
+
+	// routine calls over the song, for the peephole report
+	std::vector<int> calls(codes_count, 0);
+	for (int frame = 0; frame < m_frameCount; frame++)
+		calls[m_cmdEncoder.GetCodeFromValue(m_RowData[frame].wordCmd)]++;
+	int peepholeRoutines = 0;
+	int peepholeMax = 0;
+	int64_t peepholeTotal = 0;
 
 	// gen the code
 	for (int i = 0; i < codes_count; i++)
@@ -1558,7 +2855,10 @@ bool	LSPEncoder::ExportReplayCode(FILE* h)
 
 		char sLabel[128];
 		GenLabel(word, sLabel);
-		fprintf_s(h, ".r_%s:\n", sLabel);
+		InsaneRoutine routine;
+		routine.label = sLabel;
+		routine.cmdCode = i;
+		const int codeStart = code.GetSize();
 
 		const bool dpcA4 = ((resetCount <= 2) && (0 == instrCount));
 
@@ -1567,147 +2867,286 @@ bool	LSPEncoder::ExportReplayCode(FILE* h)
 		{
 			if (word&(1 << v))
 			{
-				fprintf_s(h, "\t\tmove.b\t(a0)+,$%02x(a6)\n", (v-4) * 16 + 9);
+				code.Printf("\t\tmove.b\t(a0)+,$%02x(a6)\n", (v-4) * 16 + 9);
 			}
 		}
 
-		fprintf_s(h, "\t\tmove.l\ta0,(a1)+\n");
+		code.Printf("\t\tmove.l\ta0,(a1)+\n");
 
 
 		const bool needWordStream = (instrCount > 0) || (word & 0xf);	// if instr or periods, need word stream
 
 		if (dmaCount > 0)
 		{
-			fprintf_s(h, "\t\tmove.l\t(a1)+,a0\n");
-			fprintf_s(h, "\t\tmoveq\t#$%02x,d0\n", dmaCon);
-			fprintf_s(h, "\t\tmove.w\td0,$96-$a0(a6)\n");
-			fprintf_s(h, "\t\tmove.b\td0,(a0)\n");
+			code.Printf("\t\tmove.l\t(a1)+,a0\n");
+			code.Printf("\t\tmoveq\t#$%02x,d0\n", dmaCon);
+			code.Printf("\t\tmove.w\td0,$96-$a0(a6)\n");
+			code.Printf("\t\tmove.b\td0,(a0)\n");
 		}
 		else if (needWordStream)
 		{
-			fprintf_s(h, "\t\taddq.w\t#4,a1\n");
+			code.Printf("\t\taddq.w\t#4,a1\n");
 		}
 
 		if ( needWordStream)
-			fprintf_s(h, "\t\tmove.l\t(a1),a0\n");
+			code.Printf("\t\tmove.l\t(a1),a0\n");
 
 		for (int v = 3; v >= 0; v--)
 		{
 			if ( word & (1<<v))
-				fprintf_s(h, "\t\tmove.w\t(a0)+,$%02x(a6)\n", v * 16 + 6);
+				code.Printf("\t\tmove.w\t(a0)+,$%02x(a6)\n", v * 16 + 6);
 		}
 
 
 		if (fetchCount > 0)
 		{
-			int currentOffset = fetchInfo[0].offset;
-			if (!dpcA4)
+			// peephole: .resetv addressing ( pc relative or a4, and a4 start ) with the lowest cycles
+			const int baseOffset = dpcA4 ? -1 : fetchInfo[0].offset;
+			GenFetchCode(fetchInfo, fetchCount, instrCount, baseOffset, fetchLines);
+			const int baseCycles = LinesCycles(fetchLines);
+			int bestOffset = baseOffset;
+			int bestCycles = baseCycles;
+			int bestBytes = LinesBytes(fetchLines);
+			for (int f = -1; f < fetchCount; f++)
 			{
-				if (currentOffset > 0)
-					fprintf_s(h, "\t\tlea\t\t.resetv+%d(pc),a4\n", currentOffset);
-				else
-					fprintf_s(h, "\t\tlea\t\t.resetv(pc),a4\n");
+				const int leaOffset = (f < 0) ? -1 : fetchInfo[f].offset;
+				if ((leaOffset < 0) && (dmaCount > 0))
+					continue;		// instrument loop pointers are written through a4
+				GenFetchCode(fetchInfo, fetchCount, instrCount, leaOffset, fetchLines);
+				const int cycles = LinesCycles(fetchLines);
+				const int bytes = LinesBytes(fetchLines);
+				if ((cycles < bestCycles) || ((cycles == bestCycles) && (bytes < bestBytes)))
+				{
+					bestOffset = leaOffset;
+					bestCycles = cycles;
+					bestBytes = bytes;
+				}
 			}
+			GenFetchCode(fetchInfo, fetchCount, instrCount, bestOffset, fetchLines);
+			for (const std::string& line : fetchLines)
+				code.Printf("%s\n", line.c_str());
+			if (bestCycles < baseCycles)
+			{
+				const int saved = baseCycles - bestCycles;
+				if (m_convertParams.m_verbose)
+					LSPPrintf("  .r_%s: %d cycles saved ( %d calls )\n", sLabel, saved, calls[i]);
+				peepholeRoutines++;
+				peepholeMax = std::max(peepholeMax, saved);
+				peepholeTotal += int64_t(saved) * calls[i];
+			}
+		}
+
+		if (needWordStream)
+			code.Printf("\t\tmove.l\ta0,(a1)\n");
 
-			if ( instrCount > 0)
-				fprintf_s(h, "\t\tmovea.l\ta1,a2\n");
+		code.Printf("\t\trts\n");
 
-			for (int i = 0; i < fetchCount; i++)
+		const char* text = (const char*)code.GetRawBuffer();
+		int lineStart = codeStart;
+		for (int c = codeStart; c < code.GetSize(); c++)
+		{
+			if ('\n' == text[c])
 			{
-				const FetchInfo& finfo = fetchInfo[i];
-				int delta = finfo.offset - currentOffset;
-				if (kResetLen == finfo.voiceCode)
-				{
-					if (dpcA4)
-					{
-						fprintf(h, "\t\tmove.l\t.resetv+%d(pc),a3\n", finfo.offset);
-					}
-					else
-					{
-						if (0 == delta)
-						{
-							fprintf(h, "\t\tmove.l\t(a4)+,a3\n");
-							currentOffset += 4;
-						}
-						else
-						{
-							fprintf(h, "\t\tmove.l\t%d(a4),a3\n", delta);
-						}
-					}
-					if (finfo.voice)
-						fprintf(h, "\t\tmove.l\t(a3)+,$%x0(a6)\n", finfo.voice);
-					else
-						fprintf(h, "\t\tmove.l\t(a3)+,(a6)\n");
-					fprintf(h, "\t\tmove.w\t(a3)+,$%x4(a6)\n", finfo.voice);
-				}
-				else
-				{
-					assert(finfo.voiceCode != kNone);
-					fprintf(h, "\t\tadd.w\t(a0)+,a2\n");
-					if (finfo.voice)
-						fprintf(h, "\t\tmove.l\t(a2)+,$%x0(a6)\n", finfo.voice);
-					else
-						fprintf(h, "\t\tmove.l\t(a2)+,(a6)\n");
-					fprintf(h, "\t\tmove.w\t(a2)+,$%x4(a6)\n", finfo.voice);
-					if (finfo.voiceCode == kPlayInstrument)
-					{
-						if (0 == delta)
-						{
-							fprintf(h, "\t\tmove.l\ta2,(a4)+\n");
-							currentOffset += 4;
-						}
-						else
-						{
-							fprintf(h, "\t\tmove.l\ta2,%d(a4)\n", delta);
-						}
-					}
-				}
+				routine.lines.push_back(std::string(text + lineStart, c - lineStart));
+				lineStart = c + 1;
 			}
 		}
+		routines.push_back(routine);
+	}
 
-		if (needWordStream)
-			fprintf_s(h, "\t\tmove.l\ta0,(a1)\n");
+	LSPPrintf("Insane peephole: %d routines faster ( up to %d cycles ), %lld cycles saved over the song\n", peepholeRoutines, peepholeMax, (long long)peepholeTotal);
+
+	assert(codes_count <= LSP_CMDWORD_MAX);
+	memset(m_insaneGenericCycles, 0, sizeof(m_insaneGenericCycles));
+	std::vector<std::string> genericLines;
+	if (m_convertParams.m_insaneBudget > 0)
+		SelectGenericRoutines(routines, calls, genericLines);
+
+	int codeBytes = 0;
+	for (const InsaneRoutine& routine : routines)
+		codeBytes += LinesBytes(routine.lines);
+	codeBytes += LinesBytes(genericLines);
+	const int savedBytes = ShareRoutineTails(routines);
+
+	int hostCount = 0;
+	for (const InsaneRoutine& routine : routines)
+		hostCount += (routine.host < 0) ? 1 : 0;
+	LSPPrintf("Insane routines: %d of %d share the tail of another one ( %d -> %d code bytes )\n", int(routines.size()) - hostCount, int(routines.size()), codeBytes, codeBytes - savedBytes);
+
+	h.Printf("; %d specific callback\n", codes_count - 1);
+	if (!genericLines.empty())
+		h.Printf("; %d of them only set d0 and jump to the generic decoder ( -insane-budget )\n", int(std::count_if(m_insaneGenericCycles, m_insaneGenericCycles + codes_count, [](int c) { return c > 0; })));
+	h.Printf("; %d of them are the tail of another one ( %d bytes saved )\n", int(routines.size()) - hostCount, savedBytes);
+	for (int r = 0; r < int(routines.size()); r++)
+	{
+		const InsaneRoutine& routine = routines[r];
+		if (routine.host >= 0)
+			continue;
+		h.Printf(".r_%s:\n", routine.label.c_str());
+		for (int l = 0; l < int(routine.lines.size()); l++)
+		{
+			for (const InsaneRoutine& tail : routines)
+			{
+				if ((r == tail.host) && (l == tail.entry))
+					h.Printf(".r_%s:\n", tail.label.c_str());
+			}
+			h.Printf("%s\n", routine.lines[l].c_str());
+		}
+		h.Printf("\n");
+	}
 
-		fprintf_s(h, "\t\trts\n\n");
+	if (!genericLines.empty())
+	{
+		h.Printf("; generic decoder, d0: dmacon << 16 | cmd word\n");
+		h.Printf(".r_generic:\n");
+		for (const std::string& line : genericLines)
+			h.Printf("%s\n", line.c_str());
+		h.Printf("\n");
 	}
 
 	return true;
 }
 
+// -insane-budget: keep specific routines for the cmds saving the most cycles over the song per code byte,
+// the other ones become a stub jumping to the generic decoder. Budget is checked before tails sharing
+void	LSPEncoder::SelectGenericRoutines(std::vector<InsaneRoutine>& routines, const std::vector<int>& calls, std::vector<std::string>& genericLines)
+{
+	const int budget = m_convertParams.m_insaneBudget;
+	const int count = int(routines.size());
+
+	std::vector<std::vector<std::string>> stubs(count);
+	std::vector<int> specificBytes(count);
+	std::vector<int> specificCycles(count);
+	std::vector<int> genericCycles(count);
+	std::vector<std::string> path;
+	int specificTotal = 0;
+	int stubsTotal = 0;
+	for (int r = 0; r < count; r++)
+	{
+		const InsaneRoutine& routine = routines[r];
+		const int word = m_cmdEncoder.GetValueFromCode(routine.cmdCode);
+		int dmaCon = 0;
+		for (int v = 0; v < 4; v++)
+			dmaCon |= (kPlayInstrument == ((word >> (8 + v * 2)) & 3)) ? (1 << v) : 0;
+		char line[128];
+		snprintf(line, sizeof(line), "\t\tmove.l\t#$%08x,d0", (dmaCon << 16) | word);
+		stubs[r].push_back(line);
+		stubs[r].push_back("\t\tbra.w\t.r_generic");
+
+		const int taken = GenGenericDecoder(word, path);
+		specificBytes[r] = LinesBytes(routine.lines);
+		specificCycles[r] = LinesCycles(routine.lines);
+		genericCycles[r] = LinesCycles(stubs[r]) + LinesCycles(path) + taken * (kBranchTaken - kBranchShortNotTaken);
+		specificTotal += specificBytes[r];
+		stubsTotal += LinesBytes(stubs[r]);
+	}
+
+	if (specificTotal <= budget)
+	{
+		LSPPrintf("Insane budget: all %d routines fit in %d bytes ( %d code bytes )\n", count, budget, specificTotal);
+		return;
+	}
+
+	GenGenericDecoder(-1, genericLines);
+	int bytes = LinesBytes(genericLines) + stubsTotal;
+	if (bytes > budget)
+		LSPPrintf("WARNING: -insane-budget %d bytes is too small, generic decoder & stubs need %d bytes\n", budget, bytes);
+
+	// code bytes added by a specific routine, and cycles it saves over the song
+	std::vector<int> order(count);
+	std::vector<int> extraBytes(count);
+	std::vector<int64_t> gain(count);
+	for (int r = 0; r < count; r++)
+	{
+		order[r] = r;
+		extraBytes[r] = specificBytes[r] - LinesBytes(stubs[r]);
+		gain[r] = int64_t(calls[routines[r].cmdCode]) * (genericCycles[r] - specificCycles[r]);
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+	{
+		if ((extraBytes[a] <= 0) || (extraBytes[b] <= 0))
+			return extraBytes[a] < extraBytes[b];
+		const int64_t ga = gain[a] * extraBytes[b];
+		const int64_t gb = gain[b] * extraBytes[a];
+		if (ga != gb)
+			return ga > gb;
+		return (genericCycles[a] - specificCycles[a]) > (genericCycles[b] - specificCycles[b]);
+	});
+
+	std::vector<bool> specific(count, false);
+	for (int r : order)
+	{
+		if ((extraBytes[r] <= 0) || (bytes + extraBytes[r] <= budget))
+		{
+			specific[r] = true;
+			bytes += extraBytes[r];
+		}
+	}
+
+	int genericCount = 0;
+	int64_t sum = 0;
+	int64_t specificSum = 0;
+	int peak = 0;
+	int specificPeak = 0;
+	for (int r = 0; r < count; r++)
+	{
+		const int n = calls[routines[r].cmdCode];
+		const int cycles = specific[r] ? specificCycles[r] : genericCycles[r];
+		sum += int64_t(n) * cycles;
+		specificSum += int64_t(n) * specificCycles[r];
+		if (n > 0)
+		{
+			peak = std::max(peak, cycles);
+			specificPeak = std::max(specificPeak, specificCycles[r]);
+		}
+		if (!specific[r])
+		{
+			routines[r].lines = stubs[r];
+			m_insaneGenericCycles[routines[r].cmdCode] = genericCycles[r];
+			genericCount++;
+		}
+	}
+	const int frameCount = std::max(1, m_frameCount);
+	LSPPrintf("Insane budget: %d of %d routines through the generic decoder ( %d code bytes, budget %d )\n", genericCount, count, bytes, budget);
+	LSPPrintf("  Cmd routine, average.....: %6d cycles | %6d cycles all specific\n", int((sum + frameCount / 2) / frameCount), int((specificSum + frameCount / 2) / frameCount));
+	LSPPrintf("  Cmd routine, peak........: %6d cycles | %6d cycles all specific\n", peak, specificPeak);
+	LSPPrintf("  Code size................: %6d bytes  | %6d bytes all specific\n", bytes, specificTotal);
+}
+
 static int	toKiB(int v)
 {
 	return (v + 1023) >> 10;
 }
 
-static void	emitLea(FILE* h, int offset, int rs, int rd, const char* comment)
+static void	emitLea(MemoryStream& h, int offset, int rs, int rd, const char* comment)
 {
 	if ( offset != 0 )
 	{
 		if ((offset >= -32768) && (offset <= 32767))
-			fprintf_s(h, "\t\t\tlea\t\t%d(a%d),a%d", offset, rs, rd);
+			h.Printf("\t\t\tlea\t\t%d(a%d),a%d", offset, rs, rd);
 		else
 		{
 			if ( rs != rd )
-				fprintf_s(h, "\t\t\tmovea.l\ta%d,a%d\n", rs, rd);
-			fprintf_s(h, "\t\t\tadd.l\t#%d,a%d", offset, rd);
+				h.Printf("\t\t\tmovea.l\ta%d,a%d\n", rs, rd);
+			h.Printf("\t\t\tadd.l\t#%d,a%d", offset, rd);
 		}
 
 		if ( comment )
-			fprintf_s(h, "\t; %s", comment);
+			h.Printf("\t; %s", comment);
 
-		fprintf_s(h, "\n");
+		h.Printf("\n");
 	}
 }
 
 // generated with the help of https://binaryconvert.dev/string-escape :) 
-static const char*	sAdpcmDepack = "\t\t\ttst.b\t(a5)\t\t\t; already depacked/relocated?\n\t\t\tbne.s\t.skipAdpcm\n\t\t\tbtst\t#2,1(a5)\n\t\t\tbeq.s\t.skipAdpcm\n\n\t\t\tmovem.l\ta0-a2,-(a7)\n\t\t\t\n\t\t; ADPCM decoding\n\t\t\tlea\t\t16(a0),a0\n\t\t\tmove.l\t(a0)+,d2\t\t; dpcm offset\t\t\n\t\t\tmove.l\t(a0)+,d4\t\t; lossless mask\n\t\t\tlea\t\t4(a1,d2.l),a2\n\t\t\taddq.w\t#4,a1\n\t\t\tlea\t\t.dpcmTable(pc),a4\n.dpcmLoop:\tmove.w\t(a0)+,d2\t\t; word count-1\n\t\t\tbeq.s\t.endDepack\t\t; end\n\t\t\tadd.l\td4,d4\t\t\t; ADPCM packed or not\n\t\t\tbcs.s\t.copy\n\t\t\tmoveq\t#0,d6\t\t\t; current sample\n\t\t\tmoveq\t#0,d0\n.dLoop:\t\tmove.b\t(a2)+,d0\n\t\t\tmoveq\t#15,d3\n\t\t\tand.w\td0,d3\n\t\t\tlsr.w\t#4,d0\n\t\t\tadd.b\t0(a4,d0.w),d6\n\t\t\tmove.b\td6,(a1)+\n\t\t\tadd.b\t0(a4,d3.w),d6\n\t\t\tmove.b\td6,(a1)+\n\t\t\tdbf\t\td2,.dLoop\n\t\t\tbra.s\t.dpcmLoop\n.copy:\t\tmove.b\t(a2)+,(a1)+\n\t\t\tmove.b\t(a2)+,(a1)+\n\t\t\tdbf\t\td2,.copy\n\t\t\tbra.s\t.dpcmLoop\n.endDepack:\n\t\t\tmovem.l\t(a7)+,a0-a2\n.skipAdpcm:\t\t\t\n";
+static const char*	sAdpcmDepack = "\t\t\ttst.b\t(a5)\t\t\t; already depacked/relocated?\n\t\t\tbne.s\t.skipAdpcm\n\t\t\tbtst\t#2,1(a5)\n\t\t\tbeq.s\t.skipAdpcm\n\n\t\t\tmovem.l\ta0-a2,-(a7)\n\t\t\t\n\t\t; ADPCM decoding\n\t\t\tlea\t\t16(a0),a0\n\t\t\tmove.l\t(a0)+,d2\t\t; dpcm offset\t\t\n\t\t\tmove.l\t(a0)+,d4\t\t; lossless mask\n\t\t\tlea\t\t4(a1,d2.l),a2\n\t\t\taddq.w\t#4,a1\n.dpcmLoop:\tmove.w\t(a0)+,d2\t\t; word count-1\n\t\t\tbeq.s\t.endDepack\t\t; end\n\t\t\tlea\t\t.dpcmTable(pc),a4\n\t\t\tbtst\t#4,1(a5)\t\t; per sample step tables?\n\t\t\tbeq.s\t.table0\n\t\t\tadda.w\t(a0)+,a4\t\t; step table offset\n.table0:\t\t\tadd.l\td4,d4\t\t\t; ADPCM packed or not\n\t\t\tbcs.s\t.copy\n\t\t\tmoveq\t#0,d6\t\t\t; current sample\n\t\t\tmoveq\t#0,d0\n.dLoop:\t\tmove.b\t(a2)+,d0\n\t\t\tmoveq\t#15,d3\n\t\t\tand.w\td0,d3\n\t\t\tlsr.w\t#4,d0\n\t\t\tadd.b\t0(a4,d0.w),d6\n\t\t\tmove.b\td6,(a1)+\n\t\t\tadd.b\t0(a4,d3.w),d6\n\t\t\tmove.b\td6,(a1)+\n\t\t\tdbf\t\td2,.dLoop\n\t\t\tbra.s\t.dpcmLoop\n.copy:\t\tmove.b\t(a2)+,(a1)+\n\t\t\tmove.b\t(a2)+,(a1)+\n\t\t\tdbf\t\td2,.copy\n\t\t\tbra.s\t.dpcmLoop\n.endDepack:\n\t\t\tmovem.l\t(a7)+,a0-a2\n.skipAdpcm:\t\t\t\n";
 
-bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
+bool	LSPEncoder::ExportCodeHeader(MemoryStream& h, int lspScoreSize, int wordStreamSize)
 {
 	const ConvertParams& params = m_convertParams;
 
-	fprintf_s(h, ";*****************************************************************\n");
-	fprintf_s(h,";\n"
+	h.Printf(";*****************************************************************\n");
+	h.Printf(";\n"
 		";\tLight Speed Player v%d.%02d\n"
 		";\tFastest Amiga MOD player ever :)\n"
 		";\tWritten By Arnaud Carr (aka Leonard / OXYGENE)\n"
@@ -1723,23 +3162,23 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 
 		const int lspInstrumentCount = m_lspIntrumentEncoder.GetCodesCount();
 
-		fprintf_s(h, ";\t*WARNING* This generated source code specific to \"%s\" LSP file\n",params.m_sScoreFilename);
-
-		fprintf_s(h, ";\n");
-		fprintf_s(h, ";\t--------How to use--------- \n");
-		fprintf_s(h, ";\n");
-		fprintf_s(h, ";\tbsr LSP_MusicInitInsane : Init LSP player code & music\n");
-		fprintf_s(h, ";\t\ta0: LSP music data(any memory)\n");
-		fprintf_s(h, ";\t\ta1: LSP sound bank(chip memory)\n");
-		fprintf_s(h, ";\t\ta2: DMACON 8bits low byte address (odd)\n");
-		fprintf_s(h, ";\n");
-		fprintf_s(h, ";\tbsr LSP_MusicPlayTickInsane : LSP player tick (call once per frame)\n");
-		fprintf_s(h, ";\t\ta6: should be $dff0a0 (and not $dff000)\n");
-		fprintf_s(h, ";\t\tUsed regs: d0/a0/a1/a2/a3/a4\n");
-		fprintf_s(h, ";\n");
-		fprintf_s(h, ";*****************************************************************\n");
-
-		fprintf_s(h, "\n"
+		h.Printf(";\t*WARNING* This generated source code specific to \"%s\" LSP file\n",params.m_sScoreFilename);
+
+		h.Printf(";\n");
+		h.Printf(";\t--------How to use--------- \n");
+		h.Printf(";\n");
+		h.Printf(";\tbsr LSP_MusicInitInsane : Init LSP player code & music\n");
+		h.Printf(";\t\ta0: LSP music data(any memory)\n");
+		h.Printf(";\t\ta1: LSP sound bank(chip memory)\n");
+		h.Printf(";\t\ta2: DMACON 8bits low byte address (odd)\n");
+		h.Printf(";\n");
+		h.Printf(";\tbsr LSP_MusicPlayTickInsane : LSP player tick (call once per frame)\n");
+		h.Printf(";\t\ta6: should be $dff0a0 (and not $dff000)\n");
+		h.Printf(";\t\tUsed regs: d0/a0/a1/a2/a3/a4\n");
+		h.Printf(";\n");
+		h.Printf(";*****************************************************************\n");
+
+		h.Printf("\n"
 			"LSP_MusicInitInsane:\n"
 			"\t\t\tmove.l\t#$%08x,d0\n"
 			"\t\t\tcmp.l\t(a1),d0\n"
@@ -1751,40 +3190,40 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 
 		const int skip = ComputeLSPMusicSize(0) - 8;	// already read 8 bytes ( LSP1 + unique id )
 
-		fprintf_s(h, "\t\t\tlea\t\t2(a0),a5\t\t; relocation byte\n");
+		h.Printf("\t\t\tlea\t\t2(a0),a5\t\t; relocation byte\n");
 
-		fprintf_s(h, sAdpcmDepack);
+		h.Printf(sAdpcmDepack);
 
-		fprintf_s(h, "\t\t\tlea\t\t%d(a0),a0\t\t; skip header\n", skip);
+		h.Printf("\t\t\tlea\t\t%d(a0),a0\t\t; skip header\n", skip);
 
-		fprintf_s(h,
+		h.Printf(
 			"\t\t\tlea\t\tLSP_StateInsane(pc),a3\n"
 			"\t\t\tmove.l\ta2,12(a3)\n"
 			"\t\t\tmove.l\ta0,16(a3)\t\t; word stream ptr\n");
 
 		emitLea(h, wordStreamSize, 0, 4, nullptr);
-		fprintf_s(h, "\t\t\tmove.l\ta4,8(a3)\t\t; byte stream ptr\n\n");
+		h.Printf("\t\t\tmove.l\ta4,8(a3)\t\t; byte stream ptr\n\n");
 
 		emitLea(h, m_wordStreamLoopPos, 0, 0, "word stream loop pos");
-		fprintf_s(h, "\t\t\tmove.l\ta0,(a3)\t; word stream loop ptr\n");
+		h.Printf("\t\t\tmove.l\ta0,(a3)\t; word stream loop ptr\n");
 
 		emitLea(h, m_byteStreamLoopPos, 4, 4, "byte stream loop pos");
-		fprintf_s(h, "\t\t\tmove.l\ta4,24(a3)\t; byte stream loop ptr\n");
+		h.Printf("\t\t\tmove.l\ta4,24(a3)\t; byte stream loop ptr\n");
 
 
 
-		fprintf_s(h,
+		h.Printf(
 			"\t\t\ttst.b\t(a5)\n"
 			"\t\t\tbne.s\t.noReloc\n"
 			"\t\t\tst\t\t(a5)\n");
 
 		if (lspInstrumentCount < 128)
-			fprintf_s(h, "\t\t\tmoveq\t#%d-1,d0\n", lspInstrumentCount);
+			h.Printf("\t\t\tmoveq\t#%d-1,d0\n", lspInstrumentCount);
 		else
-			fprintf_s(h, "\t\t\tmove.w\t#%d-1,d0\n", lspInstrumentCount);
+			h.Printf("\t\t\tmove.w\t#%d-1,d0\n", lspInstrumentCount);
 
 
-		fprintf_s(h, "\t\t\tlea\t\tLSP_InstrumentInfoInsane(pc),a0\n"
+		h.Printf("\t\t\tlea\t\tLSP_InstrumentInfoInsane(pc),a0\n"
 			"\t\t\tmove.l\ta1,d1\n"
 			".rloop:\t\tadd.l\td1,(a0)\n"
 			"\t\t\tadd.l\td1,6(a0)\n"
@@ -1792,26 +3231,34 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 			"\t\t\tdbf\t\td0,.rloop\n"
 			".noReloc:\tbset.b\t#1,$bfe001\t; disable this fucking Low pass filter!!\n");
 
-		fprintf_s(h, "\t\t\tlea\t\tLSP_StateInsane+6(pc),a0\n");
-		fprintf_s(h, "\t\t\tmove.w\t#%d,(a0)\t\t; music BPM\n", m_bpm);
+		h.Printf("\t\t\tlea\t\tLSP_StateInsane+6(pc),a0\n");
+		h.Printf("\t\t\tmove.w\t#%d,(a0)\t\t; music BPM\n", m_bpm);
 
-		fprintf_s(h, "\t\t\trts\n\n");
+		h.Printf("\t\t\trts\n\n");
 
-		fprintf_s(h,".dataError:\tillegal\n");
-		fprintf_s(h, ".dpcmTable:\tdc.b\t0,1,2,4,8,16,32,64,-128,-64,-32,-16,-8,-4,-2,-1\n\n");
+		h.Printf(".dataError:\tillegal\n");
+		h.Printf(".dpcmTable:\n");
+		for (int t = 0; t < kDpcmTableCount; t++)
+		{
+			const int8_t* dpcmTable = dpcmGetTable(t);
+			h.Printf("\t\t\tdc.b\t");
+			for (int i = 0; i < 16; i++)
+				h.Printf("%d%c", dpcmTable[i], (i < 15) ? ',' : '\n');
+		}
+		h.Printf("\n");
 
-		fprintf_s(h, "LSP_MusicGetPos:\n");
+		h.Printf("LSP_MusicGetPos:\n");
 		if ( params.m_seqGetPosSupport )
-			fprintf_s(h, "\t\t\tmove.w\tLSP_CurrentPos(pc),d0\n");
+			h.Printf("\t\t\tmove.w\tLSP_CurrentPos(pc),d0\n");
 		else
-			fprintf_s(h, "\t\t\tmoveq\t#0,d0\t\t; (music have been generated without \"-getpos\" support)\n");
-		fprintf_s(h, "\t\t\trts\n\n");
+			h.Printf("\t\t\tmoveq\t#0,d0\t\t; (music have been generated without \"-getpos\" support)\n");
+		h.Printf("\t\t\trts\n\n");
 
 		if (params.m_seqGetPosSupport)
-			fprintf_s(h, "LSP_CurrentPos:\t\tdc.w\t0\n");
+			h.Printf("LSP_CurrentPos:\t\tdc.w\t0\n");
 
 		// gen LSPVars
-		fprintf_s(h,
+		h.Printf(
 			"LSP_StateInsane:\tdc.l\t0\t\t\t; 0  word stream loop\n"
 			"\t\t\t\t\tdc.w\t0\t\t\t; 4  reloc has been done\n"
 			"\t\t\t\t\tdc.w\t0\t\t\t; 6  current music BPM\n"
@@ -1822,9 +3269,9 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 			"\t\t\t\t\tdc.l\t0\t\t\t; 24 byte stream loop\n"
 			"\n");
 
-		fprintf(h, "; WARNING: in word stream, instrument offset is shifted by -12 bytes (3 last long of LSP_StateInsane)\n");
+		h.Printf("; WARNING: in word stream, instrument offset is shifted by -12 bytes (3 last long of LSP_StateInsane)\n");
 
-		fprintf_s(h, "LSP_InstrumentInfoInsane:\t\t\t; (%d instruments)\n", lspInstrumentCount);
+		h.Printf("LSP_InstrumentInfoInsane:\t\t\t; (%d instruments)\n", lspInstrumentCount);
 
 		// gen sampleInfo
 		for (int i = 0; i < lspInstrumentCount; i++)
@@ -1840,7 +3287,7 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 			assert(lspLen >= 2);
 			assert(lspLen <= 0xffff * 2);
 
-			fprintf_s(h, "\t\t\tdc.w\t$%04x,$%04x,$%04x,$%04x,$%04x,$%04x\n",
+			h.Printf("\t\t\tdc.w\t$%04x,$%04x,$%04x,$%04x,$%04x,$%04x\n",
 				startAd >> 16,
 				startAd & 0xffff,
 				lspLen / 2,
@@ -1849,45 +3296,45 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 				info.repLen / 2);
 		}
 
-		fprintf_s(h, "\n");
+		h.Printf("\n");
 
 		const int hc = m_cmdEncoder.GetCodesCount() / 255;
 
-		fprintf_s(h, "LSP_MusicPlayTickInsane:\n");
-		fprintf_s(h, "\t\t\tlea\t\tLSP_StateInsane+8(pc),a1\n");
-		fprintf_s(h, "\t\t\tmove.l\t(a1),a0\t\t; byte stream\n");
-		fprintf_s(h, ".process:\tmoveq\t#0,d0\n");
-		fprintf_s(h, "\t\t\tmove.b\t(a0)+,d0\n");
+		h.Printf("LSP_MusicPlayTickInsane:\n");
+		h.Printf("\t\t\tlea\t\tLSP_StateInsane+8(pc),a1\n");
+		h.Printf("\t\t\tmove.l\t(a1),a0\t\t; byte stream\n");
+		h.Printf(".process:\tmoveq\t#0,d0\n");
+		h.Printf("\t\t\tmove.b\t(a0)+,d0\n");
 		if ( hc>0 )
-			fprintf_s(h, "\t\t\tbeq.s\t.extended1\n");
-		fprintf_s(h, "\t\t\tadd.w\td0,d0\n");
-		fprintf_s(h, "\t\t\tmove.w\t.LSP_JmpTable(pc,d0.w),d0\t; 14 cycles\n");
-		fprintf_s(h, "\t\t\tjmp\t\t.LSP_JmpTable(pc,d0.w)\t\t; 14 cycles\n");
-		fprintf_s(h, "\n");
+			h.Printf("\t\t\tbeq.s\t.extended1\n");
+		h.Printf("\t\t\tadd.w\td0,d0\n");
+		h.Printf("\t\t\tmove.w\t.LSP_JmpTable(pc,d0.w),d0\t; 14 cycles\n");
+		h.Printf("\t\t\tjmp\t\t.LSP_JmpTable(pc,d0.w)\t\t; 14 cycles\n");
+		h.Printf("\n");
 
 		if (hc>0)
 		{
-			fprintf_s(h, ".extended1:\tmove.w\t#$0100,d0\n");
-			fprintf_s(h, "\t\t\tmove.b\t(a0)+,d0\n");
+			h.Printf(".extended1:\tmove.w\t#$0100,d0\n");
+			h.Printf("\t\t\tmove.b\t(a0)+,d0\n");
 			if (hc > 1)
-				fprintf_s(h, "\t\t\tbeq.s\t.extended2\n");
-			fprintf_s(h, "\t\t\tadd.w\td0,d0\n");
-			fprintf_s(h, "\t\t\tmove.w\t.LSP_JmpTable(pc,d0.w),d0\n");
-			fprintf_s(h, "\t\t\tjmp\t\t.LSP_JmpTable(pc,d0.w)\n");
-			fprintf_s(h, "\n");
+				h.Printf("\t\t\tbeq.s\t.extended2\n");
+			h.Printf("\t\t\tadd.w\td0,d0\n");
+			h.Printf("\t\t\tmove.w\t.LSP_JmpTable(pc,d0.w),d0\n");
+			h.Printf("\t\t\tjmp\t\t.LSP_JmpTable(pc,d0.w)\n");
+			h.Printf("\n");
 		}
 
 		if (hc > 1)
 		{
-			fprintf_s(h, ".extended2:\tmove.w\t#$0200,d0\n");
-			fprintf_s(h, "\t\t\tmove.b\t(a0)+,d0\n");
-			fprintf_s(h, "\t\t\tadd.w\td0,d0\n");
-			fprintf_s(h, "\t\t\tmove.w\t.LSP_JmpTable(pc,d0.w),d0\n");
-			fprintf_s(h, "\t\t\tjmp\t\t.LSP_JmpTable(pc,d0.w)\n");
-			fprintf_s(h, "\n");
+			h.Printf(".extended2:\tmove.w\t#$0200,d0\n");
+			h.Printf("\t\t\tmove.b\t(a0)+,d0\n");
+			h.Printf("\t\t\tadd.w\td0,d0\n");
+			h.Printf("\t\t\tmove.w\t.LSP_JmpTable(pc,d0.w),d0\n");
+			h.Printf("\t\t\tjmp\t\t.LSP_JmpTable(pc,d0.w)\n");
+			h.Printf("\n");
 		}
 
-		fprintf_s(h,
+		h.Printf(
 			".r_rewind:\tmove.l\t0-8(a1),16-8(a1)\n"
 			"\t\t\tmove.l\t24-8(a1),a0\n"
 			"\t\t\tbra.s\t.process\n\n");
@@ -1895,31 +3342,31 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 
 		if (params.m_seqGetPosSupport)
 		{
-			fprintf_s(h,".r_getpos:\tmove.b\t(a0)+,-9(a1)\t; patch LSP_CurrentPos low byte\n"
+			h.Printf(".r_getpos:\tmove.b\t(a0)+,-9(a1)\t; patch LSP_CurrentPos low byte\n"
 			          	"\t\t\tbra.s\t.process\n\n");
 		}
 
 		if (m_setBpmCount > 1)
 		{
-			fprintf_s(h,
+			h.Printf(
 				".r_setBPM:\tmove.b\t(a0)+,-1(a1)\t; patch BPM byte\n"
 				"\t\t\tbra.s\t.process\n\n");
 		}
 
-		fprintf_s(h, ".resetv:\tdc.l\t0,0,0,0\n");
+		h.Printf(".resetv:\tdc.l\t0,0,0,0\n");
 
 
 		const int codes_count = m_cmdEncoder.GetCodesCount();
-		fprintf_s(h, "\n.LSP_JmpTable:\t\t; (%d codes)\n", codes_count);
+		h.Printf("\n.LSP_JmpTable:\t\t; (%d codes)\n", codes_count);
 		for (int i = 0; i < codes_count; i++)
 		{
 			if (0 == (i % 255))
 			{
-				fprintf_s(h, "\t\t\tdc.w\t-1\t\t; extended code\n");
+				h.Printf("\t\t\tdc.w\t-1\t\t; extended code\n");
 			}
 			if (m_cmdEncoder.IsDummyCodeEntry(i))
 			{
-				fprintf_s(h, "\t\t\tdc.w\t$0000\t\t; dummy code\n");
+				h.Printf("\t\t\tdc.w\t$0000\t\t; dummy code\n");
 			}
 			else
 			{
@@ -1931,7 +3378,7 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 				{
 					if (m_setBpmCount <= 1)
 					{
-						fprintf_s(h, "\t\t\tdc.w\t$0000\t\t; SetBpm code (not used in this music)\n");
+						h.Printf("\t\t\tdc.w\t$0000\t\t; SetBpm code (not used in this music)\n");
 						genLabel = false;
 					}
 				}
@@ -1939,7 +3386,7 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 				{
 					if (!params.m_seqGetPosSupport)
 					{
-						fprintf_s(h, "\t\t\tdc.w\t$0000\t\t; no GetPos (not supported in insane player)\n");
+						h.Printf("\t\t\tdc.w\t$0000\t\t; no GetPos (not supported in insane player)\n");
 						genLabel = false;
 					}
 				}
@@ -1947,11 +3394,11 @@ bool	LSPEncoder::ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize)
 				if ( genLabel )
 				{
 					GenLabel(word, sLabel);
-					fprintf_s(h, "\t\t\tdc.w\t.r_%s-.LSP_JmpTable\n", sLabel);
+					h.Printf("\t\t\tdc.w\t.r_%s-.LSP_JmpTable\n", sLabel);
 				}
 			}
 		}
-		fprintf_s(h, "\n");
+		h.Printf("\n");
 
 	return true;
 }
\ No newline at end of file
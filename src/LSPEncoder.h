@@ -16,6 +16,14 @@
 #include "LSPTypes.h"
 #include "ValueEncoder.h"
 #include "MemoryStream.h"
+#include "Timings.h"
+#include "ChunkedArray.h"
+#include <vector>
+#include <string>
+
+struct PlayerFrame;
+struct FetchInfo;
+struct InsaneRoutine;
 
 #define		D_MICROMOD_DEBUG				0
 
@@ -42,20 +50,29 @@ struct ConvertParams
 	}
 
 	bool	ParseArgs(int argc, char* argv[]);
+	void	SetDefaultFilenames();
 
 	const char*	m_modFilename;
+	const char*	m_batchSource;				// directory or manifest file ( -batch mode )
+	int			m_threadCount;
+	const char*	m_cacheDir;					// conversion cache directory ( -cache )
 	char		m_sBankFilename[_MAX_PATH];
 	char		m_sScoreFilename[_MAX_PATH];
 	char		m_sPlayerFilename[_MAX_PATH];
+	char		m_sPlayerObjectFilename[_MAX_PATH];		// -insaneobj hunk object
+	char		m_sPlayerBinaryFilename[_MAX_PATH];		// -insanebin raw binary
 	#if D_MICROMOD_DEBUG
 	char		m_sWavFilename[_MAX_PATH];
 	bool		m_renderWav;
 	#endif
 	char		m_sAmigaWavFilename[_MAX_PATH];
+	char		m_sTimingsFilename[_MAX_PATH];
 
 	void		SetNameWithExtension(const char* src, char* dst, const char* sExt, const char* sNamePostfix);
 
 	bool		m_generateInsane;
+	bool		m_insaneObject;
+	bool		m_insaneBinary;
 	bool		m_keepModSoundBankLayout;
 	bool		m_verbose;
 	bool		m_nosettempo;
@@ -64,27 +81,44 @@ struct ConvertParams
 	bool		m_lspMicro;
 	bool		m_fixed50hz;
 	bool		m_packEstimate;
+	bool		m_timings;
+	bool		m_cycles;
+	bool		m_optCodes;
+	bool		m_huffman;
+	bool		m_optStreams;
+	bool		m_shareSamples;
+	bool		m_optBank;
 	bool		m_seqGetPosSupport;
 	bool		m_seqSetPosSupport;
 	bool		m_shrink;
 	bool 		m_adpcm;
 	bool m_mono;
 	uint32_t m_losslessMask;
+	float	m_autoLosslessDb;			// -autolossless SNR threshold, 0 if not used
+	int		m_insaneBudget;				// -insane-budget routines code bytes, 0 if not used
+
+};
 
+// LSP conversion result, without any file system access ( see LSPEncoder::ConvertFromMemory )
+struct LSPConvertOutput
+{
+	MemoryStream	bank;				// .lsbank file content
+	MemoryStream	score;				// .lsmusic file content
+	MemoryStream	playerSource;		// insane player source code ( empty if no m_generateInsane )
+	MemoryStream	playerObject;		// insane player Amiga hunk object ( empty if no m_insaneObject )
+	MemoryStream	playerBinary;		// insane player raw binary ( empty if no m_insaneBinary )
 };
 
 class LSPEncoder
 {
 public:
+	// packed in 32bits: one entry per voice per frame for the whole song
 	struct ChannelRowData
 	{
-		int		period;
-		int		volume;
-		int		instrument;
-		int		sampleOffsetInBytes;
-		bool	dmaRestart;
-		bool	volSet;
-		bool	perSet;
+		u32		period : 12;				// AMIGA_PERIOD_BITS
+		u32		volume : 7;					// 0..64
+		u32		instrument : 5;				// 1..31 (0 means no instrument)
+		u32		sampleOffsetCode : 8;		// $9xx value (sample offset in bytes >> 8)
 	};
 
 	struct LspSample
@@ -97,6 +131,8 @@ public:
 		int resampleMaxLen;			// real sample bytes used (depending of PAULA simulation)
 		int maxReplayRate;			// max PAULA play rate for this sample (to properly fix micro-samples)
 		int sampleOffsetMax;		// max $9xx fx (sample offset) applied to this sample
+		u8*	dpcmData;				// -adpcm nibbles ( NULL if lossless )
+		int dpcmTable;				// -adpcm step table index
 
 		void	ExtendSample(int addedSampleCount);
 	};
@@ -107,16 +143,26 @@ public:
 		int			sampleOffset;
 	};
 
+	// all voices of a frame are interleaved, so readback & export passes walk memory linearly
 	struct LspFrameData
 	{
+		ChannelRowData	voices[MOD_CHANNEL_COUNT];
 		u16		bpm;
 		u16		wordCmd;
+		u8		dmaRestartMask;			// one bit per voice
+		u8		volSetMask;
+		u8		perSetMask;
+		u8		row;					// MOD pattern row ( -cycles report )
+
+		static void	SetVoiceBit(u8& mask, int voice, bool set) { mask = set ? u8(mask | (1 << voice)) : u8(mask & ~(1 << voice)); }
 	};
 
 	LSPEncoder();
 	~LSPEncoder();
 
 	bool	LoadModule();
+	bool	LoadModuleFromMemory(const void* modData, int modSize);
+	bool	ConvertFromMemory(const void* modData, int modSize, LSPConvertOutput* output);
 
 	void	SetPeriod(int channel, int period);
 	void	SetVolume(int channel, int volume);
@@ -132,18 +178,30 @@ public:
 	void	SetSampleFetch(int modSampleId, int offset);
 	void	SetOriginalModSoundBank(int moduleFileSoundBankOffset, int size);
 
-	bool	ExportCodeHeader(FILE* h, int lspScoreSize, int wordStreamSize);
+	bool	ExportCodeHeader(MemoryStream& h, int lspScoreSize, int wordStreamSize);
 	bool	ExportToLSP();
 	bool	NoSetTempoCommand() const { return m_convertParams.m_nosettempo; }
 	bool	Fixed50Hz() const { return m_convertParams.m_fixed50hz; }
 	bool	MicroMode() const { return m_convertParams.m_lspMicro; }
 	bool 	IsEmulatedBpmTick(int speed);
+	bool	IsEmulatedBpmTickPending(int speed) const { return m_bpmEmulatedCounter + m_bpm >= 125 * speed; }
 	bool	ParseArgs(int argc, char* argv[])
 	{
 		return m_convertParams.ParseArgs(argc, argv);
 	}
+	void	SetConvertParams(const ConvertParams& params) { m_convertParams = params; }
+
+	int		GetFrameCount() const { return m_frameCount; }
+	int		GetDurationSec() const { return m_modDurationSec; }
+	int		GetSoundBankSize() const { return m_lspSoundBankSize; }
+	int		GetScoreSize() const { return m_lspScoreSize; }
+	int		GetCmdCount() const { return m_cmdEncoder.GetCodesCount(); }
+	int		GetLSPInstrumentCount() const { return m_lspIntrumentEncoder.GetCodesCount(); }
+	int		GetReplayedFrameCount() const { return m_replayedFrameCount; }
+	const ConvertTimings&	GetTimings() const { return m_timings; }
 
 private:
+	friend class PatternMemo;
 
 	enum VoiceCode
 	{
@@ -155,18 +213,30 @@ private:
 
 	void	Free();
 	void	Reset();
-	bool	ExportBank(const char* sfilename);
-	bool	ExportScore(const ConvertParams& params, MemoryStream* streams, int streamCount, bool microMode);
-	bool	ExportReplayCode(FILE* h);
+	bool	BuildLSP(LSPConvertOutput* output);
+	bool	ExportBank(MemoryStream& h);
+	bool	ExportScore(const ConvertParams& params, MemoryStream* streams, int streamCount, bool microMode, MemoryStream& h);
+	bool	ExportReplayCode(MemoryStream& h);
+	void	SelectGenericRoutines(std::vector<InsaneRoutine>& routines, const std::vector<int>& calls, std::vector<std::string>& genericLines);
+	void	ReportPlayerCost(const LSPConvertOutput& output);
+	void	ReportPrefixCodesTradeOff();
+	void	BuildPlayerFrames(std::vector<PlayerFrame>& frames) const;
+	void	OptimizeCmdCodes();
+	void	OptimizeMicroLayout(MemoryStream* streams);
 	void	AddLSPInstrument(int id, int modInstrument, int sampleOffset);
 
 	int		ComputeLSPMusicSize(int dataStreamSize) const;
 	int 	ComputeAdpcmInfoSize() const;
 	void	ComputeAndFixSampleOffsets();
+	int		ShareSampleBankBytes();
+	void	OptimizeBankOrder();
+	void	EncodeDpcmSamples();
 	void	GenLabel(int word, char* out);
+	static	void	GenFetchCode(const FetchInfo* fetchInfo, int fetchCount, int instrCount, int leaOffset, std::vector<std::string>& lines);
 	int		VoiceCodeCompute(int frameDmaCon, int frameResetMask, int frameInstMask) const;
 	int		FrameToSeq(int frame) const;
 	uint32_t GetBankDepackInPlaceOffset(uint32_t* total) const;
+	bool	UsesDpcmStepTables() const;
 
 
 	int		m_ModFileSize;
@@ -180,10 +250,12 @@ private:
 	int		m_originalModSoundBankSize;
 
 	int		m_lspSoundBankSize;
+	int		m_bankOrder[31];			// used samples, in sound bank order
+	int		m_bankSampleCount;
 	int		m_lspScoreSize;
 
 	int		m_frameCount;
-	int		m_frameMax;
+	int		m_replayedFrameCount;		// frames copied by pattern memoization instead of simulated
 
 	int		m_MODScoreSize;
 	int		m_totalSampleCount;
@@ -219,16 +291,22 @@ private:
 	int				m_frameLoop;
 	int				m_byteStreamLoopPos;
 	int				m_wordStreamLoopPos;
+	int				m_bitStreamLoopPos;			// -huffman: loop point in the prefix codes bit stream
+	int				m_byteCodesScoreSize;		// -huffman: score size if cmd were stored as byte codes
+	int				m_streamCount;
+	int				m_microDecodeFlags;			// -optstreams: stream transforms the micro player has to undo
+	int				m_microStreamOrder[kMicroModeStreamCount];	// micro streams order in the .lsmusic file
+	int				m_streamScoreOffset[kMicroModeStreamCount];	// streams position in the .lsmusic file
+	int				m_streamSize[kMicroModeStreamCount];
+	int				m_insaneGenericCycles[LSP_CMDWORD_MAX];	// -insane-budget: per cmd code, generic decoder cycles ( 0 if specific routine )
 
 	LSPInstrument	m_lspIntruments[LSP_INSTRUMENT_MAX];
-	ChannelRowData*	m_ChannelRowData[MOD_CHANNEL_COUNT];
-	LspFrameData*	m_RowData;
+	ChunkedArray<LspFrameData>		m_RowData;
 	u16*			m_wordCommands_foo;
 	int				m_seqPosFrame[128];
 	int				m_seqPosWordStream[128];
 	int				m_seqPosByteStream[128];
 
 	ConvertParams	m_convertParams;
+	ConvertTimings	m_timings;
 };
-
-extern LSPEncoder gLSPEncoder;
\ No newline at end of file
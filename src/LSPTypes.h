@@ -18,3 +18,7 @@ typedef signed int		s32;
 
 static const int HOST_REPLAY_RATE = 48000;
 
+// "-optstreams" micro score decode flags ( 'LSPt' signature instead of 'LSPm' )
+static	const	int		kMicroDeltaVolume = 1 << 0;		// volume streams store the difference with the previous volume
+static	const	int		kMicroDeltaPeriod = 1 << 1;		// period streams store the difference with the previous period
+static	const	int		kMicroPeriodPlanes = 1 << 2;	// period streams store all high bytes, then all low bytes
@@ -0,0 +1,56 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "Log.h"
+
+static thread_local std::string*	tCapture = nullptr;
+
+int		LSPPrintf(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int ret;
+	if (tCapture)
+	{
+		char tmp[512];
+		va_list args2;
+		va_copy(args2, args);
+		ret = vsnprintf(tmp, sizeof(tmp), format, args2);
+		va_end(args2);
+		if (ret >= int(sizeof(tmp)))
+		{
+			const size_t pos = tCapture->size();
+			tCapture->resize(pos + ret + 1);
+			vsnprintf(&(*tCapture)[pos], ret + 1, format, args);
+			tCapture->resize(pos + ret);
+		}
+		else if (ret > 0)
+		{
+			tCapture->append(tmp, ret);
+		}
+	}
+	else
+	{
+		ret = vprintf(format, args);
+	}
+	va_end(args);
+	return ret;
+}
+
+void	LSPLogCaptureBegin(std::string* output)
+{
+	tCapture = output;
+}
+
+void	LSPLogCaptureEnd()
+{
+	tCapture = nullptr;
+}
@@ -0,0 +1,19 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Converter console output. By default it goes straight to stdout. A thread can capture
+// its own output into a string ( used by batch mode to print each module log in order )
+
+#pragma once
+#include <string>
+
+int		LSPPrintf(const char* format, ...);
+
+void	LSPLogCaptureBegin(std::string* output);
+void	LSPLogCaptureEnd();
@@ -0,0 +1,880 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Small 68000 assembler for the generated insane player source ( -insaneobj & -insanebin command line options )
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include "M68kAssembler.h"
+#include "Log.h"
+
+static const int	kEaImmediate = (7 << 3) | 4;
+
+static std::string	Trim(const std::string& s)
+{
+	const size_t start = s.find_first_not_of(" \t");
+	if (std::string::npos == start)
+		return std::string();
+	const size_t end = s.find_last_not_of(" \t");
+	return s.substr(start, end - start + 1);
+}
+
+static std::string	Lower(const std::string& s)
+{
+	std::string out(s);
+	for (char& c : out)
+		c = char(tolower(c));
+	return out;
+}
+
+// 0-7 d0-d7, 8-15 a0-a7 ( sp is a7 ), -1 if not a register
+static int	RegisterId(const std::string& text)
+{
+	const std::string s = Lower(text);
+	if ("sp" == s)
+		return 15;
+	if ((2 == s.size()) && (s[1] >= '0') && (s[1] <= '7'))
+	{
+		if ('d' == s[0])
+			return s[1] - '0';
+		if ('a' == s[0])
+			return 8 + s[1] - '0';
+	}
+	return -1;
+}
+
+// movem register list ( "d0-a6", "d0/d2-d4/a0" ), bit n is register n. -1 if not a list
+static int	RegisterListMask(const std::string& s)
+{
+	int mask = 0;
+	size_t start = 0;
+	while (start < s.size())
+	{
+		size_t end = s.find('/', start);
+		if (std::string::npos == end)
+			end = s.size();
+		const std::string item = s.substr(start, end - start);
+		const size_t dash = item.find('-');
+		const int r0 = RegisterId(item.substr(0, dash));
+		const int r1 = (std::string::npos == dash) ? r0 : RegisterId(item.substr(dash + 1));
+		if ((r0 < 0) || (r1 < r0))
+			return -1;
+		for (int r = r0; r <= r1; r++)
+			mask |= 1 << r;
+		start = end + 1;
+	}
+	return mask;
+}
+
+// Bcc, DBcc & Scc condition ( "eq", "ne", ... ), -1 if unknown
+static int	ConditionCode(const std::string& s)
+{
+	static const char* const names[] = { "t","f","hi","ls","cc","cs","ne","eq","vc","vs","pl","mi","ge","lt","gt","le" };
+	for (int i = 0; i < 16; i++)
+		if (s == names[i])
+			return i;
+	if ("hs" == s)
+		return 4;
+	if ("lo" == s)
+		return 5;
+	return -1;
+}
+
+// operands, split on top level commas
+static std::vector<std::string>	SplitOperands(const std::string& s)
+{
+	std::vector<std::string> ops;
+	std::string cur;
+	int depth = 0;
+	bool quote = false;
+	for (char c : s)
+	{
+		if ('\'' == c)
+			quote = !quote;
+		else if ((!quote) && ('(' == c))
+			depth++;
+		else if ((!quote) && (')' == c))
+			depth--;
+		if ((',' == c) && (0 == depth) && (!quote))
+		{
+			ops.push_back(Trim(cur));
+			cur.clear();
+		}
+		else
+			cur += c;
+	}
+	if (!Trim(cur).empty())
+		ops.push_back(Trim(cur));
+	return ops;
+}
+
+M68kAssembler::M68kAssembler() :
+	m_pass(0),
+	m_sizingPass(0),
+	m_relaxed(false),
+	m_pc(0),
+	m_lineNumber(0),
+	m_quiet(false),
+	m_line(NULL)
+{
+}
+
+// immediate operand value, as parsed with the instruction size ( byte immediates are not sign extended )
+int		M68kAssembler::ImmediateValue(const Ea& ea)
+{
+	if (2 == ea.extCount)
+		return int(s32((u32(ea.ext[0]) << 16) | ea.ext[1]));
+	return s16(ea.ext[0]);
+}
+
+bool	M68kAssembler::Error(const char* message)
+{
+	if (m_quiet)
+		return false;
+	LSPPrintf("ERROR: Insane player assembly, line %d: %s\n", m_lineNumber, message);
+	if (m_line)
+		LSPPrintf("  %s\n", m_line->c_str());
+	return false;
+}
+
+void	M68kAssembler::Emit16(u16 v)
+{
+	m_code.push_back(u8(v >> 8));
+	m_code.push_back(u8(v));
+	m_pc += 2;
+}
+
+void	M68kAssembler::Emit32(u32 v, bool reloc)
+{
+	if (reloc)
+		m_relocs.push_back(m_pc);
+	Emit16(u16(v >> 16));
+	Emit16(u16(v));
+}
+
+void	M68kAssembler::EmitEa(const Ea& ea)
+{
+	if ((2 == ea.extCount) && (ea.reloc))
+		Emit32((u32(ea.ext[0]) << 16) | ea.ext[1], true);
+	else
+	{
+		for (int i = 0; i < ea.extCount; i++)
+			Emit16(ea.ext[i]);
+	}
+}
+
+// number ( $hex, %binary, decimal, 'chars' ) or label, with + & -
+bool	M68kAssembler::ParseValue(const std::string& s, Value& v)
+{
+	v.value = 0;
+	v.labels = 0;
+	v.symbol = false;
+	size_t i = 0;
+	bool expectTerm = true;
+	int sign = 1;
+	while (i < s.size())
+	{
+		if (!expectTerm)
+		{
+			if ('+' == s[i])
+				sign = 1;
+			else if ('-' == s[i])
+				sign = -1;
+			else
+				return Error("bad expression");
+			i++;
+			expectTerm = true;
+			continue;
+		}
+
+		while ((i < s.size()) && (('-' == s[i]) || ('+' == s[i])))
+		{
+			if ('-' == s[i])
+				sign = -sign;
+			i++;
+		}
+		if (i >= s.size())
+			break;
+
+		int64_t term = 0;
+		int termLabels = 0;
+		const char c = s[i];
+		if (('$' == c) || ('%' == c) || (isdigit(c)))
+		{
+			const int base = ('$' == c) ? 16 : (('%' == c) ? 2 : 10);
+			if (!isdigit(c))
+				i++;
+			const size_t start = i;
+			while ((i < s.size()) && ((16 == base) ? isxdigit(s[i]) : ((isdigit(s[i])) && (s[i] - '0' < base))))
+				i++;
+			if (start == i)
+				return Error("bad number");
+			term = int64_t(strtoull(s.substr(start, i - start).c_str(), NULL, base));
+		}
+		else if ('\'' == c)
+		{
+			i++;
+			while ((i < s.size()) && ('\'' != s[i]))
+				term = (term << 8) | u8(s[i++]);
+			if (i >= s.size())
+				return Error("missing quote");
+			i++;
+		}
+		else if ((isalpha(c)) || ('_' == c) || ('.' == c))
+		{
+			const size_t start = i;
+			while ((i < s.size()) && ((isalnum(s[i])) || ('_' == s[i]) || ('.' == s[i])))
+				i++;
+			const std::string name = s.substr(start, i - start);
+			const std::string key = ('.' == name[0]) ? m_scope + name : name;
+			auto it = m_labels.find(key);
+			if (it != m_labels.end())
+				term = it->second;
+			else if (2 == m_pass)
+			{
+				char msg[256];
+				snprintf(msg, sizeof(msg), "unknown label \"%s\"", name.c_str());
+				return Error(msg);
+			}
+			termLabels = 1;
+			v.symbol = true;
+		}
+		else
+			return Error("bad expression");
+
+		v.value += sign * term;
+		v.labels += sign * termLabels;
+		sign = 1;
+		expectTerm = false;
+	}
+	if (expectTerm)
+		return Error("missing value");
+	return true;
+}
+
+bool	M68kAssembler::ParseEa(const std::string& s, char size, int extAddress, Ea& ea)
+{
+	memset(&ea, 0, sizeof(ea));
+	ea.regMask = -1;
+	if (s.empty())
+		return Error("missing operand");
+
+	const int reg = RegisterId(s);
+	if (reg >= 0)
+	{
+		ea.mode = (reg < 8) ? 0 : 1;
+		ea.reg = reg & 7;
+		return true;
+	}
+
+	if ('#' == s[0])
+	{
+		Value v;
+		if (!ParseValue(s.substr(1), v))
+			return false;
+		ea.mode = 7;
+		ea.reg = 4;
+		if ('l' == size)
+		{
+			if ((v.labels < 0) || (v.labels > 1))
+				return Error("bad immediate address");
+			ea.reloc = (1 == v.labels);
+			ea.extCount = 2;
+			ea.ext[0] = u16(v.value >> 16);
+			ea.ext[1] = u16(v.value);
+			if ((2 == m_pass) && ((v.value < -0x80000000ll) || (v.value > 0xffffffffll)))
+				return Error("immediate value out of range");
+		}
+		else
+		{
+			if (0 != v.labels)
+				return Error("code address in a byte or word immediate");
+			const int64_t minValue = ('b' == size) ? -128 : -32768;
+			const int64_t maxValue = ('b' == size) ? 255 : 65535;
+			if ((2 == m_pass) && ((v.value < minValue) || (v.value > maxValue)))
+				return Error("immediate value out of range");
+			ea.extCount = 1;
+			ea.ext[0] = ('b' == size) ? u16(v.value & 0xff) : u16(v.value);
+		}
+		return true;
+	}
+
+	const size_t len = s.size();
+	if ((len > 3) && ('-' == s[0]) && ('(' == s[1]) && (')' == s[len - 1]))
+	{
+		const int r = RegisterId(s.substr(2, len - 3));
+		if (r < 8)
+			return Error("bad -(An) operand");
+		ea.mode = 4;
+		ea.reg = r & 7;
+		return true;
+	}
+	if ((len > 3) && ('(' == s[0]) && (')' == s[len - 2]) && ('+' == s[len - 1]))
+	{
+		const int r = RegisterId(s.substr(1, len - 3));
+		if (r < 8)
+			return Error("bad (An)+ operand");
+		ea.mode = 3;
+		ea.reg = r & 7;
+		return true;
+	}
+
+	if (')' == s[len - 1])
+	{
+		const size_t open = s.rfind('(');
+		if (std::string::npos == open)
+			return Error("bad operand");
+		const std::string inside = s.substr(open + 1, len - open - 2);
+		const std::string disp = Trim(s.substr(0, open));
+		const size_t comma = inside.find(',');
+		const std::string base = Lower(Trim(inside.substr(0, comma)));
+		const bool pc = ("pc" == base);
+		const int baseReg = pc ? -1 : RegisterId(base);
+		if ((!pc) && (baseReg < 8))
+			return Error("bad base register");
+
+		// index register ( "d0.w", "a1.l" )
+		u16 brief = 0;
+		const bool indexed = (std::string::npos != comma);
+		if (indexed)
+		{
+			std::string index = Lower(Trim(inside.substr(comma + 1)));
+			bool longIndex = false;
+			if ((index.size() > 2) && ('.' == index[index.size() - 2]))
+			{
+				longIndex = ('l' == index.back());
+				index.resize(index.size() - 2);
+			}
+			const int indexReg = RegisterId(index);
+			if (indexReg < 0)
+				return Error("bad index register");
+			brief = u16(((indexReg & 8) ? 0x8000 : 0) | ((indexReg & 7) << 12) | (longIndex ? 0x0800 : 0));
+		}
+
+		if ((!pc) && (disp.empty()) && (!indexed))
+		{
+			ea.mode = 2;
+			ea.reg = baseReg & 7;
+			return true;
+		}
+
+		Value v = { 0, 0, false };
+		if ((!disp.empty()) && (!ParseValue(disp, v)))
+			return false;
+		int64_t offset = v.value;
+		if (pc)
+		{
+			if (1 == v.labels)
+				offset = v.value - extAddress;
+			else if (0 != v.labels)
+				return Error("bad pc relative address");
+		}
+		else if (0 != v.labels)
+			return Error("code address used as a displacement");
+
+		ea.mode = pc ? 7 : (indexed ? 6 : 5);
+		ea.reg = pc ? (indexed ? 3 : 2) : (baseReg & 7);
+		ea.extCount = 1;
+		if (indexed)
+		{
+			if ((2 == m_pass) && ((offset < -128) || (offset > 127)))
+				return Error("8 bits displacement out of range");
+			ea.ext[0] = u16(brief | (offset & 0xff));
+		}
+		else
+		{
+			if ((2 == m_pass) && ((offset < -32768) || (offset > 32767)))
+				return Error("16 bits displacement out of range");
+			ea.ext[0] = u16(offset);
+		}
+		return true;
+	}
+
+	const int mask = RegisterListMask(s);
+	if (mask > 0)
+	{
+		ea.regMask = mask;
+		return true;
+	}
+
+	// absolute address, optional .w or .l
+	std::string text = s;
+	char forced = 0;
+	if ((len > 2) && ('.' == s[len - 2]) && (('w' == tolower(s[len - 1])) || ('l' == tolower(s[len - 1]))))
+	{
+		forced = char(tolower(s[len - 1]));
+		text.resize(len - 2);
+	}
+	Value v;
+	if (!ParseValue(text, v))
+		return false;
+	if ((v.labels < 0) || (v.labels > 1))
+		return Error("bad address");
+	const bool shortAddress = ('w' == forced) || ((0 == forced) && (!v.symbol) && (v.value >= -32768) && (v.value <= 32767));
+	ea.mode = 7;
+	if (shortAddress)
+	{
+		if (v.labels)
+			return Error("code address can't be a short absolute address");
+		if ((2 == m_pass) && ((v.value < -32768) || (v.value > 32767)))
+			return Error("short absolute address out of range");
+		ea.reg = 0;
+		ea.extCount = 1;
+		ea.ext[0] = u16(v.value);
+	}
+	else
+	{
+		ea.reg = 1;
+		ea.extCount = 2;
+		ea.reloc = (1 == v.labels);
+		ea.ext[0] = u16(v.value >> 16);
+		ea.ext[1] = u16(v.value);
+	}
+	return true;
+}
+
+bool	M68kAssembler::AssembleData(char size, const std::vector<std::string>& ops)
+{
+	if (('b' != size) && (m_pc & 1))
+		return Error("dc.w or dc.l at odd address");
+	for (const std::string& op : ops)
+	{
+		if (('b' == size) && (op.size() >= 2) && ('\'' == op[0]) && ('\'' == op.back()))
+		{
+			for (size_t i = 1; i + 1 < op.size(); i++)
+			{
+				m_code.push_back(u8(op[i]));
+				m_pc++;
+			}
+			continue;
+		}
+		Value v;
+		if (!ParseValue(op, v))
+			return false;
+		if ('l' == size)
+		{
+			if ((v.labels < 0) || (v.labels > 1))
+				return Error("bad address");
+			Emit32(u32(v.value), 1 == v.labels);
+			continue;
+		}
+		if (0 != v.labels)
+			return Error("code address in dc.b or dc.w");
+		const int64_t minValue = ('b' == size) ? -128 : -32768;
+		const int64_t maxValue = ('b' == size) ? 255 : 65535;
+		if ((2 == m_pass) && ((v.value < minValue) || (v.value > maxValue)))
+			return Error("data value out of range");
+		if ('b' == size)
+		{
+			m_code.push_back(u8(v.value));
+			m_pc++;
+		}
+		else
+			Emit16(u16(v.value));
+	}
+	return true;
+}
+
+bool	M68kAssembler::AssembleInstruction(const std::string& mnemonic, const std::vector<std::string>& ops)
+{
+	std::string base = mnemonic;
+	char size = 0;
+	const size_t dot = mnemonic.find('.');
+	if (std::string::npos != dot)
+	{
+		size = mnemonic[dot + 1];
+		base = mnemonic.substr(0, dot);
+	}
+	const char opSize = (('b' == size) || ('l' == size)) ? size : 'w';
+	const int sz = ('b' == opSize) ? 0 : (('l' == opSize) ? 2 : 1);
+	const int start = m_pc;
+
+	if (ops.empty())
+	{
+		if ("rts" == base) Emit16(0x4e75);
+		else if ("rte" == base) Emit16(0x4e73);
+		else if ("nop" == base) Emit16(0x4e71);
+		else if ("illegal" == base) Emit16(0x4afc);
+		else return Error("unsupported instruction");
+		return true;
+	}
+
+	Ea src;
+	Ea dst;
+	if (!ParseEa(ops[0], opSize, start + 2, src))
+		return false;
+	if (ops.size() > 2)
+		return Error("too many operands");
+	const bool twoOps = (2 == ops.size());
+	if ((twoOps) && (!ParseEa(ops[1], opSize, start + 2 + 2 * src.extCount, dst)))
+		return false;
+	const int srcEa = (src.mode << 3) | src.reg;
+	const int dstEa = (dst.mode << 3) | dst.reg;
+	const bool srcImm = (kEaImmediate == srcEa) && (src.regMask < 0);
+
+	// branches
+	int cc = -1;
+	if ("bra" == base) cc = 0;
+	else if ("bsr" == base) cc = 1;
+	else if (('b' == base[0]) && (3 == base.size()) && (ConditionCode(base.substr(1)) >= 2)) cc = ConditionCode(base.substr(1));
+	if ((cc >= 0) && (!twoOps))
+	{
+		Value target;
+		if (!ParseValue(ops[0], target))
+			return false;
+		if ((2 == m_pass) && (1 != target.labels))
+			return Error("branch to a non code address");
+		const int64_t disp = target.value - (start + 2);
+		bool shortBranch = (('s' == size) || ('b' == size)) && (!m_longBranches.count(m_lineNumber));
+		if ((shortBranch) && ((disp < -128) || (disp > 127) || (0 == disp)))
+		{
+			// like vasm, promote an out of range short branch to a word branch ( one more sizing pass )
+			if ((1 == m_pass) && (m_sizingPass > 1))
+			{
+				m_longBranches.insert(m_lineNumber);
+				m_relaxed = true;
+				shortBranch = false;
+			}
+			else if (2 == m_pass)
+				return Error("short branch out of range");
+		}
+		if (shortBranch)
+			Emit16(u16(0x6000 | (cc << 8) | (disp & 0xff)));
+		else
+		{
+			if ((2 == m_pass) && ((disp < -32768) || (disp > 32767)))
+				return Error("branch out of range");
+			Emit16(u16(0x6000 | (cc << 8)));
+			Emit16(u16(disp));
+		}
+		return true;
+	}
+
+	if ((0 == base.compare(0, 2, "db")) && (twoOps))
+	{
+		cc = ("dbra" == base) ? 1 : ConditionCode(base.substr(2));
+		if ((cc < 0) || (0 != src.mode))
+			return Error("bad DBcc instruction");
+		Value target;
+		if (!ParseValue(ops[1], target))
+			return false;
+		if ((2 == m_pass) && (1 != target.labels))
+			return Error("branch to a non code address");
+		const int64_t disp = target.value - (start + 2);
+		if ((2 == m_pass) && ((disp < -32768) || (disp > 32767)))
+			return Error("branch out of range");
+		Emit16(u16(0x50c8 | (cc << 8) | src.reg));
+		Emit16(u16(disp));
+		return true;
+	}
+
+	if (!twoOps)
+	{
+		if (("jmp" == base) || ("jsr" == base) || ("pea" == base))
+		{
+			Emit16(u16((("jmp" == base) ? 0x4ec0 : (("jsr" == base) ? 0x4e80 : 0x4840)) | srcEa));
+			EmitEa(src);
+			return true;
+		}
+		if (("tst" == base) || ("clr" == base) || ("neg" == base) || ("not" == base))
+		{
+			const int opcode = ("tst" == base) ? 0x4a00 : (("clr" == base) ? 0x4200 : (("neg" == base) ? 0x4400 : 0x4600));
+			Emit16(u16(opcode | (sz << 6) | srcEa));
+			EmitEa(src);
+			return true;
+		}
+		if (("swap" == base) && (0 == src.mode))
+		{
+			Emit16(u16(0x4840 | src.reg));
+			return true;
+		}
+		if (("ext" == base) && (0 == src.mode))
+		{
+			Emit16(u16((('l' == opSize) ? 0x48c0 : 0x4880) | src.reg));
+			return true;
+		}
+		if (('s' == base[0]) && (ConditionCode(base.substr(1)) >= 0))
+		{
+			Emit16(u16(0x50c0 | (ConditionCode(base.substr(1)) << 8) | srcEa));
+			EmitEa(src);
+			return true;
+		}
+		return Error("unsupported instruction");
+	}
+
+	if (("move" == base) || ("movea" == base))
+	{
+		if ((7 == dst.mode) && (dst.reg >= 2))
+			return Error("bad move destination");
+		if ((1 == dst.mode) && ('b' == opSize))
+			return Error("byte move to an address register");
+		const int sizeCode = ('b' == opSize) ? 1 : (('l' == opSize) ? 2 : 3);
+		Emit16(u16((sizeCode << 12) | (dst.reg << 9) | (dst.mode << 6) | srcEa));
+		EmitEa(src);
+		EmitEa(dst);
+		return true;
+	}
+
+	if ("moveq" == base)
+	{
+		if ((!srcImm) || (0 != dst.mode))
+			return Error("bad moveq operands");
+		const int value = ImmediateValue(src);
+		if ((2 == m_pass) && ((value < -128) || (value > 127)))
+			return Error("moveq value out of range");
+		Emit16(u16(0x7000 | (dst.reg << 9) | (value & 0xff)));
+		return true;
+	}
+
+	if (("addq" == base) || ("subq" == base))
+	{
+		const int value = ImmediateValue(src);
+		if ((!srcImm) || ((2 == m_pass) && ((value < 1) || (value > 8))))
+			return Error("bad quick value");
+		Emit16(u16(0x5000 | ((value & 7) << 9) | (("subq" == base) ? 0x100 : 0) | (sz << 6) | dstEa));
+		EmitEa(dst);
+		return true;
+	}
+
+	if (("lea" == base) && (1 == dst.mode))
+	{
+		Emit16(u16(0x41c0 | (dst.reg << 9) | srcEa));
+		EmitEa(src);
+		return true;
+	}
+
+	if ("movem" == base)
+	{
+		const bool toMemory = (src.regMask > 0) || (src.mode <= 1);
+		const Ea& list = toMemory ? src : dst;
+		const Ea& mem = toMemory ? dst : src;
+		int mask = (list.regMask > 0) ? list.regMask : (1 << (list.reg + ((1 == list.mode) ? 8 : 0)));
+		if (4 == mem.mode)
+		{
+			int reversed = 0;
+			for (int r = 0; r < 16; r++)
+				if (mask & (1 << r))
+					reversed |= 1 << (15 - r);
+			mask = reversed;
+		}
+		// register mask comes before the EA extension
+		Ea memEa;
+		if (!ParseEa(toMemory ? ops[1] : ops[0], opSize, start + 4, memEa))
+			return false;
+		Emit16(u16(0x4880 | (toMemory ? 0 : 0x400) | (('l' == opSize) ? 0x40 : 0) | (mem.mode << 3) | mem.reg));
+		Emit16(u16(mask));
+		EmitEa(memEa);
+		return true;
+	}
+
+	static const char* const shifts[] = { "as","ls","rox","ro" };
+	for (int t = 0; t < 4; t++)
+	{
+		const size_t n = strlen(shifts[t]);
+		if ((base.size() == n + 1) && (0 == base.compare(0, n, shifts[t])) && (('l' == base[n]) || ('r' == base[n])))
+		{
+			if (0 != dst.mode)
+				return Error("only data register shifts are supported");
+			int count = src.reg;
+			if (srcImm)
+			{
+				count = ImmediateValue(src);
+				if ((2 == m_pass) && ((count < 1) || (count > 8)))
+					return Error("shift count out of range");
+			}
+			else if (0 != src.mode)
+				return Error("bad shift count");
+			Emit16(u16(0xe000 | ((count & 7) << 9) | (('l' == base[n]) ? 0x100 : 0) | (sz << 6) | (srcImm ? 0 : 0x20) | (t << 3) | dst.reg));
+			return true;
+		}
+	}
+
+	static const char* const bitOps[] = { "btst","bchg","bclr","bset" };
+	for (int t = 0; t < 4; t++)
+	{
+		if (base == bitOps[t])
+		{
+			if (srcImm)
+			{
+				Emit16(u16(0x0800 | (t << 6) | dstEa));
+				Emit16(u16(ImmediateValue(src) & 0xff));
+			}
+			else if (0 == src.mode)
+				Emit16(u16(0x0100 | (src.reg << 9) | (t << 6) | dstEa));
+			else
+				return Error("bad bit number");
+			EmitEa(dst);
+			return true;
+		}
+	}
+
+	// add, sub, and, or, eor, cmp ( and "a" & "i" variants )
+	static const char* const roots[] = { "add","sub","and","or","eor","cmp" };
+	static const int families[] = { 0xd000, 0x9000, 0xc000, 0x8000, 0xb000, 0xb000 };
+	static const int immediates[] = { 0x0600, 0x0400, 0x0200, 0x0000, 0x0a00, 0x0c00 };
+	for (int r = 0; r < 6; r++)
+	{
+		const std::string root = roots[r];
+		if ((base != root) && (base != root + "a") && (base != root + "i"))
+			continue;
+		const bool addressForm = (1 == dst.mode) || (base == root + "a");
+		if (addressForm)
+		{
+			if (((0 != r) && (1 != r) && (5 != r)) || (1 != dst.mode) || ('b' == opSize))
+				return Error("bad address register operation");
+			Emit16(u16(families[r] | (dst.reg << 9) | ((('l' == opSize) ? 7 : 3) << 6) | srcEa));
+			EmitEa(src);
+		}
+		else if (srcImm)
+		{
+			Emit16(u16(immediates[r] | (sz << 6) | dstEa));
+			EmitEa(src);
+			EmitEa(dst);
+		}
+		else if ((0 == dst.mode) && (4 != r))
+		{
+			Emit16(u16(families[r] | (dst.reg << 9) | (sz << 6) | srcEa));
+			EmitEa(src);
+		}
+		else if ((0 == src.mode) && (5 != r))
+		{
+			Emit16(u16(families[r] | (src.reg << 9) | ((4 + sz) << 6) | dstEa));
+			EmitEa(dst);
+		}
+		else
+			return Error("bad operands");
+		return true;
+	}
+
+	return Error("unsupported instruction");
+}
+
+bool	M68kAssembler::AssembleLine(const std::string& line)
+{
+	// strip comment
+	std::string text;
+	bool quote = false;
+	for (char c : line)
+	{
+		if ('\'' == c)
+			quote = !quote;
+		if ((';' == c) && (!quote))
+			break;
+		text += c;
+	}
+	if ((!text.empty()) && ('*' == text[0]))
+		return true;
+
+	size_t p = 0;
+	if ((!text.empty()) && (' ' != text[0]) && ('\t' != text[0]))
+	{
+		while ((p < text.size()) && (':' != text[p]) && (' ' != text[p]) && ('\t' != text[p]))
+			p++;
+		const std::string name = text.substr(0, p);
+		if ((p < text.size()) && (':' == text[p]))
+			p++;
+		const bool local = ('.' == name[0]);
+		if (!local)
+			m_scope = name;
+		const std::string key = local ? m_scope + name : name;
+		if (1 == m_pass)
+		{
+			if ((1 == m_sizingPass) && (m_labels.count(key)))
+				return Error("label defined twice");
+			m_labels[key] = m_pc;
+		}
+		else
+		{
+			assert(m_labels[key] == m_pc);		// same sizes in both passes
+			if (!local)
+				m_globals.push_back({ name, m_pc });
+		}
+	}
+
+	while ((p < text.size()) && ((' ' == text[p]) || ('\t' == text[p])))
+		p++;
+	const size_t mnemonicStart = p;
+	while ((p < text.size()) && (' ' != text[p]) && ('\t' != text[p]))
+		p++;
+	const std::string mnemonic = Lower(text.substr(mnemonicStart, p - mnemonicStart));
+	if (mnemonic.empty())
+		return true;
+	const std::vector<std::string> ops = SplitOperands(Trim(text.substr(p)));
+
+	if ((4 == mnemonic.size()) && (0 == mnemonic.compare(0, 3, "dc.")))
+		return AssembleData(mnemonic[3], ops);
+	if ("even" == mnemonic)
+	{
+		if (m_pc & 1)
+		{
+			m_code.push_back(0);
+			m_pc++;
+		}
+		return true;
+	}
+	if (m_pc & 1)
+		return Error("instruction at odd address");
+	return AssembleInstruction(mnemonic, ops);
+}
+
+bool	M68kAssembler::Assemble(const char* source, int size)
+{
+	m_labels.clear();
+	m_longBranches.clear();
+	m_sizingPass = 0;
+	m_pass = 1;
+	while (m_pass <= 2)
+	{
+		m_sizingPass++;
+		m_relaxed = false;
+		m_pc = 0;
+		m_lineNumber = 0;
+		m_scope.clear();
+		m_code.clear();
+		m_globals.clear();
+		m_relocs.clear();
+		int start = 0;
+		for (int i = 0; i <= size; i++)
+		{
+			if ((i == size) || ('\n' == source[i]))
+			{
+				std::string line(source + start, i - start);
+				if ((!line.empty()) && ('\r' == line.back()))
+					line.pop_back();
+				m_lineNumber++;
+				m_line = &line;
+				const bool ok = AssembleLine(line);
+				m_line = NULL;
+				if (!ok)
+					return false;
+				start = i + 1;
+			}
+		}
+		// sizing passes until no more branch promotion, then the final pass
+		if ((2 == m_pass) || ((m_sizingPass > 1) && (!m_relaxed)))
+			m_pass++;
+	}
+	return true;
+}
+
+// first sizing pass of a single line: short branches are not promoted and unknown labels are allowed
+int		M68kAssembler::InstructionBytes(const char* line)
+{
+	M68kAssembler assembler;
+	assembler.m_quiet = true;
+	assembler.m_pass = 1;
+	assembler.m_sizingPass = 1;
+	const std::string text(line);
+	if (!assembler.AssembleLine(text))
+		return -1;
+	return assembler.m_pc;
+}
@@ -0,0 +1,89 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Small 68000 assembler for the generated insane player source ( -insaneobj & -insanebin command line options )
+// Motorola syntax as written by LSPConvert: "label:", local ".labels", dc.b/w/l, + & - expressions.
+// Instruction sizes only depend on the operands syntax, except out of range short branches promoted to word branches:
+// sizing passes run until no more promotion, then the final pass emits the code.
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include "LSPTypes.h"
+
+struct AsmSymbol
+{
+	std::string	name;
+	int			offset;
+};
+
+class M68kAssembler
+{
+public:
+	M68kAssembler();
+
+	// errors are printed with the source line. Returns false on error
+	bool	Assemble(const char* source, int size);
+
+	// encoded size in bytes of one instruction line ( opcode & extension words ), as sized before any label is known.
+	// Label or comment only line is 0 bytes. Returns -1 if not supported
+	static	int	InstructionBytes(const char* line);
+
+	const std::vector<u8>&			GetCode() const { return m_code; }
+	const std::vector<AsmSymbol>&	GetGlobalSymbols() const { return m_globals; }
+	const std::vector<int>&			GetRelocs() const { return m_relocs; }		// code offsets of 32bits addresses ( code start relative )
+
+private:
+	struct Value
+	{
+		int64_t	value;
+		int		labels;			// code addresses count ( 0: absolute value, 1: code address )
+		bool	symbol;			// any symbol in the expression
+	};
+
+	struct Ea
+	{
+		int		mode;			// 68000 6 bits EA, mode & reg
+		int		reg;
+		int		extCount;		// extension words
+		u16		ext[2];
+		bool	reloc;			// 32bits extension is a code address
+		int		regMask;		// register list ( movem ), -1 if not a list
+	};
+
+	bool	AssembleLine(const std::string& line);
+	bool	AssembleInstruction(const std::string& mnemonic, const std::vector<std::string>& ops);
+	bool	AssembleData(char size, const std::vector<std::string>& ops);
+
+	bool	ParseValue(const std::string& s, Value& v);
+	bool	ParseEa(const std::string& s, char size, int extAddress, Ea& ea);
+	bool	Error(const char* message);
+	static int	ImmediateValue(const Ea& ea);
+
+	void	Emit16(u16 v);
+	void	Emit32(u32 v, bool reloc);
+	void	EmitEa(const Ea& ea);
+
+	int		m_pass;				// 1: sizing, 2: final
+	int		m_sizingPass;
+	bool	m_relaxed;			// a branch was promoted during this sizing pass
+	int		m_pc;
+	int		m_lineNumber;
+	bool	m_quiet;			// no error message ( InstructionBytes )
+	const std::string*	m_line;
+	std::string			m_scope;			// last global label ( local labels owner )
+	std::unordered_map<std::string, int>	m_labels;
+	std::vector<u8>		m_code;
+	std::vector<AsmSymbol>	m_globals;
+	std::vector<int>	m_relocs;
+	std::set<int>		m_longBranches;		// promoted short branches source lines
+};
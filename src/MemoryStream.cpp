@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <stdarg.h>
 #include "MemoryStream.h"
 #ifdef MACOS_LINUX
 #include "WindowsCompat.h"
@@ -41,13 +42,51 @@ void	MemoryStream::Store8(unsigned char v, int offset)
 
 void	MemoryStream::Add(const MemoryStream& stream)
 {
-	if (m_pos + stream.m_pos > m_bufferSize)
+	AddBuffer(stream.GetRawBuffer(), stream.m_pos);
+}
+
+void	MemoryStream::AddBuffer(const void* data, int size)
+{
+	if (m_pos + size > m_bufferSize)
 	{
-		m_bufferSize = m_pos + stream.m_pos + GROWING_SIZE;
+		m_bufferSize = m_pos + size + GROWING_SIZE;
 		m_buffer = (unsigned char*)realloc(m_buffer, m_bufferSize);
 	}
-	memcpy(m_buffer + m_pos, stream.GetRawBuffer(), stream.m_pos);
-	m_pos += stream.m_pos;
+	if (size > 0)
+		memcpy(m_buffer + m_pos, data, size);
+	m_pos += size;
+}
+
+void	MemoryStream::Printf(const char* format, ...)
+{
+	char tmp[1024];
+	va_list args;
+	va_start(args, format);
+	const int len = vsnprintf(tmp, sizeof(tmp), format, args);
+	va_end(args);
+	if (len < int(sizeof(tmp)))
+	{
+		AddBuffer(tmp, len);
+	}
+	else
+	{
+		// long text ( ADPCM depack code )
+		char* big = (char*)malloc(len + 1);
+		va_start(args, format);
+		vsnprintf(big, len + 1, format, args);
+		va_end(args);
+		AddBuffer(big, len);
+		free(big);
+	}
+}
+
+bool	MemoryStream::SaveToFile(const char* fname, bool textMode /* = false */) const
+{
+	FILE* h;
+	if (0 != fopen_s(&h, fname, textMode ? "w" : "wb"))
+		return false;
+	const bool ret = (size_t(m_pos) == fwrite(m_buffer, 1, m_pos, h));
+	return (0 == fclose(h)) && ret;
 }
 
 void	MemoryStream::DebugSave(const char* fname)
@@ -71,6 +110,35 @@ void	MemoryStream::DeltaProcess()
 	}
 }
 
+void	MemoryStream::DeltaProcess16()
+{
+	assert(0 == (m_pos & 1));
+	unsigned short cur = 0;
+	for (int i = 0; i < m_pos; i += 2)
+	{
+		const unsigned short ncur = (m_buffer[i] << 8) | m_buffer[i + 1];
+		const unsigned short delta = ncur - cur;
+		m_buffer[i] = delta >> 8;
+		m_buffer[i + 1] = delta & 255;
+		cur = ncur;
+	}
+}
+
+void	MemoryStream::BytePlaneSplit16()
+{
+	assert(0 == (m_pos & 1));
+	const int count = m_pos / 2;
+	unsigned char* tmp = (unsigned char*)malloc(m_pos + 1);
+	for (int i = 0; i < count; i++)
+	{
+		tmp[i] = m_buffer[i * 2];
+		tmp[count + i] = m_buffer[i * 2 + 1];
+	}
+	if (m_pos > 0)
+		memcpy(m_buffer, tmp, m_pos);
+	free(tmp);
+}
+
 void	MemoryStream::Store16(unsigned short v, int offset)
 {
 	assert(0 == (offset & 1));
@@ -16,6 +16,8 @@ class MemoryStream
 public:
 		MemoryStream();
 		~MemoryStream();
+		MemoryStream(const MemoryStream&) = delete;
+		MemoryStream&	operator=(const MemoryStream&) = delete;
 
 		void	Add8(unsigned char v)
 		{
@@ -33,6 +35,8 @@ public:
 			m_pos += 4;
 		}
 		void	Add(const MemoryStream& stream);
+		void	AddBuffer(const void* data, int size);
+		void	Printf(const char* format, ...);			// text output ( generated source code )
 		
 		void	Store8(unsigned char v, int offset);
 		void	Store16(unsigned short v, int offset);
@@ -41,7 +45,10 @@ public:
 		int		GetSize() const { return m_pos; }
 		const unsigned char*	GetRawBuffer() const { return m_buffer; }
 		void	FileWrite(FILE* h) const;
+		bool	SaveToFile(const char* fname, bool textMode = false) const;
 		void	DeltaProcess();
+		void	DeltaProcess16();				// big endian words
+		void	BytePlaneSplit16();				// big endian words: all high bytes, then all low bytes
 		void	DebugSave(const char* fname);
 
 private:
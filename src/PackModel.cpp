@@ -0,0 +1,123 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include "PackModel.h"
+
+static const int	kProbBits = 16;
+static const int	kAdjustShift = 4;			// same as Shrinkler ADJUST_SHIFT
+static const int	kCostTableBits = 12;
+
+// -log2(p) in 1/256 bit, p quantized on 12 bits
+struct CostTable
+{
+	CostTable()
+	{
+		for (int i = 0; i < (1 << kCostTableBits); i++)
+		{
+			const double p = double(i ? i : 1) / double(1 << kCostTableBits);
+			cost[i] = int(floor(0.5 - log(p) / log(2.0) * (1 << LiteralCostModel::kCostBitShift)));
+		}
+	}
+	int		cost[1 << kCostTableBits];
+};
+
+static const CostTable	sCostTable;
+
+LiteralCostModel::LiteralCostModel()
+{
+	Reset();
+}
+
+void	LiteralCostModel::Reset()
+{
+	for (int p = 0; p < 2; p++)
+		for (int i = 0; i < 256; i++)
+			m_prob[p][i] = 1 << (kProbBits - 1);
+	m_cost = 0;
+}
+
+void	LiteralCostModel::Add(u8 value, int position)
+{
+	const int* costTable = sCostTable.cost;
+	u16* prob = m_prob[position & 1];
+	int context = 1;
+	for (int i = 7; i >= 0; i--)
+	{
+		const int bit = (value >> i) & 1;
+		const int p1 = prob[context];
+		if (bit)
+		{
+			m_cost += costTable[p1 >> (kProbBits - kCostTableBits)];
+			prob[context] = u16(p1 + (((1 << kProbBits) - p1) >> kAdjustShift));
+		}
+		else
+		{
+			m_cost += costTable[((1 << kProbBits) - p1) >> (kProbBits - kCostTableBits)];
+			prob[context] = u16(p1 - (p1 >> kAdjustShift));
+		}
+		context = (context << 1) | bit;
+	}
+}
+
+void	LiteralCostModel::MarkMatches(const u8* data, int size, u8* inMatch)
+{
+	static const int kMinMatch = 3;
+	static const int kHashBits = 16;
+	static const int kMaxChain = 64;
+
+	memset(inMatch, 0, size);
+	std::vector<int> head(1 << kHashBits, -1);
+	std::vector<int> prev(size, -1);
+	auto hash = [data](int pos) { return ((data[pos] << 16) ^ (data[pos + 1] << 8) ^ data[pos + 2]) * 2654435761u >> (32 - kHashBits); };
+	auto insert = [&](int pos)
+	{
+		if (pos + kMinMatch <= size)
+		{
+			const unsigned h = hash(pos);
+			prev[pos] = head[h];
+			head[h] = pos;
+		}
+	};
+
+	int pos = 0;
+	while (pos < size)
+	{
+		int bestLen = 0;
+		if (pos + kMinMatch <= size)
+		{
+			int candidate = head[hash(pos)];
+			for (int chain = 0; (candidate >= 0) && (chain < kMaxChain); chain++, candidate = prev[candidate])
+			{
+				int len = 0;
+				while ((pos + len < size) && (data[candidate + len] == data[pos + len]))
+					len++;
+				if (len > bestLen)
+					bestLen = len;
+			}
+		}
+		if (bestLen >= kMinMatch)
+		{
+			for (int i = 0; i < bestLen; i++)
+			{
+				inMatch[pos + i] = 1;
+				insert(pos + i);
+			}
+			pos += bestLen;
+		}
+		else
+		{
+			insert(pos);
+			pos++;
+		}
+	}
+}
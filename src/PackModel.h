@@ -0,0 +1,35 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Fast packed size model, used to compare data layouts without running Shrinkler ( -optcodes command line option )
+// Bytes covered by a LZ match don't depend on the byte values, so only literals are modeled: same adaptive bit-tree
+// contexts as Shrinkler literals ( 8 bits, one tree per byte position parity ), probabilities updated with shift 4.
+
+#pragma once
+#include <stdint.h>
+#include "LSPTypes.h"
+
+class LiteralCostModel
+{
+public:
+	static const int	kCostBitShift = 8;		// costs are in 1/256 bit
+
+	LiteralCostModel();
+
+	void	Reset();
+	void	Add(u8 value, int position);			// position parity selects the context tree
+	int64_t	GetCost() const { return m_cost; }
+
+	// mark bytes that a greedy LZ parse would cover with a match ( 0: literal, 1: in a match )
+	static void	MarkMatches(const u8* data, int size, u8* inMatch);
+
+private:
+	u16		m_prob[2][256];					// probability of a "1" bit, 16 bits
+	int64_t	m_cost;
+};
@@ -16,16 +16,21 @@
 
 #define NUM_RELOC_CONTEXTS 256
 
-int	ShrinklerCompressEstimate(u8* data, int dataSize)
-{
-	vector<unsigned> pack_buffer;
-
 #ifdef NDEBUG
-	const int p = 9;					// -9 option
+static const int	kPreset = 9;					// -9 option
 #else
-	const int p = 1;					// -2 option
+static const int	kPreset = 1;					// -2 option
 #endif
-	printf("Estimating Amiga Shrinkler packing size... (preset -%d)\n", p);
+
+int	ShrinklerEstimatePreset()
+{
+	return kPreset;
+}
+
+// reentrant: several estimates can run at the same time ( -pack with -v, -batch, -optstreams )
+int	ShrinklerCompressEstimate(u8* data, int dataSize, int p)
+{
+	vector<unsigned> pack_buffer;
 
 	RangeCoder *range_coder = new RangeCoder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffer);
 
@@ -47,3 +52,8 @@ int	ShrinklerCompressEstimate(u8* data, int dataSize)
 	delete range_coder;
 	return packedSize;
 }
+
+int	ShrinklerCompressEstimate(u8* data, int dataSize)
+{
+	return ShrinklerCompressEstimate(data, dataSize, kPreset);
+}
@@ -0,0 +1,121 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Pattern level memoization of the micromod simulation
+
+#include <string.h>
+#include <assert.h>
+#include "PatternMemo.h"
+#include "LSPEncoder.h"
+
+PatternMemo::PatternMemo(LSPEncoder& encoder, Micromod& micromod) :
+	m_encoder(encoder),
+	m_micromod(micromod),
+	m_recording(false),
+	m_recordPattern(-1),
+	m_recordWarningCount(0)
+{
+}
+
+void	PatternMemo::SaveEncoderState(EncoderState& state) const
+{
+	memset(&state, 0, sizeof(state));
+	memcpy(state.previousVolumes, m_encoder.m_previousVolumes, sizeof(state.previousVolumes));
+	memcpy(state.previousPeriods, m_encoder.m_previousPeriods, sizeof(state.previousPeriods));
+	memcpy(state.previousInstrument, m_encoder.m_previousInstrument, sizeof(state.previousInstrument));
+	state.bpm = m_encoder.m_bpm;
+	state.bpmEmulatedCounter = m_encoder.m_bpmEmulatedCounter;
+}
+
+void	PatternMemo::LoadEncoderState(const EncoderState& state)
+{
+	memcpy(m_encoder.m_previousVolumes, state.previousVolumes, sizeof(state.previousVolumes));
+	memcpy(m_encoder.m_previousPeriods, state.previousPeriods, sizeof(state.previousPeriods));
+	memcpy(m_encoder.m_previousInstrument, state.previousInstrument, sizeof(state.previousInstrument));
+	m_encoder.m_bpm = state.bpm;
+	m_encoder.m_bpmEmulatedCounter = state.bpmEmulatedCounter;
+}
+
+// the recorded pattern is complete ( next tick enters a new pattern )
+void	PatternMemo::EndRecord()
+{
+	assert(m_recording);
+	m_recording = false;
+
+	// a pattern printing warnings is not memoized, so the log stays the same
+	if (m_micromod.get_warning_count() != m_recordWarningCount)
+		return;
+
+	Entry& e = m_record;
+	e.frameCount = m_encoder.m_frameCount - e.firstFrame;
+	e.sampleCount = m_encoder.m_totalSampleCount - e.sampleCount;
+	e.setBpmCount = m_encoder.m_setBpmCount - e.setBpmCount;
+	e.setFilterCount = m_encoder.m_setFilterCount - e.setFilterCount;
+	e.rowsPlayed = m_micromod.get_rows_played(e.seqPos);
+	SaveEncoderState(e.encoderOut);
+	m_micromod.save_replay_state(e.stateOut);
+	m_entries[m_recordPattern].push_back(e);
+}
+
+void	PatternMemo::Replay(const Entry& e, long seqPos)
+{
+	m_encoder.SetSeqPos(int(seqPos));
+
+	const int dst = m_encoder.m_frameCount;
+	for (int i = 0; i < e.frameCount; i++)
+		m_encoder.m_RowData[dst + i] = m_encoder.m_RowData[e.firstFrame + i];
+
+	m_encoder.m_frameCount += e.frameCount;
+	m_encoder.m_replayedFrameCount += e.frameCount;
+	m_encoder.m_totalSampleCount += e.sampleCount;
+	m_encoder.m_setBpmCount += e.setBpmCount;
+	m_encoder.m_setFilterCount += e.setFilterCount;
+	LoadEncoderState(e.encoderOut);
+	m_micromod.load_replay_state(e.stateOut, seqPos, e.rowsPlayed);
+}
+
+bool	PatternMemo::Update()
+{
+	const long seqPos = m_micromod.get_next_entry_position();
+	if (seqPos < 0)
+		return false;
+
+	if (m_recording)
+		EndRecord();
+
+	// only first visits: any played row means the next tick could detect the song end
+	if (0 != m_micromod.get_rows_played(seqPos))
+		return false;
+
+	const long pattern = m_micromod.get_sequence_pattern(seqPos);
+	Entry& e = m_record;
+	SaveEncoderState(e.encoderIn);
+	m_micromod.save_replay_state(e.stateIn);
+
+	for (const Entry& memo : m_entries[pattern])
+	{
+		if ((0 == memcmp(&memo.encoderIn, &e.encoderIn, sizeof(EncoderState))) &&
+			(m_micromod.same_entry_state(memo.stateIn, e.stateIn)))
+		{
+			Replay(memo, seqPos);
+			return true;
+		}
+	}
+
+	// new entry state, record this pattern
+	e.seqPos = seqPos;
+	e.firstFrame = m_encoder.m_frameCount;
+	e.sampleCount = m_encoder.m_totalSampleCount;
+	e.setBpmCount = m_encoder.m_setBpmCount;
+	e.setFilterCount = m_encoder.m_setFilterCount;
+	m_recording = true;
+	m_recordPattern = pattern;
+	m_recordWarningCount = m_micromod.get_warning_count();
+	return false;
+}
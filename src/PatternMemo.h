@@ -0,0 +1,66 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Pattern level memoization of the micromod simulation
+// When a pattern is entered with exactly the same player & encoder state as a previous entry,
+// the recorded frames are copied instead of simulating all the pattern ticks again.
+// Sample fetch & replay rate maxima don't need any replay: the same run can't raise them.
+
+#pragma once
+#include <vector>
+#include "external/micromod/micromod.h"
+
+class LSPEncoder;
+
+class PatternMemo
+{
+public:
+	PatternMemo(LSPEncoder& encoder, Micromod& micromod);
+
+	// call between two simulation ticks. Returns true if a whole pattern was replayed from memory
+	bool	Update();
+
+private:
+	struct EncoderState
+	{
+		int		previousVolumes[4];
+		int		previousPeriods[4];
+		int		previousInstrument[4];
+		int		bpm;
+		int		bpmEmulatedCounter;
+	};
+
+	struct Entry
+	{
+		long					seqPos;
+		int						firstFrame;
+		int						frameCount;
+		int						sampleCount;
+		int						setBpmCount;
+		int						setFilterCount;
+		unsigned long long		rowsPlayed;
+		EncoderState			encoderIn;
+		EncoderState			encoderOut;
+		Micromod::replay_state	stateIn;
+		Micromod::replay_state	stateOut;
+	};
+
+	void	SaveEncoderState(EncoderState& state) const;
+	void	LoadEncoderState(const EncoderState& state);
+	void	EndRecord();
+	void	Replay(const Entry& entry, long seqPos);
+
+	LSPEncoder&			m_encoder;
+	Micromod&			m_micromod;
+	std::vector<Entry>	m_entries[128];			// per MOD pattern
+	Entry				m_record;
+	bool				m_recording;
+	long				m_recordPattern;
+	long				m_recordWarningCount;
+};
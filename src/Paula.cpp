@@ -12,10 +12,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <memory.h>
 #include <assert.h>
 #include "Paula.h"
 
+// Voices are rendered in blocks, then mixed & clamped 8 samples at a time, SSE2 or NEON when available ( same result as scalar )
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define	PAULA_SSE2	1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define	PAULA_NEON	1
+#endif
+
+static const int	kRenderBlock = 256;
+
 Paula::Paula(int renderingRate)
 {
 	m_chipRam = (s8*)malloc(kAmigaChipRamSize);
@@ -64,18 +76,44 @@ void	Paula::SetLen(int v, u16 len)
 	m_voice[v].nextLen = u32(len) * 2;		// len in bytes
 }
 
-void Paula::AudioStreamRender(s16* buffer, int sampleCount)
+// left is voices 0 & 3, right is voices 1 & 2. Each voice is sample*volume ( 14bits ), so the sums fit in 16bits
+static void	MixStereo(const s16 voices[4][kRenderBlock], s16* buffer, int count)
 {
 	// safe gain is 2 ( 14bits*2voices*2=16bits)
 	const int gain = int(2.9f * 256.f);
-	for (int i = 0; i < sampleCount; i++)
+	int i = 0;
+#if PAULA_SSE2
+	const __m128i g = _mm_set1_epi16(s16(gain));
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m128i l = _mm_add_epi16(_mm_load_si128((const __m128i*)(voices[0] + i)), _mm_load_si128((const __m128i*)(voices[3] + i)));
+		const __m128i r = _mm_add_epi16(_mm_load_si128((const __m128i*)(voices[1] + i)), _mm_load_si128((const __m128i*)(voices[2] + i)));
+		// 16x16 -> 32bits products, >>8, then saturated pack is the clamp
+		const __m128i lLo = _mm_mullo_epi16(l, g);
+		const __m128i lHi = _mm_mulhi_epi16(l, g);
+		const __m128i rLo = _mm_mullo_epi16(r, g);
+		const __m128i rHi = _mm_mulhi_epi16(r, g);
+		const __m128i outL = _mm_packs_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(lLo, lHi), 8), _mm_srai_epi32(_mm_unpackhi_epi16(lLo, lHi), 8));
+		const __m128i outR = _mm_packs_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(rLo, rHi), 8), _mm_srai_epi32(_mm_unpackhi_epi16(rLo, rHi), 8));
+		_mm_storeu_si128((__m128i*)(buffer + i * 2), _mm_unpacklo_epi16(outL, outR));
+		_mm_storeu_si128((__m128i*)(buffer + i * 2 + 8), _mm_unpackhi_epi16(outL, outR));
+	}
+#elif PAULA_NEON
+	const int16x4_t g = vdup_n_s16(s16(gain));
+	for (; i + 8 <= count; i += 8)
+	{
+		const int16x8_t l = vaddq_s16(vld1q_s16(voices[0] + i), vld1q_s16(voices[3] + i));
+		const int16x8_t r = vaddq_s16(vld1q_s16(voices[1] + i), vld1q_s16(voices[2] + i));
+		int16x8x2_t out;
+		out.val[0] = vcombine_s16(vqmovn_s32(vshrq_n_s32(vmull_s16(vget_low_s16(l), g), 8)), vqmovn_s32(vshrq_n_s32(vmull_s16(vget_high_s16(l), g), 8)));
+		out.val[1] = vcombine_s16(vqmovn_s32(vshrq_n_s32(vmull_s16(vget_low_s16(r), g), 8)), vqmovn_s32(vshrq_n_s32(vmull_s16(vget_high_s16(r), g), 8)));
+		vst2q_s16(buffer + i * 2, out);
+	}
+#endif
+	for (; i < count; i++)
 	{
-		int outL = 0;
-		int outR = 0;
-		outL += m_voice[0].ComputeNextSample(m_chipRam, (m_dmaCon&(1<<0)) != 0);
-		outR += m_voice[1].ComputeNextSample(m_chipRam, (m_dmaCon&(1<<1)) != 0);
-		outR += m_voice[2].ComputeNextSample(m_chipRam, (m_dmaCon&(1<<2)) != 0);
-		outL += m_voice[3].ComputeNextSample(m_chipRam, (m_dmaCon&(1<<3)) != 0);
+		int outL = voices[0][i] + voices[3][i];
+		int outR = voices[1][i] + voices[2][i];
 
 		outL = (outL * gain)>>8;
 		outR = (outR * gain)>>8;
@@ -89,9 +127,22 @@ void Paula::AudioStreamRender(s16* buffer, int sampleCount)
 		else if (outR > 32767)
 			outR = 32767;
 
-		buffer[0] = outL;
-		buffer[1] = outR;
-		buffer += 2;
+		buffer[i * 2 + 0] = outL;
+		buffer[i * 2 + 1] = outR;
+	}
+}
+
+void Paula::AudioStreamRender(s16* buffer, int sampleCount)
+{
+	alignas(16) s16 voices[4][kRenderBlock];
+	while (sampleCount > 0)
+	{
+		const int count = (sampleCount < kRenderBlock) ? sampleCount : kRenderBlock;
+		for (int v = 0; v < 4; v++)
+			m_voice[v].Render(m_chipRam, (m_dmaCon&(1<<v)) != 0, voices[v], count);
+		MixStereo(voices, buffer, count);
+		buffer += count * 2;
+		sampleCount -= count;
 	}
 }
 
@@ -121,12 +172,44 @@ void	Paula::WriteDmaCon(u16 value)
 	}
 }
 
-int	Paula::PaulaVoice::ComputeNextSample(const s8* chipMemory, bool dmaOn)
+// Registers are only written between AudioStreamRender calls, so the loop point is the only event:
+// samples are fetched in spans, without any test, up to the output sample reaching the sample end
+void	Paula::PaulaVoice::Render(const s8* chipMemory, bool dmaOn, s16* out, int count)
 {
-	if (dmaOn)
+	if (!dmaOn)
+	{
+		const s16 value = s16(audioDat * volume);
+		for (int i = 0; i < count; i++)
+			out[i] = value;
+		return;
+	}
+
+	int i = 0;
+	while (i < count)
 	{
-		audioDat = chipMemory[ad + (pos >> kPaulaPosPrec)];
-		pos += step;
+		// samples read before pos reaches len ( at least one, the loop test is done after each read )
+		const uint64_t end = uint64_t(len) << kPaulaPosPrec;
+		int span = count - i;
+		if (uint64_t(pos) + step >= end)
+			span = 1;
+		else if (step > 0)
+		{
+			const uint64_t left = (end - pos + step - 1) / step;
+			if (left < uint64_t(span))
+				span = int(left);
+		}
+
+		const s8* src = chipMemory + ad;
+		u32 p = pos;
+		for (int n = 0; n < span; n++)
+		{
+			out[i + n] = s16(src[p >> kPaulaPosPrec] * volume);
+			p += step;
+		}
+		audioDat = src[(p - step) >> kPaulaPosPrec];
+		pos = p;
+		i += span;
+
 		if ((pos >> kPaulaPosPrec) >= len)
 		{
 			// looping sound
@@ -135,5 +218,4 @@ int	Paula::PaulaVoice::ComputeNextSample(const s8* chipMemory, bool dmaOn)
 			pos &= (1 << kPaulaPosPrec) - 1;
 		}
 	}
-	return audioDat * volume;
 }
@@ -48,7 +48,7 @@ private:
 		u32 step;
 		int audioDat;
 
-		int	ComputeNextSample(const s8* chipMemory, bool dmaOn);
+		void	Render(const s8* chipMemory, bool dmaOn, s16* out, int count);
 	};
 
 	PaulaVoice	m_voice[4];
@@ -0,0 +1,88 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+struct WorkerQueue
+{
+	std::mutex			lock;
+	std::deque<int>		jobs;
+
+	bool	PopFront(int* job)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (jobs.empty())
+			return false;
+		*job = jobs.front();
+		jobs.pop_front();
+		return true;
+	}
+
+	bool	StealBack(int* job)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (jobs.empty())
+			return false;
+		*job = jobs.back();
+		jobs.pop_back();
+		return true;
+	}
+};
+
+int		GetDefaultThreadCount()
+{
+	const int count = int(std::thread::hardware_concurrency());
+	return (count > 0) ? count : 1;
+}
+
+void	ParallelFor(int jobCount, int threadCount, const std::function<void(int)>& job)
+{
+	if (threadCount <= 0)
+		threadCount = GetDefaultThreadCount();
+	if (threadCount > jobCount)
+		threadCount = jobCount;
+
+	if (threadCount <= 1)
+	{
+		for (int i = 0; i < jobCount; i++)
+			job(i);
+		return;
+	}
+
+	// round robin distribution, so jobs tend to complete in index order
+	std::vector<WorkerQueue> queues(threadCount);
+	for (int i = 0; i < jobCount; i++)
+		queues[i % threadCount].jobs.push_back(i);
+
+	// no job is ever added once started, so a worker can leave as soon as all queues are empty
+	auto worker = [&](int w)
+	{
+		int j;
+		for (;;)
+		{
+			bool found = queues[w].PopFront(&j);
+			for (int s = 1; (!found) && (s < threadCount); s++)
+				found = queues[(w + s) % threadCount].StealBack(&j);
+			if (!found)
+				break;
+			job(j);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int w = 1; w < threadCount; w++)
+		threads.emplace_back(worker, w);
+	worker(0);
+	for (std::thread& t : threads)
+		t.join();
+}
@@ -0,0 +1,19 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Tiny work stealing job system. Each worker thread owns a queue of job indices
+// and steals from the other workers' queues once its own one is empty.
+
+#pragma once
+#include <functional>
+
+int		GetDefaultThreadCount();
+
+// run job(0) .. job(jobCount-1) on threadCount threads (0 means all cores), returns when all jobs are done
+void	ParallelFor(int jobCount, int threadCount, const std::function<void(int)>& job);
@@ -0,0 +1,150 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Per phase conversion timings ( -timings command line option )
+
+#define	_CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include "Timings.h"
+#include "LSPEncoder.h"
+#ifdef MACOS_LINUX
+#include <sys/resource.h>
+#else
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+
+size_t	GetPeakMemoryUsage()
+{
+#ifdef MACOS_LINUX
+	struct rusage usage;
+	if (0 != getrusage(RUSAGE_SELF, &usage))
+		return 0;
+	#ifdef __APPLE__
+	return size_t(usage.ru_maxrss);				// bytes on macOS
+	#else
+	return size_t(usage.ru_maxrss) * 1024;		// KiB on Linux
+	#endif
+#else
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#endif
+}
+
+const char*	ConvertTimings::GetPhaseName(TimingPhase phase)
+{
+	static const char* const names[kPhaseCount] =
+	{
+		"simulation",
+		"readback",
+		"cmdCodes",
+		"streams",
+		"streamLayout",
+		"sampleOffsets",
+		"adpcm",
+		"preview",
+		"packEstimate",
+	};
+	return names[phase];
+}
+
+ConvertTimings::ConvertTimings()
+{
+	Reset();
+}
+
+void	ConvertTimings::Reset()
+{
+	for (int i = 0; i < kPhaseCount; i++)
+	{
+		PhaseInfo& info = m_phases[i];
+		info.used = false;
+		info.seconds = 0.0;
+		info.frames = 0;
+		info.bytes = 0;
+		info.peakMemBefore = 0;
+		info.peakMemAfter = 0;
+	}
+	m_start = Clock::now();
+}
+
+void	ConvertTimings::Begin(TimingPhase phase)
+{
+	PhaseInfo& info = m_phases[phase];
+	if (!info.used)
+		info.peakMemBefore = GetPeakMemoryUsage();
+	info.start = Clock::now();
+}
+
+void	ConvertTimings::End(TimingPhase phase, int frameCount, size_t byteCount)
+{
+	PhaseInfo& info = m_phases[phase];
+	info.seconds += std::chrono::duration<double>(Clock::now() - info.start).count();
+	info.frames += frameCount;
+	info.bytes += byteCount;
+	info.peakMemAfter = GetPeakMemoryUsage();
+	info.used = true;
+}
+
+double	ConvertTimings::GetTotalSeconds() const
+{
+	return std::chrono::duration<double>(Clock::now() - m_start).count();
+}
+
+static void	WriteJsonString(FILE* h, const char* s)
+{
+	fputc('"', h);
+	for (; *s; s++)
+	{
+		const unsigned char c = (unsigned char)*s;
+		if (('"' == c) || ('\\' == c))
+			fprintf(h, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(h, "\\u%04x", c);
+		else
+			fputc(c, h);
+	}
+	fputc('"', h);
+}
+
+bool	ConvertTimings::WriteJson(const char* sFilename, const char* sModFilename, int frameCount) const
+{
+	FILE* h = fopen(sFilename, "w");
+	if (NULL == h)
+		return false;
+
+	fprintf(h, "{\n");
+	fprintf(h, "\t\"module\": ");
+	WriteJsonString(h, sModFilename);
+	fprintf(h, ",\n");
+	fprintf(h, "\t\"version\": \"%d.%02d\",\n", LSP_MAJOR_VERSION, LSP_MINOR_VERSION);
+	fprintf(h, "\t\"frames\": %d,\n", frameCount);
+	fprintf(h, "\t\"totalSeconds\": %.6f,\n", GetTotalSeconds());
+	fprintf(h, "\t\"peakMemoryKiB\": %zu,\n", GetPeakMemoryUsage() >> 10);
+	fprintf(h, "\t\"phases\": [");
+	bool first = true;
+	for (int i = 0; i < kPhaseCount; i++)
+	{
+		const PhaseInfo& info = m_phases[i];
+		if (!info.used)
+			continue;
+		fprintf(h, "%s\n\t\t{ \"name\": \"%s\", \"seconds\": %.6f, \"frames\": %d, \"framesPerSec\": %.1f", first ? "" : ",",
+			GetPhaseName(TimingPhase(i)), info.seconds, info.frames, (info.seconds > 0.0) ? double(info.frames) / info.seconds : 0.0);
+		if (info.bytes > 0)
+			fprintf(h, ", \"bytes\": %zu, \"MBPerSec\": %.3f", info.bytes, (info.seconds > 0.0) ? double(info.bytes) / (info.seconds * 1024.0 * 1024.0) : 0.0);
+		fprintf(h, ", \"peakMemoryKiB\": %zu, \"peakMemoryGrowthKiB\": %zu }", info.peakMemAfter >> 10, (info.peakMemAfter - info.peakMemBefore) >> 10);
+		first = false;
+	}
+	fprintf(h, "\n\t]\n}\n");
+	return 0 == fclose(h);
+}
@@ -0,0 +1,67 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Per phase conversion timings ( -timings command line option )
+// Each phase records its wall time, the number of frames (and bytes) it processed and the
+// process memory high-water mark, then the whole report is saved as a JSON file.
+
+#pragma once
+#include <stddef.h>
+#include <chrono>
+
+enum TimingPhase
+{
+	kPhaseSimulation,			// micromod simulation loop
+	kPhaseReadback,				// frame data read back & cmd words registration
+	kPhaseCmdCodes,				// cmd codes order optimization ( -optcodes )
+	kPhaseStreams,				// LSP streams building
+	kPhaseStreamLayout,			// micro streams order & transforms search ( -optstreams )
+	kPhaseSampleOffsets,		// ComputeAndFixSampleOffsets
+	kPhaseAdpcm,				// ADPCM samples encoding
+	kPhasePreview,				// Paula preview rendering
+	kPhasePackEstimate,			// Shrinkler packing estimation
+	kPhaseCount
+};
+
+// process peak memory usage in bytes ( peak RSS / peak working set )
+size_t	GetPeakMemoryUsage();
+
+class ConvertTimings
+{
+public:
+	ConvertTimings();
+
+	void	Reset();
+	void	Begin(TimingPhase phase);
+	void	End(TimingPhase phase, int frameCount, size_t byteCount = 0);
+
+	double	GetSeconds(TimingPhase phase) const { return m_phases[phase].seconds; }
+	double	GetTotalSeconds() const;
+
+	bool	WriteJson(const char* sFilename, const char* sModFilename, int frameCount) const;
+
+	static const char*	GetPhaseName(TimingPhase phase);
+
+private:
+	typedef std::chrono::steady_clock	Clock;
+
+	struct PhaseInfo
+	{
+		bool		used;
+		double		seconds;
+		int			frames;
+		size_t		bytes;
+		size_t		peakMemBefore;
+		size_t		peakMemAfter;
+		Clock::time_point	start;
+	};
+
+	PhaseInfo			m_phases[kPhaseCount];
+	Clock::time_point	m_start;
+};
@@ -12,12 +12,17 @@
 #include <assert.h>
 #include <string.h>
 #include "ValueEncoder.h"
+#include "Log.h"
 
 ValueEncoder::ValueEncoder()
 {
 	m_valueToCode = NULL;
 	m_valueCounts = NULL;
 	m_codeToValue = NULL;
+	m_huffmanBits = NULL;
+	m_huffmanCodes = NULL;
+	m_huffmanRankToCode = NULL;
+	m_huffmanSymbolCount = 0;
 }
 
 void	ValueEncoder::Setup(int maxValueCount, int maxCodeCount)
@@ -43,6 +48,13 @@ void	ValueEncoder::Release()
 	free(m_valueCounts);
 	free(m_valueToCode);
 	free(m_codeToValue);
+	free(m_huffmanBits);
+	free(m_huffmanCodes);
+	free(m_huffmanRankToCode);
+	m_huffmanBits = NULL;
+	m_huffmanCodes = NULL;
+	m_huffmanRankToCode = NULL;
+	m_huffmanSymbolCount = 0;
 }
 
 bool	ValueEncoder::IsValueRegistered(int value) const
@@ -174,16 +186,208 @@ void ValueEncoder::SortValues()
 	free(list);
 }
 
+// values of codes [firstCode,firstCode+count) are assigned in "values" order
+void	ValueEncoder::SetCodeOrder(int firstCode, int count, const int* values)
+{
+	assert((firstCode >= 0) && (firstCode + count <= int(m_codeCount)));
+	for (int i = 0; i < count; i++)
+	{
+		assert(m_valueCounts[values[i]] > 0);
+		m_codeToValue[firstCode + i] = values[i];
+		m_valueToCode[values[i]] = firstCode + i;
+	}
+}
+
+// deterministic local search on codes [firstCode,firstCode+count): a swap of two codes is kept if the cost is lower
+int64_t	ValueEncoder::OptimizeCodeOrder(int firstCode, int count, const CodeOrderCostFunc& cost, int maxEvaluations)
+{
+	assert((firstCode >= 0) && (firstCode + count <= int(m_codeCount)));
+	int* order = m_codeToValue + firstCode;
+	int64_t bestCost = cost(m_codeToValue);
+	int evaluations = 1;
+	bool improved = true;
+	while ((improved) && (evaluations < maxEvaluations))
+	{
+		improved = false;
+		for (int i = 0; (i < count) && (evaluations < maxEvaluations); i++)
+		{
+			for (int j = i + 1; (j < count) && (evaluations < maxEvaluations); j++)
+			{
+				if ((IsDummyCodeEntry(firstCode + i)) && (IsDummyCodeEntry(firstCode + j)))
+					continue;
+				int tmp = order[i];
+				order[i] = order[j];
+				order[j] = tmp;
+				const int64_t c = cost(m_codeToValue);
+				evaluations++;
+				if (c < bestCost)
+				{
+					bestCost = c;
+					improved = true;
+				}
+				else
+				{
+					order[j] = order[i];
+					order[i] = tmp;
+				}
+			}
+		}
+	}
+	for (int i = 0; i < count; i++)
+		m_valueToCode[order[i]] = firstCode + i;
+	return bestCost;
+}
+
+// override the usage count of a registered value ( ex: ESC codes, registered once but used several times )
+void	ValueEncoder::SetValueCount(int value, int count)
+{
+	assert(IsValueRegistered(value));
+	assert((count > 0) && (m_valueCounts[value] != kDummyEntryValue));
+	m_valueCounts[value] = count;
+}
+
+static int	fCompareHuffmanLeaf(const void *arg1, const void *arg2)
+{
+	const SortElement* pa = (const SortElement*)arg1;
+	const SortElement* pb = (const SortElement*)arg2;
+	if (pa->count != pb->count)
+		return (pa->count < pb->count) ? -1 : 1;
+	return pa->code - pb->code;
+}
+
+// Canonical prefix codes from value counts ( dummy entries are not coded ).
+// Lengths come from a two queues Huffman tree, then are limited to kHuffmanMaxBits ( JPEG annex K.3 adjustment ).
+// Codes are assigned in ( length, code ) order, so the decoder only needs the count of codes per length.
+int	ValueEncoder::HuffmanPack(const char* label)
+{
+	free(m_huffmanBits);
+	free(m_huffmanCodes);
+	free(m_huffmanRankToCode);
+	m_huffmanBits = (u8*)calloc(m_codeCount, sizeof(u8));
+	m_huffmanCodes = (u32*)calloc(m_codeCount, sizeof(u32));
+	m_huffmanRankToCode = (int*)malloc(m_codeCount * sizeof(int));
+	memset(m_huffmanLengthCount, 0, sizeof(m_huffmanLengthCount));
+
+	// leaves, lowest count first
+	SortElement* leaves = (SortElement*)malloc(m_codeCount * sizeof(SortElement));
+	int n = 0;
+	for (int i = 0; i < int(m_codeCount); i++)
+	{
+		const int count = m_valueCounts[m_codeToValue[i]];
+		if ((count > 0) && (count != kDummyEntryValue))
+		{
+			leaves[n].code = i;
+			leaves[n].value = m_codeToValue[i];
+			leaves[n].count = count;
+			n++;
+		}
+	}
+	qsort(leaves, n, sizeof(SortElement), fCompareHuffmanLeaf);
+	m_huffmanSymbolCount = n;
+
+	int bitsCount[64] = {};
+	if (1 == n)
+		bitsCount[1] = 1;
+	else if (n > 1)
+	{
+		// nodes 0..n-1 are leaves, n.. are internal nodes, created with increasing weights
+		const int nodeCount = n * 2 - 1;
+		int64_t* weight = (int64_t*)malloc(nodeCount * sizeof(int64_t));
+		int* parent = (int*)malloc(nodeCount * sizeof(int));
+		int* depth = (int*)malloc(nodeCount * sizeof(int));
+		for (int i = 0; i < n; i++)
+			weight[i] = leaves[i].count;
+		int leaf = 0;
+		int node = n;
+		for (int i = n; i < nodeCount; i++)
+		{
+			int pick[2];
+			for (int k = 0; k < 2; k++)
+			{
+				if ((leaf < n) && ((node >= i) || (weight[leaf] <= weight[node])))
+					pick[k] = leaf++;
+				else
+					pick[k] = node++;
+			}
+			weight[i] = weight[pick[0]] + weight[pick[1]];
+			parent[pick[0]] = i;
+			parent[pick[1]] = i;
+		}
+		depth[nodeCount - 1] = 0;
+		for (int i = nodeCount - 2; i >= 0; i--)
+			depth[i] = depth[parent[i]] + 1;
+		for (int i = 0; i < n; i++)
+		{
+			assert(depth[i] < 64);
+			bitsCount[depth[i]]++;
+		}
+		free(depth);
+		free(parent);
+		free(weight);
+
+		// limit code length
+		for (int i = 63; i > kHuffmanMaxBits; i--)
+		{
+			while (bitsCount[i] > 0)
+			{
+				int j = i - 2;
+				while (0 == bitsCount[j])
+					j--;
+				bitsCount[i] -= 2;
+				bitsCount[i - 1]++;
+				bitsCount[j + 1] += 2;
+				bitsCount[j]--;
+			}
+		}
+	}
+
+	// most used codes get the shortest lengths
+	int bits = 1;
+	int sizeInBits = 0;
+	for (int i = n - 1; i >= 0; i--)
+	{
+		while (0 == bitsCount[bits])
+			bits++;
+		bitsCount[bits]--;
+		m_huffmanBits[leaves[i].code] = u8(bits);
+		m_huffmanLengthCount[bits]++;
+		sizeInBits += bits * leaves[i].count;
+	}
+	free(leaves);
+
+	// canonical codes
+	int rank = 0;
+	u32 code = 0;
+	for (int len = 1; len <= kHuffmanMaxBits; len++)
+	{
+		for (int i = 0; i < int(m_codeCount); i++)
+		{
+			if (m_huffmanBits[i] == len)
+			{
+				m_huffmanCodes[i] = code++;
+				m_huffmanRankToCode[rank++] = i;
+			}
+		}
+		code <<= 1;
+	}
+	assert(rank == n);
+
+	if (label)
+		LSPPrintf("%s: %d prefix codes, %d bits max, %d bytes\n", label, n, bits, (sizeInBits + 7) >> 3);
+
+	return sizeInBits;
+}
+
 void ValueEncoder::DebugLog(const char* name)
 {
 
-	printf("ValueEncoder %s : %d codes\n", name, m_codeCount);
+	LSPPrintf("ValueEncoder %s : %d codes\n", name, m_codeCount);
 	int small = 0;
 	for (int i = 0; i < int(m_codeCount); i++)
 	{
 		int val = m_codeToValue[i];
 		assert(m_valueCounts[val] > 0);
 
-		printf("Code %3d : $%04x ( count=%6d )\n", i, val, m_valueCounts[val]);
+		LSPPrintf("Code %3d : $%04x ( count=%6d )\n", i, val, m_valueCounts[val]);
 	}
 }
@@ -8,8 +8,14 @@
 *********************************************************************/
 
 #pragma once
+#include <stdint.h>
+#include <functional>
+#include "LSPTypes.h"
 
 static const int	kDummyEntryValue = 0x7fffffff;
+static const int	kHuffmanMaxBits = 16;			// canonical prefix codes length limit
+
+typedef std::function<int64_t(const int* codeToValue)>	CodeOrderCostFunc;
 
 class ValueEncoder
 {
@@ -25,13 +31,23 @@ public:
 	int		GetCodeFromValue(int value) const;
 	int		GetCodesCount() const { return m_codeCount; }
 	void	SortValues();
+	void	SetCodeOrder(int firstCode, int count, const int* values);
+	int64_t	OptimizeCodeOrder(int firstCode, int count, const CodeOrderCostFunc& cost, int maxEvaluations);
 	int		ComputeValueUsedCount() const;
 	int		GetFirstUnusedValue() const;
 	void	AddDummyCodeEntry();
 	bool	IsDummyCodeEntry(int code) const { return (m_valueCounts[m_codeToValue[code]] == kDummyEntryValue); };
 
+	void	SetValueCount(int value, int count);
 	void	DebugLog(const char* name);
+
+	// canonical prefix codes of registered codes ( length limited to kHuffmanMaxBits ), returns coded size in bits
 	int		HuffmanPack(const char* label);
+	int		GetHuffmanBits(int code) const { return m_huffmanBits[code]; }
+	u32		GetHuffmanCode(int code) const { return m_huffmanCodes[code]; }
+	int		GetHuffmanLengthCount(int bits) const { return m_huffmanLengthCount[bits]; }
+	int		GetHuffmanSymbolCount() const { return m_huffmanSymbolCount; }
+	int		GetCodeFromHuffmanRank(int rank) const { return m_huffmanRankToCode[rank]; }
 
 private:
 	void			Release();
@@ -41,4 +57,9 @@ private:
 	int*			m_valueToCode;
 	int*			m_codeToValue;
 	unsigned int	m_codeCount;
+	u8*				m_huffmanBits;
+	u32*			m_huffmanCodes;
+	int*			m_huffmanRankToCode;
+	int				m_huffmanSymbolCount;
+	int				m_huffmanLengthCount[kHuffmanMaxBits + 1];
 };
@@ -13,6 +13,7 @@
 #include <assert.h>
 #include "LSPTypes.h"
 #include "WavWriter.h"
+#include "Log.h"
 
 
 AudioBuffer::AudioBuffer(int channelCount /* = 2 */)
@@ -66,7 +67,7 @@ bool	WavWriter::Open(const char* sFilename, int samplingRate, int channelCount /
 	}
 	else
 	{
-		printf("ERROR: Unable to write file \"%s\"\n", sFilename);
+		LSPPrintf("ERROR: Unable to write file \"%s\"\n", sFilename);
 	}
 	return ret;
 }
@@ -2,6 +2,7 @@
 // Created by Rich/Defekt on 21.02.2024.
 //
 
+#include <string.h>
 #include "WindowsCompat.h"
 
 #ifdef MACOS_LINUX
@@ -12,4 +13,11 @@ int fopen_s(FILE** h, const char* fname, const char* mode)
     return *h == NULL ? 1 : 0;
 }
 
+int strncpy_s(char* dst, const char* src, size_t count)
+{
+    strncpy(dst, src, count - 1);
+    dst[count - 1] = 0;
+    return 0;
+}
+
 #endif
\ No newline at end of file
@@ -13,6 +13,7 @@
 #define fprintf_s fprintf
 
 int fopen_s(FILE** h, const char* fname, const char* mode);
+int strncpy_s(char* dst, const char* src, size_t count);
 
 #endif
 
@@ -9,35 +9,119 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
 #include "adpcm.h"
 #include "WavWriter.h"
 
-static const int8_t sAdpcmTable[16] =
+// same tables in LightSpeedPlayer.asm & generated insane player ( .dpcmTable )
+static const int8_t sAdpcmTables[kDpcmTableCount][16] =
 {
-	0,1,2,4,8,16,32,64,-128,-64,-32,-16,-8,-4,-2,-1
+	{ 0,1,2,4,8,16,32,64,-128,-64,-32,-16,-8,-4,-2,-1 },		// default
+	{ 0,1,2,4,7,12,20,32,-48,-32,-20,-12,-7,-4,-2,-1 },			// medium
+	{ 0,1,2,3,4,6,8,11,-14,-11,-8,-6,-4,-3,-2,-1 },				// soft samples
+	{ 0,1,4,9,16,25,48,96,-128,-96,-48,-25,-16,-9,-4,-1 },		// loud samples
 };
+static const int8_t* sAdpcmTable = sAdpcmTables[0];
 
-static uint8_t bestIndex(int value, int next, const int8_t* table)
+const int8_t*	dpcmGetTable(int index)
 {
-	uint8_t bestId = 0;
-	uint32_t bestDist = ~0;
-	int diff = next - value;
-	for (int i = 0; i < 16; i++)
+	assert((index >= 0) && (index < kDpcmTableCount));
+	return sAdpcmTables[index];
+}
+
+// Trellis ( Viterbi ) encoder: each state is a decoded sample value, so the total squared error is minimized instead of
+// choosing each nibble greedily. Transitions leaving the -128..127 range don't exist, so the runtime decoder never has to
+// clamp. The search runs over a window: when it's full, the first half of the current best path is committed and only the
+// states going through it are kept, so memory doesn't depend on the sample length.
+// Cost step is a "shifted min" over 16 deltas, SSE2 when available ( same result as scalar ).
+static const int		kStateCount = 256;					// decoded value + 128
+static const int		kStatePad = 128;					// INF margins, any table delta reads in range
+static const int32_t	kInfiniteCost = 1 << 30;
+static const int		kTrellisWindow = 2048;				// back pointers kept, in samples: 256 KiB per encoder
+static const int		kTrellisCommit = kTrellisWindow / 2;	// samples committed when the window is full
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define	DPCM_SSE2	1
+#endif
+
+// next[t] = min over nibbles n of cost[t - table[n]], best[t] = first nibble reaching this min
+static void	TrellisStep(const int32_t* paddedCost, int32_t* next, int32_t* best, const int8_t* table)
+{
+	for (int t = 0; t < kStateCount; t++)
 	{
-		int emulatedValue = value + table[i];
-		if ((emulatedValue < -128) || (emulatedValue > 127))	// discard overshot value during encoding to avoid clamping in runtime decoder
-			continue;
+		next[t] = kInfiniteCost;
+		best[t] = 0;
+	}
+	for (int n = 0; n < 16; n++)
+	{
+		const int32_t* src = paddedCost + kStatePad - table[n];
+#if DPCM_SSE2
+		const __m128i nibble = _mm_set1_epi32(n);
+		for (int t = 0; t < kStateCount; t += 4)
+		{
+			const __m128i c = _mm_loadu_si128((const __m128i*)(src + t));
+			const __m128i m = _mm_load_si128((const __m128i*)(next + t));
+			const __m128i b = _mm_load_si128((const __m128i*)(best + t));
+			const __m128i lt = _mm_cmplt_epi32(c, m);
+			_mm_store_si128((__m128i*)(next + t), _mm_or_si128(_mm_and_si128(lt, c), _mm_andnot_si128(lt, m)));
+			_mm_store_si128((__m128i*)(best + t), _mm_or_si128(_mm_and_si128(lt, nibble), _mm_andnot_si128(lt, b)));
+		}
+#else
+		for (int t = 0; t < kStateCount; t++)
+		{
+			const bool lt = src[t] < next[t];
+			next[t] = lt ? src[t] : next[t];
+			best[t] = lt ? n : best[t];
+		}
+#endif
+	}
+}
 
-		uint32_t dist = abs(diff - table[i]);
-		if (dist < bestDist)
+// greedy encoder, closest value for each sample. Used if the trellis back pointers can't be allocated
+static void	dpcmEncodeGreedy(const int8_t* input, int inLen, uint8_t* output, const int8_t* table)
+{
+	int sample = 0;
+	for (int i = 0; i < inLen; i++)
+	{
+		int nibble = 0;
+		int bestDist = 1 << 30;
+		for (int n = 0; n < 16; n++)
 		{
-			bestDist = dist;
-			bestId = i;
+			const int value = sample + table[n];
+			if ((value < -128) || (value > 127))		// runtime decoder never clamps
+				continue;
+			const int dist = abs(input[i] - value);
+			if (dist < bestDist)
+			{
+				bestDist = dist;
+				nibble = n;
+			}
 		}
+		sample += table[nibble];
+		if (i & 1)
+			output[i >> 1] |= nibble;
+		else
+			output[i >> 1] = uint8_t(nibble << 4);
+	}
+}
+
+static int	BestState(const int32_t* cost)
+{
+	int state = 0;
+	for (int t = 1; t < kStateCount; t++)
+	{
+		if (cost[t] < cost[state])
+			state = t;
 	}
-	return bestId;
+	return state;
+}
+
+static inline int	PathNibble(const uint8_t* row, int state)
+{
+	return (row[state >> 1] >> ((state & 1) * 4)) & 15;
 }
 
 void	dpcmEncode(const int8_t* input, int inLen, uint8_t* output, const int8_t* table)
@@ -46,15 +130,114 @@ void	dpcmEncode(const int8_t* input, int inLen, uint8_t* output, const int8_t* t
 		table = sAdpcmTable;
 
 	assert(0 == (inLen & 1));		// amiga samples len are always even
-	int sample = 0;
-	for (int i = 0; i < inLen; i+=2)
+	if (0 == inLen)
+		return;
+
+	// best nibble reaching each state, for each sample of the window ( two states per byte )
+	const int rowBytes = kStateCount / 2;
+	uint8_t* path = (uint8_t*)malloc(size_t(kTrellisWindow) * rowBytes);
+	if (NULL == path)
+	{
+		dpcmEncodeGreedy(input, inLen, output, table);
+		return;
+	}
+
+	alignas(16) int32_t paddedCost[kStatePad + kStateCount + kStatePad];
+	alignas(16) int32_t next[kStateCount];
+	alignas(16) int32_t best[kStateCount];
+	int32_t* cost = paddedCost + kStatePad;
+	for (int i = 0; i < kStatePad + kStateCount + kStatePad; i++)
+		paddedCost[i] = kInfiniteCost;
+	cost[128] = 0;		// decoder starts at 0
+
+	int base = 0;				// first sample of the window
+#ifndef NDEBUG
+	int baseState = 128;		// decoded value + 128 before the first sample of the window ( only checked by asserts )
+#endif
+	for (int i = 0; i < inLen; i++)
+	{
+		if (i - base == kTrellisWindow)
+		{
+			// window full: commit its first half from the current best path
+			int state = BestState(cost);
+			int committed = -1;
+			for (int r = i - 1; r >= base; r--)
+			{
+				const int nibble = PathNibble(path + size_t(r - base) * rowBytes, state);
+				if (r < base + kTrellisCommit)
+				{
+					if (r & 1)
+						output[r >> 1] = uint8_t(nibble);
+					else
+						output[r >> 1] |= nibble << 4;
+				}
+				state -= table[nibble];
+				if (r == base + kTrellisCommit)
+					committed = state;
+			}
+			assert(baseState == state);
+
+			// only the states whose path goes through the committed one stay reachable
+			int ancestor[kStateCount];
+			int previous[kStateCount];
+			for (int t = 0; t < kStateCount; t++)
+				ancestor[t] = t;
+			for (int r = base + kTrellisCommit; r < i; r++)
+			{
+				const uint8_t* row = path + size_t(r - base) * rowBytes;
+				for (int t = 0; t < kStateCount; t++)
+					previous[t] = ancestor[t];
+				for (int t = 0; t < kStateCount; t++)
+				{
+					const int from = t - table[PathNibble(row, t)];
+					ancestor[t] = ((from >= 0) && (from < kStateCount)) ? previous[from] : -1;
+				}
+			}
+			for (int t = 0; t < kStateCount; t++)
+			{
+				if (ancestor[t] != committed)
+					cost[t] = kInfiniteCost;
+			}
+
+			memmove(path, path + size_t(kTrellisCommit) * rowBytes, size_t(kTrellisWindow - kTrellisCommit) * rowBytes);
+			base += kTrellisCommit;
+#ifndef NDEBUG
+			baseState = committed;
+#endif
+		}
+
+		TrellisStep(paddedCost, next, best, table);
+		int32_t minCost = kInfiniteCost;
+		for (int t = 0; t < kStateCount; t++)
+		{
+			const int err = (t - 128) - input[i];
+			next[t] += err * err;
+			minCost = (next[t] < minCost) ? next[t] : minCost;
+		}
+		// costs are kept relative to the best state, so they never overflow
+		uint8_t* p = path + size_t(i - base) * rowBytes;
+		for (int t = 0; t < kStateCount; t++)
+		{
+			const int32_t c = next[t] - minCost;
+			cost[t] = (c < kInfiniteCost) ? c : kInfiniteCost;
+		}
+		for (int t = 0; t < kStateCount; t += 2)
+			p[t >> 1] = uint8_t(best[t] | (best[t + 1] << 4));
+	}
+
+	int state = BestState(cost);
+	for (int i = inLen - 1; i >= base; i--)
 	{
-		uint8_t nib0 = bestIndex(sample, input[i], table);
-		sample += table[nib0];
-		uint8_t nib1 = bestIndex(sample, input[i+1], table);
-		sample += table[nib1];
-		output[i >> 1] = (nib0 << 4) | (nib1);
+		const int nibble = PathNibble(path + size_t(i - base) * rowBytes, state);
+		if (i & 1)
+			output[i >> 1] = uint8_t(nibble);
+		else
+			output[i >> 1] |= nibble << 4;
+		state -= table[nibble];
+		assert((state >= 0) && (state < kStateCount));
 	}
+	assert(baseState == state);
+	free(path);
 }
 
 void dpcmDecode(const uint8_t* stream, int inLen, int8_t* output, const int8_t* table)
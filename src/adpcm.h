@@ -1,5 +1,10 @@
 #pragma once
 #include <stdint.h>
 
+// step tables family: the encoder keeps the best one per sample, its index is stored in the ADPCM header
+static const int	kDpcmTableCount = 4;
+
+const int8_t*	dpcmGetTable(int index);
+
 void dpcmEncode(const int8_t* input, int inLen, uint8_t* output, const int8_t* table = nullptr);
 void dpcmDecode(const uint8_t* stream, int inLen, int8_t* output, const int8_t* table = nullptr);
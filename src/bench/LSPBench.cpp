@@ -0,0 +1,296 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// lsp_bench: time conversion, Paula preview and packing estimate on synthetic MODs
+// Each measure is repeated, median time is used for the throughput
+
+#define	_CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../LSPEncoder.h"
+#include "../LSPDecoder.h"
+#include "../Log.h"
+#include "../CycleModel.h"
+#include "SyntheticMod.h"
+
+int	ShrinklerCompressEstimate(u8* data, int size);
+
+enum BenchPhase
+{
+	kBenchConvert,
+	kBenchPreview,
+	kBenchPack,
+	kBenchPhaseCount
+};
+
+static const char* const	kBenchPhaseNames[kBenchPhaseCount] = { "convert", "preview", "pack" };
+
+struct BenchOptions
+{
+	int			repeat;
+	u32			seed;
+	bool		adpcm;
+	bool		preview;
+	bool		pack;
+	const char*	caseName;
+	const char*	saveDir;
+	const char*	playerDir;
+};
+
+struct BenchStats
+{
+	double	median;
+	double	min;
+	double	stddev;
+};
+
+static BenchStats	ComputeStats(std::vector<double> times)
+{
+	BenchStats stats = {};
+	if (times.empty())
+		return stats;
+	std::sort(times.begin(), times.end());
+	const size_t n = times.size();
+	stats.median = (n & 1) ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) * 0.5;
+	stats.min = times[0];
+	double mean = 0.0;
+	for (double t : times)
+		mean += t;
+	mean /= double(n);
+	double var = 0.0;
+	for (double t : times)
+		var += (t - mean) * (t - mean);
+	stats.stddev = sqrt(var / double(n));
+	return stats;
+}
+
+template <typename F> static double	TimeSeconds(F func)
+{
+	const auto start = std::chrono::steady_clock::now();
+	func();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void	PrintPhase(const char* caseName, BenchPhase phase, int frames, size_t bytes, const std::vector<double>& times)
+{
+	const BenchStats stats = ComputeStats(times);
+	const double fps = (stats.median > 0.0) ? double(frames) / stats.median : 0.0;
+	const double mbs = (stats.median > 0.0) ? double(bytes) / (stats.median * 1024.0 * 1024.0) : 0.0;
+	const double dev = (stats.median > 0.0) ? (stats.stddev * 100.0) / stats.median : 0.0;
+	printf("%-10s %-8s %8d %11.3f %10.3f %8.1f%% %12.0f %9.3f\n", caseName, kBenchPhaseNames[phase], frames,
+		stats.median * 1000.0, stats.min * 1000.0, dev, fps, mbs);
+}
+
+static bool	BenchCase(SyntheticModKind kind, const BenchOptions& options)
+{
+	const char* name = GetSyntheticModName(kind);
+
+	std::vector<u8> mod;
+	GenerateSyntheticMod(kind, options.seed, mod);
+
+	char modName[_MAX_PATH];
+	snprintf(modName, sizeof(modName), "%s.mod", name);
+	if (options.saveDir)
+	{
+		std::string path = std::string(options.saveDir) + "/" + modName;
+		FILE* h = fopen(path.c_str(), "wb");
+		if (h)
+		{
+			fwrite(mod.data(), 1, mod.size(), h);
+			fclose(h);
+		}
+		else
+			printf("Warning: Unable to save \"%s\"\n", path.c_str());
+	}
+
+	ConvertParams params;
+	params.m_modFilename = modName;
+	params.m_adpcm = options.adpcm;
+
+	// conversion ( keep the last result for preview & pack )
+	std::string log;
+	std::vector<double> times;
+	LSPConvertOutput* output = NULL;
+	LSPEncoder* encoder = NULL;
+	for (int r = 0; r < options.repeat; r++)
+	{
+		delete output;
+		delete encoder;
+		output = new LSPConvertOutput;
+		encoder = new LSPEncoder;
+		encoder->SetConvertParams(params);
+
+		log.clear();
+		LSPLogCaptureBegin(&log);
+		bool ok = false;
+		times.push_back(TimeSeconds([&]() { ok = encoder->ConvertFromMemory(mod.data(), int(mod.size()), output); }));
+		LSPLogCaptureEnd();
+		if (!ok)
+		{
+			printf("%-10s FAILED\n%s\n", name, log.c_str());
+			delete output;
+			delete encoder;
+			return false;
+		}
+	}
+
+	const int frames = encoder->GetFrameCount();
+	PrintPhase(name, kBenchConvert, frames, mod.size(), times);
+
+	if (options.preview)
+	{
+		times.clear();
+		int renderedFrames = 0;
+		size_t pcmBytes = 0;
+		for (int r = 0; r < options.repeat; r++)
+		{
+			LSPDecoder decoder;
+			log.clear();
+			LSPLogCaptureBegin(&log);
+			times.push_back(TimeSeconds([&]() { decoder.RenderFromMemory(output->score.GetRawBuffer(), output->score.GetSize(),
+				output->bank.GetRawBuffer(), output->bank.GetSize(), NULL, false, false, false); }));
+			LSPLogCaptureEnd();
+			renderedFrames = decoder.GetRenderedFrameCount();
+			pcmBytes = size_t(decoder.GetRenderedSampleCount()) * 2 * sizeof(s16);
+		}
+		PrintPhase(name, kBenchPreview, renderedFrames, pcmBytes, times);
+	}
+
+	if (options.pack)
+	{
+		times.clear();
+		for (int r = 0; r < options.repeat; r++)
+		{
+			log.clear();
+			LSPLogCaptureBegin(&log);
+			times.push_back(TimeSeconds([&]() { ShrinklerCompressEstimate((u8*)output->score.GetRawBuffer(), output->score.GetSize()); }));
+			LSPLogCaptureEnd();
+		}
+		PrintPhase(name, kBenchPack, frames, output->score.GetSize(), times);
+	}
+
+	printf("%-10s ( MOD %d KiB, %d LSP instruments, %d cmds, score %d bytes, bank %d bytes, %d replayed frames )\n", "",
+		int(mod.size() >> 10), encoder->GetLSPInstrumentCount(), encoder->GetCmdCount(), output->score.GetSize(), output->bank.GetSize(),
+		encoder->GetReplayedFrameCount());
+
+	delete output;
+	delete encoder;
+	return true;
+}
+
+static void	Help()
+{
+	printf("Usage:\n"
+		"\tlsp_bench [-options]\n"
+		"\noptions:\n"
+		"\t-repeat <n> : measure each phase n times (default 5)\n"
+		"\t-case <name> : only run one case (longsong, offsets, bpm, cmdwords)\n"
+		"\t-seed <n> : synthetic MOD generator seed (default 1)\n"
+		"\t-adpcm : convert with -adpcm option\n"
+		"\t-nopreview : skip Paula preview rendering\n"
+		"\t-nopack : skip Shrinkler packing estimate\n"
+		"\t-save <dir> : also save the generated MOD files in <dir>\n"
+		"\t-checkcycles <dir> : only check the -cycles player model against the .asm players in <dir>\n");
+}
+
+static bool	ParseArgs(int argc, char* argv[], BenchOptions& options)
+{
+	for (int argId = 1; argId < argc; argId++)
+	{
+		const char* arg = argv[argId];
+		const bool hasValue = (argId < argc - 1);
+		if ((0 == strcmp(arg, "-repeat")) && hasValue)
+			options.repeat = atoi(argv[++argId]);
+		else if ((0 == strcmp(arg, "-case")) && hasValue)
+			options.caseName = argv[++argId];
+		else if ((0 == strcmp(arg, "-seed")) && hasValue)
+			options.seed = u32(strtoul(argv[++argId], NULL, 0));
+		else if ((0 == strcmp(arg, "-save")) && hasValue)
+			options.saveDir = argv[++argId];
+		else if ((0 == strcmp(arg, "-checkcycles")) && hasValue)
+			options.playerDir = argv[++argId];
+		else if (0 == strcmp(arg, "-adpcm"))
+			options.adpcm = true;
+		else if (0 == strcmp(arg, "-nopreview"))
+			options.preview = false;
+		else if (0 == strcmp(arg, "-nopack"))
+			options.pack = false;
+		else
+		{
+			printf("Unknown option \"%s\"\n\n", arg);
+			return false;
+		}
+	}
+	if (options.repeat < 1)
+	{
+		printf("ERROR: Invalid -repeat count\n\n");
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	printf("LSP benchmark v%d.%02d\n", LSP_MAJOR_VERSION, LSP_MINOR_VERSION);
+
+	BenchOptions options;
+	options.repeat = 5;
+	options.seed = 1;
+	options.adpcm = false;
+	options.preview = true;
+	options.pack = true;
+	options.caseName = NULL;
+	options.saveDir = NULL;
+	options.playerDir = NULL;
+
+	if (!ParseArgs(argc, argv, options))
+	{
+		Help();
+		return -1;
+	}
+
+	if (options.playerDir)
+	{
+		const int errors = PlayerCostModel::CheckPlayerSources(options.playerDir);
+		if (0 == errors)
+			printf("-cycles player model matches the .asm players of \"%s\"\n", options.playerDir);
+		return (0 == errors) ? 0 : -1;
+	}
+
+#ifndef NDEBUG
+	printf("Warning: asserts enabled, use a Release build for meaningful timings\n");
+#endif
+	printf("%d repeat(s), seed %u%s\n\n", options.repeat, options.seed, options.adpcm ? ", -adpcm" : "");
+	printf("%-10s %-8s %8s %11s %10s %9s %12s %9s\n", "case", "phase", "frames", "median ms", "min ms", "stddev", "frames/s", "MB/s");
+
+	int failCount = 0;
+	int runCount = 0;
+	for (int k = 0; k < kSynthKindCount; k++)
+	{
+		const SyntheticModKind kind = SyntheticModKind(k);
+		if ((options.caseName) && (0 != strcmp(options.caseName, GetSyntheticModName(kind))))
+			continue;
+		runCount++;
+		if (!BenchCase(kind, options))
+			failCount++;
+	}
+
+	if (0 == runCount)
+	{
+		printf("ERROR: Unknown case \"%s\"\n", options.caseName);
+		return -1;
+	}
+	return (0 == failCount) ? 0 : -1;
+}
@@ -0,0 +1,297 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Deterministic synthetic 4 channels MOD generator ( lsp_bench )
+
+#include <string.h>
+#include <assert.h>
+#include "SyntheticMod.h"
+
+static const int kRowCount = 64;
+static const int kChannelCount = 4;
+static const int kPatternSize = kRowCount * kChannelCount * 4;
+
+// 3 octaves ProTracker periods ( finetune 0 )
+static const u16 kPeriods[36] =
+{
+	856,808,762,720,678,640,604,570,538,508,480,453,
+	428,404,381,360,339,320,302,285,269,254,240,226,
+	214,202,190,180,170,160,151,143,135,127,120,113
+};
+
+// xorshift32, so the generated bytes never depend on the C runtime
+class SynthRandom
+{
+public:
+	SynthRandom(u32 seed) : m_state(seed ? seed : 0x2545f491) {}
+
+	u32		Next()
+	{
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return m_state;
+	}
+	int		Range(int n) { return int(Next() % u32(n)); }
+	bool	Chance(int percent) { return Range(100) < percent; }
+
+private:
+	u32		m_state;
+};
+
+class ModBuilder
+{
+public:
+	ModBuilder(int patternCount)
+	{
+		memset(m_samples, 0, sizeof(m_samples));
+		m_patterns.assign(patternCount * kPatternSize, 0);
+	}
+
+	// lengths in bytes, repLen <= 2 means no loop
+	void	SetSample(int id, int len, int repStart, int repLen, int volume, SynthRandom& rnd)
+	{
+		assert((id >= 1) && (id <= 31));
+		assert((0 == (len & 1)) && (len <= 0xffff * 2));
+		SampleInfo& info = m_samples[id - 1];
+		info.len = len;
+		info.repStart = (repLen > 2) ? repStart : 0;
+		info.repLen = (repLen > 2) ? repLen : 2;
+		info.volume = volume;
+
+		// saw + square mix with a bit of noise, a different shape for each sample
+		const int sawStep = 1 + rnd.Range(6);
+		const int squareHalf = 8 + rnd.Range(56);
+		int saw = 0;
+		for (int i = 0; i < len; i++)
+		{
+			const int square = ((i / squareHalf) & 1) ? 40 : -40;
+			const int v = (saw - 64) + square + rnd.Range(17) - 8;
+			m_sampleData.push_back(u8(s8(v < -128 ? -128 : (v > 127 ? 127 : v))));
+			saw = (saw + sawStep) & 127;
+		}
+	}
+
+	void	SetNote(int pattern, int row, int channel, int instrument, int period, int fx, int param)
+	{
+		u8* p = &m_patterns[pattern * kPatternSize + (row * kChannelCount + channel) * 4];
+		p[0] = u8((instrument & 0xf0) | (period >> 8));
+		p[1] = u8(period & 255);
+		p[2] = u8(((instrument & 15) << 4) | (fx & 15));
+		p[3] = u8(param);
+	}
+
+	void	Build(const std::vector<int>& order, std::vector<u8>& mod) const
+	{
+		assert((order.size() >= 1) && (order.size() <= 127));		// micromod reads song length & 0x7f
+		static const char title[20] = "lsp_bench synthetic";
+		mod.assign(title, title + 20);
+		for (int i = 0; i < 31; i++)
+		{
+			const SampleInfo& info = m_samples[i];
+			u8 header[30] = {};
+			if (info.len > 0)
+				memcpy(header, "synth", 5);
+			header[22] = u8(info.len >> 9);
+			header[23] = u8(info.len >> 1);
+			header[24] = 0;							// finetune
+			header[25] = u8(info.volume);
+			header[26] = u8(info.repStart >> 9);
+			header[27] = u8(info.repStart >> 1);
+			header[28] = u8((info.len > 0 ? info.repLen : 2) >> 9);
+			header[29] = u8((info.len > 0 ? info.repLen : 2) >> 1);
+			mod.insert(mod.end(), header, header + 30);
+		}
+		mod.push_back(u8(order.size()));
+		mod.push_back(127);
+		for (int i = 0; i < 128; i++)
+			mod.push_back(u8((i < int(order.size())) ? order[i] : 0));
+		mod.insert(mod.end(), { 'M', '.', 'K', '.' });
+		mod.insert(mod.end(), m_patterns.begin(), m_patterns.end());
+		mod.insert(mod.end(), m_sampleData.begin(), m_sampleData.end());
+	}
+
+private:
+	struct SampleInfo
+	{
+		int		len;
+		int		repStart;
+		int		repLen;
+		int		volume;
+	};
+
+	SampleInfo			m_samples[31];
+	std::vector<u8>		m_patterns;
+	std::vector<u8>		m_sampleData;
+};
+
+// a dozen of samples, short & long, half of them looping
+static void	AddGenericSamples(ModBuilder& mod, SynthRandom& rnd, int count)
+{
+	static const int lens[4] = { 512, 2048, 6000, 16384 };
+	for (int i = 1; i <= count; i++)
+	{
+		const int len = lens[rnd.Range(4)];
+		if (rnd.Chance(50))
+			mod.SetSample(i, len, (len / 4) & ~1, len - ((len / 4) & ~1), 32 + rnd.Range(33), rnd);
+		else
+			mod.SetSample(i, len, 0, 0, 32 + rnd.Range(33), rnd);
+	}
+}
+
+// usual melodic content. No position jump, pattern break or loop command so the song length is known
+static void	RandomCell(ModBuilder& mod, SynthRandom& rnd, int pattern, int row, int channel, int instrumentCount, int notePercent)
+{
+	int instrument = 0;
+	int period = 0;
+	if (rnd.Chance(notePercent))
+	{
+		instrument = 1 + rnd.Range(instrumentCount);
+		period = kPeriods[rnd.Range(36)];
+	}
+
+	int fx = 0;
+	int param = 0;
+	const int x = rnd.Range(100);
+	if (x < 10)			{ fx = 0xa; param = rnd.Chance(50) ? (1 + rnd.Range(4)) : ((1 + rnd.Range(4)) << 4); }	// volume slide
+	else if (x < 15)	{ fx = 0xc; param = rnd.Range(65); }						// set volume
+	else if (x < 20)	{ fx = 0x4; param = 0x46; }									// vibrato
+	else if (x < 24)	{ fx = 0x0; param = 0x37; }									// arpeggio
+	else if (x < 27)	{ fx = 0x1 + rnd.Range(2); param = 1 + rnd.Range(3); }		// portamento up/down
+	else if ((x < 30) && (period))	{ fx = 0x3; param = 4 + rnd.Range(8); }		// tone portamento
+
+	mod.SetNote(pattern, row, channel, instrument, period, fx, param);
+}
+
+static void	GenerateLongSong(SynthRandom& rnd, std::vector<u8>& out)
+{
+	const int patternCount = 16;
+	ModBuilder mod(patternCount);
+	AddGenericSamples(mod, rnd, 12);
+	for (int p = 0; p < patternCount; p++)
+		for (int row = 0; row < kRowCount; row++)
+			for (int c = 0; c < kChannelCount; c++)
+				RandomCell(mod, rnd, p, row, c, 12, 40);
+
+	std::vector<int> order;
+	for (int i = 0; i < 127; i++)
+		order.push_back((i * 7) % patternCount);
+	mod.Build(order, out);
+}
+
+static void	GenerateSampleOffsets(SynthRandom& rnd, std::vector<u8>& out)
+{
+	// 31 long samples, each played with 74 different $9xx values: 31*74 = 2294 LSP instruments
+	const int offsetCount = 74;
+	const int patternCount = 16;
+	ModBuilder mod(patternCount);
+	for (int i = 1; i <= 31; i++)
+		mod.SetSample(i, 32768, 0, 0, 48, rnd);
+
+	for (int p = 0; p < patternCount; p++)
+		for (int row = 0; row < kRowCount; row++)
+			for (int c = 0; c < kChannelCount; c++)
+			{
+				const int k = (p * kRowCount + row) * kChannelCount + c;
+				const int offset = (k / 31) % offsetCount;
+				mod.SetNote(p, row, c, 1 + (k % 31), kPeriods[(k * 5) % 36], offset ? 0x9 : 0, offset);
+			}
+
+	std::vector<int> order;
+	for (int i = 0; i < patternCount; i++)
+		order.push_back(i);
+	mod.Build(order, out);
+}
+
+static void	GenerateBpmChanges(SynthRandom& rnd, std::vector<u8>& out)
+{
+	const int patternCount = 24;
+	ModBuilder mod(patternCount);
+	AddGenericSamples(mod, rnd, 8);
+	for (int p = 0; p < patternCount; p++)
+		for (int row = 0; row < kRowCount; row++)
+		{
+			for (int c = 0; c < kChannelCount; c++)
+				RandomCell(mod, rnd, p, row, c, 8, 30);
+			if (0 == (row & 1))		// BPM change every other row, on voice 0
+				mod.SetNote(p, row, 0, 1 + rnd.Range(8), kPeriods[rnd.Range(36)], 0xf, 32 + rnd.Range(224));
+		}
+
+	std::vector<int> order;
+	for (int i = 0; i < patternCount; i++)
+		order.push_back(i);
+	mod.Build(order, out);
+}
+
+static void	GenerateCmdWords(SynthRandom& rnd, std::vector<u8>& out)
+{
+	// each voice gets independent note / retrigger / volume / period events, to produce
+	// as many different frame cmd words as possible
+	const int patternCount = 16;
+	ModBuilder mod(patternCount);
+	AddGenericSamples(mod, rnd, 12);
+	for (int p = 0; p < patternCount; p++)
+		for (int row = 0; row < kRowCount; row++)
+			for (int c = 0; c < kChannelCount; c++)
+			{
+				int instrument = 0;
+				int period = 0;
+				int fx = 0;
+				int param = 0;
+				const int note = rnd.Range(100);
+				if (note < 25)
+				{
+					instrument = 1 + rnd.Range(12);
+					period = kPeriods[rnd.Range(36)];
+				}
+				else if (note < 35)
+				{
+					period = kPeriods[rnd.Range(36)];		// note without instrument
+				}
+				else if (note < 40)
+				{
+					instrument = 1 + rnd.Range(12);			// instrument without note
+				}
+				const int x = rnd.Range(100);
+				if (x < 20)			{ fx = 0xc; param = rnd.Range(65); }
+				else if (x < 30)	{ fx = 0x4; param = 0x11 * (1 + rnd.Range(8)); }
+				else if (x < 40)	{ fx = 0xa; param = rnd.Chance(50) ? 2 : 0x20; }
+				mod.SetNote(p, row, c, instrument, period, fx, param);
+			}
+
+	std::vector<int> order;
+	for (int i = 0; i < patternCount; i++)
+		order.push_back(i);
+	mod.Build(order, out);
+}
+
+const char*	GetSyntheticModName(SyntheticModKind kind)
+{
+	static const char* const names[kSynthKindCount] =
+	{
+		"longsong",
+		"offsets",
+		"bpm",
+		"cmdwords",
+	};
+	return names[kind];
+}
+
+void	GenerateSyntheticMod(SyntheticModKind kind, u32 seed, std::vector<u8>& mod)
+{
+	SynthRandom rnd(seed * 0x9e3779b9u + u32(kind) + 1);
+	switch (kind)
+	{
+	case kSynthLongSong:		GenerateLongSong(rnd, mod); break;
+	case kSynthSampleOffsets:	GenerateSampleOffsets(rnd, mod); break;
+	case kSynthBpmChanges:		GenerateBpmChanges(rnd, mod); break;
+	case kSynthCmdWords:		GenerateCmdWords(rnd, mod); break;
+	default:					assert(false); mod.clear(); break;
+	}
+}
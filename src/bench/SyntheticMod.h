@@ -0,0 +1,27 @@
+/*********************************************************************
+
+	LSP (Light Speed Player) Converter
+	Fastest & Tiniest 68k MOD player ever!
+	Written by Arnaud Carré aka Leonard/Oxygene (@leonard_coder)
+	https://github.com/arnaud-carre/LSPlayer
+
+*********************************************************************/
+
+// Deterministic synthetic 4 channels MOD generator ( lsp_bench )
+// Each kind stresses a specific part of the converter. Same kind & seed always give the same bytes.
+
+#pragma once
+#include <vector>
+#include "../LSPTypes.h"
+
+enum SyntheticModKind
+{
+	kSynthLongSong,				// 127 positions song, dense notes & effects
+	kSynthSampleOffsets,		// heavy $9xx use, LSP instrument count close to LSP_INSTRUMENT_MAX
+	kSynthBpmChanges,			// $Fxx BPM change every other row
+	kSynthCmdWords,				// independent per voice events, cmd count close to LSP_CMDWORD_MAX
+	kSynthKindCount
+};
+
+const char*	GetSyntheticModName(SyntheticModKind kind);
+void		GenerateSyntheticMod(SyntheticModKind kind, u32 seed, std::vector<u8>& mod);
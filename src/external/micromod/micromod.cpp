@@ -1,36 +1,15 @@
 // warning: this .c file is now compiled as c++
+#include <stddef.h>
 #include "micromod.h"
 #include "../../LSPEncoder.h"
+#include "../../Log.h"
 
-#define MAX_CHANNELS 16
 #define FP_SHIFT 14
 #define FP_ONE   16384
 #define FP_MASK  16383
 
 static const char *MICROMOD_VERSION = "Micromod Protracker replay 20260303 (c)mumart@gmail.com";
 
-struct note {
-	unsigned short key;
-	unsigned char instrument, effect, param;
-};
-
-struct instrument {
-	unsigned char volume, fine_tune;
-	unsigned long loop_start, loop_length;
-	const signed char *sample_data;
-};
-
-struct channel {
-	struct note note;
-	unsigned short period, porta_period;
-	unsigned long sample_offset, sample_idx, step;
-	unsigned char volume, panning, fine_tune, ampl, mute;
-	unsigned char id, instrument, assigned, porta_speed, pl_row, fx_count;
-	unsigned char vibrato_type, vibrato_phase, vibrato_speed, vibrato_depth;
-	unsigned char tremolo_type, tremolo_phase, tremolo_speed, tremolo_depth;
-	signed char tremolo_add, vibrato_add, arpeggio_add;
-};
-
 static const unsigned short fine_tuning[] = {
 	4340, 4308, 4277, 4247, 4216, 4186, 4156, 4126,
 	4096, 4067, 4037, 4008, 3979, 3951, 3922, 3894
@@ -46,18 +25,11 @@ static const unsigned char sine_table[] = {
 	255, 253, 250, 244, 235, 224, 212, 197, 180, 161, 141, 120,  97,  74,  49,  24
 };
 
-static signed char *module_data;
-static unsigned char *pattern_data, *sequence;
-static long song_length, restart, num_patterns, num_channels;
-struct instrument instruments[ 32 ];
-
-static long sample_rate, gain, c2_rate, tick_offset;
-long tick_len;
-static long pattern, break_pattern, row, next_row, tick;
-static long speed, pl_count, pl_channel, random_seed;
-static char rowPlayed[128 * 64];
-
-static struct channel channels[ MAX_CHANNELS ];
+Micromod::Micromod(LSPEncoder* encoder)
+{
+	memset(this, 0, sizeof(Micromod));
+	this->encoder = encoder;
+}
 
 static long calculate_num_patterns( signed char *module_header ) {
 	long num_patterns, order_entry, pattern;
@@ -88,7 +60,7 @@ long calculate_num_channels( signed char *module_header ) {
 			numchan = 0;
 			break;
 	}
-	if( numchan > MAX_CHANNELS ) numchan = 0;
+	if( numchan > Micromod::MAX_CHANNELS ) numchan = 0;
 	return numchan;
 }
 
@@ -96,11 +68,11 @@ static long unsigned_short_big_endian( signed char *buf, long offset ) {
 	return ( ( buf[ offset ] & 0xFF ) << 8 ) | ( buf[ offset + 1 ] & 0xFF );
 }
 
-static void set_tempo( long tempo ) {
+void Micromod::set_tempo( long tempo ) {
 	tick_len = ( ( sample_rate << 1 ) + ( sample_rate >> 1 ) ) / tempo;
 }
 
-static void update_frequency( struct channel *chan ) {
+void Micromod::update_frequency( struct channel *chan ) {
 	long period, volume;
 	unsigned long freq;
 	period = chan->period + chan->vibrato_add;
@@ -112,11 +84,11 @@ static void update_frequency( struct channel *chan ) {
 	if (chan->instrument)
 	{
 		const int lspFreq = 3546895 / period;
-		gLSPEncoder.SetSampleReplayRate(chan->instrument, lspFreq);
+		encoder->SetSampleReplayRate(chan->instrument, lspFreq);
 	}
 
 	assert(period >= AMIGA_PER_MIN);
-	gLSPEncoder.SetPeriod(chan->id, period);
+	encoder->SetPeriod(chan->id, period);
 
 	freq = c2_rate * 428 / period;
 	chan->step = ( freq << FP_SHIFT ) / sample_rate;
@@ -124,11 +96,11 @@ static void update_frequency( struct channel *chan ) {
 	if( volume > 64 ) volume = 64;
 	if( volume < 0 ) volume = 0;
 
-	gLSPEncoder.SetVolume(chan->id, volume);
+	encoder->SetVolume(chan->id, volume);
 	chan->ampl = ( volume * gain ) >> 5;
 }
 
-static void tone_portamento( struct channel *chan ) {
+void Micromod::tone_portamento( struct channel *chan ) {
 	long source, dest;
 	source = chan->period;
 	dest = chan->porta_period;
@@ -142,7 +114,7 @@ static void tone_portamento( struct channel *chan ) {
 	chan->period = source;
 }
 
-static void volume_slide( struct channel *chan, long param ) {
+void Micromod::volume_slide( struct channel *chan, long param ) {
 	long volume;
 	volume = chan->volume + ( param >> 4 ) - ( param & 0xF );
 	if( volume < 0 ) volume = 0;
@@ -150,7 +122,7 @@ static void volume_slide( struct channel *chan, long param ) {
 	chan->volume = volume;
 }
 
-static long waveform( long phase, long type ) {
+long Micromod::waveform( long phase, long type ) {
 	long amplitude = 0;
 	switch( type & 0x3 ) {
 		case 0: /* Sine. */
@@ -171,15 +143,15 @@ static long waveform( long phase, long type ) {
 	return amplitude;
 }
 
-static void vibrato( struct channel *chan ) {
+void Micromod::vibrato( struct channel *chan ) {
 	chan->vibrato_add = waveform( chan->vibrato_phase, chan->vibrato_type ) * chan->vibrato_depth >> 7;
 }
 
-static void tremolo( struct channel *chan ) {
+void Micromod::tremolo( struct channel *chan ) {
 	chan->tremolo_add = waveform( chan->tremolo_phase, chan->tremolo_type ) * chan->tremolo_depth >> 6;
 }
 
-static void trigger( struct channel *channel ) {
+void Micromod::trigger( struct channel *channel ) {
 	long period, ins;
 	int lspIns = -1;
 	bool lspDMARestart = true;
@@ -217,10 +189,10 @@ static void trigger( struct channel *channel ) {
 	}
 
 	if (lspIns > 0)
-		gLSPEncoder.NoteOn(channel->id, lspIns, lspSampleOffset, lspDMARestart);
+		encoder->NoteOn(channel->id, lspIns, lspSampleOffset, lspDMARestart);
 }
 
-static void channel_row( struct channel *chan ) {
+void Micromod::channel_row( struct channel *chan ) {
 	long effect, param, volume, period;
 	effect = chan->note.effect;
 	param = chan->note.param;
@@ -254,6 +226,7 @@ static void channel_row( struct channel *chan ) {
 		case 0xB: /* Pattern Jump.*/
 			if( pl_count < 0 ) {
 				break_pattern = param;
+				break_relative = false;
 				next_row = 0;
 			}
 			break;
@@ -262,7 +235,10 @@ static void channel_row( struct channel *chan ) {
 			break;
 		case 0xD: /* Pattern Break.*/
 			if( pl_count < 0 ) {
-				if( break_pattern < 0 ) break_pattern = pattern + 1;
+				if( break_pattern < 0 ) {
+					break_pattern = pattern + 1;
+					break_relative = true;
+				}
 				next_row = ( param >> 4 ) * 10 + ( param & 0xF );
 				if( next_row >= 64 ) next_row = 0;
 			}
@@ -270,21 +246,21 @@ static void channel_row( struct channel *chan ) {
 		case 0xF: /* Set Speed.*/
 			if( param > 0 )
 			{
-				if ((param < 32) || (gLSPEncoder.NoSetTempoCommand()))
+				if ((param < 32) || (encoder->NoSetTempoCommand()))
 				{
 					tick = speed = param;
 				}
 				else
 				{
-					if (!gLSPEncoder.Fixed50Hz())
+					if (!encoder->Fixed50Hz())
 						set_tempo(param);			// if fixed50, do not modify amount of samples per tick
 
-					gLSPEncoder.SetBPM(param);
+					encoder->SetBPM(param);
 				}
 			}
 			break;
 		case 0x10:
-			gLSPEncoder.SetFilter();
+			encoder->SetFilter();
 			break;
 		case 0x11: /* Fine Portamento Up.*/
 			period = chan->period - param;
@@ -340,14 +316,17 @@ static void channel_row( struct channel *chan ) {
 		default:
 		{
 			if ( effect&0x10 )
-				printf("Warning: unsupported channel_row fx E%x ($%x)\n",effect&0xf, effect);
+			{
+				LSPPrintf("Warning: unsupported channel_row fx E%x ($%x)\n",effect&0xf, effect);
+				warning_count++;
+			}
 		}
 			break;
 	}
 	update_frequency( chan );
 }
 
-static void channel_tick( struct channel *chan ) {
+void Micromod::channel_tick( struct channel *chan ) {
 	long effect, param, period;
 	effect = chan->note.effect;
 	param = chan->note.param;
@@ -394,7 +373,7 @@ static void channel_tick( struct channel *chan ) {
 			if( chan->fx_count >= param ) {
 				chan->fx_count = 0;
 				chan->sample_idx = 0;
-				gLSPEncoder.NoteOn(chan->id, chan->instrument, 0, true);
+				encoder->NoteOn(chan->id, chan->instrument, 0, true);
 			}
 			break;
 		case 0x1C: /* Note Cut.*/
@@ -404,7 +383,7 @@ static void channel_tick( struct channel *chan ) {
 			if( param == chan->fx_count ) trigger( chan );
 			break;
 		case 0x10:
-			gLSPEncoder.SetFilter();
+			encoder->SetFilter();
 			break;
 		case 0x11:
 		case 0x12:
@@ -418,13 +397,16 @@ static void channel_tick( struct channel *chan ) {
 			break;
 		default:
 			if ( effect & 0x10 )
-				printf("Warning: Unsupported channel_tick fx E%x ($%x)\n", effect & 0xf, effect);
+			{
+				LSPPrintf("Warning: Unsupported channel_tick fx E%x ($%x)\n", effect & 0xf, effect);
+				warning_count++;
+			}
 			break;
 	}
 	if( effect > 0 ) update_frequency( chan );
 }
 
-static long sequence_row( void ) {
+long Micromod::sequence_row( void ) {
 	long song_end, chan_idx, pat_offset;
 	long effect, param;
 	struct note *note;
@@ -438,12 +420,12 @@ static long sequence_row( void ) {
 		{
 			break_pattern = next_row = 0;
 			song_end = 1;
-			gLSPEncoder.SetSeqLoop(0);
+			encoder->SetSeqLoop(0);
 		}
 		pattern = break_pattern;
 		for( chan_idx = 0; chan_idx < num_channels; chan_idx++ ) channels[ chan_idx ].pl_row = 0;
 		break_pattern = -1;
-		gLSPEncoder.SetSeqPos(pattern);
+		encoder->SetSeqPos(pattern);
 	}
 	row = next_row;
 	next_row = row + 1;
@@ -454,7 +436,7 @@ static long sequence_row( void ) {
 		// if we're not in a loop, we consider the song is over if the row have already been played
 		if (rowPlayed[pattern * 64 + row])
 		{
-			gLSPEncoder.SetSeqLoop(pattern);
+			encoder->SetSeqLoop(pattern);
 			song_end = 1;
 		}
 	}
@@ -482,13 +464,13 @@ static long sequence_row( void ) {
 	return song_end;
 }
 
-long sequence_tick( void ) {
+long Micromod::sequence_tick( void ) {
 	long song_end, chan_idx;
 	song_end = 0;
 
 	bool bTick = false;
-	if (gLSPEncoder.Fixed50Hz())
-		bTick = gLSPEncoder.IsEmulatedBpmTick(speed);
+	if (encoder->Fixed50Hz())
+		bTick = encoder->IsEmulatedBpmTick(speed);
 	else
 		bTick = (--tick <= 0);
 
@@ -506,7 +488,7 @@ long sequence_tick( void ) {
 	return song_end;
 }
 
-static void resample( struct channel *chan, short *buf, long offset, long count ) {
+void Micromod::resample( struct channel *chan, short *buf, long offset, long count ) {
 	unsigned long epos;
 	unsigned long buf_idx = offset << 1;
 	unsigned long buf_end = ( offset + count ) << 1;
@@ -538,7 +520,7 @@ static void resample( struct channel *chan, short *buf, long offset, long count
 			if( lamp && ramp ) {
 				/* Mix both channels. */
 				while( sidx < epos ) {
-					gLSPEncoder.SetSampleFetch(chan->instrument, sidx >> FP_SHIFT);
+					encoder->SetSampleFetch(chan->instrument, sidx >> FP_SHIFT);
 					ampl = sdat[ sidx >> FP_SHIFT ];
 					buf[ buf_idx++ ] += ampl * lamp >> 2;
 					buf[ buf_idx++ ] += ampl * ramp >> 2;
@@ -548,7 +530,7 @@ static void resample( struct channel *chan, short *buf, long offset, long count
 				/* Only mix one channel. */
 				if( ramp ) buf_idx++;
 				while( sidx < epos ) {
-					gLSPEncoder.SetSampleFetch(chan->instrument, sidx >> FP_SHIFT);
+					encoder->SetSampleFetch(chan->instrument, sidx >> FP_SHIFT);
 					buf[ buf_idx ] += sdat[ sidx >> FP_SHIFT ] * ampl;
 					buf_idx += 2;
 					sidx += step;
@@ -564,6 +546,50 @@ static void resample( struct channel *chan, short *buf, long offset, long count
 	chan->sample_idx = sidx;
 }
 
+/*
+	Measure-only version of resample(): same sample_idx update, and reports the
+	highest sample fetched by each mixing run instead of every single fetch.
+*/
+void Micromod::resample_fetch( struct channel *chan, long count ) {
+	unsigned long epos, steps;
+	unsigned long remain = count;
+	unsigned long sidx = chan->sample_idx;
+	unsigned long step = chan->step;
+	unsigned long llen = instruments[ chan->instrument ].loop_length;
+	unsigned long lep1 = instruments[ chan->instrument ].loop_start + llen;
+	short ampl = !chan->mute ? chan->ampl : 0;
+	short lamp = ampl * ( 127 - chan->panning ) >> 5;
+	short ramp = ampl * chan->panning >> 5;
+	while( remain > 0 ) {
+		if( sidx >= lep1 ) {
+			/* Handle loop. */
+			if( llen <= FP_ONE ) {
+				/* One-shot sample. */
+				sidx = lep1;
+				break;
+			}
+			/* Subtract loop-length until within loop points. */
+			while( sidx >= lep1 ) sidx -= llen;
+		}
+		/* Calculate sample position at end. */
+		epos = sidx + remain * step;
+		if( ( lamp || ramp ) && step ) {
+			/* Only mix to end of current loop. */
+			if( epos > lep1 ) epos = lep1;
+			/* Fetches are sidx, sidx + step, ... while below epos. */
+			steps = ( epos - sidx - 1 ) / step + 1;
+			encoder->SetSampleFetch(chan->instrument, ( sidx + ( steps - 1 ) * step ) >> FP_SHIFT);
+			sidx += steps * step;
+			remain -= steps;
+		} else {
+			/* No need to mix.*/
+			sidx = epos;
+			remain = 0;
+		}
+	}
+	chan->sample_idx = sidx;
+}
+
 /*
 	Returns a string containing version information.
 */
@@ -605,7 +631,7 @@ long micromod_calculate_mod_file_len( signed char *module_header )
 	Returns -1 if the data is not recognised as a module.
 	Returns -2 if the sampling rate is less than 8000hz.
 */
-long micromod_initialise( signed char *data, long sampling_rate ) {
+long Micromod::initialise( signed char *data, long sampling_rate ) {
 	struct instrument *inst;
 	long sample_data_offset, inst_idx;
 	long sample_length, volume, fine_tune, loop_start, loop_length;
@@ -643,7 +669,7 @@ long micromod_initialise( signed char *data, long sampling_rate ) {
 				loop_length = sample_length - loop_start;
 			}
 		}
-		gLSPEncoder.SetModInstrumentInfo(inst_idx, soundBank, sample_data_offset, sample_length, loop_start, loop_length);
+		encoder->SetModInstrumentInfo(inst_idx, soundBank, sample_data_offset, sample_length, loop_start, loop_length);
 
 		if (loop_length < 4) {
 			loop_start = sample_length;
@@ -655,11 +681,11 @@ long micromod_initialise( signed char *data, long sampling_rate ) {
 		inst->sample_data = soundBank + sample_data_offset;
 		sample_data_offset += sample_length;
 	}
-	gLSPEncoder.SetOriginalModSoundBank(soundBankOffset, sample_data_offset);
+	encoder->SetOriginalModSoundBank(soundBankOffset, sample_data_offset);
 	c2_rate = ( num_channels > 4 ) ? 8363 : 8287;
 	gain = ( num_channels > 4 ) ? 32 : 64;
-	micromod_mute_channel( -1 );
-	micromod_set_position( 0, true );
+	mute_channel( -1 );
+	set_position( 0, true );
 	return 0;
 }
 
@@ -669,7 +695,7 @@ long micromod_initialise( signed char *data, long sampling_rate ) {
 	The name is copied into the location pointed to by string,
 	and is at most 23 characters long, including the trailing null.
 */
-void micromod_get_string( long instrument, char *string ) {
+void Micromod::get_string( long instrument, char *string ) {
 	long index, offset, length, character;
 	if( num_channels <= 0 ) {
 		string[ 0 ] = 0;
@@ -692,17 +718,17 @@ void micromod_get_string( long instrument, char *string ) {
 /*
 	Returns the total song duration in samples at the current sampling rate.
 */
-long micromod_calculate_song_duration( void ) {
+long Micromod::calculate_song_duration( void ) {
 	long duration, song_end;
 	duration = 0;
 	if( num_channels > 0 ) {
-		micromod_set_position( 0, false );
+		set_position( 0, false );
 		song_end = 0;
 		while( !song_end ) {
 			duration += tick_len;
 			song_end = sequence_tick();
 		}
-		micromod_set_position( 0, false );
+		set_position( 0, false );
 	}
 	return duration;
 }
@@ -711,7 +737,7 @@ long micromod_calculate_song_duration( void ) {
 /*
 	Jump directly to a specific pattern in the sequence.
 */
-void micromod_set_position( long pos, bool skipFirstTick)
+void Micromod::set_position( long pos, bool skipFirstTick)
 {
 	long chan_idx;
 	struct channel *chan;
@@ -723,6 +749,7 @@ void micromod_set_position( long pos, bool skipFirstTick)
 	if( num_channels <= 0 ) return; 
 	if( pos >= song_length ) pos = 0;
 	break_pattern = pos;
+	break_relative = false;
 	next_row = 0;
 	tick = 1;
 	speed = 6;
@@ -750,7 +777,7 @@ void micromod_set_position( long pos, bool skipFirstTick)
 	If channel is negative, un-mute all channels.
 	Returns the number of channels.
 */
-long micromod_mute_channel( long channel ) {
+long Micromod::mute_channel( long channel ) {
 	long chan_idx;
 	if( channel < 0 ) {
 		for( chan_idx = 0; chan_idx < num_channels; chan_idx++ ) {
@@ -767,7 +794,7 @@ long micromod_mute_channel( long channel ) {
 	For 4-channel modules, a value of 64 can be used without distortion.
 	For 8-channel modules, a value of 32 or less is recommended.
 */
-void micromod_set_gain( long value ) {
+void Micromod::set_gain( long value ) {
 	gain = value;
 }
 
@@ -776,7 +803,7 @@ void micromod_set_gain( long value ) {
 	If output pointer is zero, the replay will quickly skip count samples.
 	The output buffer should be cleared with zeroes.
 */
-void micromod_get_audio( short *output_buffer, long count ) {
+void Micromod::get_audio( short *output_buffer, long count ) {
 	long offset, remain, chan_idx;
 	if( num_channels <= 0 ) return;
 	offset = 0;
@@ -796,9 +823,81 @@ void micromod_get_audio( short *output_buffer, long count ) {
 	}
 }
 
-void	simulateMixing(short* buffer, int count)
+void	Micromod::simulateMixing(short* buffer, int count)
 {
 	memset(buffer, 0, 2 * sizeof(short) * count);
 	for (int chan_idx = 0; chan_idx < num_channels; chan_idx++)
 		resample(&channels[chan_idx], buffer, 0, count);
 }
+
+void	Micromod::simulateSampleFetch(long count)
+{
+	for (int chan_idx = 0; chan_idx < num_channels; chan_idx++)
+		resample_fetch(&channels[chan_idx], count);
+}
+
+long Micromod::get_next_entry_position( void ) const {
+	long pos;
+	if( next_row >= 0 && break_pattern < 0 ) return -1;
+	if( encoder->Fixed50Hz() ) {
+		if( !encoder->IsEmulatedBpmTickPending( speed ) ) return -1;
+	} else if( tick > 1 ) {
+		return -1;
+	}
+	pos = ( next_row < 0 ) ? pattern + 1 : break_pattern;
+	if( pos >= song_length ) return -1;
+	return pos;
+}
+
+unsigned long long Micromod::get_rows_played( long pos ) const {
+	unsigned long long mask = 0;
+	for( long r = 0; r < 64; r++ )
+		if( rowPlayed[ pos * 64 + r ] ) mask |= 1ULL << r;
+	return mask;
+}
+
+void Micromod::save_replay_state( replay_state &state ) const {
+	state.tick_len = tick_len;
+	state.pattern = pattern;
+	state.break_pattern = break_pattern;
+	state.row = row;
+	state.next_row = next_row;
+	state.tick = tick;
+	state.speed = speed;
+	state.pl_count = pl_count;
+	state.pl_channel = pl_channel;
+	state.random_seed = random_seed;
+	state.break_relative = break_relative;
+	memcpy( state.channels, channels, sizeof( channels ) );
+}
+
+bool Micromod::same_entry_state( const replay_state &a, const replay_state &b ) const {
+	if( a.tick_len != b.tick_len || a.next_row != b.next_row || a.tick != b.tick ||
+		a.speed != b.speed || a.pl_count != b.pl_count || a.pl_channel != b.pl_channel ||
+		a.random_seed != b.random_seed ) return false;
+	/* The note is reloaded by the entry row, compare everything after it. */
+	const size_t offset = offsetof( struct channel, period );
+	for( long chan_idx = 0; chan_idx < num_channels; chan_idx++ ) {
+		if( memcmp( (const char *) &a.channels[ chan_idx ] + offset,
+			(const char *) &b.channels[ chan_idx ] + offset, sizeof( struct channel ) - offset ) ) return false;
+	}
+	return true;
+}
+
+void Micromod::load_replay_state( const replay_state &state, long pos, unsigned long long rows_played ) {
+	tick_len = state.tick_len;
+	pattern = pos;
+	break_pattern = state.break_pattern;
+	if( break_pattern >= 0 && state.break_relative ) break_pattern += pos - state.pattern;
+	row = state.row;
+	next_row = state.next_row;
+	tick = state.tick;
+	speed = state.speed;
+	pl_count = state.pl_count;
+	pl_channel = state.pl_channel;
+	random_seed = state.random_seed;
+	break_relative = state.break_relative;
+	memcpy( channels, state.channels, sizeof( channels ) );
+	for( long r = 0; r < 64; r++ )
+		if( rows_played & ( 1ULL << r ) ) rowPlayed[ pos * 64 + r ] = 1;
+}
@@ -1,3 +1,5 @@
+#pragma once
+class LSPEncoder;
 
 /*
 	Returns a string containing version information.
@@ -10,56 +12,173 @@ const char *micromod_get_version( void );
 */
 long micromod_calculate_mod_file_len( signed char *module_header );
 
-/*
-    Set the player to play the specified module data.
-    The data array must not be less than the length given by micromod_calculate_mod_file_len().
-	Returns -1 if the data is not recognised as a module.
-	Returns -2 if the sampling rate is less than 8000hz.
-*/
-long micromod_initialise( signed char *data, long sampling_rate );
+long	micromod_calculate_score_len(signed char* module_header);
+long	micromod_calculate_samples_len(signed char* module_header);
+long	calculate_num_channels(signed char *module_header);
 
 /*
-	Obtains song and instrument names from the module.
-	The song name is returned as instrument 0.
-	The name is copied into the location pointed to by string,
-	and is at most 23 characters long, including the trailing null.
+	Micromod replay state. All the player state used to live in file statics,
+	it's now one instance per conversion so several modules can be simulated
+	at the same time (one Micromod per thread). Every LSP event is reported to
+	the LSPEncoder given at construction.
 */
-void micromod_get_string( long instrument, char *string );
+class Micromod
+{
+public:
+	enum { MAX_CHANNELS = 16 };
 
-/*
-	Returns the total song duration in samples at the current sampling rate.
-*/
-long micromod_calculate_song_duration( void );
+	Micromod(LSPEncoder* encoder);
 
-/*
-	Jump directly to a specific pattern in the sequence.
-*/
-void micromod_set_position(long pos, bool skipFirstTick);
+	/*
+		Set the player to play the specified module data.
+		The data array must not be less than the length given by micromod_calculate_mod_file_len().
+		Returns -1 if the data is not recognised as a module.
+		Returns -2 if the sampling rate is less than 8000hz.
+	*/
+	long initialise( signed char *data, long sampling_rate );
 
-/*
-	Mute the specified channel.
-	If channel is negative, un-mute all channels.
-	Returns the number of channels.
-*/
-long micromod_mute_channel( long channel );
+	/*
+		Obtains song and instrument names from the module.
+		The song name is returned as instrument 0.
+		The name is copied into the location pointed to by string,
+		and is at most 23 characters long, including the trailing null.
+	*/
+	void get_string( long instrument, char *string );
 
-/*
-	Set the playback gain.
-	For 4-channel modules, a value of 64 can be used without distortion.
-	For 8-channel modules, a value of 32 or less is recommended.
-*/
-void micromod_set_gain( long value );
+	/*
+		Returns the total song duration in samples at the current sampling rate.
+	*/
+	long calculate_song_duration( void );
 
-/*
-	Calculate the specified number of stereo samples of audio.
-	Output buffer must be zeroed.
-*/
-void micromod_get_audio( short *output_buffer, long count );
+	/*
+		Jump directly to a specific pattern in the sequence.
+	*/
+	void set_position(long pos, bool skipFirstTick);
 
-long sequence_tick(void);
+	/*
+		Mute the specified channel.
+		If channel is negative, un-mute all channels.
+		Returns the number of channels.
+	*/
+	long mute_channel( long channel );
 
-long	micromod_calculate_score_len(signed char* module_header);
-long	micromod_calculate_samples_len(signed char* module_header);
-long	calculate_num_channels(signed char *module_header);
+	/*
+		Set the playback gain.
+		For 4-channel modules, a value of 64 can be used without distortion.
+		For 8-channel modules, a value of 32 or less is recommended.
+	*/
+	void set_gain( long value );
+
+	/*
+		Calculate the specified number of stereo samples of audio.
+		Output buffer must be zeroed.
+	*/
+	void get_audio( short *output_buffer, long count );
+
+	long sequence_tick(void);
+
+	void simulateMixing(short* buffer, int count);
+
+	/*
+		Same sample fetch reports as simulateMixing(), but without any mixing:
+		the fetched range of each channel is computed from step and loop points.
+	*/
+	void simulateSampleFetch(long count);
+
+	long get_tick_len() const { return tick_len; }
+	long get_row() const { return row; }
+
+private:
+
+	struct note {
+		unsigned short key;
+		unsigned char instrument, effect, param;
+	};
+
+	struct instrument {
+		unsigned char volume, fine_tune;
+		unsigned long loop_start, loop_length;
+		const signed char *sample_data;
+	};
+
+	struct channel {
+		struct note note;
+		unsigned short period, porta_period;
+		unsigned long sample_offset, sample_idx, step;
+		unsigned char volume, panning, fine_tune, ampl, mute;
+		unsigned char id, instrument, assigned, porta_speed, pl_row, fx_count;
+		unsigned char vibrato_type, vibrato_phase, vibrato_speed, vibrato_depth;
+		unsigned char tremolo_type, tremolo_phase, tremolo_speed, tremolo_depth;
+		signed char tremolo_add, vibrato_add, arpeggio_add;
+	};
+
+	void set_tempo( long tempo );
+	void update_frequency( struct channel *chan );
+	void tone_portamento( struct channel *chan );
+	void volume_slide( struct channel *chan, long param );
+	long waveform( long phase, long type );
+	void vibrato( struct channel *chan );
+	void tremolo( struct channel *chan );
+	void trigger( struct channel *channel );
+	void channel_row( struct channel *chan );
+	void channel_tick( struct channel *chan );
+	long sequence_row( void );
+	void resample( struct channel *chan, short *buf, long offset, long count );
+	void resample_fetch( struct channel *chan, long count );
+
+	LSPEncoder* encoder;
+
+	signed char *module_data;
+	unsigned char *pattern_data, *sequence;
+	long song_length, restart, num_patterns, num_channels;
+	struct instrument instruments[ 32 ];
+
+	long sample_rate, gain, c2_rate, tick_offset;
+	long tick_len;
+	long pattern, break_pattern, row, next_row, tick;
+	long speed, pl_count, pl_channel, random_seed;
+	bool break_relative;		/* break_pattern set by Dxx (pattern + 1) and not by Bxx */
+	long warning_count;
+	char rowPlayed[128 * 64];
+
+	struct channel channels[ MAX_CHANNELS ];
+
+public:
+	/*
+		Pattern level memoization support (see PatternMemo).
+		A replay state is the complete player state between two ticks.
+	*/
+	struct replay_state {
+		long tick_len, pattern, break_pattern, row, next_row, tick;
+		long speed, pl_count, pl_channel, random_seed;
+		bool break_relative;
+		struct channel channels[ MAX_CHANNELS ];
+	};
+
+	/*
+		Returns the sequence position the next tick enters (row tick starting a new pattern),
+		or -1 if the next tick stays in the current pattern or ends the song.
+	*/
+	long get_next_entry_position( void ) const;
+	long get_sequence_pattern( long pos ) const { return sequence[ pos ] & 0x7F; }
+	long get_warning_count( void ) const { return warning_count; }
+
+	/*
+		Bit mask of the rows already played at the given sequence position.
+	*/
+	unsigned long long get_rows_played( long pos ) const;
+
+	void save_replay_state( replay_state &state ) const;
+
+	/*
+		True if both states produce the same ticks when entering a new pattern.
+		Pattern, break and row are not compared, they are set by the pattern entry.
+	*/
+	bool same_entry_state( const replay_state &a, const replay_state &b ) const;
 
-void	simulateMixing(short* buffer, int count);
+	/*
+		Restore a state saved at the end of a pattern played from another sequence position.
+		Pattern jump & break are moved to the new position, and rows_played are marked as played.
+	*/
+	void load_replay_state( const replay_state &state, long pos, unsigned long long rows_played );
+};